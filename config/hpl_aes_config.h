@@ -0,0 +1,35 @@
+/* Auto-generated config file hpl_aes_config.h */
+#ifndef HPL_AES_CONFIG_H
+#define HPL_AES_CONFIG_H
+
+// <<< Use Configuration Wizard in Context Menu >>>
+
+// <e> AES enable
+// <i> Decrypt the downloaded images (AES-CTR or AES-GCM, see the DFU Encrypted Images section of usbd_config.h)
+// <id> aes_enable
+#ifndef CONF_AES_ENABLE
+#define CONF_AES_ENABLE 0
+#endif
+
+// <q> Software implementation
+// <i> Use a table-based implementation in C instead of the AES peripheral (used by the host build)
+// <i> It takes about 8 (CTR) to 13 (GCM) times the CPU cycles of the peripheral, and 1.3 KB of flash for its tables
+// <id> aes_software
+#ifndef CONF_AES_SOFTWARE
+#define CONF_AES_SOFTWARE 0
+#endif
+
+// <o> Key size
+// <0=> 128 bits
+// <1=> 192 bits
+// <2=> 256 bits
+// <id> aes_keysize
+#ifndef CONF_AES_KEYSIZE
+#define CONF_AES_KEYSIZE 0
+#endif
+
+// </e>
+
+// <<< end of configuration section >>>
+
+#endif // HPL_AES_CONFIG_H
@@ -8,9 +8,10 @@
 
 // <q> Cache enable
 //<i> Defines the cache should be enabled or not.
+//<i> The flash controller driver invalidates the cache after each erase and write, and the cache is disabled again before starting the application.
 // <id> cmcc_enable
 #ifndef CONF_CMCC_ENABLE
-#define CONF_CMCC_ENABLE 0x0
+#define CONF_CMCC_ENABLE 0x1
 #endif
 
 // <o> Cache Size
@@ -8,9 +8,35 @@
 // <i> Indicates whether dmac is enabled or not
 // <id> dmac_enable
 #ifndef CONF_DMAC_ENABLE
-#define CONF_DMAC_ENABLE 0
+#define CONF_DMAC_ENABLE 1
 #endif
 
+// <h> Memory copy service
+// <i> Copies in the flash and USB paths (hpl_dma_copy.h), started by software on one channel.
+// <i> Chained blocks use the descriptors of the following channels, which are never enabled: the copy channels need 32-bit beats with source and destination increment.
+
+// <o> Channel <0-31>
+// <id> dmac_copy_channel
+#ifndef CONF_DMA_COPY_CHANNEL
+#define CONF_DMA_COPY_CHANNEL 0
+#endif
+
+// <o> Maximum number of chained blocks <1-4>
+// <i> Number of channel descriptors used from the copy channel on
+// <id> dmac_copy_blocks
+#ifndef CONF_DMA_COPY_BLOCKS
+#define CONF_DMA_COPY_BLOCKS 2
+#endif
+
+// <o> Size threshold (bytes) <0-65535>
+// <i> Smaller copies are done by the CPU, for which setting up the DMAC would cost more than the copy
+// <i> Copies which are not 32-bit aligned, or while the channel is busy, are also done by the CPU
+// <id> dmac_copy_threshold
+#ifndef CONF_DMA_COPY_THRESHOLD
+#define CONF_DMA_COPY_THRESHOLD 128
+#endif
+// </h>
+
 // <q> Priority Level 0
 // <i> Indicates whether Priority Level 0 is enabled or not
 // <id> dmac_lvlen0
@@ -105,7 +131,7 @@
 // <e> Channel 0 settings
 // <id> dmac_channel_0_settings
 #ifndef CONF_DMAC_CHANNEL_0_SETTINGS
-#define CONF_DMAC_CHANNEL_0_SETTINGS 0
+#define CONF_DMAC_CHANNEL_0_SETTINGS 1
 #endif
 
 // <q> Channel Run in Standby
@@ -122,7 +148,7 @@
 // <i> Defines the trigger action used for a transfer
 // <id> dmac_trigact_0
 #ifndef CONF_DMAC_TRIGACT_0
-#define CONF_DMAC_TRIGACT_0 0
+#define CONF_DMAC_TRIGACT_0 3
 #endif
 
 // <o> Trigger source
@@ -284,14 +310,14 @@
 // <i> Indicates whether the source address incrementation is enabled or not
 // <id> dmac_srcinc_0
 #ifndef CONF_DMAC_SRCINC_0
-#define CONF_DMAC_SRCINC_0 0
+#define CONF_DMAC_SRCINC_0 1
 #endif
 
 // <q> Destination Address Increment
 // <i> Indicates whether the destination address incrementation is enabled or not
 // <id> dmac_dstinc_0
 #ifndef CONF_DMAC_DSTINC_0
-#define CONF_DMAC_DSTINC_0 0
+#define CONF_DMAC_DSTINC_0 1
 #endif
 
 // <o> Beat Size
@@ -301,7 +327,7 @@
 // <i> Defines the size of one beat
 // <id> dmac_beatsize_0
 #ifndef CONF_DMAC_BEATSIZE_0
-#define CONF_DMAC_BEATSIZE_0 0
+#define CONF_DMAC_BEATSIZE_0 2
 #endif
 
 // <o> Block Action
@@ -329,7 +355,7 @@
 // <e> Channel 1 settings
 // <id> dmac_channel_1_settings
 #ifndef CONF_DMAC_CHANNEL_1_SETTINGS
-#define CONF_DMAC_CHANNEL_1_SETTINGS 0
+#define CONF_DMAC_CHANNEL_1_SETTINGS 1
 #endif
 
 // <q> Channel Run in Standby
@@ -508,14 +534,14 @@
 // <i> Indicates whether the source address incrementation is enabled or not
 // <id> dmac_srcinc_1
 #ifndef CONF_DMAC_SRCINC_1
-#define CONF_DMAC_SRCINC_1 0
+#define CONF_DMAC_SRCINC_1 1
 #endif
 
 // <q> Destination Address Increment
 // <i> Indicates whether the destination address incrementation is enabled or not
 // <id> dmac_dstinc_1
 #ifndef CONF_DMAC_DSTINC_1
-#define CONF_DMAC_DSTINC_1 0
+#define CONF_DMAC_DSTINC_1 1
 #endif
 
 // <o> Beat Size
@@ -525,7 +551,7 @@
 // <i> Defines the size of one beat
 // <id> dmac_beatsize_1
 #ifndef CONF_DMAC_BEATSIZE_1
-#define CONF_DMAC_BEATSIZE_1 0
+#define CONF_DMAC_BEATSIZE_1 2
 #endif
 
 // <o> Block Action
@@ -2,6 +2,8 @@
 #ifndef HPL_GCLK_CONFIG_H
 #define HPL_GCLK_CONFIG_H
 
+#include <hpl_oscctrl_config.h> // CONF_CLOCK_CRYSTALLESS
+
 // <<< Use Configuration Wizard in Context Menu >>>
 
 // <e> Generic clock generator 0 configuration
@@ -25,7 +27,7 @@
 // <i> This defines the clock source for generic clock generator 0
 // <id> gclk_gen_0_oscillator
 #ifndef CONF_GCLK_GEN_0_SOURCE
-#define CONF_GCLK_GEN_0_SOURCE GCLK_GENCTRL_SRC_XOSC1
+#define CONF_GCLK_GEN_0_SOURCE (CONF_CLOCK_CRYSTALLESS ? GCLK_GENCTRL_SRC_DFLL : GCLK_GENCTRL_SRC_XOSC1)
 #endif
 
 // <q> Run in Standby
@@ -252,7 +254,7 @@
 // <i> This defines the clock source for generic clock generator 3
 // <id> gclk_gen_3_oscillator
 #ifndef CONF_GCLK_GEN_3_SOURCE
-#define CONF_GCLK_GEN_3_SOURCE GCLK_GENCTRL_SRC_XOSC32K
+#define CONF_GCLK_GEN_3_SOURCE (CONF_CLOCK_CRYSTALLESS ? GCLK_GENCTRL_SRC_OSCULP32K : GCLK_GENCTRL_SRC_XOSC32K)
 #endif
 
 // <q> Run in Standby
@@ -2,6 +2,8 @@
 #ifndef HPL_MCLK_CONFIG_H
 #define HPL_MCLK_CONFIG_H
 
+#include <hpl_oscctrl_config.h> // CONF_CLOCK_CRYSTALLESS
+
 // <<< Use Configuration Wizard in Context Menu >>>
 
 #include <peripheral_clk_config.h>
@@ -92,7 +94,7 @@
 // <15=> 15
 // <id> nvm_wait_states
 #ifndef CONF_NVM_WAIT_STATE
-#define CONF_NVM_WAIT_STATE 0
+#define CONF_NVM_WAIT_STATE (CONF_CLOCK_CRYSTALLESS ? 1 : 0) /* 48 MHz needs 1 wait state */
 #endif
 
 // </h>
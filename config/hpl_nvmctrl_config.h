@@ -15,6 +15,26 @@
 #define CONF_NVM_SLEEPPRM 0
 #endif
 
+// <o> Write Mode
+// <0x00=> Manual Write
+// <0x01=> Automatic Double Word Write
+// <0x02=> Automatic Quad Word Write
+// <0x03=> Automatic Page Write
+// <i> In the automatic modes, the flash is written when the last word of the page (or quad/double word) buffer is loaded, without page buffer clear and write commands
+// <i> The mode can be changed at run time using CTRLA.WMODE
+// <id> nvm_arch_wmode
+#ifndef CONF_NVM_WMODE
+#define CONF_NVM_WMODE 0
+#endif
+
+// <q> Suspend Enable
+// <i> A read of the bank being erased or written (e.g. an instruction fetch from an interrupt handler) suspends the operation, which resumes after the read
+// <i> Else the read waits until the erase or write is complete
+// <id> nvm_arch_suspen
+#ifndef CONF_NVM_SUSPEN
+#define CONF_NVM_SUSPEN 1
+#endif
+
 // <q> AHB0 Cache Disable
 // <i> Indicate whether AHB0 cache is disable or not
 // <id> nvm_arch_cache0
@@ -2,6 +2,8 @@
 #ifndef HPL_OSC32KCTRL_CONFIG_H
 #define HPL_OSC32KCTRL_CONFIG_H
 
+#include <hpl_oscctrl_config.h> // CONF_CLOCK_CRYSTALLESS
+
 // <<< Use Configuration Wizard in Context Menu >>>
 
 // <e> RTC Source configuration
@@ -51,7 +53,7 @@
 // <i> Indicates whether 32kHz External Crystal Oscillator is enabled or not
 // <id> xosc32k_arch_enable
 #ifndef CONF_XOSC32K_ENABLE
-#define CONF_XOSC32K_ENABLE 1
+#define CONF_XOSC32K_ENABLE (!CONF_CLOCK_CRYSTALLESS)
 #endif
 
 // <o> Start-Up Time
@@ -4,6 +4,14 @@
 
 // <<< Use Configuration Wizard in Context Menu >>>
 
+// <q> Crystal-less start
+// <i> Boot on the DFLL48M alone, locked on the USB start of frames (DFLL USB clock recovery mode): the CPU runs from the DFLL, and the crystals (XOSC1, XOSC32K) are neither started nor waited for, so that the device attaches to the bus as soon as possible.
+// <i> XOSC1 is then only started by the maximum throughput clock profile of the DFU mode (CONF_USB_DFUD_CLOCK_PROFILE), as reference for DPLL0.
+// <id> clock_crystalless
+#ifndef CONF_CLOCK_CRYSTALLESS
+#define CONF_CLOCK_CRYSTALLESS 0
+#endif
+
 // <e> External Multipurpose Crystal Oscillator Configuration
 // <i> Indicates whether configuration for XOSC0 is enabled or not
 // <id> enable_xosc0
@@ -136,7 +144,7 @@
 // <i> Indicates whether External Multipurpose Crystal Oscillator is enabled or not
 // <id> xosc1_arch_enable
 #ifndef CONF_XOSC1_ENABLE
-#define CONF_XOSC1_ENABLE 1
+#define CONF_XOSC1_ENABLE (!CONF_CLOCK_CRYSTALLESS)
 #endif
 
 // <o> Start-Up Time
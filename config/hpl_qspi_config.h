@@ -0,0 +1,63 @@
+/* Auto-generated config file hpl_qspi_config.h */
+#ifndef HPL_QSPI_CONFIG_H
+#define HPL_QSPI_CONFIG_H
+
+// <<< Use Configuration Wizard in Context Menu >>>
+
+// <e> QSPI enable
+// <i> Serial NOR flash on the QSPI (SST26VF064B on the SAM E54 Xplained Pro), programmed through a second DFU alternate setting
+// <id> qspi_enable
+#ifndef CONF_QSPI_ENABLE
+#define CONF_QSPI_ENABLE 0
+#endif
+
+// <o> SCK divider (SCBR) <0-255>
+// <i> SCK runs at CLK_QSPI_AHB (the CPU clock) / (SCBR + 1): 60 MHz at 120 MHz, below the 104 MHz of the SST26VF064B
+// <id> qspi_scbr
+#ifndef CONF_QSPI_SCBR
+#define CONF_QSPI_SCBR 1
+#endif
+
+// <h> Serial NOR flash
+// <i> Geometry of the flash: the driver uses the command set of the SST26 family (quad I/O read and page program, 4 KB sector and 64 KB block erase)
+
+// <o> Size (bytes) <0x100000-0x1000000>
+// <id> qspi_nor_size
+#ifndef CONF_QSPI_NOR_SIZE
+#define CONF_QSPI_NOR_SIZE 0x800000
+#endif
+
+// <o> Page size (bytes) <256-256>
+// <i> Largest page program
+// <id> qspi_nor_page_size
+#ifndef CONF_QSPI_NOR_PAGE_SIZE
+#define CONF_QSPI_NOR_PAGE_SIZE 256
+#endif
+
+// <o> Sector size (bytes) <4096-4096>
+// <i> Smallest erase
+// <id> qspi_nor_sector_size
+#ifndef CONF_QSPI_NOR_SECTOR_SIZE
+#define CONF_QSPI_NOR_SECTOR_SIZE 4096
+#endif
+
+// <o> Block size (bytes) <65536-65536>
+// <i> Largest erase: the SST26VF064B only has 64 KB blocks from 64 KB to 64 KB before the end, the first and last 64 KB being divided in 8 and 32 KB blocks
+// <id> qspi_nor_block_size
+#ifndef CONF_QSPI_NOR_BLOCK_SIZE
+#define CONF_QSPI_NOR_BLOCK_SIZE 0x10000
+#endif
+
+// <o> Manufacturer ID <0x00-0xFF>
+// <i> First byte of the JEDEC ID, checked to detect the flash (0xBF for Microchip SST)
+// <id> qspi_nor_manufacturer
+#ifndef CONF_QSPI_NOR_MANUFACTURER
+#define CONF_QSPI_NOR_MANUFACTURER 0xBF
+#endif
+// </h>
+
+// </e>
+
+// <<< end of configuration section >>>
+
+#endif // HPL_QSPI_CONFIG_H
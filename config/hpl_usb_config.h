@@ -2,6 +2,8 @@
 #ifndef HPL_USB_CONFIG_H
 #define HPL_USB_CONFIG_H
 
+#include <usbd_config.h> // CONF_USB_MSCD_UF2_EN, the bulk endpoints of the mass storage interface
+
 // <<< Use Configuration Wizard in Context Menu >>>
 
 #define CONF_USB_N_0 0
@@ -39,8 +41,12 @@
 // <CONF_USB_D_N_EP_MAX"> Max possible (by "Max Endpoint Number" config)
 // <id> usbd_num_ep_sp
 #ifndef CONF_USB_D_NUM_EP_SP
+#if CONF_USB_MSCD_UF2_EN // EP0 and the two bulk endpoints
+#define CONF_USB_D_NUM_EP_SP CONF_USB_N_3
+#else
 #define CONF_USB_D_NUM_EP_SP CONF_USB_N_1
 #endif
+#endif
 
 // </h>
 
@@ -60,8 +66,14 @@
 // <i> The number of physical endpoints - 1
 // <id> usbd_arch_max_ep_n
 #ifndef CONF_USB_D_MAX_EP_N
+#if CONF_USB_MSCD_UF2_EN // the highest of the bulk endpoints
+#define CONF_USB_D_MAX_EP_N                                                                                            \
+	(((CONF_USB_MSCD_BULKIN_EPADDR & 0x0F) > CONF_USB_MSCD_BULKOUT_EPADDR) ? (CONF_USB_MSCD_BULKIN_EPADDR & 0x0F)  \
+	                                                                        : CONF_USB_MSCD_BULKOUT_EPADDR)
+#else
 #define CONF_USB_D_MAX_EP_N CONF_USB_N_0
 #endif
+#endif
 
 // <y> USB Speed Limit
 // <i> Limits the working speed of the device.
@@ -2,6 +2,8 @@
 #ifndef PERIPHERAL_CLK_CONFIG_H
 #define PERIPHERAL_CLK_CONFIG_H
 
+#include <hpl_oscctrl_config.h> // CONF_CLOCK_CRYSTALLESS
+
 // <<< Use Configuration Wizard in Context Menu >>>
 
 /**
@@ -9,7 +11,7 @@
  * \brief CPU's Clock frequency
  */
 #ifndef CONF_CPU_FREQUENCY
-#define CONF_CPU_FREQUENCY 12000000
+#define CONF_CPU_FREQUENCY (CONF_CLOCK_CRYSTALLESS ? 48000000 : 12000000)
 #endif
 
 // <y> USB Clock Source
@@ -2,6 +2,10 @@
 #ifndef USBD_CONFIG_H
 #define USBD_CONFIG_H
 
+#include <peripheral_clk_config.h> // CONF_CPU_FREQUENCY, the boot clock
+#include <hpl_qspi_config.h>       // CONF_QSPI_ENABLE, the QSPI flash alternate setting
+#include <hpl_aes_config.h>        // CONF_AES_ENABLE, the encrypted images
+
 // <<< Use Configuration Wizard in Context Menu >>>
 
 // ---- USB Device Stack Core Options ----
@@ -16,6 +20,13 @@
 
 // ---- USB Device Stack DFU Options ----
 
+// <q> UF2 mass storage interface
+// <i> Second interface of the device: a virtual FAT16 volume where UF2 files can be copied to flash the application (see the UF2 Mass Storage section)
+// <id> usb_mscd_uf2_en
+#ifndef CONF_USB_MSCD_UF2_EN
+#define CONF_USB_MSCD_UF2_EN 0
+#endif
+
 // <e> Enable String Descriptors
 // <ID> USB_DFUD_STR_EN
 #ifndef CONF_USB_DFUD_STR_EN
@@ -163,7 +174,7 @@
 // <e> Enable string descriptor of iSerialNum
 // <id> usb_dfud_iserialnum_en
 #ifndef CONF_USB_DFUD_ISERIALNUM_EN
-#define CONF_USB_DFUD_ISERIALNUM_EN 0
+#define CONF_USB_DFUD_ISERIALNUM_EN 1
 #endif
 
 #ifndef CONF_USB_DFUD_ISERIALNUM
@@ -175,11 +186,13 @@
 // <s> Unicode string of iSerialNum
 // <id> usb_dfud_iserialnum_str
 #ifndef CONF_USB_DFUD_ISERIALNUM_STR
-#define CONF_USB_DFUD_ISERIALNUM_STR "123456789ABCDEF"
+#define CONF_USB_DFUD_ISERIALNUM_STR "00000000000000000000000000000000"
 #endif
 
+// the serial number string is built at run time from the 128-bit chip serial number (32 hexadecimal digits),
+// this descriptor is only a placeholder keeping the indexes of the following strings in place
 #ifndef CONF_USB_DFUD_ISERIALNUM_STR_DESC
-#define CONF_USB_DFUD_ISERIALNUM_STR_DESC 
+#define CONF_USB_DFUD_ISERIALNUM_STR_DESC 66, 0x03, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00, '0', 0x00,
 #endif
 
 // </e>
@@ -195,15 +208,16 @@
 // <h> DFU Configuration Descriptor
 
 // <o> wTotalLength <0x01-0xFF>
+// <i> Configuration, interface and DFU functional descriptors, and the interface and DFU functional descriptors of the QSPI flash alternate setting
 // <id> usb_dfud_wtotallength
 #ifndef CONF_USB_DFUD_WTOTALLENGTH
-#define CONF_USB_DFUD_WTOTALLENGTH 27
+#define CONF_USB_DFUD_WTOTALLENGTH (27 + CONF_QSPI_ENABLE * 18 + CONF_USB_MSCD_UF2_EN * 23)
 #endif
 
 // <o> bNumInterfaces <0x01-0xFF>
 // <id> usb_dfud_bnuminterfaces
 #ifndef CONF_USB_DFUD_BNUMINTERFACES
-#define CONF_USB_DFUD_BNUMINTERFACES 1
+#define CONF_USB_DFUD_BNUMINTERFACES (1 + CONF_USB_MSCD_UF2_EN)
 #endif
 
 // <o> bConfigurationValue <0x01-0xFF>
@@ -300,6 +314,275 @@
 // </e>
 // </h>
 
+// <h> DFU QSPI Flash Alternate Setting
+// <i> Second alternate setting of the DFU interface, downloading to the serial NOR flash on the QSPI (enabled with CONF_QSPI_ENABLE, see hpl_qspi_config.h)
+// <i> The data is streamed to the flash in the background: pages already holding the downloaded data are skipped, and the programmed pages are read back and checked.
+
+// <o> Region offset (bytes) <0x0-0xFF0000:0x10000>
+// <i> Start of the region written by the downloads in the flash, at a block boundary
+// <id> usb_dfud_qspi_offset
+#ifndef CONF_USB_DFUD_QSPI_OFFSET
+#define CONF_USB_DFUD_QSPI_OFFSET 0x10000
+#endif
+
+// <o> Region size (bytes) <0x10000-0x1000000:0x10000>
+// <i> The default keeps to the uniform 64 KB blocks of the SST26VF064B (see CONF_QSPI_NOR_BLOCK_SIZE): smaller blocks are rewritten sector by sector
+// <id> usb_dfud_qspi_size
+#ifndef CONF_USB_DFUD_QSPI_SIZE
+#define CONF_USB_DFUD_QSPI_SIZE 0x7E0000
+#endif
+
+// <o> Write queue (transfers) <2-64>
+// <i> Downloaded transfers waiting to be written, in the staging RAM arena: the download only waits for the flash when the queue is full
+// <id> usb_dfud_qspi_queue
+#ifndef CONF_USB_DFUD_QSPI_QUEUE
+#define CONF_USB_DFUD_QSPI_QUEUE 32
+#endif
+
+// <o> Status poll timeout (ms) <0-255>
+// <i> bwPollTimeout reported by GETSTATUS for the QSPI flash: a transfer only has to be queued, unless the write queue is full, so the host can ask again sooner than for the internal flash
+// <id> usb_dfud_qspi_poll_timeout
+#ifndef CONF_USB_DFUD_QSPI_POLL_TIMEOUT
+#define CONF_USB_DFUD_QSPI_POLL_TIMEOUT 2
+#endif
+
+#ifndef CONF_USB_DFUD_QSPI_IINTERFACE
+#define CONF_USB_DFUD_QSPI_IINTERFACE                                                                                  \
+	(CONF_USB_DFUD_IINTERFACE_EN * (CONF_USB_DFUD_IINTERFACE + CONF_USB_DFUD_IINTERFACE_EN))
+#endif
+
+// <s> Unicode string of iInterface
+// <id> usb_dfud_qspi_iinterface_str
+#ifndef CONF_USB_DFUD_QSPI_IINTERFACE_STR
+#define CONF_USB_DFUD_QSPI_IINTERFACE_STR "QSPI flash"
+#endif
+
+#ifndef CONF_USB_DFUD_QSPI_IINTERFACE_STR_DESC
+#define CONF_USB_DFUD_QSPI_IINTERFACE_STR_DESC 22, 0x03, 'Q', 0x00, 'S', 0x00, 'P', 0x00, 'I', 0x00, ' ', 0x00, 'f', 0x00, 'l', 0x00, 'a', 0x00, 's', 0x00, 'h', 0x00,
+#endif
+
+#if CONF_QSPI_ENABLE && (CONF_USB_DFUD_QSPI_OFFSET % CONF_QSPI_NOR_SECTOR_SIZE || CONF_USB_DFUD_QSPI_OFFSET + CONF_USB_DFUD_QSPI_SIZE > CONF_QSPI_NOR_SIZE)
+#error "the QSPI flash region must start at a sector boundary and fit in the flash"
+#endif
+// </h>
+
+// <h> DFU Download
+
+// <o> Status poll timeout (ms) <1-255>
+// <i> bwPollTimeout reported by GETSTATUS: time the host waits before the next request while the device is busy.
+// <i> The device answers promptly during block erases when NVMCTRL suspends them for reads (CONF_NVM_SUSPEN), so a short timeout lets the host resume the download as soon as a block is written.
+// <id> usb_dfud_poll_timeout
+#ifndef CONF_USB_DFUD_POLL_TIMEOUT
+#define CONF_USB_DFUD_POLL_TIMEOUT 3
+#endif
+
+// <q> Stage the downloaded image in RAM
+// <i> Receive the image (or as much of it as fits) in the RAM left after the stack, then check it and program it in one pass of block erases and page writes.
+// <i> The staging area is the free RAM arena given by the _sdfu_staging and _edfu_staging linker symbols (at least 256 KB minus RAM_BUDGET, see gcc/Makefile).
+// <id> usb_dfud_staging_en
+#ifndef CONF_USB_DFUD_STAGING_EN
+#define CONF_USB_DFUD_STAGING_EN 0
+#endif
+
+// <q> Dual-bank A/B update
+// <i> Download the application in the inactive flash bank while running from the active one, and swap the banks (BKSWRST) once the image is complete and checked.
+// <i> The application region is limited to one bank (half of the flash) minus the bootloader, which is copied in both banks.
+// <id> usb_dfud_dual_bank_en
+#ifndef CONF_USB_DFUD_DUAL_BANK_EN
+#define CONF_USB_DFUD_DUAL_BANK_EN 0
+#endif
+
+// <e> Erase ahead of the download
+// <i> Erase the blocks of the application region in the background, ahead of the downloaded data, once a download started or DFU has been forced (button or magic value).
+// <i> The downloaded data is then written in erased pages, and the block erases take place during the USB transfers.
+// <i> Can not be combined with staging in RAM, which checks the image before touching the flash.
+// <id> usb_dfud_pre_erase_en
+#ifndef CONF_USB_DFUD_PRE_ERASE_EN
+#define CONF_USB_DFUD_PRE_ERASE_EN 0
+#endif
+// <o> Blocks erased ahead <1-127>
+// <i> Number of 8 KB blocks erased ahead of the downloaded data
+// <id> usb_dfud_pre_erase_blocks
+#ifndef CONF_USB_DFUD_PRE_ERASE_BLOCKS
+#define CONF_USB_DFUD_PRE_ERASE_BLOCKS 2
+#endif
+// </e>
+
+// <e> Resumable downloads
+// <i> Record which 8 KB blocks of the application region have been programmed and verified, together with the identity (size and CRC) of the image given by the host.
+// <i> The record persists in the SmartEEPROM, so that after an interrupted download the host only sends the missing blocks (osmo-ASF4-DFU vendor requests, see usb_protocol_dfu.h).
+// <i> The SmartEEPROM must be allocated by the SEESBLK and SEEPSZ fuses (any size), else the progress is only reported until the next reset.
+// <i> Can not be combined with staging in RAM.
+// <id> usb_dfud_resume_en
+#ifndef CONF_USB_DFUD_RESUME_EN
+#define CONF_USB_DFUD_RESUME_EN 0
+#endif
+// <o> Checkpoint interval (blocks) <1-128>
+// <i> Number of blocks completed between two updates of the record, which also is the number of blocks downloaded again after an interruption in the worst case
+// <id> usb_dfud_resume_checkpoint
+#ifndef CONF_USB_DFUD_RESUME_CHECKPOINT
+#define CONF_USB_DFUD_RESUME_CHECKPOINT 16
+#endif
+// <o> Offset of the record in the SmartEEPROM <0x0-0x1B0:0x10>
+// <i> The record is saved alternately in two slots of 36 bytes (1 MB of flash), within the first 512 bytes of the SmartEEPROM
+// <id> usb_dfud_resume_offset
+#ifndef CONF_USB_DFUD_RESUME_OFFSET
+#define CONF_USB_DFUD_RESUME_OFFSET 0x1B0
+#endif
+// <q> Block CRC check
+// <i> The host can send the CRC-32 of every block of the image once identified, and the blocks already holding the same data in flash are recorded as programmed.
+// <i> For incremental updates, only the changed blocks are then downloaded and programmed. The flash is checked using the CRC-32 of the DSU.
+// <id> usb_dfud_block_crc_en
+#ifndef CONF_USB_DFUD_BLOCK_CRC_EN
+#define CONF_USB_DFUD_BLOCK_CRC_EN 1
+#endif
+// </e>
+
+// <q> DfuSe commands
+// <i> Download sparse images: DNLOAD requests with wValue 0 carry the DfuSe commands (ST AN3156) setting the address of the following data blocks, erasing the 8 KB flash block holding an address, or erasing the whole application region.
+// <i> The host then only sends the populated segments of the image (e.g. dfu-util -s ADDRESS on a DfuSe file), at the addresses the application is linked at, and erases the blocks it needs erased: the rest of the application region is left as is.
+// <i> Pages erased by a command are written without erasing again, other pages are read, erased and written again with their block. Read unprotect is not supported.
+// <i> bcdDFUVersion becomes 0x011A. dfu-util also parses the memory layout from the iInterface string, e.g. "@Internal Flash  /0x00000000/2*008Ka,62*008Kg" for a 16 KB bootloader on 512 KB of flash.
+// <i> Can not be combined with staging in RAM, resumable downloads, encrypted images, erasing ahead, the QSPI flash alternate setting or the UF2 mass storage interface, which all expect the image from its start.
+// <id> usb_dfud_dfuse_en
+#ifndef CONF_USB_DFUD_DFUSE_EN
+#define CONF_USB_DFUD_DFUSE_EN 0
+#endif
+#if CONF_USB_DFUD_DFUSE_EN && (CONF_USB_DFUD_STAGING_EN || CONF_USB_DFUD_RESUME_EN || CONF_AES_ENABLE || CONF_USB_DFUD_PRE_ERASE_EN || CONF_QSPI_ENABLE || CONF_USB_MSCD_UF2_EN)
+#error "the DfuSe commands can not be combined with staging in RAM, resumable downloads, encrypted images, erasing ahead, the QSPI flash or UF2"
+#endif
+
+// <o> Clock profile
+// <i> Clocks of the DFU mode, switched to once DFU is entered: the application is started with the clocks of the Atmel START configuration (CPU on the 12 MHz crystal, or on the 48 MHz DFLL for a crystal-less start), which it can reconfigure safely.
+// <i> The NVM read wait states and the NVMCTRL caches (CTRLA.CACHEDIS0/1, CONF_NVM_CACHE0/1 before the switch) follow the CPU frequency: the caches are enabled when there are wait states to hide.
+// <0=> Minimal: CPU on the boot clock (12 MHz crystal, or 48 MHz DFLL for a crystal-less start)
+// <1=> USB: CPU on the 48 MHz DFLL, locked on the USB start of frames
+// <2=> Maximum throughput: CPU on DPLL0 at 120 MHz, from the 12 MHz crystal (started then for a crystal-less start, falling back to the USB profile if it does not start)
+// <id> usb_dfud_clock_profile
+#ifndef CONF_USB_DFUD_CLOCK_PROFILE
+#define CONF_USB_DFUD_CLOCK_PROFILE 2
+#endif
+#define USB_DFUD_CLOCK_MINIMAL 0
+#define USB_DFUD_CLOCK_USB 1
+#define USB_DFUD_CLOCK_MAX 2
+/* CPU frequency of the profile */
+#define CONF_USB_DFUD_CPU_FREQUENCY                                                                                    \
+	((CONF_USB_DFUD_CLOCK_PROFILE == USB_DFUD_CLOCK_MAX)                                                           \
+	     ? 120000000                                                                                               \
+	     : ((CONF_USB_DFUD_CLOCK_PROFILE == USB_DFUD_CLOCK_USB) ? 48000000 : CONF_CPU_FREQUENCY))
+/* NVM read wait states for a CPU frequency (SAM D5x/E5x data sheet, NVM characteristics) */
+#define USB_DFUD_NVM_WAIT_STATE(frequency)                                                                             \
+	(((frequency) <= 24000000) ? 0 : ((frequency) <= 51000000) ? 1 : ((frequency) <= 77000000) ? 2 :               \
+	 ((frequency) <= 101000000) ? 3 : ((frequency) <= 119000000) ? 4 : 5)
+/* NVM read wait states of the profile */
+#define CONF_USB_DFUD_NVM_WAIT_STATE USB_DFUD_NVM_WAIT_STATE(CONF_USB_DFUD_CPU_FREQUENCY)
+
+// </h>
+
+// <h> DFU Encrypted Images
+// <i> With CONF_AES_ENABLE (see hpl_aes_config.h), the downloaded images are encrypted: the first transfer is a header (usb_dfu_encrypted_header_t in usb/class/dfu/usb_protocol_dfu.h) giving the mode, the payload length, the IV and the GCM tag, padded to 512 bytes.
+// <i> The payload is decrypted transfer by transfer before it is written, and the GCM tag is checked at manifestation: the first block of the written image is erased when the check fails.
+// <i> Only staging in RAM and dual-bank updates keep a rejected image out of the application region (it is discarded, or never swapped to). Without them, and always on the QSPI flash, the payload is written as it arrives: a rejected image leaves unauthenticated data in flash past its first block, which is only no longer started.
+// <i> Can not be combined with resumable downloads, since the flash would be compared with the encrypted image.
+
+// <s> Key
+// <i> Comma separated bytes of the AES key (16, 24 or 32 bytes for CONF_AES_KEYSIZE), to be set for each product
+// <id> usb_dfud_decrypt_key
+#ifndef CONF_USB_DFUD_DECRYPT_KEY
+#define CONF_USB_DFUD_DECRYPT_KEY 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+#endif
+
+// <q> Accept AES-CTR images
+// <i> Images in CTR mode are decrypted but not authenticated: only accept AES-GCM images when disabled
+// <id> usb_dfud_decrypt_ctr_en
+#ifndef CONF_USB_DFUD_DECRYPT_CTR_EN
+#define CONF_USB_DFUD_DECRYPT_CTR_EN 1
+#endif
+
+// </h>
+
+// <h> UF2 Mass Storage
+// <i> With CONF_USB_MSCD_UF2_EN, the device also is a USB drive (Bulk-Only Transport, SCSI) holding INFO_UF2.TXT and CURRENT.UF2, the application in flash.
+// <i> UF2 blocks written anywhere on the volume are programmed in the application region, in any order and even written twice, and the device resets once all the blocks of the file are written.
+// <i> Can not be combined with staging in RAM, resumable downloads or encrypted images: the blocks are written as they come, unauthenticated.
+
+// <o> bInterfaceNumber <0x00-0xFF>
+// <id> usb_mscd_bifcnum
+#ifndef CONF_USB_MSCD_BIFCNUM
+#define CONF_USB_MSCD_BIFCNUM (CONF_USB_DFUD_BIFCNUM + 1)
+#endif
+
+// <o> Bulk-In endpoint address
+// <0x81=> EndpointAddress = 0x81
+// <0x82=> EndpointAddress = 0x82
+// <0x83=> EndpointAddress = 0x83
+// <id> usb_mscd_bulkin_epaddr
+#ifndef CONF_USB_MSCD_BULKIN_EPADDR
+#define CONF_USB_MSCD_BULKIN_EPADDR 0x81
+#endif
+
+// <o> Bulk-Out endpoint address
+// <0x01=> EndpointAddress = 0x01
+// <0x02=> EndpointAddress = 0x02
+// <0x03=> EndpointAddress = 0x03
+// <id> usb_mscd_bulkout_epaddr
+#ifndef CONF_USB_MSCD_BULKOUT_EPADDR
+#define CONF_USB_MSCD_BULKOUT_EPADDR 0x01
+#endif
+
+// <o> Bulk endpoints wMaxPacketSize
+// <0x0008=> 8 bytes
+// <0x0010=> 16 bytes
+// <0x0020=> 32 bytes
+// <0x0040=> 64 bytes
+// <id> usb_mscd_bulk_maxpksz
+#ifndef CONF_USB_MSCD_BULKIN_MAXPKSZ
+#define CONF_USB_MSCD_BULKIN_MAXPKSZ 0x40
+#endif
+#ifndef CONF_USB_MSCD_BULKOUT_MAXPKSZ
+#define CONF_USB_MSCD_BULKOUT_MAXPKSZ CONF_USB_MSCD_BULKIN_MAXPKSZ
+#endif
+
+// <o> Volume size (512-byte sectors) <8192-65535>
+// <i> Large enough for the FAT16 file system (at least 4085 clusters of one sector) and for the host to write a new UF2 file (twice the application region) next to CURRENT.UF2
+// <id> usb_mscd_uf2_sectors
+#ifndef CONF_USB_MSCD_UF2_SECTORS
+#define CONF_USB_MSCD_UF2_SECTORS 16384
+#endif
+
+// <s> Volume label
+// <i> Up to 11 characters
+// <id> usb_mscd_uf2_label
+#ifndef CONF_USB_MSCD_UF2_LABEL
+#define CONF_USB_MSCD_UF2_LABEL "OSMO-DFU"
+#endif
+
+// <s> Board ID
+// <i> Reported in INFO_UF2.TXT, for the tools picking the right UF2 file
+// <id> usb_mscd_uf2_board_id
+#ifndef CONF_USB_MSCD_UF2_BOARD_ID
+#if defined(SYSMOOCTSIM)
+#define CONF_USB_MSCD_UF2_BOARD_ID "SAME54-sysmoOCTSIM"
+#else
+#define CONF_USB_MSCD_UF2_BOARD_ID "SAME54-Xplained-Pro"
+#endif
+#endif
+
+// <o> Family ID
+// <i> UF2 blocks tagged with another family are ignored (0x55114460: SAM D5x/E5x)
+// <id> usb_mscd_uf2_family_id
+#ifndef CONF_USB_MSCD_UF2_FAMILY_ID
+#define CONF_USB_MSCD_UF2_FAMILY_ID 0x55114460
+#endif
+
+#if CONF_USB_MSCD_UF2_EN && (CONF_USB_DFUD_STAGING_EN || CONF_USB_DFUD_RESUME_EN || CONF_AES_ENABLE)
+#error "the UF2 mass storage interface can not be combined with staging in RAM, resumable downloads or encrypted images"
+#endif
+#if CONF_USB_MSCD_UF2_SECTORS < 8192 || CONF_USB_MSCD_UF2_SECTORS > 65535
+#error "the UF2 volume must have 8192 to 65535 sectors"
+#endif
+// </h>
+
 // <<< end of configuration section >>>
 
 #endif // USBD_CONFIG_H
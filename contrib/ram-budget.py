@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+#
+# RAM budget of the bootloader
+#
+# Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+"""RAM budget of the bootloader, used by gcc/Makefile.
+
+stack: compute the worst-case stack usage from the call graphs written by
+  gcc -fcallgraph-info=su (.ci files), and print the stack size to reserve.
+  The deepest path from the entry point is added to the deepest interrupt
+  handler (all interrupts have the same priority, so they do not nest) and
+  to the exception frame.  Indirect calls are bounded by the deepest
+  function which is never called directly (callbacks), up to a few levels
+  of callbacks calling callbacks (a function also called directly is not
+  counted as callback, use --margin if it is only known by address), and
+  recursion or frames of unbounded dynamic size are errors.
+  The report goes to stderr, the stack size alone to stdout.
+
+map: print the RAM map from the symbols of the linked image (nm output on
+  stdin), and fail if the RAM used before the free arena exceeds the budget.
+"""
+
+import argparse
+import re
+import sys
+
+INDIRECT = '__indirect_call'
+
+RE_NODE = re.compile(r'^node: \{ title: "([^"]*)" label: "([^"]*)"')
+RE_EDGE = re.compile(r'^edge: \{ sourcename: "([^"]*)" targetname: "([^"]*)"')
+RE_STACK = re.compile(r'\\n(\d+) bytes \(([a-z,]+)\)')
+
+
+class Unbounded(Exception):
+	pass
+
+
+class Function:
+	def __init__(self, name, frame, qualifier):
+		self.name = name  # prefixed with the file name for static functions
+		self.frame = frame
+		self.qualifier = qualifier  # static, dynamic or dynamic,bounded
+		self.callees = set()  # names as written in the call graph
+		self.called = False  # called directly from somewhere
+
+
+def parse(paths):
+	"""Return the defined functions by name."""
+	functions = {}
+	edges = []
+	for path in paths:
+		with open(path) as f:
+			for line in f:
+				line = line.strip()
+				node = RE_NODE.match(line)
+				if node:
+					title, label = node.groups()
+					stack = RE_STACK.search(label)
+					if stack:
+						functions[title] = Function(title, int(stack.group(1)), stack.group(2))
+					continue
+				edge = RE_EDGE.match(line)
+				if edge:
+					edges.append((edge.group(1), edge.group(2)))
+	for source, target in edges:
+		functions[source].callees.add(target)
+	return functions
+
+
+class Graph:
+	def __init__(self, functions, extern_frame, indirect_levels):
+		self.functions = functions
+		self.extern_frame = extern_frame
+		self.indirect_levels = indirect_levels
+		self.missing = set()  # functions only known by name, e.g. from the C library
+		self.memo = {}
+		for f in functions.values():
+			for callee in f.callees:
+				if callee in functions:
+					functions[callee].called = True
+
+	def callbacks(self, entries):
+		return [f for f in self.functions.values() if not f.called and f.name not in entries]
+
+	def depth(self, f, level, path=()):
+		"""Return the worst-case stack usage of f and the corresponding call path."""
+		key = (f.name, level)
+		if key in self.memo:
+			return self.memo[key]
+		if key in path:
+			raise Unbounded('recursion ' + ' -> '.join(name for name, level in path + (key,)))
+		if f.qualifier == 'dynamic':
+			raise Unbounded('dynamically sized frame in ' + f.name)
+		path = path + (key,)
+		worst = (0, [])
+		for callee in sorted(f.callees):
+			if callee == INDIRECT:
+				if level >= self.indirect_levels:
+					self.missing.add('indirect calls nested deeper than %u levels' % self.indirect_levels)
+					candidate = (self.extern_frame, [INDIRECT])
+				else:
+					candidate = (0, [])
+					for cb in self.indirect_targets:
+						sub = self.depth(cb, level + 1, path)
+						if sub[0] > candidate[0]:
+							candidate = (sub[0], ['(indirect)'] + sub[1])
+			else:
+				if callee in self.functions:
+					candidate = self.depth(self.functions[callee], level, path)
+				else:
+					self.missing.add(callee)
+					candidate = (self.extern_frame, [callee + ' (external)'])
+			if candidate[0] > worst[0]:
+				worst = candidate
+		result = (f.frame + worst[0], ['%s (%u)' % (f.name, f.frame)] + worst[1])
+		self.memo[key] = result
+		return result
+
+
+def stack(args):
+	functions = parse(args.callgraphs)
+	graph = Graph(functions, args.extern, args.indirect_levels)
+	handlers = sorted(name for name in functions if name.endswith('_Handler'))
+	entry = functions.get(args.entry)
+	if not entry:
+		print('error: entry point %s not found in the call graphs' % args.entry, file=sys.stderr)
+		return 1
+	graph.indirect_targets = graph.callbacks([args.entry] + handlers)
+	try:
+		main = graph.depth(entry, 0)
+		irq = (0, [])
+		for name in handlers:
+			sub = graph.depth(functions[name], 0)
+			if sub[0] > irq[0]:
+				irq = sub
+	except Unbounded as e:
+		print('error: the stack usage can not be bounded: %s' % e, file=sys.stderr)
+		return 1
+
+	total = main[0] + irq[0] + args.frame + args.margin
+	total = (total + 7) & ~7  # the stack pointer is 8-byte aligned
+	print('worst-case stack usage: %u bytes' % total, file=sys.stderr)
+	print('  %6u  %s' % (main[0], ' -> '.join(main[1])), file=sys.stderr)
+	print('  %6u  %s' % (irq[0], ' -> '.join(irq[1]) if irq[1] else 'no interrupt handler'), file=sys.stderr)
+	print('  %6u  exception frame' % args.frame, file=sys.stderr)
+	print('  %6u  margin' % args.margin, file=sys.stderr)
+	if graph.missing:
+		print('  counting %u bytes for each of: %s' % (args.extern, ', '.join(sorted(graph.missing))), file=sys.stderr)
+	print(total)
+	return 0
+
+
+def ram_map(args):
+	symbols = {}
+	for line in sys.stdin:
+		fields = line.split()
+		if len(fields) == 3:
+			symbols[fields[2]] = int(fields[0], 16)
+	regions = [
+		('data', '_srelocate', '_erelocate'),
+		('bss', '_sbss', '_ebss'),
+		('stack', '_sstack', '_estack'),
+		('free arena', '_sdfu_staging', '_edfu_staging'),
+	]
+	print('RAM map:')
+	for name, start, end in regions:
+		if start not in symbols or end not in symbols:
+			print('error: %s or %s not found' % (start, end), file=sys.stderr)
+			return 1
+		print('  0x%08x-0x%08x %7u bytes  %s' % (symbols[start], symbols[end], symbols[end] - symbols[start], name))
+	used = symbols['_sdfu_staging'] - args.origin
+	print('  %u of %u budgeted bytes used' % (used, args.budget))
+	if used > args.budget:
+		print('error: RAM budget exceeded by %u bytes' % (used - args.budget), file=sys.stderr)
+		return 1
+	return 0
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+	sub = parser.add_subparsers(dest='command')
+	p = sub.add_parser('stack', help='compute the stack size')
+	p.add_argument('--entry', default='Reset_Handler', help='entry point (default: %(default)s)')
+	p.add_argument('--frame', type=int, default=108, help='exception frame, with the FPU context (default: %(default)s)')
+	p.add_argument('--extern', type=int, default=64, help='stack usage assumed for functions without call graph, e.g. from the C library (default: %(default)s)')
+	p.add_argument('--indirect-levels', type=int, default=4, help='nesting of indirect calls bounded (default: %(default)s)')
+	p.add_argument('--margin', type=int, default=0, help='bytes added to the worst case (default: %(default)s)')
+	p.add_argument('callgraphs', nargs='+', help='.ci files')
+	p.set_defaults(run=stack)
+	p = sub.add_parser('map', help='print the RAM map from nm output')
+	p.add_argument('--origin', type=lambda x: int(x, 0), default=0x20000004, help='start of the RAM region, after the DFU magic (default: 0x20000004)')
+	p.add_argument('--budget', type=lambda x: int(x, 0), required=True, help='bytes which can be used before the free arena')
+	p.set_defaults(run=ram_map)
+	args = parser.parse_args()
+	if not args.command:
+		parser.print_help()
+		return 1
+	return args.run(args)
+
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# Code size report of the bootloader
+#
+# Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+"""Code size report of the bootloader, used by gcc/Makefile.
+
+Reads the symbols of the linked image with their size and source line
+(`nm -S -l --defined-only`) on stdin, and prints the flash used per source
+file: code and read-only data, and initial values of the data.  Symbols
+without debug information, e.g. from the C library, are grouped apart.
+This also works after link-time optimization, where the objects no longer
+tell where the code comes from.
+
+The image must fit in the bootloader region protected by BOOTPROT, which
+grows in 8 KB blocks: the report tells how much is left before the next
+boundary, and how much to save to need one block less, and fails when the
+image does not fit.
+"""
+
+import argparse
+import os
+import sys
+
+BLOCK_SIZE = 8192
+FLASH_TYPES = 'TtWwRrDdVv'
+DATA_TYPES = 'DdVv'
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('--top', default='..', help='top directory of the sources, to shorten the file names (default: %(default)s)')
+	parser.add_argument('--bootprot', type=int, required=True, help='BOOTPROT fuse value the bootloader is built for')
+	parser.add_argument('--rows', type=int, default=0, help='only list the largest source files (default: all)')
+	args = parser.parse_args()
+
+	top = os.path.realpath(args.top)
+	modules = {}
+	symbols = {}
+	for line in sys.stdin:
+		fields = line.split()
+		if len(fields) < 3:
+			continue
+		if len(fields[1]) == 1:  # no size
+			symbols[fields[2]] = int(fields[0], 16)
+			continue
+		address, size, kind, name = fields[:4]
+		symbols[name] = int(address, 16)
+		if kind not in FLASH_TYPES:
+			continue
+		if len(fields) > 4:
+			source = os.path.realpath(fields[4].rsplit(':', 1)[0])
+			if source.startswith(top + os.sep):
+				source = source[len(top) + 1:]
+		else:
+			source = '(no debug information)'
+		text, data = modules.get(source, (0, 0))
+		if kind in DATA_TYPES:
+			data += int(size, 16)
+		else:
+			text += int(size, 16)
+		modules[source] = (text, data)
+
+	for name in ('_sfixed', '_etext', '_srelocate', '_erelocate'):
+		if name not in symbols:
+			print('error: %s not found' % name, file=sys.stderr)
+			return 1
+	image = symbols['_etext'] - symbols['_sfixed'] + symbols['_erelocate'] - symbols['_srelocate']
+	region = (15 - args.bootprot) * BLOCK_SIZE
+
+	print('Flash usage per source file:')
+	print('  %7s %7s  %s' % ('text', 'data', 'file'))
+	rows = sorted(modules.items(), key=lambda m: m[1][0] + m[1][1], reverse=True)
+	if args.rows:
+		rows = rows[:args.rows]
+	for source, (text, data) in rows:
+		print('  %7u %7u  %s' % (text, data, source))
+	print('  %u bytes in total (vector table, alignment and symbols without size included)' % image)
+
+	if image > region:
+		print('error: the image is %u bytes larger than the %u bytes reserved by BOOTPROT=%u' % (image - region, region, args.bootprot), file=sys.stderr)
+		return 1
+	print('  %u bytes left in the %u bytes reserved by BOOTPROT=%u' % (region - image, region, args.bootprot))
+	smaller = region - BLOCK_SIZE  # one block less, the bootloader needs at least one
+	if smaller > 0 and image > smaller:
+		print('  %u bytes to save to fit in BOOTPROT=%u, leaving 8 KB more to the application' % (image - smaller, args.bootprot + 1))
+	elif smaller > 0:
+		print('  the image also fits in BOOTPROT=%u, leaving 8 KB more to the application' % (args.bootprot + 1))
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -33,6 +33,25 @@ extern struct flash_descriptor FLASH_0;
 void FLASH_0_init(void);
 void FLASH_0_CLOCK_init(void);
 
+#include <hpl_qspi_config.h>
+#if CONF_QSPI_ENABLE
+#include <hpl_qspi_nor.h>
+
+extern struct _qspi_sync_dev QSPI_INSTANCE;
+
+void QSPI_INSTANCE_PORT_init(void);
+void QSPI_INSTANCE_CLOCK_init(void);
+void QSPI_INSTANCE_init(void);
+#endif
+
+#include <hpl_aes.h>
+#if CONF_AES_ENABLE
+extern struct _aes_sync_device CRYPTOGRAPHY_0;
+
+void CRYPTOGRAPHY_0_CLOCK_init(void);
+void CRYPTOGRAPHY_0_init(void);
+#endif
+
 /**
  * \brief Switch system LED on
  */
@@ -311,8 +311,8 @@ void SDHC0_Handler(void) __attribute__((weak, alias("Dummy_Handler")));
 void SDHC1_Handler(void) __attribute__((weak, alias("Dummy_Handler")));
 #endif
 
-/* Exception Table */
-__attribute__((section(".vectors"))) const DeviceVectors exception_table
+/* Exception Table (only referenced by the linker script, kept by link-time optimization) */
+__attribute__((section(".vectors"), used)) const DeviceVectors exception_table
     = {
 
         /* Configure Initial Stack Pointer, using linker-generated symbols */
@@ -0,0 +1,140 @@
+/**
+ * \file
+ *
+ * \brief AES decryption (CTR and GCM modes).
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HPL_AES_H_INCLUDED
+#define _HPL_AES_H_INCLUDED
+
+#include <compiler.h>
+#include <hpl_aes_config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \addtogroup hpl_aes
+ *
+ * Streaming decryption with the AES peripheral, or with a software implementation (CONF_AES_SOFTWARE).
+ * Only the forward cipher is used: CTR and GCM decrypt by encrypting the counter blocks.
+ * The counter blocks are a 96-bit nonce followed by a 32-bit big-endian block counter, as in GCM.
+ *
+ * @{
+ */
+
+/** AES block size, in bytes */
+#define AES_BLOCK_SIZE 16
+/** Nonce (CTR) or IV (GCM) size, in bytes */
+#define AES_IV_SIZE 12
+
+/** Key sizes (AES CTRLA.KEYSIZE) */
+enum _aes_keysize {
+	AES_KEY_128, /**< 128-bit key, 10 rounds */
+	AES_KEY_192, /**< 192-bit key, 12 rounds */
+	AES_KEY_256, /**< 256-bit key, 14 rounds */
+};
+
+/** AES device */
+struct _aes_sync_device {
+	void *   hw;                    /**< AES peripheral */
+	uint8_t  keysize;               /**< enum _aes_keysize */
+	uint32_t key[8];                /**< key, as written in KEYWORD */
+	uint8_t  j0[AES_BLOCK_SIZE];    /**< GCM: pre-counter block, encrypted for the tag */
+	uint32_t gcm_aad_length;        /**< GCM: length of the additional authenticated data */
+	uint32_t gcm_length;            /**< GCM: length of the data processed so far */
+#if CONF_AES_SOFTWARE
+	uint32_t rk[60];                /**< round keys */
+	uint8_t  rounds;                /**< number of rounds */
+	uint64_t hl[16];                /**< GCM: multiples of the hash subkey, low halves (4-bit tables) */
+	uint64_t hh[16];                /**< GCM: multiples of the hash subkey, high halves */
+	uint8_t  ghash[AES_BLOCK_SIZE]; /**< GCM: GHASH of the data so far */
+#endif
+};
+
+/**
+ * \brief Initialize the AES device
+ * \param[in] dev AES device
+ * \param[in] hw AES peripheral (unused by the software implementation)
+ * \return Operation status
+ */
+int32_t _aes_sync_init(struct _aes_sync_device *const dev, void *const hw);
+
+/**
+ * \brief Set the key
+ * \param[in] dev AES device
+ * \param[in] key Key
+ * \param[in] size Key size
+ * \return Operation status
+ */
+int32_t _aes_sync_set_key(struct _aes_sync_device *const dev, const uint8_t *key, const enum _aes_keysize size);
+
+/**
+ * \brief Encrypt or decrypt data in CTR mode, from any block of the stream
+ * \param[in] dev AES device
+ * \param[in] nonce Nonce (AES_IV_SIZE bytes)
+ * \param[in] position Position of the data in the stream, a multiple of AES_BLOCK_SIZE
+ * \param[in] input Input data
+ * \param[out] output Output data, which can be the input data
+ * \param[in] length Length of the data
+ * \return Operation status
+ */
+int32_t _aes_sync_ctr_crypt(struct _aes_sync_device *const dev, const uint8_t *nonce, const uint32_t position,
+                            const uint8_t *input, uint8_t *output, const uint32_t length);
+
+/**
+ * \brief Start decrypting a GCM message
+ * \param[in] dev AES device
+ * \param[in] iv IV (AES_IV_SIZE bytes)
+ * \param[in] aad Additional authenticated data
+ * \param[in] aad_length Length of the additional authenticated data
+ * \return Operation status
+ */
+int32_t _aes_sync_gcm_start(struct _aes_sync_device *const dev, const uint8_t *iv, const uint8_t *aad,
+                            const uint32_t aad_length);
+
+/**
+ * \brief Decrypt the next part of the GCM message
+ *
+ * The GHASH covers the input data: encrypting instead gives the ciphertext, but not its tag.
+ * \param[in] dev AES device
+ * \param[in] input Ciphertext
+ * \param[out] output Plaintext, which can be the ciphertext
+ * \param[in] length Length of the data, a multiple of AES_BLOCK_SIZE except for the last part
+ * \return Operation status
+ */
+int32_t _aes_sync_gcm_decrypt(struct _aes_sync_device *const dev, const uint8_t *input, uint8_t *output,
+                              const uint32_t length);
+
+/**
+ * \brief Compute the tag of the GCM message
+ * \param[in] dev AES device
+ * \param[out] tag Tag (AES_BLOCK_SIZE bytes)
+ * \return Operation status
+ */
+int32_t _aes_sync_gcm_finish(struct _aes_sync_device *const dev, uint8_t *tag);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HPL_AES_H_INCLUDED */
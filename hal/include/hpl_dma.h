@@ -140,6 +140,36 @@ int32_t _dma_set_data_amount(const uint8_t channel, const uint32_t amount);
  */
 int32_t _dma_enable_transaction(const uint8_t channel, const bool software_trigger);
 
+/**
+ * \brief Chain the descriptor of a channel to the descriptor of another one
+ *
+ * The descriptor of the next channel is used as further block of the transaction, without enabling that channel:
+ * it is made valid, and the current descriptor does not end the transaction anymore.
+ * \param[in] current_channel DMA channel whose descriptor continues with the next one
+ * \param[in] next_channel DMA channel whose descriptor follows
+ * \return status of operation
+ */
+int32_t _dma_set_next_descriptor(const uint8_t current_channel, const uint8_t next_channel);
+
+/**
+ * \brief Make the descriptor of a channel end the transaction, with the transfer complete interrupt
+ * \param[in] channel DMA channel whose descriptor is the last block
+ * \return status of operation
+ */
+int32_t _dma_set_last_descriptor(const uint8_t channel);
+
+/**
+ * \brief Get the status of the transaction on the given channel, without interrupt
+ *
+ * Once the transaction is over, its interrupt flags are cleared: a transfer error is reported once.
+ * \param[in] channel DMA channel to check
+ * \return status of the transaction
+ * \retval ERR_BUSY The transaction is in progress
+ * \retval ERR_IO The transaction ended with a transfer error
+ * \retval ERR_NONE The transaction is complete
+ */
+int32_t _dma_get_transaction_status(const uint8_t channel);
+
 /**
  * \brief Retrieves DMA resource structure
  *
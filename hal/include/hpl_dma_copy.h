@@ -0,0 +1,128 @@
+/**
+ * \file
+ *
+ * \brief Memory copy service on the DMAC.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HPL_DMA_COPY_H_INCLUDED
+#define _HPL_DMA_COPY_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \addtogroup hpl_dma_copy
+ *
+ * Memory to memory copies on one DMAC channel (CONF_DMA_COPY_CHANNEL), started by software,
+ * with up to CONF_DMA_COPY_BLOCKS blocks chained in one transaction.
+ * The blocks are copied with 32-bit beats: their addresses and sizes must be multiples of 4.
+ * The synchronous copies fall back to the CPU when the DMAC can not do them, so that they can be used
+ * anywhere, also from interrupt handlers.
+ *
+ * @{
+ */
+
+#include <compiler.h>
+
+/**
+ * \brief Block of a copy
+ */
+struct _dma_copy_block {
+	void *      dst;  /**< Destination, 32-bit aligned */
+	const void *src;  /**< Source, 32-bit aligned */
+	uint32_t    size; /**< Size in bytes, a multiple of 4 */
+};
+
+/**
+ * \brief Completion callback of an asynchronous copy, called from the DMAC interrupt
+ * \param[in] status ERR_NONE, or ERR_IO on a transfer error
+ */
+typedef void (*_dma_copy_cb_t)(const int32_t status);
+
+/**
+ * \brief Take the copy channel in use, once the DMAC is initialized (_dma_init)
+ *
+ * Before, all copies are done by the CPU.
+ */
+void _dma_copy_init(void);
+
+/**
+ * \brief Copy blocks in order by the DMAC, and wait for the end of the copy
+ *
+ * Nothing is copied by the CPU: use it for destinations which need 32-bit writes, such as the NVM page buffer.
+ * While the DMAC copies, the CPU polls the channel, with the interrupts enabled.
+ * \param[in] blocks Blocks to copy
+ * \param[in] count Number of blocks, up to CONF_DMA_COPY_BLOCKS
+ * \return Operation status
+ * \retval ERR_NONE The blocks are copied
+ * \retval ERR_NOT_INITIALIZED _dma_copy_init has not been called, or the DMAC is disabled
+ * \retval ERR_INVALID_ARG Too many blocks, or a block is not 32-bit aligned or too large
+ * \retval ERR_BUSY A copy is in progress, e.g. in the interrupted code
+ * \retval ERR_IO Transfer error, the destinations are partially written
+ */
+int32_t _dma_copy_wait(const struct _dma_copy_block *const blocks, const uint8_t count);
+
+/**
+ * \brief Copy blocks in order, by the DMAC if possible, and wait for the end of the copy
+ *
+ * The copy is done by the CPU (memcpy) when it is smaller than CONF_DMA_COPY_THRESHOLD in total,
+ * a block is not 32-bit aligned, the channel is busy, or the DMAC reports a transfer error.
+ * While the DMAC copies, the CPU polls the channel, with the interrupts enabled.
+ * \param[in] blocks Blocks to copy
+ * \param[in] count Number of blocks
+ */
+void _dma_copy_blocks(const struct _dma_copy_block *const blocks, const uint8_t count);
+
+/**
+ * \brief Copy one block, by the DMAC if possible, and wait for the end of the copy (see _dma_copy_blocks)
+ * \param[out] dst Destination
+ * \param[in] src Source
+ * \param[in] size Size in bytes
+ */
+void _dma_copy(void *const dst, const void *const src, const uint32_t size);
+
+/**
+ * \brief Start copying blocks in order by the DMAC, without waiting
+ *
+ * The blocks must not be modified, nor the destinations used, before the callback is called.
+ * \param[in] blocks Blocks to copy, only read before returning
+ * \param[in] count Number of blocks, up to CONF_DMA_COPY_BLOCKS
+ * \param[in] cb Callback called once the copy is complete
+ * \return Operation status
+ * \retval ERR_NONE The copy is started
+ * \retval ERR_NOT_INITIALIZED _dma_copy_init has not been called
+ * \retval ERR_INVALID_ARG Too many blocks, a block is not 32-bit aligned or too large, or no callback
+ * \retval ERR_BUSY A copy is in progress
+ */
+int32_t _dma_copy_start(const struct _dma_copy_block *const blocks, const uint8_t count, const _dma_copy_cb_t cb);
+
+/**
+ * \brief Check whether a copy started by _dma_copy_start is in progress
+ * \return true until its callback is called
+ */
+bool _dma_copy_is_busy(void);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HPL_DMA_COPY_H_INCLUDED */
@@ -164,6 +164,14 @@ bool _flash_is_locked(struct _flash_device *const device, const uint32_t dst_add
  */
 void _flash_erase(struct _flash_device *const device, const uint32_t dst_addr, uint32_t page_nums);
 
+/** \brief Wait for the last erase or write in the internal flash to complete
+ *
+ *  Erases and writes may still run when the functions above return. Once this one returns,
+ *  the flash can be read directly, the content cached before the operation completed being dropped.
+ *  \param[in] device         The pointer to FLASH device instance
+ */
+void _flash_wait_ready(struct _flash_device *const device);
+
 /**
  * \brief Get the flash page size.
  *
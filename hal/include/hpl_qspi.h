@@ -0,0 +1,132 @@
+/**
+ * \file
+ *
+ * \brief QSPI serial memory mode related functionality declaration.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HPL_QSPI_H_INCLUDED
+#define _HPL_QSPI_H_INCLUDED
+
+#include <compiler.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \addtogroup hpl_qspi
+ *
+ * Commands to a serial memory, in the serial memory mode of the QSPI (as the QSPI HPL of ASF4).
+ * The data phase goes through the QSPI AHB window, copied by the DMAC when possible (hpl_dma_copy.h).
+ *
+ * @{
+ */
+
+/** Lines used by the instruction, address/option and data phases (INSTRFRAME.WIDTH) */
+enum _qspi_width {
+	QSPI_INST1_ADDR1_DATA1, /**< single-bit SPI */
+	QSPI_INST1_ADDR1_DATA2, /**< dual output */
+	QSPI_INST1_ADDR1_DATA4, /**< quad output */
+	QSPI_INST1_ADDR2_DATA2, /**< dual I/O */
+	QSPI_INST1_ADDR4_DATA4, /**< quad I/O */
+	QSPI_INST2_ADDR2_DATA2, /**< dual command */
+	QSPI_INST4_ADDR4_DATA4, /**< quad command */
+};
+
+/** Direction of the data phase (INSTRFRAME.TFRTYPE) */
+enum _qspi_tfr_type {
+	QSPI_READ_ACCESS,        /**< read a register, or memory through the AHB window from its start */
+	QSPI_READMEM_ACCESS,     /**< read memory through the AHB window at the command address */
+	QSPI_WRITE_ACCESS,       /**< write a register, or no data */
+	QSPI_WRITEMEM_ACCESS,    /**< write memory through the AHB window at the command address */
+};
+
+/**
+ * \brief Instruction frame of a command (QSPI INSTRFRAME)
+ */
+union _qspi_inst_frame {
+	struct {
+		uint32_t width : 3;        /**< enum _qspi_width */
+		uint32_t reserved0 : 1;
+		uint32_t inst_en : 1;      /**< send the instruction */
+		uint32_t addr_en : 1;      /**< send the address */
+		uint32_t opt_en : 1;       /**< send the option (mode byte) */
+		uint32_t data_en : 1;      /**< data phase */
+		uint32_t opt_len : 2;      /**< option length: 0 for 1 bit, 1 for 2, 2 for 4, 3 for 8 bits */
+		uint32_t addr_len : 1;     /**< 0 for 24-bit addresses, 1 for 32-bit */
+		uint32_t reserved1 : 1;
+		uint32_t tfr_type : 2;     /**< enum _qspi_tfr_type */
+		uint32_t continues_read : 1;
+		uint32_t ddr_enable : 1;
+		uint32_t dummy_cycles : 5; /**< clock cycles between the address/option and the data */
+		uint32_t reserved2 : 11;
+	} bits;
+	uint32_t word;
+};
+
+/**
+ * \brief Command to the serial memory
+ */
+struct _qspi_command {
+	union _qspi_inst_frame inst_frame;
+	uint8_t                instruction;
+	uint8_t                option;
+	uint32_t               address;
+	uint32_t               buf_len; /**< length of the data phase */
+	const void *           tx_buf;  /**< data to write, if TFRTYPE is a write */
+	void *                 rx_buf;  /**< buffer for the read data, if TFRTYPE is a read */
+};
+
+/**
+ * \brief QSPI device
+ */
+struct _qspi_sync_dev {
+	void *prvt; /**< QSPI hardware instance */
+};
+
+/**
+ * \brief Initialize the QSPI in serial memory mode, and enable it
+ * \param[in] dev QSPI device
+ * \param[in] hw QSPI hardware instance
+ * \return Operation status
+ */
+int32_t _qspi_sync_init(struct _qspi_sync_dev *dev, void *const hw);
+
+/**
+ * \brief Disable the QSPI and reset it
+ * \param[in] dev QSPI device
+ * \return Operation status
+ */
+int32_t _qspi_sync_deinit(struct _qspi_sync_dev *dev);
+
+/**
+ * \brief Run a command, and wait for its end
+ * \param[in] dev QSPI device
+ * \param[in] cmd Command
+ * \return Operation status
+ */
+int32_t _qspi_sync_serial_run_command(struct _qspi_sync_dev *dev, const struct _qspi_command *cmd);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HPL_QSPI_H_INCLUDED */
@@ -0,0 +1,101 @@
+/**
+ * \file
+ *
+ * \brief Serial NOR flash on the QSPI.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HPL_QSPI_NOR_H_INCLUDED
+#define _HPL_QSPI_NOR_H_INCLUDED
+
+#include <hpl_qspi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \addtogroup hpl_qspi_nor
+ *
+ * Serial NOR flash of the SST26 family (geometry in hpl_qspi_config.h), read and programmed in quad I/O mode.
+ * Programs and erases only start the operation: the next operation waits for the flash to be ready,
+ * so that the caller can do something else meanwhile (see _qspi_nor_is_busy).
+ *
+ * @{
+ */
+
+/**
+ * \brief Reset the flash, check its JEDEC ID, enable the quad I/O mode and unlock all blocks
+ * \param[in] dev QSPI device, initialized
+ * \return Operation status
+ * \retval ERR_NONE The flash is ready
+ * \retval ERR_NOT_FOUND No flash answered with the configured manufacturer ID
+ */
+int32_t _qspi_nor_init(struct _qspi_sync_dev *dev);
+
+/**
+ * \brief Read data, once the flash is ready
+ * \param[in] dev QSPI device
+ * \param[in] addr Address in the flash
+ * \param[out] buffer Read data
+ * \param[in] length Length of the data
+ * \return Operation status
+ */
+int32_t _qspi_nor_read(struct _qspi_sync_dev *dev, const uint32_t addr, uint8_t *const buffer, const uint32_t length);
+
+/**
+ * \brief Start programming data in one page, once the flash is ready
+ *
+ * Only bits at 1 can be programmed to 0: the data is ANDed with the flash content.
+ * \param[in] dev QSPI device
+ * \param[in] addr Address in the flash
+ * \param[in] buffer Data to program
+ * \param[in] length Length of the data, not crossing a page boundary
+ * \return Operation status
+ */
+int32_t _qspi_nor_program(struct _qspi_sync_dev *dev, const uint32_t addr, const uint8_t *const buffer,
+                          const uint32_t length);
+
+/**
+ * \brief Start erasing a sector or a block, once the flash is ready
+ * \param[in] dev QSPI device
+ * \param[in] addr Address of the sector or block, aligned to its size
+ * \param[in] size CONF_QSPI_NOR_SECTOR_SIZE or CONF_QSPI_NOR_BLOCK_SIZE
+ * \return Operation status
+ */
+int32_t _qspi_nor_erase(struct _qspi_sync_dev *dev, const uint32_t addr, const uint32_t size);
+
+/**
+ * \brief Check whether a program or erase is still running (one status read)
+ * \param[in] dev QSPI device
+ */
+bool _qspi_nor_is_busy(struct _qspi_sync_dev *dev);
+
+/**
+ * \brief Wait for the end of the running program or erase
+ * \param[in] dev QSPI device
+ */
+void _qspi_nor_wait_ready(struct _qspi_sync_dev *dev);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HPL_QSPI_NOR_H_INCLUDED */
@@ -47,6 +47,7 @@ extern "C" {
  * with the flash contents, e.g.,
  * - NVM Software Calibration Area of SAM D/L/C family
  * - User Signature of SAM E/S/V 70
+ * - SmartEEPROM of SAM D5x/E5x
  *
  * \param[in]  base   The base address of the user area
  * \param[in]  offset The byte offset of the data to be read inside the area
@@ -58,6 +59,7 @@ extern "C" {
  * \retval ERR_UNSUPPORTED_OP base address not in any supported user area
  * \retval ERR_BAD_ADDRESS offset not in right area
  * \retval ERR_INVALID_ARG offset and size exceeds the right area
+ * \retval ERR_NOT_INITIALIZED the SmartEEPROM is not allocated
  */
 int32_t _user_area_read(const void *base, const uint32_t offset, uint8_t *buf, const uint32_t size);
 
@@ -81,6 +83,7 @@ uint32_t _user_area_read_bits(const void *base, const uint32_t bit_offset, const
  * with the flash contents, e.g.,
  * - NVM Software Calibration Area of SAM D/L/C family
  * - User Signature of SAM E/S/V 70
+ * - SmartEEPROM of SAM D5x/E5x, written by 32-bit words
  *
  * When assigned offset and size exceeds the data area, error is reported.
  *
@@ -94,7 +97,8 @@ uint32_t _user_area_read_bits(const void *base, const uint32_t bit_offset, const
  * \retval ERR_UNSUPPORTED_OP base address not in any supported user area
  * \retval ERR_DENIED Security bit is set
  * \retval ERR_BAD_ADDRESS offset not in right area
- * \retval ERR_INVALID_ARG offset and size exceeds the right area
+ * \retval ERR_INVALID_ARG offset and size exceeds the right area, or are not word aligned (SmartEEPROM)
+ * \retval ERR_NOT_INITIALIZED the SmartEEPROM is not allocated
  */
 int32_t _user_area_write(void *base, const uint32_t offset, const uint8_t *buf, const uint32_t size);
 
@@ -35,6 +35,7 @@
 #include <utils_assert.h>
 #include <utils.h>
 #include <hal_atomic.h>
+#include <hpl_nvmctrl_geometry.h>
 
 /**
  * \brief Driver version
@@ -85,11 +86,8 @@ int32_t flash_read(struct flash_descriptor *flash, uint32_t src_addr, uint8_t *b
 {
 	ASSERT(flash && buffer && length);
 
-	uint32_t page_size   = _flash_get_page_size(&flash->dev);
-	uint32_t total_pages = _flash_get_total_pages(&flash->dev);
-
 	/* Check if the address is valid */
-	if ((src_addr > page_size * total_pages) || (src_addr + length > page_size * total_pages)) {
+	if (!NVM_RANGE_VALID(src_addr, length)) {
 		return ERR_BAD_ADDRESS;
 	}
 
@@ -105,11 +103,8 @@ int32_t flash_write(struct flash_descriptor *flash, uint32_t dst_addr, uint8_t *
 {
 	ASSERT(flash && buffer && length);
 
-	uint32_t page_size   = _flash_get_page_size(&flash->dev);
-	uint32_t total_pages = _flash_get_total_pages(&flash->dev);
-
 	/* Check if the address is valid */
-	if ((dst_addr > page_size * total_pages) || (dst_addr + length > page_size * total_pages)) {
+	if (!NVM_RANGE_VALID(dst_addr, length)) {
 		return ERR_BAD_ADDRESS;
 	}
 
@@ -129,11 +124,8 @@ int32_t flash_append(struct flash_descriptor *flash, uint32_t dst_addr, uint8_t
 {
 	ASSERT(flash && buffer && length);
 
-	uint32_t page_size   = _flash_get_page_size(&flash->dev);
-	uint32_t total_pages = _flash_get_total_pages(&flash->dev);
-
 	/* Check if the address is valid */
-	if ((dst_addr > page_size * total_pages) || (dst_addr + length > page_size * total_pages)) {
+	if (!NVM_RANGE_VALID(dst_addr, length)) {
 		return ERR_BAD_ADDRESS;
 	}
 
@@ -152,16 +144,14 @@ int32_t flash_append(struct flash_descriptor *flash, uint32_t dst_addr, uint8_t
 int32_t flash_erase(struct flash_descriptor *flash, const uint32_t dst_addr, const uint32_t page_nums)
 {
 	ASSERT(flash && page_nums);
-	uint32_t page_size   = _flash_get_page_size(&flash->dev);
-	uint32_t total_pages = _flash_get_total_pages(&flash->dev);
-	int32_t  rc;
+	int32_t rc;
 
 	rc = flash_is_address_aligned(flash, dst_addr);
 	if (rc) {
 		return rc;
 	}
 
-	if ((page_nums > total_pages) || (dst_addr / page_size + page_nums > total_pages)) {
+	if ((page_nums > NVM_TOTAL_PAGES) || ((dst_addr >> NVM_PAGE_SHIFT) + page_nums > NVM_TOTAL_PAGES)) {
 		return ERR_INVALID_ARG;
 	}
 
@@ -201,16 +191,14 @@ int32_t flash_register_callback(struct flash_descriptor *flash, const enum flash
 int32_t flash_lock(struct flash_descriptor *flash, const uint32_t dst_addr, const uint32_t page_nums)
 {
 	ASSERT(flash && page_nums);
-	uint32_t page_size   = _flash_get_page_size(&flash->dev);
-	uint32_t total_pages = _flash_get_total_pages(&flash->dev);
-	int32_t  rc;
+	int32_t rc;
 
 	rc = flash_is_address_aligned(flash, dst_addr);
 	if (rc) {
 		return rc;
 	}
 
-	if ((page_nums > total_pages) || (dst_addr / page_size + page_nums > total_pages)) {
+	if ((page_nums > NVM_TOTAL_PAGES) || ((dst_addr >> NVM_PAGE_SHIFT) + page_nums > NVM_TOTAL_PAGES)) {
 		return ERR_INVALID_ARG;
 	}
 
@@ -223,16 +211,14 @@ int32_t flash_lock(struct flash_descriptor *flash, const uint32_t dst_addr, cons
 int32_t flash_unlock(struct flash_descriptor *flash, const uint32_t dst_addr, const uint32_t page_nums)
 {
 	ASSERT(flash && page_nums);
-	uint32_t page_size   = _flash_get_page_size(&flash->dev);
-	uint32_t total_pages = _flash_get_total_pages(&flash->dev);
-	int32_t  rc;
+	int32_t rc;
 
 	rc = flash_is_address_aligned(flash, dst_addr);
 	if (rc) {
 		return rc;
 	}
 
-	if ((page_nums > total_pages) || (dst_addr / page_size + page_nums > total_pages)) {
+	if ((page_nums > NVM_TOTAL_PAGES) || ((dst_addr >> NVM_PAGE_SHIFT) + page_nums > NVM_TOTAL_PAGES)) {
 		return ERR_INVALID_ARG;
 	}
 
@@ -278,10 +264,8 @@ static int32_t flash_is_address_aligned(struct flash_descriptor *flash, const ui
 {
 	ASSERT(flash);
 
-	uint32_t page_size = _flash_get_page_size(&flash->dev);
-
 	/* Check if the read address not aligned to the start of a page */
-	if (flash_addr & (page_size - 1)) {
+	if (flash_addr & (NVM_PAGE_SIZE - 1)) {
 		return ERR_BAD_ADDRESS;
 	}
 	return ERR_NONE;
@@ -0,0 +1,120 @@
+/**
+ * \file
+ *
+ * \brief Single-producer single-consumer queue declaration.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _UTILS_SPSC_H_INCLUDED
+#define _UTILS_SPSC_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \addtogroup doc_driver_hal_utils_spsc
+ *
+ * A ring of fixed-size items, e.g. job descriptors, passed from one producer to one consumer,
+ * such as an interrupt handler and the main loop, or two threads.
+ * Each side only writes its own index, and publishes it with a release store once the item is copied:
+ * no critical section is needed, and neither side ever waits for the other.
+ *
+ * @{
+ */
+
+#include <compiler.h>
+
+/**
+ * \brief Single-producer single-consumer queue descriptor
+ */
+struct spsc_queue {
+	uint8_t *buf;                  /**< Storage for size items */
+	uint32_t item_size;            /**< Size of an item, in bytes */
+	uint32_t size;                 /**< Number of items, a power of 2 */
+	volatile uint32_t read_index;  /**< Items taken since the initialization, only written by the consumer */
+	volatile uint32_t write_index; /**< Items put since the initialization, only written by the producer */
+};
+
+/**
+ * \brief Initialize a queue
+ *
+ * \param[out] queue The pointer to a queue descriptor
+ * \param[in] buf Storage for the items
+ * \param[in] item_size Size of an item, in bytes
+ * \param[in] size Number of items the storage holds, a power of 2
+ *
+ * \return ERR_NONE on success, or an error code on failure.
+ */
+int32_t spsc_queue_init(struct spsc_queue *const queue, void *const buf, uint32_t item_size, uint32_t size);
+
+/**
+ * \brief Put an item at the tail of the queue (producer)
+ *
+ * \param[in] queue The pointer to a queue descriptor
+ * \param[in] item The item to copy in the queue
+ *
+ * \return ERR_NONE on success, ERR_NO_RESOURCE if the queue is full.
+ */
+int32_t spsc_queue_put(struct spsc_queue *const queue, const void *const item);
+
+/**
+ * \brief Take the item at the head of the queue (consumer)
+ *
+ * \param[in] queue The pointer to a queue descriptor
+ * \param[out] item Where to copy the item
+ *
+ * \return ERR_NONE on success, ERR_NOT_FOUND if the queue is empty.
+ */
+int32_t spsc_queue_get(struct spsc_queue *const queue, void *const item);
+
+/**
+ * \brief Access the item at the head of the queue without taking it (consumer)
+ *
+ * The item stays valid, and is not overwritten by the producer, until spsc_queue_drop() is called.
+ *
+ * \param[in] queue The pointer to a queue descriptor
+ *
+ * \return A pointer to the item, NULL if the queue is empty.
+ */
+void *spsc_queue_peek(struct spsc_queue *const queue);
+
+/**
+ * \brief Release the item at the head of the queue after spsc_queue_peek() (consumer)
+ *
+ * \param[in] queue The pointer to a queue descriptor
+ */
+void spsc_queue_drop(struct spsc_queue *const queue);
+
+/**
+ * \brief Get the number of items in the queue (producer or consumer)
+ *
+ * \param[in] queue The pointer to a queue descriptor
+ *
+ * \return The number of items, only a lower bound for the consumer and an upper bound for the producer
+ * since the other side might be changing it.
+ */
+uint32_t spsc_queue_num(const struct spsc_queue *const queue);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTILS_SPSC_H_INCLUDED */
@@ -0,0 +1,126 @@
+/**
+ * \file
+ *
+ * \brief Single-producer single-consumer queue functionality implementation.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <utils_assert.h>
+#include <utils_spsc.h>
+#include <err_codes.h>
+
+/*
+ * The indexes run freely and wrap around at 2^32, a multiple of the size:
+ * write_index - read_index is the number of items, and the item slot is the index modulo the size.
+ * The acquire load of the other side's index orders the item access after it,
+ * and the release store of our index publishes the item access before it.
+ */
+
+/**
+ * \brief Initialize a queue
+ */
+int32_t spsc_queue_init(struct spsc_queue *const queue, void *const buf, uint32_t item_size, uint32_t size)
+{
+	ASSERT(queue && buf && item_size);
+
+	if (0 == size || (size & (size - 1))) {
+		return ERR_INVALID_ARG;
+	}
+
+	queue->buf         = (uint8_t *)buf;
+	queue->item_size   = item_size;
+	queue->size        = size;
+	queue->read_index  = 0;
+	queue->write_index = 0;
+
+	return ERR_NONE;
+}
+
+/**
+ * \brief Put an item at the tail of the queue
+ */
+int32_t spsc_queue_put(struct spsc_queue *const queue, const void *const item)
+{
+	uint32_t write_index;
+
+	ASSERT(queue && item);
+
+	write_index = queue->write_index; // only written here
+	if (write_index - __atomic_load_n(&queue->read_index, __ATOMIC_ACQUIRE) >= queue->size) {
+		return ERR_NO_RESOURCE;
+	}
+	memcpy(&queue->buf[(write_index & (queue->size - 1)) * queue->item_size], item, queue->item_size);
+	__atomic_store_n(&queue->write_index, write_index + 1, __ATOMIC_RELEASE);
+
+	return ERR_NONE;
+}
+
+/**
+ * \brief Access the item at the head of the queue without taking it
+ */
+void *spsc_queue_peek(struct spsc_queue *const queue)
+{
+	uint32_t read_index;
+
+	ASSERT(queue);
+
+	read_index = queue->read_index; // only written by the consumer
+	if (__atomic_load_n(&queue->write_index, __ATOMIC_ACQUIRE) == read_index) {
+		return NULL;
+	}
+	return &queue->buf[(read_index & (queue->size - 1)) * queue->item_size];
+}
+
+/**
+ * \brief Release the item at the head of the queue
+ */
+void spsc_queue_drop(struct spsc_queue *const queue)
+{
+	ASSERT(queue && queue->read_index != queue->write_index);
+
+	__atomic_store_n(&queue->read_index, queue->read_index + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Take the item at the head of the queue
+ */
+int32_t spsc_queue_get(struct spsc_queue *const queue, void *const item)
+{
+	const void *head = spsc_queue_peek(queue);
+
+	ASSERT(item);
+
+	if (NULL == head) {
+		return ERR_NOT_FOUND;
+	}
+	memcpy(item, head, queue->item_size);
+	spsc_queue_drop(queue);
+
+	return ERR_NONE;
+}
+
+/**
+ * \brief Get the number of items in the queue
+ */
+uint32_t spsc_queue_num(const struct spsc_queue *const queue)
+{
+	ASSERT(queue);
+
+	return __atomic_load_n(&queue->write_index, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->read_index, __ATOMIC_ACQUIRE);
+}
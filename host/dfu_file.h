@@ -0,0 +1,234 @@
+/**
+ * \file
+ * \brief DFU file formats for the host tools: DFU suffix (DFU specification 1.1, appendix B) and DfuSe files (ST UM0391)
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_DFU_FILE_H
+#define HOST_DFU_FILE_H
+
+#include <cstring>
+#include <string>
+
+#include "dfu_protocol.h"
+
+namespace dfu {
+
+/** Length of the DFU suffix */
+constexpr size_t suffix_length = 16;
+/** bcdDFU of the suffix of plain DFU files, as written by dfu-suffix */
+constexpr uint16_t suffix_version = 0x0100;
+/** bcdDevice of the suffix matching any device release */
+constexpr uint16_t suffix_any_device = 0xFFFF;
+
+/** Fields of a DFU suffix */
+struct suffix {
+	uint16_t bcdDevice;
+	uint16_t idProduct;
+	uint16_t idVendor;
+	uint16_t bcdDFU;
+	uint32_t dwCRC;
+};
+
+/** Result of looking for the DFU suffix of a file */
+enum class suffix_check {
+	none, /**< the file has no suffix */
+	ok, /**< the suffix has been removed */
+	bad_crc, /**< the file has a suffix, but the data does not match its CRC */
+};
+
+inline uint16_t get_le16(const uint8_t *buf)
+{
+	return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+inline uint32_t get_le32(const uint8_t *buf)
+{
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+inline void put_le16(std::vector<uint8_t> &buf, uint16_t value)
+{
+	buf.push_back((uint8_t)value);
+	buf.push_back((uint8_t)(value >> 8));
+}
+
+inline void put_le32(std::vector<uint8_t> &buf, uint32_t value)
+{
+	for (int i = 0; i < 4; i++) {
+		buf.push_back((uint8_t)(value >> (i * 8)));
+	}
+}
+
+/** Append the DFU suffix to a file, with the CRC of the whole file (the CRC-32 without its final inversion) */
+inline void append_suffix(std::vector<uint8_t> &file, uint16_t bcdDFU, uint16_t idVendor, uint16_t idProduct)
+{
+	put_le16(file, suffix_any_device);
+	put_le16(file, idProduct);
+	put_le16(file, idVendor);
+	put_le16(file, bcdDFU);
+	file.push_back('U');
+	file.push_back('F');
+	file.push_back('D');
+	file.push_back((uint8_t)suffix_length);
+	put_le32(file, crc32_update(0xFFFFFFFF, file.data(), file.size()));
+}
+
+/** Remove the DFU suffix if the file has one
+ *  \param[out] fields the suffix fields, when one has been found
+ */
+inline suffix_check strip_suffix(std::vector<uint8_t> &file, suffix *fields = nullptr)
+{
+	const size_t n = file.size();
+	if (n < suffix_length || 'U' != file[n - 8] || 'F' != file[n - 7] || 'D' != file[n - 6]) {
+		return suffix_check::none;
+	}
+	const size_t length = file[n - 5];
+	if (length < suffix_length || length > n) {
+		return suffix_check::none;
+	}
+	const uint32_t crc = get_le32(&file[n - 4]);
+	if (crc != crc32_update(0xFFFFFFFF, file.data(), n - 4)) {
+		return suffix_check::bad_crc;
+	}
+	if (fields) {
+		*fields = suffix{get_le16(&file[n - 16]), get_le16(&file[n - 14]), get_le16(&file[n - 12]), get_le16(&file[n - 10]), crc};
+	}
+	file.resize(n - length);
+	return suffix_check::ok;
+}
+
+/** Data to be written at an address of the device memory: a DfuSe image element */
+struct element {
+	uint32_t address;
+	std::vector<uint8_t> data;
+};
+
+/** Lengths of the DfuSe file prefix, target prefix and element header */
+constexpr size_t dfuse_prefix_length = 11;
+constexpr size_t dfuse_target_length = 274;
+constexpr size_t dfuse_element_length = 8;
+/** Length of the DfuSe target name field */
+constexpr size_t dfuse_name_length = 255;
+
+/** Serialize a DfuSe file with one target, without its suffix
+ *  \param[in] alternate alternate setting the elements are downloaded to
+ *  \param[in] name target name, for the tools showing it
+ */
+inline std::vector<uint8_t> dfuse_file(const std::vector<element> &elements, uint8_t alternate, const std::string &name)
+{
+	size_t target_size = 0;
+	for (const element &e : elements) {
+		target_size += dfuse_element_length + e.data.size();
+	}
+	std::vector<uint8_t> file;
+	file.reserve(dfuse_prefix_length + dfuse_target_length + target_size + suffix_length);
+	file.insert(file.end(), {'D', 'f', 'u', 'S', 'e', 0x01});
+	put_le32(file, (uint32_t)(dfuse_prefix_length + dfuse_target_length + target_size));
+	file.push_back(1); // bTargets
+	file.insert(file.end(), {'T', 'a', 'r', 'g', 'e', 't', alternate});
+	put_le32(file, name.empty() ? 0 : 1);
+	const size_t name_start = file.size();
+	file.resize(name_start + dfuse_name_length, 0);
+	std::memcpy(&file[name_start], name.data(), std::min<size_t>(name.size(), dfuse_name_length - 1));
+	put_le32(file, (uint32_t)target_size);
+	put_le32(file, (uint32_t)elements.size());
+	for (const element &e : elements) {
+		put_le32(file, e.address);
+		put_le32(file, (uint32_t)e.data.size());
+		file.insert(file.end(), e.data.begin(), e.data.end());
+	}
+	return file;
+}
+
+/** Check if a file, without its suffix, is a DfuSe file */
+inline bool is_dfuse_file(const std::vector<uint8_t> &file)
+{
+	return file.size() >= dfuse_prefix_length && 0 == std::memcmp(file.data(), "DfuSe", 5);
+}
+
+/** Parse a DfuSe file, without its suffix
+ *  \param[in] alternate only the elements of the targets for this alternate setting are returned
+ *  \param[out] elements the elements, in file order
+ *  \return false if the file is malformed
+ */
+inline bool parse_dfuse_file(const std::vector<uint8_t> &file, uint8_t alternate, std::vector<element> &elements)
+{
+	if (!is_dfuse_file(file) || 0x01 != file[5] || get_le32(&file[6]) != file.size()) {
+		return false;
+	}
+	size_t pos = dfuse_prefix_length;
+	for (unsigned target = 0; target < file[10]; target++) {
+		if (file.size() - pos < dfuse_target_length || 0 != std::memcmp(&file[pos], "Target", 6)) {
+			return false;
+		}
+		const uint8_t alt = file[pos + 6];
+		const uint32_t count = get_le32(&file[pos + 270]);
+		pos += dfuse_target_length;
+		for (uint32_t i = 0; i < count; i++) {
+			if (file.size() - pos < dfuse_element_length) {
+				return false;
+			}
+			const uint32_t address = get_le32(&file[pos]);
+			const uint32_t size = get_le32(&file[pos + 4]);
+			pos += dfuse_element_length;
+			if (file.size() - pos < size) {
+				return false;
+			}
+			if (alt == alternate) {
+				elements.push_back(element{address, std::vector<uint8_t>(file.begin() + pos, file.begin() + pos + size)});
+			}
+			pos += size;
+		}
+	}
+	return pos == file.size();
+}
+
+/** Flatten elements into one image starting at the lowest address, the gaps being filled with the erased value 0xFF
+ *  \param[out] address address of the image
+ *  \return false if elements overlap
+ */
+inline bool flatten_elements(const std::vector<element> &elements, std::vector<uint8_t> &image, uint32_t &address)
+{
+	image.clear();
+	if (elements.empty()) {
+		return true;
+	}
+	std::vector<const element *> sorted;
+	for (const element &e : elements) {
+		sorted.push_back(&e);
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const element *a, const element *b) { return a->address < b->address; });
+	uint64_t end = 0;
+	for (const element *e : sorted) {
+		if (e != sorted.front() && e->address < end) {
+			return false;
+		}
+		end = std::max<uint64_t>(end, (uint64_t)e->address + e->data.size());
+	}
+	const uint32_t start = sorted.front()->address;
+	image.assign(end - start, 0xFF);
+	for (const element *e : sorted) {
+		std::copy(e->data.begin(), e->data.end(), image.begin() + (e->address - start));
+	}
+	address = start;
+	return true;
+}
+
+} // namespace dfu
+
+#endif // HOST_DFU_FILE_H
@@ -0,0 +1,264 @@
+/**
+ * \file
+ * \brief Per-device DFU download pipeline
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <algorithm>
+
+#include "dfu_pipeline.h"
+#include "dfu_protocol.h"
+
+namespace dfu {
+
+pipeline::pipeline(device &dev, const std::vector<uint8_t> &image, bool resume)
+	: _dev(dev), _image(image), _name(dev.name()), _transfer_size(dev.transfer_size()), _resume(resume)
+{
+}
+
+void pipeline::start()
+{
+	if (!(_dev.attributes() & CAN_DOWNLOAD)) {
+		fail("device does not support download");
+		return;
+	}
+	if (0 == _transfer_size) {
+		fail("invalid transfer size");
+		return;
+	}
+	_stats.start = clock::now();
+	if (!_resume) {
+		send_block();
+		return;
+	}
+	_phase = phase::resume_query;
+	query_resume();
+}
+
+void pipeline::query_resume()
+{
+	if (!_dev.vendor_in(GET_RESUME, 0, resume_info_length,
+	                    [this](xfer_result result, const uint8_t *data, size_t length) { on_resume_info(result, data, length); })) {
+		fail("could not submit resume request");
+	}
+}
+
+void pipeline::on_resume_info(xfer_result result, const uint8_t *data, size_t length)
+{
+	if (xfer_result::stall == result && phase::resume_query == _phase) { // the device does not support resuming
+		send_block();
+		return;
+	}
+	if (xfer_result::ok != result || length < resume_info_length) {
+		fail("resume request failed");
+		return;
+	}
+
+	const image_id id = image_id::of(_image.data(), _image.size());
+	const resume_info info = resume_info::parse(data);
+	if (info.bPending) { // the device is still processing the previous request (checking the flash), ask again later
+		_pending = _phase;
+		_phase = phase::idle;
+		_wait_start = clock::now();
+		_deadline = _wait_start + std::chrono::milliseconds(pending_poll_ms);
+		return;
+	}
+	if (info.image == id) {
+		_resume_info = info;
+	}
+	if (phase::block_query == _phase) { // the device checked the blocks already in flash
+		send_block();
+		return;
+	}
+	_block_size = info.wBlockSize;
+	uint8_t buf[image_id_length];
+	id.serialize(buf);
+	_phase = phase::resume_set;
+	if (!_dev.vendor_out(SET_IMAGE, 0, buf, sizeof(buf), [this](xfer_result result, const uint8_t *, size_t) { on_image_set(result); })) {
+		fail("could not submit image identification");
+	}
+}
+
+void pipeline::on_image_set(xfer_result result)
+{
+	if (xfer_result::ok != result) {
+		fail("image identification failed");
+		return;
+	}
+	_block_crcs = block_crcs(_image.data(), _image.size(), _block_size);
+	if (_block_crcs.empty()) {
+		send_block();
+		return;
+	}
+	_phase = phase::block_crcs_set;
+	if (!_dev.vendor_out(SET_BLOCK_CRCS, 0, _block_crcs.data(), (uint16_t)_block_crcs.size(),
+	                     [this](xfer_result result, const uint8_t *, size_t) { on_block_crcs_set(result); })) {
+		fail("could not submit block CRCs");
+	}
+}
+
+void pipeline::on_block_crcs_set(xfer_result result)
+{
+	if (xfer_result::stall == result) { // the device does not check the blocks already in flash
+		send_block();
+		return;
+	}
+	if (xfer_result::ok != result) {
+		fail("block CRCs request failed");
+		return;
+	}
+	_phase = phase::block_query;
+	query_resume();
+}
+
+void pipeline::send_block()
+{
+	while (_offset < _image.size()) { // skip the data the device already programmed
+		const size_t length = std::min<size_t>(_transfer_size, _image.size() - _offset);
+		if (!_resume_info.done(_offset) || !_resume_info.done(_offset + length - 1)) {
+			break;
+		}
+		_offset += length;
+		_stats.skipped += length;
+		_block++;
+	}
+	if (_offset >= _image.size()) { // all data sent, the zero length download starts manifestation
+		_phase = phase::manifest;
+		if (!_dev.control_out(DNLOAD, _block, nullptr, 0,
+		                      [this](xfer_result result, const uint8_t *, size_t) { on_download(result); })) {
+			fail("could not submit final download request");
+		}
+		return;
+	}
+
+	uint16_t length = (uint16_t)std::min<size_t>(_transfer_size, _image.size() - _offset);
+	_phase = phase::download;
+	if (!_dev.control_out(DNLOAD, _block, _image.data() + _offset, length,
+	                      [this](xfer_result result, const uint8_t *, size_t) { on_download(result); })) {
+		fail("could not submit download request");
+		return;
+	}
+	_stats.blocks++;
+}
+
+void pipeline::send_status()
+{
+	_stats.status_polls++;
+	if (!_dev.control_in(GETSTATUS, 0, status_length,
+	                     [this](xfer_result result, const uint8_t *data, size_t length) { on_status(result, data, length); })) {
+		fail("could not submit status request");
+	}
+}
+
+void pipeline::on_download(xfer_result result)
+{
+	if (xfer_result::ok != result) {
+		fail(phase::manifest == _phase ? "final download request failed" : "download request failed");
+		return;
+	}
+	if (phase::download == _phase) {
+		size_t length = std::min<size_t>(_transfer_size, _image.size() - _offset);
+		_offset += length;
+		_stats.bytes += length;
+		_block++;
+		_phase = phase::download_status;
+	} else {
+		_phase = phase::manifest_status;
+	}
+	send_status();
+}
+
+void pipeline::on_status(xfer_result result, const uint8_t *data, size_t length)
+{
+	if (phase::manifest_status == _phase && xfer_result::ok != result && (_dev.attributes() & WILL_DETACH)) {
+		// the device resets itself after manifestation, it disappearing is the expected outcome
+		finish();
+		return;
+	}
+	if (xfer_result::ok != result || length < status_length) {
+		fail("status request failed");
+		return;
+	}
+
+	const status st = status::parse(data);
+	if (0 != st.bStatus || DFU_ERROR == st.bState) {
+		fail(std::string("device reported error status ") + std::to_string(st.bStatus) + " in state "
+		     + state_name(st.bState));
+		return;
+	}
+
+	bool busy;
+	if (phase::download_status == _phase) {
+		if (DFU_DNLOAD_IDLE == st.bState) {
+			send_block(); // no need to wait the poll timeout: it only applies to the next GETSTATUS
+			return;
+		}
+		busy = (DFU_DNLOAD_SYNC == st.bState || DFU_DNBUSY == st.bState);
+	} else {
+		if (DFU_MANIFEST_WAIT_RESET == st.bState || DFU_IDLE == st.bState) {
+			finish();
+			return;
+		}
+		busy = (DFU_MANIFEST_SYNC == st.bState || DFU_MANIFEST == st.bState);
+	}
+	if (!busy) {
+		fail(std::string("unexpected state ") + state_name(st.bState));
+		return;
+	}
+
+	// the device is still working: ask again exactly once the requested poll timeout elapsed
+	_pending = _phase;
+	_phase = phase::idle;
+	_wait_start = clock::now();
+	_deadline = _wait_start + std::chrono::milliseconds(st.bwPollTimeout);
+}
+
+void pipeline::on_timer()
+{
+	if (clock::time_point::max() == _deadline) {
+		return;
+	}
+	clock::time_point now = clock::now();
+	if (now < _deadline) {
+		return;
+	}
+	_stats.poll_wait += now - _wait_start;
+	_deadline = clock::time_point::max();
+	_phase = _pending;
+	if (phase::resume_query == _phase || phase::block_query == _phase) {
+		query_resume();
+	} else {
+		send_status();
+	}
+}
+
+void pipeline::fail(const std::string &reason)
+{
+	_error = reason;
+	_phase = phase::failed;
+	_deadline = clock::time_point::max();
+	_stats.end = clock::now();
+}
+
+void pipeline::finish()
+{
+	_phase = phase::done;
+	_deadline = clock::time_point::max();
+	_stats.end = clock::now();
+}
+
+} // namespace dfu
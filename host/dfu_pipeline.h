@@ -0,0 +1,116 @@
+/**
+ * \file
+ * \brief Per-device DFU download pipeline
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_DFU_PIPELINE_H
+#define HOST_DFU_PIPELINE_H
+
+#include <string>
+#include <vector>
+
+#include "dfu_protocol.h"
+#include "dfu_transport.h"
+
+namespace dfu {
+
+/** Drives a complete DFU download session on one device
+ *
+ *  The pipeline is a state machine advanced by transfer completions and timers.
+ *  It never blocks, so any number of pipelines can share a single event loop.
+ *  GETSTATUS is only re-issued once the bwPollTimeout reported by the device has elapsed, and a new block is sent as soon as the device reports dfuDNLOAD-IDLE.
+ *  Unless disabled, the image is first identified to the device (GET_RESUME and SET_IMAGE vendor requests), so that the blocks
+ *  it already programmed during an interrupted download of the same image are skipped; devices stalling these requests get the whole image.
+ *  The CRC-32 of every block is then sent (SET_BLOCK_CRCS), and the blocks the device already holds are skipped as well.
+ */
+class pipeline {
+public:
+	pipeline(device &dev, const std::vector<uint8_t> &image, bool resume = true);
+
+	/** Start the download session */
+	void start();
+	/** Time at which the pipeline needs on_timer() to be called, or clock::time_point::max() */
+	clock::time_point deadline() const { return _deadline; }
+	/** Advance the pipeline once its deadline is reached */
+	void on_timer();
+
+	bool finished() const { return _phase == phase::done || _phase == phase::failed; }
+	bool failed() const { return _phase == phase::failed; }
+	const std::string &error() const { return _error; }
+	const std::string &name() const { return _name; }
+
+	/** Session statistics */
+	struct statistics {
+		size_t bytes = 0; /**< bytes acknowledged by the device */
+		size_t skipped = 0; /**< bytes not sent since the device already programmed them */
+		unsigned blocks = 0; /**< DNLOAD requests sent */
+		unsigned status_polls = 0; /**< GETSTATUS requests sent */
+		clock::duration poll_wait{}; /**< cumulated time waited because of bwPollTimeout */
+		clock::time_point start;
+		clock::time_point end;
+	};
+	const statistics &stats() const { return _stats; }
+
+private:
+	enum class phase {
+		idle,
+		resume_query, /**< GET_RESUME outstanding */
+		resume_set, /**< SET_IMAGE outstanding */
+		block_crcs_set, /**< SET_BLOCK_CRCS outstanding */
+		block_query, /**< GET_RESUME after SET_BLOCK_CRCS outstanding */
+		download, /**< DNLOAD of a data block outstanding */
+		download_status, /**< GETSTATUS after a data block outstanding */
+		manifest, /**< zero length DNLOAD outstanding */
+		manifest_status, /**< GETSTATUS during manifestation outstanding */
+		done,
+		failed,
+	};
+
+	void query_resume();
+	void on_resume_info(xfer_result result, const uint8_t *data, size_t length);
+	void on_image_set(xfer_result result);
+	void on_block_crcs_set(xfer_result result);
+	void send_block();
+	void send_status();
+	void on_download(xfer_result result);
+	void on_status(xfer_result result, const uint8_t *data, size_t length);
+	void fail(const std::string &reason);
+	void finish();
+
+	device &_dev;
+	const std::vector<uint8_t> &_image;
+	std::string _name;
+	uint16_t _transfer_size;
+	bool _resume;
+	resume_info _resume_info{}; /**< blocks programmed by the device, for this image */
+	uint16_t _block_size = 0; /**< size of the blocks tracked by the device */
+	std::vector<uint8_t> _block_crcs; /**< SET_BLOCK_CRCS data */
+	size_t _offset = 0; /**< offset of the next block to send */
+	uint16_t _block = 0; /**< wValue of the next block to send */
+	phase _phase = phase::idle;
+	/** Phase to go to once the deadline is reached (resume_query, block_query, download_status or manifest_status) */
+	phase _pending = phase::idle;
+	clock::time_point _deadline = clock::time_point::max();
+	clock::time_point _wait_start;
+	std::string _error;
+	statistics _stats;
+};
+
+} // namespace dfu
+
+#endif // HOST_DFU_PIPELINE_H
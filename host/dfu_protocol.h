@@ -0,0 +1,271 @@
+/**
+ * \file
+ * \brief USB DFU protocol definitions for the host tools
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_DFU_PROTOCOL_H
+#define HOST_DFU_PROTOCOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* the device side configuration is the single source of the USB IDs */
+#include "usbd_config.h"
+
+namespace dfu {
+
+/** USB IDs of the osmo-ASF4-DFU bootloader (for the board selected at compile time) */
+constexpr uint16_t default_vid = CONF_USB_OPENMOKO_IDVENDOR;
+constexpr uint16_t default_pid = CONF_USB_OSMOASF4DFU_IDPRODUCT;
+
+/** DFU class request IDs (see usb/class/dfu/usb_protocol_dfu.h) */
+enum request : uint8_t {
+	DETACH = 0,
+	DNLOAD = 1,
+	UPLOAD = 2,
+	GETSTATUS = 3,
+	CLRSTATUS = 4,
+	GETSTATE = 5,
+	ABORT = 6,
+};
+
+/** DFU device states (see usb/class/dfu/usb_protocol_dfu.h) */
+enum state : uint8_t {
+	APP_IDLE = 0,
+	APP_DETACH = 1,
+	DFU_IDLE = 2,
+	DFU_DNLOAD_SYNC = 3,
+	DFU_DNBUSY = 4,
+	DFU_DNLOAD_IDLE = 5,
+	DFU_MANIFEST_SYNC = 6,
+	DFU_MANIFEST = 7,
+	DFU_MANIFEST_WAIT_RESET = 8,
+	DFU_UPLOAD_IDLE = 9,
+	DFU_ERROR = 10,
+};
+
+/** DFU functional descriptor attributes */
+enum attributes : uint8_t {
+	CAN_DOWNLOAD = 0x01,
+	CAN_UPLOAD = 0x02,
+	MANIFEST_TOLERANT = 0x04,
+	WILL_DETACH = 0x08,
+};
+
+/** bmRequestType of DFU class requests to the interface */
+constexpr uint8_t request_type_out = 0x21;
+constexpr uint8_t request_type_in = 0xA1;
+
+/** DFU functional descriptor type */
+constexpr uint8_t func_desc_type = 0x21;
+
+/** Length of the GETSTATUS response */
+constexpr uint16_t status_length = 6;
+
+/** Decoded GETSTATUS response */
+struct status {
+	uint8_t bStatus;
+	uint32_t bwPollTimeout; /**< in milliseconds */
+	uint8_t bState;
+
+	static status parse(const uint8_t *buf)
+	{
+		return status{buf[0], (uint32_t)buf[1] | ((uint32_t)buf[2] << 8) | ((uint32_t)buf[3] << 16), buf[4]};
+	}
+};
+
+/** osmo-ASF4-DFU vendor requests to the DFU interface, for resumable downloads (see usb/class/dfu/usb_protocol_dfu.h)
+ *
+ *  Bootloaders without this extension stall them.
+ */
+enum vendor_request : uint8_t {
+	GET_RESUME = 0x40,
+	SET_IMAGE = 0x41,
+	SET_BLOCK_CRCS = 0x42, /**< optional, stalled by bootloaders not checking the blocks already in flash */
+};
+
+/** bmRequestType of vendor requests to the interface */
+constexpr uint8_t vendor_request_type_out = 0x41;
+constexpr uint8_t vendor_request_type_in = 0xC1;
+
+/** Length of the SET_IMAGE data */
+constexpr uint16_t image_id_length = 8;
+/** Length of the GET_RESUME response */
+constexpr uint16_t resume_info_length = 27;
+/** Interval between GET_RESUME requests while bPending is reported: every request interrupts the device checking the flash */
+constexpr unsigned pending_poll_ms = 10;
+/** Maximum number of blocks in the SET_BLOCK_CRCS data (one per bit of resume_info::bmBlocks) */
+constexpr size_t max_block_crcs = 16 * 8;
+
+/** Table of the CRC-32 remainders of every byte value, for a byte at a time */
+struct crc32_table {
+	uint32_t entries[256];
+
+	crc32_table()
+	{
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++) {
+				crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+			}
+			entries[i] = crc;
+		}
+	}
+};
+
+/** Continue a CRC-32 computation (initial value 0xFFFFFFFF, without the final inversion) */
+inline uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length)
+{
+	static const crc32_table table;
+	for (size_t i = 0; i < length; i++) {
+		crc = (crc >> 8) ^ table.entries[(crc ^ data[i]) & 0xFF];
+	}
+	return crc;
+}
+
+/** CRC-32 (IEEE 802.3) */
+inline uint32_t crc32(const uint8_t *data, size_t length)
+{
+	return ~crc32_update(0xFFFFFFFF, data, length);
+}
+
+/** Identity of a downloaded image (SET_IMAGE data) */
+struct image_id {
+	uint32_t size;
+	uint32_t crc;
+
+	static image_id of(const uint8_t *data, size_t length) { return image_id{(uint32_t)length, crc32(data, length)}; }
+	static image_id parse(const uint8_t *buf)
+	{
+		return image_id{(uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24),
+		                (uint32_t)buf[4] | ((uint32_t)buf[5] << 8) | ((uint32_t)buf[6] << 16) | ((uint32_t)buf[7] << 24)};
+	}
+	void serialize(uint8_t *buf) const
+	{
+		for (int i = 0; i < 4; i++) {
+			buf[i] = (uint8_t)(size >> (i * 8));
+			buf[4 + i] = (uint8_t)(crc >> (i * 8));
+		}
+	}
+	bool operator==(const image_id &other) const { return size == other.size && crc == other.crc; }
+};
+
+/** Decoded GET_RESUME response: the blocks of the image already programmed by the device */
+struct resume_info {
+	image_id image;
+	uint16_t wBlockSize;
+	uint8_t bmBlocks[16];
+	uint8_t bPending; /**< the device did not process the last SET_IMAGE or SET_BLOCK_CRCS yet */
+
+	static resume_info parse(const uint8_t *buf)
+	{
+		resume_info info{image_id::parse(buf), (uint16_t)(buf[8] | (buf[9] << 8)), {}, buf[26]};
+		for (size_t i = 0; i < sizeof(info.bmBlocks); i++) {
+			info.bmBlocks[i] = buf[10 + i];
+		}
+		return info;
+	}
+	/** Check if the data at the given offset of the image is programmed */
+	bool done(size_t offset) const
+	{
+		if (0 == wBlockSize || offset / wBlockSize >= sizeof(bmBlocks) * 8) {
+			return false;
+		}
+		const size_t block = offset / wBlockSize;
+		return bmBlocks[block / 8] & (1 << (block % 8));
+	}
+};
+
+/** Serialize the SET_BLOCK_CRCS data: the CRC-32 of every block of the image
+ *  \return the data, empty if the image has more blocks than the device can track
+ */
+inline std::vector<uint8_t> block_crcs(const uint8_t *data, size_t length, uint16_t block_size)
+{
+	std::vector<uint8_t> crcs;
+	if (0 == block_size || 0 == length || (length + block_size - 1) / block_size > max_block_crcs) {
+		return crcs;
+	}
+	for (size_t offset = 0; offset < length; offset += block_size) {
+		const uint32_t crc = crc32(data + offset, std::min<size_t>(block_size, length - offset));
+		for (int i = 0; i < 4; i++) {
+			crcs.push_back((uint8_t)(crc >> (i * 8)));
+		}
+	}
+	return crcs;
+}
+
+/** DfuSe commands, downloaded with wValue 0 to devices reporting bcdDFUVersion dfuse_version (see usb/class/dfu/usb_protocol_dfu.h) */
+enum dfuse_command : uint8_t {
+	GET_COMMANDS = 0x00, /**< read with UPLOAD */
+	SET_ADDRESS = 0x21,
+	ERASE = 0x41, /**< the page holding the address, or the whole memory without address */
+	READ_UNPROTECT = 0x92, /**< not supported by osmo-ASF4-DFU */
+};
+
+/** bcdDFUVersion of devices supporting the DfuSe commands */
+constexpr uint16_t dfuse_version = 0x011A;
+/** wValue of the data block at the address set by SET_ADDRESS, the following blocks being wTransferSize apart */
+constexpr uint16_t dfuse_first_block = 2;
+
+/** Serialize a DfuSe command with its 32-bit address */
+inline std::vector<uint8_t> dfuse_request(dfuse_command command, uint32_t address)
+{
+	return std::vector<uint8_t>{command, (uint8_t)address, (uint8_t)(address >> 8), (uint8_t)(address >> 16), (uint8_t)(address >> 24)};
+}
+
+/** Part of an image holding data, to be downloaded at its own address */
+struct segment {
+	size_t offset; /**< in the image */
+	size_t length;
+};
+
+/** Find the segments of an image to download after erasing the flash: the transfers holding other bytes than 0xFF
+ *  \param[in] transfer_size the segments are made of transfers of this size, from the start of the image
+ */
+inline std::vector<segment> populated_segments(const uint8_t *data, size_t length, uint16_t transfer_size)
+{
+	std::vector<segment> segments;
+	for (size_t offset = 0; transfer_size && offset < length; offset += transfer_size) {
+		const size_t chunk = std::min<size_t>(transfer_size, length - offset);
+		if (std::all_of(data + offset, data + offset + chunk, [](uint8_t byte) { return 0xFF == byte; })) {
+			continue;
+		}
+		if (!segments.empty() && segments.back().offset + segments.back().length == offset) {
+			segments.back().length += chunk;
+		} else {
+			segments.push_back(segment{offset, chunk});
+		}
+	}
+	return segments;
+}
+
+/** Return a printable name for a DFU state */
+inline const char *state_name(uint8_t state)
+{
+	static const char *const names[] = {
+		"appIDLE", "appDETACH", "dfuIDLE", "dfuDNLOAD-SYNC", "dfuDNBUSY", "dfuDNLOAD-IDLE",
+		"dfuMANIFEST-SYNC", "dfuMANIFEST", "dfuMANIFEST-WAIT-RESET", "dfuUPLOAD-IDLE", "dfuERROR",
+	};
+	return state < sizeof(names) / sizeof(names[0]) ? names[state] : "unknown";
+}
+
+} // namespace dfu
+
+#endif // HOST_DFU_PROTOCOL_H
@@ -0,0 +1,115 @@
+/**
+ * \file
+ * \brief Asynchronous USB control transfer abstraction for the host tools
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_DFU_TRANSPORT_H
+#define HOST_DFU_TRANSPORT_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dfu {
+
+using clock = std::chrono::steady_clock;
+
+/** Outcome of a control transfer */
+enum class xfer_result {
+	ok,       /**< transfer completed */
+	stall,    /**< device stalled the control pipe (request refused) */
+	no_device, /**< device is gone (e.g. it reset after manifestation) */
+	error,    /**< any other transfer error */
+};
+
+/** Completion callback: result and, for IN transfers, the received data */
+using xfer_callback = std::function<void(xfer_result result, const uint8_t *data, size_t length)>;
+
+/** A DFU capable device on which asynchronous control transfers can be issued
+ *
+ *  Only one transfer should be outstanding per device since the control pipe is serialised by the device anyway.
+ */
+class device {
+public:
+	virtual ~device() = default;
+
+	/** Stable identifier of the device: the serial number if available, else the bus path */
+	virtual std::string name() const = 0;
+	/** DFU interface number */
+	virtual uint8_t interface() const = 0;
+	/** bmAttributes of the DFU functional descriptor */
+	virtual uint8_t attributes() const = 0;
+	/** wTransferSize of the DFU functional descriptor */
+	virtual uint16_t transfer_size() const = 0;
+
+	/** Submit a control OUT transfer
+	 *  \param[in] data payload to send, copied by the implementation
+	 *  \return false if the transfer could not be submitted (the callback will not be called)
+	 */
+	virtual bool control_out(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, xfer_callback cb) = 0;
+	/** Submit a control IN transfer of up to length bytes
+	 *  \return false if the transfer could not be submitted (the callback will not be called)
+	 */
+	virtual bool control_in(uint8_t request, uint16_t value, uint16_t length, xfer_callback cb) = 0;
+	/** Submit a vendor OUT transfer to the DFU interface (see vendor_request), as control_out() */
+	virtual bool vendor_out(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, xfer_callback cb) = 0;
+	/** Submit a vendor IN transfer to the DFU interface (see vendor_request), as control_in() */
+	virtual bool vendor_in(uint8_t request, uint16_t value, uint16_t length, xfer_callback cb) = 0;
+
+	/** Backend specific information to print at the end of a session (e.g. counters of simulated devices) */
+	virtual std::string diagnostics() const { return std::string(); }
+};
+
+/** A bus on which DFU devices are discovered and transfer completions are processed */
+class bus {
+public:
+	virtual ~bus() = default;
+
+	/** Find and open all DFU mode devices matching the USB IDs */
+	virtual std::vector<std::unique_ptr<device>> discover(uint16_t vid, uint16_t pid) = 0;
+	/** Process transfer completions, returning at the latest at the deadline
+	 *
+	 *  Completion callbacks are called from within this function.
+	 */
+	virtual void handle_events(clock::time_point deadline) = 0;
+};
+
+#ifdef HAVE_LIBUSB
+/** Create a bus backed by libusb asynchronous transfers */
+std::unique_ptr<bus> make_libusb_bus();
+#endif
+
+/** Parameters of the simulated devices */
+struct sim_params {
+	unsigned devices = 1; /**< number of simulated devices */
+	uint32_t poll_timeout_ms = 10; /**< bwPollTimeout reported in GETSTATUS */
+	uint32_t xfer_latency_us = 1000; /**< time for a control transfer to complete */
+	uint32_t page_write_us = 2500; /**< time to write a 512 bytes page */
+	uint32_t block_erase_us = 6000; /**< time to erase a 8 KB block */
+	uint32_t flash_size = 1024 * 1024; /**< size of the application region */
+};
+
+/** Create a bus with simulated devices implementing the bootloader DFU state machine */
+std::unique_ptr<bus> make_sim_bus(const sim_params &params);
+
+} // namespace dfu
+
+#endif // HOST_DFU_TRANSPORT_H
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Set up a USB gadget with a FunctionFS function on dummy_hcd, for osmo-dfu-ffs
+#
+# Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+#
+# usage: ffs-gadget.sh up|bind|down
+#   up    load dummy_hcd, create the gadget and mount its FunctionFS instance on $FFS_DIR
+#   bind  attach the gadget to the dummy UDC, once osmo-dfu-ffs wrote the descriptors
+#   down  detach and remove the gadget
+# The device descriptor (IDs and strings) is taken from config/usbd_config.h for $BOARD.
+set -e
+
+BOARD=${BOARD:-SAME54_XPLAINED_PRO}
+FFS_DIR=${FFS_DIR:-/dev/ffs-osmo-dfu}
+GADGET=/sys/kernel/config/usb_gadget/osmo-dfu
+CONFIG_DIR=$(dirname "$0")/../config
+
+# print the values of the given usbd_config.h macros
+usbd_config() {
+	printf '#include "usbd_config.h"\n%s\n' "$*" | ${CC:-cc} -E -P -D"$BOARD" -I"$CONFIG_DIR" -x c - | tail -n 1
+}
+
+case "$1" in
+up)
+	modprobe dummy_hcd
+	modprobe libcomposite
+	mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+	set -- $(usbd_config CONF_USB_OPENMOKO_IDVENDOR CONF_USB_OSMOASF4DFU_IDPRODUCT CONF_USB_DFUD_BCDDEVICE)
+	mkdir "$GADGET"
+	echo "$1" > "$GADGET/idVendor"
+	echo "$2" > "$GADGET/idProduct"
+	echo "$3" > "$GADGET/bcdDevice"
+	mkdir "$GADGET/strings/0x409"
+	usbd_config CONF_USB_DFUD_IMANUFACT_STR | tr -d '"' > "$GADGET/strings/0x409/manufacturer"
+	usbd_config CONF_USB_DFUD_IPRODUCT_STR | tr -d '"' > "$GADGET/strings/0x409/product"
+	mkdir "$GADGET/configs/c.1"
+	mkdir "$GADGET/functions/ffs.osmo-dfu"
+	ln -s "$GADGET/functions/ffs.osmo-dfu" "$GADGET/configs/c.1/"
+	mkdir -p "$FFS_DIR"
+	mount -t functionfs osmo-dfu "$FFS_DIR"
+	;;
+bind)
+	ls /sys/class/udc | grep -m 1 dummy_udc > "$GADGET/UDC"
+	;;
+down)
+	[ -z "$(cat "$GADGET/UDC" 2> /dev/null)" ] || echo "" > "$GADGET/UDC"
+	! mountpoint -q "$FFS_DIR" || umount "$FFS_DIR"
+	rm -f "$GADGET/configs/c.1/ffs.osmo-dfu"
+	rmdir "$GADGET/functions/ffs.osmo-dfu" "$GADGET/configs/c.1" "$GADGET/strings/0x409" "$GADGET"
+	;;
+*)
+	echo "usage: $0 up|bind|down" >&2
+	exit 1
+	;;
+esac
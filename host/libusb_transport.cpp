@@ -0,0 +1,258 @@
+/**
+ * \file
+ * \brief DFU devices accessed through libusb asynchronous transfers
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <libusb.h>
+
+#include "dfu_protocol.h"
+#include "dfu_transport.h"
+
+namespace dfu {
+
+namespace {
+
+/** Timeout of a single control transfer, in milliseconds */
+constexpr unsigned int xfer_timeout_ms = 5000;
+
+/** Upper bound for a single wait in handle_events(), so that a missed deadline does not hang the loop */
+constexpr long max_wait_us = 1000000;
+
+class libusb_dfu_device : public device {
+public:
+	libusb_dfu_device(libusb_device_handle *handle, const std::string &name, uint8_t iface, uint8_t attributes,
+	                  uint16_t transfer_size)
+		: _handle(handle), _name(name), _iface(iface), _attributes(attributes), _transfer_size(transfer_size)
+	{
+	}
+
+	~libusb_dfu_device() override
+	{
+		libusb_release_interface(_handle, _iface); // fails harmlessly if the device already reset
+		libusb_close(_handle);
+	}
+
+	std::string name() const override { return _name; }
+	uint8_t interface() const override { return _iface; }
+	uint8_t attributes() const override { return _attributes; }
+	uint16_t transfer_size() const override { return _transfer_size; }
+
+	bool control_out(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, xfer_callback cb) override
+	{
+		return submit(request_type_out, request, value, data, length, cb);
+	}
+
+	bool control_in(uint8_t request, uint16_t value, uint16_t length, xfer_callback cb) override
+	{
+		return submit(request_type_in, request, value, nullptr, length, cb);
+	}
+
+	bool vendor_out(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, xfer_callback cb) override
+	{
+		return submit(vendor_request_type_out, request, value, data, length, cb);
+	}
+
+	bool vendor_in(uint8_t request, uint16_t value, uint16_t length, xfer_callback cb) override
+	{
+		return submit(vendor_request_type_in, request, value, nullptr, length, cb);
+	}
+
+private:
+	bool submit(uint8_t request_type, uint8_t request, uint16_t value, const uint8_t *data, uint16_t length,
+	            const xfer_callback &cb);
+	static void LIBUSB_CALL on_transfer(struct libusb_transfer *transfer);
+
+	libusb_device_handle *_handle;
+	std::string _name;
+	uint8_t _iface;
+	uint8_t _attributes;
+	uint16_t _transfer_size;
+};
+
+bool libusb_dfu_device::submit(uint8_t request_type, uint8_t request, uint16_t value, const uint8_t *data,
+                               uint16_t length, const xfer_callback &cb)
+{
+	struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+	if (!transfer) {
+		return false;
+	}
+	// libusb frees the buffer with free() because of LIBUSB_TRANSFER_FREE_BUFFER
+	unsigned char *buffer = (unsigned char *)std::malloc(LIBUSB_CONTROL_SETUP_SIZE + length);
+	if (!buffer) {
+		libusb_free_transfer(transfer);
+		return false;
+	}
+	libusb_fill_control_setup(buffer, request_type, request, value, _iface, length);
+	if (data && length) {
+		std::memcpy(buffer + LIBUSB_CONTROL_SETUP_SIZE, data, length);
+	}
+	xfer_callback *context = new xfer_callback(cb);
+	libusb_fill_control_transfer(transfer, _handle, buffer, on_transfer, context, xfer_timeout_ms);
+	transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+	if (LIBUSB_SUCCESS != libusb_submit_transfer(transfer)) {
+		delete context;
+		libusb_free_transfer(transfer); // also frees the buffer
+		return false;
+	}
+	return true;
+}
+
+void LIBUSB_CALL libusb_dfu_device::on_transfer(struct libusb_transfer *transfer)
+{
+	xfer_callback *context = static_cast<xfer_callback *>(transfer->user_data);
+	xfer_result result;
+	switch (transfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		result = xfer_result::ok;
+		break;
+	case LIBUSB_TRANSFER_STALL:
+		result = xfer_result::stall;
+		break;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		result = xfer_result::no_device;
+		break;
+	default:
+		result = xfer_result::error;
+		break;
+	}
+	(*context)(result, libusb_control_transfer_get_data(transfer), (size_t)transfer->actual_length);
+	delete context;
+}
+
+class libusb_bus : public bus {
+public:
+	libusb_bus()
+	{
+		if (LIBUSB_SUCCESS != libusb_init(&_ctx)) {
+			throw std::runtime_error("could not initialize libusb");
+		}
+	}
+
+	~libusb_bus() override { libusb_exit(_ctx); }
+
+	std::vector<std::unique_ptr<device>> discover(uint16_t vid, uint16_t pid) override;
+
+	void handle_events(clock::time_point deadline) override
+	{
+		long wait_us = max_wait_us;
+		clock::time_point now = clock::now();
+		if (deadline <= now) {
+			wait_us = 0;
+		} else if (deadline - now < std::chrono::microseconds(max_wait_us)) {
+			wait_us = (long)std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+		}
+		struct timeval tv = {wait_us / 1000000, wait_us % 1000000};
+		libusb_handle_events_timeout_completed(_ctx, &tv, nullptr);
+	}
+
+private:
+	libusb_context *_ctx = nullptr;
+};
+
+/** Identify a device by its serial number, or by its bus path if it has none */
+std::string device_name(libusb_device *dev, libusb_device_handle *handle, const struct libusb_device_descriptor &desc)
+{
+	if (desc.iSerialNumber) {
+		unsigned char serial[256];
+		int rc = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial));
+		if (rc > 0) {
+			return std::string((const char *)serial, (size_t)rc);
+		}
+	}
+	uint8_t ports[8];
+	int depth = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	std::string name = std::to_string(libusb_get_bus_number(dev)) + "-";
+	for (int i = 0; i < depth; i++) {
+		name += (i ? "." : "") + std::to_string(ports[i]);
+	}
+	return name;
+}
+
+std::vector<std::unique_ptr<device>> libusb_bus::discover(uint16_t vid, uint16_t pid)
+{
+	std::vector<std::unique_ptr<device>> devices;
+	libusb_device **list;
+	ssize_t count = libusb_get_device_list(_ctx, &list);
+	for (ssize_t i = 0; i < count; i++) {
+		struct libusb_device_descriptor desc;
+		if (LIBUSB_SUCCESS != libusb_get_device_descriptor(list[i], &desc)) {
+			continue;
+		}
+		if (desc.idVendor != vid || desc.idProduct != pid) {
+			continue;
+		}
+		struct libusb_config_descriptor *config;
+		if (LIBUSB_SUCCESS != libusb_get_config_descriptor(list[i], 0, &config)) {
+			continue;
+		}
+		// find the DFU mode interface and its functional descriptor
+		int iface = -1;
+		uint8_t attributes = 0;
+		uint16_t transfer_size = 0;
+		for (uint8_t j = 0; j < config->bNumInterfaces && iface < 0; j++) {
+			const struct libusb_interface_descriptor *alt = &config->interface[j].altsetting[0];
+			if (0xFE != alt->bInterfaceClass || 0x01 != alt->bInterfaceSubClass || 0x02 != alt->bInterfaceProtocol) {
+				continue;
+			}
+			for (int k = 0; k + 7 <= alt->extra_length; k += alt->extra[k]) {
+				if (0 == alt->extra[k]) {
+					break; // malformed descriptor
+				}
+				if (func_desc_type == alt->extra[k + 1]) {
+					attributes = alt->extra[k + 2];
+					transfer_size = (uint16_t)(alt->extra[k + 5] | (alt->extra[k + 6] << 8));
+					iface = alt->bInterfaceNumber;
+					break;
+				}
+			}
+		}
+		libusb_free_config_descriptor(config);
+		if (iface < 0) {
+			continue;
+		}
+
+		libusb_device_handle *handle;
+		if (LIBUSB_SUCCESS != libusb_open(list[i], &handle)) {
+			continue;
+		}
+		libusb_set_auto_detach_kernel_driver(handle, 1);
+		if (LIBUSB_SUCCESS != libusb_claim_interface(handle, iface)) {
+			libusb_close(handle);
+			continue;
+		}
+		devices.emplace_back(new libusb_dfu_device(handle, device_name(list[i], handle, desc), (uint8_t)iface,
+		                                           attributes, transfer_size));
+	}
+	if (count >= 0) {
+		libusb_free_device_list(list, 1);
+	}
+	return devices;
+}
+
+} // namespace
+
+std::unique_ptr<bus> make_libusb_bus()
+{
+	return std::unique_ptr<bus>(new libusb_bus());
+}
+
+} // namespace dfu
@@ -0,0 +1,1786 @@
+/**
+ * \file
+ * \brief Throughput benchmark of the whole DFU download path
+ *
+ * The bootloader sources (DFU class, USB device stack, usb_start.c main loop, flash HAL and NVMCTRL HPL)
+ * are built for the host and run against timed NVMCTRL and USB models (see host/port).
+ * With the QSPI enabled in the bootloader configuration, the image can also be downloaded to the QSPI flash model.
+ * With AES enabled, the image can be encrypted, the bootloader decrypting it with the software implementation.
+ * A virtual USB host enumerates the device and downloads synthetic images as dfu-util would.
+ * With the UF2 mass storage interface enabled, the host can instead copy the image as a UF2 file to the virtual volume,
+ * as a file manager would, writing the blocks in order, shuffled or with duplicates.
+ * Each session runs in its own process so that it starts from a freshly booted bootloader.
+ * An interrupted download (power loss) can be run first in another process, the flash, user row and SmartEEPROM being shared.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "dfu_protocol.h"
+
+#include "hal_flash.h" // first, for the register interface used by hal_cache.h
+#include "hal_cache.h"
+#include "hpl_aes.h"
+#include "hpl_cmcc_config.h"
+#include "hpl_dma.h"
+#include "hpl_dma_copy.h"
+#include "hpl_dmac_config.h"
+#include "hpl_nvmctrl_config.h"
+#include "hpl_nvmctrl_geometry.h"
+#include "hpl_qspi.h"
+#include "nvm_model.h"
+#include "port.h"
+#include "qspi_model.h"
+#include "usb_model.h"
+#include "mscdf.h"
+#include "usb_start.h"
+
+/* from driver_init.h, which can not be included with unistd.h since hal_sleep.h declares sleep() */
+extern "C" struct flash_descriptor FLASH_0;
+extern "C" struct _qspi_sync_dev QSPI_INSTANCE;
+#if CONF_AES_ENABLE
+extern "C" struct _aes_sync_device CRYPTOGRAPHY_0;
+#endif
+
+namespace {
+
+/** Synthetic image content */
+enum class pattern {
+	random,    /**< random data, the flash holds a different random image */
+	ff,        /**< one page in 8 holds random data, the rest is 0xFF; the flash is erased */
+	unchanged, /**< one page in 16 differs from the image already in flash */
+	patch,     /**< one block in 8 differs from the image already in flash */
+	sparse,    /**< code in the first eighth and a table in the last block, 0xFF in between; the flash holds a different random image */
+};
+
+const char *pattern_name(pattern p)
+{
+	switch (p) {
+	case pattern::random:
+		return "random";
+	case pattern::ff:
+		return "ff";
+	case pattern::unchanged:
+		return "unchanged";
+	case pattern::patch:
+		return "patch";
+	case pattern::sparse:
+		return "sparse";
+	}
+	return "unknown";
+}
+
+/** Encryption of the downloaded image */
+enum class encryption {
+	off,
+	ctr, /**< AES-CTR */
+	gcm, /**< AES-GCM, the tag being checked at manifestation */
+};
+
+const char *const encryption_names[] = {"off", "ctr", "gcm"};
+
+/** NVMCTRL write modes (CTRLA.WMODE) */
+const char *const wmode_names[] = {"man", "adw", "aqw", "ap"};
+
+/** Protocol used by the host to download the image */
+enum class protocol {
+	dfu, /**< DFU requests on the control endpoint */
+	uf2, /**< UF2 file copied to the mass storage interface */
+	dfuse, /**< DfuSe commands erasing the flash, then DFU requests for the populated segments of the image only */
+};
+
+const char *const protocol_names[] = {"dfu", "uf2", "dfuse"};
+
+/** Order in which the UF2 blocks are written */
+enum class uf2_order {
+	sequential, /**< as a file copy */
+	shuffled,   /**< bursts in a random order */
+	duplicates, /**< sequential, every fourth burst being followed by the previous one again */
+};
+
+const char *const uf2_order_names[] = {"sequential", "shuffled", "duplicates"};
+
+/** Benchmark configuration */
+struct bench_params {
+	struct nvm_model_params nvm;
+	struct usb_model_params usb;
+	struct qspi_model_params qspi;
+	bool target_qspi;      /**< download to the QSPI flash (second alternate setting), else to the internal flash */
+	uint32_t seed;
+	uint8_t wmode;         /**< NVMCTRL write mode, set after flash_init() */
+	bool suspend;          /**< NVMCTRL erase and write suspend (CTRLA.SUSPEN), set after flash_init() */
+	bool cache;            /**< CMCC enabled by system_init() */
+	bool dma;              /**< DMAC copy service enabled by system_init() */
+	uint32_t access_cycles; /**< estimated CPU cycles of an NVMCTRL register access */
+	uint32_t load_cycles;   /**< estimated CPU cycles to load a word in the page buffer */
+	uint32_t dma_setup_cycles; /**< estimated CPU cycles to set up a DMAC copy and see it complete */
+	uint32_t dma_beat_cycles;  /**< estimated cycles of the DMAC to copy a 32-bit word */
+	uint32_t cpu_mhz;       /**< CPU frequency of the clock profile, for the estimate */
+	uint32_t interrupt;     /**< percentage of the image after which a first download is interrupted, 0 for none */
+	encryption encrypt;
+	uint32_t decrypt_hw_cycles; /**< estimated CPU cycles to decrypt a 16-byte block with the AES peripheral */
+	uint32_t decrypt_sw_cycles; /**< estimated CPU cycles to decrypt a 16-byte block with the software implementation */
+	protocol proto;
+	uf2_order order;
+	uint32_t uf2_burst; /**< sectors written by a WRITE(10) command */
+};
+
+/** Outcome of a download session, passed from the session process to the parent */
+struct session_result {
+	bool ok;
+	bool verified; /**< the flash holds the image after the session */
+	char error[96];
+	uint32_t transfer_size; /**< DFU transfer size, or bytes of a WRITE(10) command */
+	uint64_t time_ns; /**< from the end of the enumeration to the reset after manifestation */
+	uint32_t block_erases;
+	uint32_t page_writes;
+	uint32_t page_buffer_clears;
+	uint32_t nvm_commands;
+	uint32_t status_reads;
+	uint32_t buffer_loads;
+	uint64_t nvm_busy_ns;
+	uint32_t suspends;
+	uint32_t control_transfers;
+	uint32_t status_polls;
+	uint64_t max_response_ns; /**< longest time from issuing a DFU request to its completion */
+	uint64_t skipped_bytes; /**< bytes not downloaded since the device already held them (interrupted download or unchanged blocks), or erased (DfuSe) */
+	uint32_t user_row_erases;
+	uint32_t see_writes;  /**< words written in the SmartEEPROM (resume record) */
+	uint32_t sleeps;      /**< sleeps of the main loop ended by an interrupt */
+	uint64_t sleep_ns;    /**< time the main loop slept */
+	uint64_t wake_ns;     /**< total time from the waking interrupts to their handlers running */
+	uint64_t wake_max_ns; /**< longest of these wake-to-service latencies */
+	uint32_t cache_hits;  /**< interrupts whose handler was in the CMCC */
+	uint32_t cache_invalidations;
+	uint32_t stale_cache; /**< flash erases and writes not followed by a CMCC invalidation once completed */
+	uint32_t dma_transactions; /**< copies done by the DMAC */
+	uint64_t dma_bytes;
+	uint32_t dma_buffer_loads; /**< page buffer words loaded by the DMAC */
+	uint32_t qspi_erases; /**< sector and block erases of the QSPI flash */
+	uint32_t qspi_page_programs;
+	uint64_t qspi_busy_ns;
+	uint32_t qspi_errors; /**< commands ignored by the QSPI flash */
+	uint32_t bulk_transfers; /**< transfers of the host on the bulk endpoints */
+	uint64_t bulk_bytes;
+	uint64_t dnload_bytes; /**< bytes sent in DNLOAD requests, DfuSe commands included */
+};
+
+/** Address of the application once started (in the active bank for dual-bank updates) */
+uint32_t application_start(const bench_params &params)
+{
+	return (15 - params.nvm.bootprot) * NVMCTRL_BLOCK_SIZE;
+}
+
+/** USB host downloading an image, acting as the interrupt source of the host port */
+class bench_host {
+public:
+	virtual ~bench_host() = default;
+
+	/** Enumerate and configure the device, as the host stack does when the device attaches */
+	virtual bool enumerate() = 0;
+	/** Model time of the next request, PORT_TIME_NEVER while there is none to issue */
+	virtual uint64_t due() const { return _done ? PORT_TIME_NEVER : _due; }
+	/** Issue the next request */
+	virtual void run() = 0;
+
+	bool done() const { return _done; }
+	bool failed() const { return !_error.empty(); }
+	const std::string &error() const { return _error; }
+	/** The download completed and the device is manifesting or resetting */
+	bool manifesting() const { return _manifest; }
+	uint32_t transfer_size() const { return _transfer_size; }
+	uint64_t start_ns() const { return _start_ns; }
+	uint32_t status_polls() const { return _status_polls; }
+	uint64_t max_response_ns() const { return _max_response_ns; }
+	uint64_t skipped_bytes() const { return _skipped_bytes; }
+	uint64_t dnload_bytes() const { return _dnload_bytes; }
+
+	static const struct port_irq_source irq_source;
+
+protected:
+	enum usb_model_result control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, uint8_t *data,
+	                              uint16_t length, uint16_t *received = nullptr);
+	void fail(const std::string &error);
+	/** Reset the device, set its address and read its whole configuration descriptor */
+	bool get_configuration(std::vector<uint8_t> &config);
+	/** Select the configuration */
+	bool set_configuration(uint8_t value);
+
+	uint32_t _transfer_size = 0;
+	bool _manifest = false;
+	bool _done = false;
+	std::string _error;
+	uint64_t _due = 0;
+	uint64_t _start_ns = 0;
+	uint32_t _status_polls = 0;
+	uint64_t _max_response_ns = 0;
+	uint64_t _skipped_bytes = 0;
+	uint64_t _dnload_bytes = 0;
+};
+
+const struct port_irq_source bench_host::irq_source = {
+	[](void *context) { return static_cast<bench_host *>(context)->due(); },
+	[](void *context) { static_cast<bench_host *>(context)->run(); },
+	nullptr,
+	-1,
+};
+
+enum usb_model_result bench_host::control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                                          uint8_t *data, uint16_t length, uint16_t *received)
+{
+	const uint8_t setup[8] = {request_type, request, (uint8_t)value, (uint8_t)(value >> 8),
+	                          (uint8_t)index, (uint8_t)(index >> 8), (uint8_t)length, (uint8_t)(length >> 8)};
+	return usb_model_control(setup, data, received);
+}
+
+void bench_host::fail(const std::string &error)
+{
+	_error = error;
+	_done = true;
+}
+
+bool bench_host::get_configuration(std::vector<uint8_t> &config)
+{
+	uint8_t desc[512];
+	uint16_t length;
+
+	if (!usb_model_bus_reset()) {
+		fail("device did not attach");
+		return false;
+	}
+	if (USB_MODEL_OK != control(0x80, USB_REQ_GET_DESC, USB_DT_DEVICE << 8, 0, desc, 18, &length) || length != 18) {
+		fail("GET_DESCRIPTOR(device) failed");
+		return false;
+	}
+	if (USB_MODEL_OK != control(0x00, USB_REQ_SET_ADDRESS, 1, 0, nullptr, 0)) {
+		fail("SET_ADDRESS failed");
+		return false;
+	}
+	if (USB_MODEL_OK != control(0x80, USB_REQ_GET_DESC, USB_DT_CONFIG << 8, 0, desc, 9, &length) || length != 9) {
+		fail("GET_DESCRIPTOR(configuration) failed");
+		return false;
+	}
+	const uint16_t total = (uint16_t)(desc[2] | (desc[3] << 8));
+	if (total > sizeof(desc) || USB_MODEL_OK != control(0x80, USB_REQ_GET_DESC, USB_DT_CONFIG << 8, 0, desc, total, &length)
+	    || length != total) {
+		fail("GET_DESCRIPTOR(configuration) failed");
+		return false;
+	}
+	config.assign(desc, desc + length);
+	return true;
+}
+
+bool bench_host::set_configuration(uint8_t value)
+{
+	if (USB_MODEL_OK != control(0x00, USB_REQ_SET_CONFIG, value, 0, nullptr, 0)) {
+		fail("SET_CONFIGURATION failed");
+		return false;
+	}
+	return true;
+}
+
+/** USB host downloading an image using the DFU protocol */
+class virtual_host : public bench_host {
+public:
+	/** \param[in] alt alternate setting of the DFU interface to download to
+	 *  \param[in] stop_after the host disappears once this many bytes are downloaded, as on a power loss */
+	explicit virtual_host(const std::vector<uint8_t> &image, uint8_t alt = 0, size_t stop_after = SIZE_MAX)
+		: _image(image), _alt(alt), _stop_after(stop_after)
+	{
+	}
+
+	bool enumerate() override;
+	void run() override;
+	/** Only download the populated segments of the image, with DfuSe commands
+	 *  \param[in] address address of the image in flash
+	 *  \param[in] mass_erase erase the whole application region, else the blocks of the image */
+	void dfuse(uint32_t address, bool mass_erase);
+
+private:
+	/** DNLOAD request of a DfuSe session */
+	struct dfuse_step {
+		uint16_t block; /**< wValue: 0 for a command, else the data block at offset */
+		std::vector<uint8_t> command;
+		size_t offset; /**< of the data block in the image */
+	};
+
+	void resume();
+	void download();
+	void dfuse_download();
+	void get_status();
+
+	const std::vector<uint8_t> &_image;
+	const uint8_t _alt;
+	const size_t _stop_after;
+	uint8_t _interface = 0;
+	size_t _offset = 0;
+	uint16_t _block = 0;
+	unsigned _resume_step = 0; /**< next request 0: GET_RESUME, 1: SET_IMAGE, 2: SET_BLOCK_CRCS, 3: GET_RESUME, 4: the download */
+	dfu::resume_info _resume_info{}; /**< blocks of the image kept by the device */
+	uint16_t _block_size = 0; /**< size of the blocks tracked by the device */
+	bool _status_next = false; /**< next request is GETSTATUS, else DNLOAD */
+	bool _dfuse = false;
+	uint32_t _address = 0; /**< of the image in flash, for DfuSe */
+	bool _mass_erase = false;
+	std::vector<dfuse_step> _steps; /**< requests of the DfuSe session, planned once the transfer size is known */
+	size_t _step = 0;
+};
+
+void virtual_host::dfuse(uint32_t address, bool mass_erase)
+{
+	_dfuse = true;
+	_address = address;
+	_mass_erase = mass_erase;
+}
+
+bool virtual_host::enumerate()
+{
+	std::vector<uint8_t> desc;
+
+	if (!get_configuration(desc)) {
+		return false;
+	}
+	const size_t length = desc.size();
+	bool alt_found = false;
+	bool dfu_interface = false;
+	for (size_t i = 0; i + 1 < length && desc[i]; i += desc[i]) {
+		if (USB_DT_INTERFACE == desc[i + 1] && i + 7 < length) {
+			dfu_interface = (0xFE == desc[i + 5] && 0x01 == desc[i + 6] && 0x02 == desc[i + 7]); // DFU mode, as dfu-util
+			if (dfu_interface) {
+				_interface = desc[i + 2];
+				alt_found = alt_found || desc[i + 3] == _alt;
+			}
+		} else if (dfu_interface && dfu::func_desc_type == desc[i + 1] && i + 7 <= length) {
+			_transfer_size = (uint16_t)(desc[i + 5] | (desc[i + 6] << 8));
+		}
+	}
+	if (0 == _transfer_size) {
+		fail("no DFU functional descriptor");
+		return false;
+	}
+	if (!alt_found) {
+		fail("no alternate setting " + std::to_string(_alt));
+		return false;
+	}
+	if (!set_configuration(desc[5])) {
+		return false;
+	}
+	if (_alt && USB_MODEL_OK != control(0x01, USB_REQ_SET_INTERFACE, _alt, _interface, nullptr, 0)) {
+		fail("SET_INTERFACE failed");
+		return false;
+	}
+	if (_dfuse) { // erase, as dfu-util does before writing, then set the address of each segment and send its blocks
+		if (_mass_erase) {
+			_steps.push_back(dfuse_step{0, std::vector<uint8_t>{dfu::ERASE}, 0});
+		} else {
+			for (uint32_t block = _address & ~(NVMCTRL_BLOCK_SIZE - 1); block < _address + _image.size(); block += NVMCTRL_BLOCK_SIZE) {
+				_steps.push_back(dfuse_step{0, dfu::dfuse_request(dfu::ERASE, block), 0});
+			}
+		}
+		_skipped_bytes = _image.size(); // the holes are erased, not downloaded
+		for (const dfu::segment &seg : dfu::populated_segments(_image.data(), _image.size(), (uint16_t)_transfer_size)) {
+			_skipped_bytes -= seg.length;
+			_steps.push_back(dfuse_step{0, dfu::dfuse_request(dfu::SET_ADDRESS, _address + (uint32_t)seg.offset), 0});
+			for (size_t offset = 0; offset < seg.length; offset += _transfer_size) {
+				_steps.push_back(dfuse_step{(uint16_t)(dfu::dfuse_first_block + offset / _transfer_size), {}, seg.offset + offset});
+			}
+		}
+		_resume_step = 4; // resumable downloads need the whole image
+	}
+	_start_ns = port_time_ns;
+	_due = port_time_ns;
+	return true;
+}
+
+void virtual_host::run()
+{
+	const uint64_t issued = _due; // the interrupt is served late if the device can't fetch its handler
+	if (_resume_step < 4) {
+		resume();
+	} else if (_status_next) {
+		get_status();
+	} else if (_dfuse) {
+		dfuse_download();
+	} else {
+		download();
+	}
+	_max_response_ns = std::max<uint64_t>(_max_response_ns, port_time_ns - issued);
+}
+
+void virtual_host::resume()
+{
+	const dfu::image_id id = dfu::image_id::of(_image.data(), _image.size());
+	uint8_t buf[dfu::resume_info_length];
+	uint16_t length;
+	enum usb_model_result rc;
+
+	switch (_resume_step) {
+	case 0:
+	case 3:
+		rc = control(dfu::vendor_request_type_in, dfu::GET_RESUME, 0, _interface, buf, sizeof(buf), &length);
+		if (USB_MODEL_STALL == rc && 0 == _resume_step) { // resumable downloads are not enabled
+			_resume_step = 4;
+		} else if (USB_MODEL_OK != rc || length != dfu::resume_info_length) {
+			fail("GET_RESUME failed");
+			return;
+		} else {
+			const dfu::resume_info info = dfu::resume_info::parse(buf);
+			if (info.bPending) { // ask again later, as osmo-dfu-flash: every request interrupts the device
+				_due = port_time_ns + dfu::pending_poll_ms * 1000000ULL;
+				return;
+			}
+			if (info.image == id) {
+				_resume_info = info;
+			}
+			_block_size = info.wBlockSize;
+			_resume_step++;
+		}
+		break;
+	case 1:
+		id.serialize(buf);
+		if (USB_MODEL_OK != control(dfu::vendor_request_type_out, dfu::SET_IMAGE, 0, _interface, buf, dfu::image_id_length)) {
+			fail("SET_IMAGE failed");
+			return;
+		}
+		_resume_step = 2;
+		break;
+	case 2: {
+		std::vector<uint8_t> crcs = dfu::block_crcs(_image.data(), _image.size(), _block_size);
+		rc = crcs.empty() ? USB_MODEL_STALL
+		                  : control(dfu::vendor_request_type_out, dfu::SET_BLOCK_CRCS, 0, _interface, crcs.data(), (uint16_t)crcs.size());
+		if (USB_MODEL_STALL == rc) { // the blocks in flash are not checked
+			_resume_step = 4;
+		} else if (USB_MODEL_OK != rc) {
+			fail("SET_BLOCK_CRCS failed");
+			return;
+		} else {
+			_resume_step = 3;
+		}
+		break;
+	}
+	}
+	_due = port_time_ns;
+}
+
+void virtual_host::download()
+{
+	while (_offset < _image.size()) { // skip the data the device kept
+		const size_t skip = std::min<size_t>(_transfer_size, _image.size() - _offset);
+		if (!_resume_info.done(_offset) || !_resume_info.done(_offset + skip - 1)) {
+			break;
+		}
+		_offset += skip;
+		_skipped_bytes += skip;
+		_block++;
+	}
+	if (_offset >= _stop_after) { // the host is gone, and the device is about to lose power
+		_done = true;
+		return;
+	}
+	const uint16_t length = (uint16_t)std::min<size_t>(_transfer_size, _image.size() - _offset);
+	std::vector<uint8_t> chunk(_image.begin() + _offset, _image.begin() + _offset + length);
+	enum usb_model_result rc = control(dfu::request_type_out, dfu::DNLOAD, _block, _interface, chunk.data(), length);
+	if (USB_MODEL_OK != rc) {
+		fail("DNLOAD of block " + std::to_string(_block) + " failed");
+		return;
+	}
+	if (0 == length) {
+		_manifest = true;
+	}
+	_offset += length;
+	_block++;
+	_dnload_bytes += length;
+	_status_next = true;
+	_due = port_time_ns;
+}
+
+void virtual_host::dfuse_download()
+{
+	if (_step >= _steps.size()) { // the zero length download starts manifestation
+		if (USB_MODEL_OK != control(dfu::request_type_out, dfu::DNLOAD, dfu::dfuse_first_block, _interface, nullptr, 0)) {
+			fail("final DNLOAD failed");
+			return;
+		}
+		_manifest = true;
+	} else {
+		const dfuse_step &step = _steps[_step];
+		std::vector<uint8_t> data = step.command;
+		if (step.block) {
+			const size_t length = std::min<size_t>(_transfer_size, _image.size() - step.offset);
+			data.assign(_image.begin() + step.offset, _image.begin() + step.offset + length);
+		}
+		if (USB_MODEL_OK != control(dfu::request_type_out, dfu::DNLOAD, step.block, _interface, data.data(), (uint16_t)data.size())) {
+			fail(step.block ? "DNLOAD of block " + std::to_string(step.block) + " failed" : std::string("DfuSe command failed"));
+			return;
+		}
+		_dnload_bytes += data.size();
+		_step++;
+	}
+	_status_next = true;
+	_due = port_time_ns;
+}
+
+void virtual_host::get_status()
+{
+	uint8_t buf[dfu::status_length];
+	uint16_t length;
+	enum usb_model_result rc = control(dfu::request_type_in, dfu::GETSTATUS, 0, _interface, buf, sizeof(buf), &length);
+	_status_polls++;
+	if (USB_MODEL_NO_DEVICE == rc && _manifest) {
+		_done = true; // the device reset to start the application
+		return;
+	}
+	if (USB_MODEL_OK != rc || length != dfu::status_length) {
+		fail("GETSTATUS failed");
+		return;
+	}
+	const dfu::status st = dfu::status::parse(buf);
+	if (st.bStatus || dfu::DFU_ERROR == st.bState) {
+		fail(std::string("device reported error status ") + std::to_string(st.bStatus) + " in "
+		     + dfu::state_name(st.bState));
+		return;
+	}
+	switch (st.bState) {
+	case dfu::DFU_DNLOAD_IDLE:
+		_status_next = false;
+		_due = port_time_ns;
+		break;
+	case dfu::DFU_IDLE:
+		if (_manifest) {
+			_done = true; // manifestation tolerant device completed
+			return;
+		}
+		fail("unexpected dfuIDLE state");
+		break;
+	case dfu::DFU_DNLOAD_SYNC:
+	case dfu::DFU_DNBUSY:
+	case dfu::DFU_MANIFEST_SYNC:
+	case dfu::DFU_MANIFEST:
+	case dfu::DFU_MANIFEST_WAIT_RESET:
+		_due = port_time_ns + (uint64_t)st.bwPollTimeout * 1000000;
+		break;
+	default:
+		fail(std::string("unexpected state ") + dfu::state_name(st.bState));
+		break;
+	}
+}
+
+/** USB host copying the image as a UF2 file to the mass storage interface, as a file manager does */
+class uf2_host : public bench_host {
+public:
+	/** \param[in] start address of the application, where the image is written
+	 *  \param[in] burst sectors written by a WRITE(10) command */
+	uf2_host(const std::vector<uint8_t> &image, uint32_t start, uf2_order order, uint32_t burst, uint32_t seed)
+		: _image(image), _start(start), _order(order), _burst(burst), _seed(seed)
+	{
+		_transfer_size = burst * MSCDF_BLOCK_SIZE;
+	}
+
+	bool enumerate() override;
+	uint64_t due() const override;
+	void run() override;
+
+private:
+	/** What the completion of a command is checked for */
+	enum class kind { inquiry, capacity, ready, boot_sector, root_directory, metadata, blocks };
+	/** SCSI command, with its data stage */
+	struct command {
+		kind what;
+		uint8_t cdb[10];
+		uint8_t cdb_length;
+		bool in;
+		std::vector<uint8_t> data; /**< data to write, or buffer for the data read */
+		bool last;                 /**< the command writes the last of the UF2 blocks not written yet */
+	};
+	/** Stage of the Bulk-Only Transport */
+	enum class stage { cbw, data, csw };
+
+	void queue(kind what, uint8_t opcode, uint32_t lba, uint32_t length, bool in);
+	void queue_file();
+	bool check(const command &c);
+	bool transferred(enum usb_model_result rc, uint8_t ep);
+	bool clear_halt(uint8_t ep);
+
+	const std::vector<uint8_t> &_image;
+	const uint32_t _start;
+	const uf2_order _order;
+	const uint32_t _burst;
+	const uint32_t _seed;
+	uint8_t _interface = 0;
+	uint8_t _ep_in = 0;
+	uint8_t _ep_out = 0;
+	uint32_t _sectors = 0; /**< of the volume */
+	uint32_t _root = 0;    /**< first sector of the root directory */
+	std::vector<uint8_t> _root_sector;
+	std::vector<command> _commands;
+	size_t _current = 0;
+	stage _stage = stage::cbw;
+	uint32_t _offset = 0; /**< in the data stage */
+	bool _first = true;   /**< next transaction starts a transfer of the host */
+	uint8_t _wait_ep = 0; /**< the host retries once the device armed this endpoint */
+	uint32_t _tag = 1;
+	uint64_t _issued = 0; /**< time the command was issued */
+};
+
+bool uf2_host::enumerate()
+{
+	std::vector<uint8_t> desc;
+	uint8_t lun = 0xFF;
+	uint16_t length;
+
+	if (!get_configuration(desc)) {
+		return false;
+	}
+	bool msc_interface = false;
+	for (size_t i = 0; i + 1 < desc.size() && desc[i]; i += desc[i]) {
+		if (USB_DT_INTERFACE == desc[i + 1] && i + 7 < desc.size()) {
+			msc_interface = (USB_MSC_CLASS == desc[i + 5] && USB_MSC_SUBCLASS_SCSI == desc[i + 6]
+			                 && USB_MSC_PROTOCOL_BULK == desc[i + 7]);
+			if (msc_interface) {
+				_interface = desc[i + 2];
+			}
+		} else if (msc_interface && USB_DT_ENDPOINT == desc[i + 1] && i + 3 < desc.size()
+		           && USB_EP_XTYPE_BULK == (desc[i + 3] & USB_EP_XTYPE_MASK)) {
+			if (desc[i + 2] & USB_EP_DIR) {
+				_ep_in = desc[i + 2];
+			} else {
+				_ep_out = desc[i + 2];
+			}
+		}
+	}
+	if (0 == _ep_in || 0 == _ep_out) {
+		fail("no mass storage interface");
+		return false;
+	}
+	if (!set_configuration(desc[5])) {
+		return false;
+	}
+	if (USB_MODEL_OK != control(0xA1, USB_REQ_MSC_GET_MAX_LUN, 0, _interface, &lun, 1, &length) || 1 != length || lun) {
+		fail("GET_MAX_LUN failed");
+		return false;
+	}
+	// as the host stack and the file system mounting the volume
+	queue(kind::inquiry, SCSI_INQUIRY, 0, 36, true);
+	queue(kind::ready, SCSI_TEST_UNIT_READY, 0, 0, false);
+	queue(kind::capacity, SCSI_READ_CAPACITY10, 0, 8, true);
+	queue(kind::boot_sector, SCSI_READ10, 0, 1, true);
+	_start_ns = port_time_ns;
+	_due = port_time_ns;
+	return true;
+}
+
+void uf2_host::queue(kind what, uint8_t opcode, uint32_t lba, uint32_t length, bool in)
+{
+	command c;
+	std::memset(c.cdb, 0, sizeof(c.cdb));
+	c.what = what;
+	c.cdb[0] = opcode;
+	c.in = in;
+	c.last = false;
+	if (SCSI_READ10 == opcode || SCSI_WRITE10 == opcode) { // length in sectors
+		c.cdb_length = 10;
+		c.cdb[2] = (uint8_t)(lba >> 24);
+		c.cdb[3] = (uint8_t)(lba >> 16);
+		c.cdb[4] = (uint8_t)(lba >> 8);
+		c.cdb[5] = (uint8_t)lba;
+		c.cdb[7] = (uint8_t)(length >> 8);
+		c.cdb[8] = (uint8_t)length;
+		length *= MSCDF_BLOCK_SIZE;
+	} else if (SCSI_READ_CAPACITY10 == opcode) {
+		c.cdb_length = 10;
+	} else {
+		c.cdb_length = 6;
+		c.cdb[4] = (uint8_t)length;
+	}
+	c.data.assign(length, 0);
+	_commands.push_back(std::move(c));
+}
+
+/** Queue the writes of the UF2 file: directory entry, then the blocks in bursts */
+void uf2_host::queue_file()
+{
+	const uint32_t blocks = (uint32_t)((_image.size() + 255) / 256);
+	const uint32_t lba = _sectors - blocks; // free clusters at the end of the volume; the device ignores where the blocks go
+
+	// the directory entry of the new file, the device ignoring what is not a UF2 block
+	static const char name[11] = {'F', 'L', 'A', 'S', 'H', ' ', ' ', ' ', 'U', 'F', '2'};
+	queue(kind::metadata, SCSI_WRITE10, _root, 1, false);
+	std::vector<uint8_t> &dir = _commands.back().data;
+	dir = _root_sector;
+	for (size_t entry = 0; entry < dir.size(); entry += 32) {
+		if (0 == dir[entry]) { // first free entry
+			std::memcpy(&dir[entry], name, sizeof(name));
+			dir[entry + 11] = 0x20; // archive
+			break;
+		}
+	}
+
+	std::vector<uint32_t> bursts;
+	for (uint32_t first = 0; first < blocks; first += _burst) {
+		bursts.push_back(first);
+	}
+	if (uf2_order::shuffled == _order) {
+		std::mt19937 rng(_seed);
+		std::shuffle(bursts.begin(), bursts.end(), rng);
+	} else if (uf2_order::duplicates == _order) {
+		std::vector<uint32_t> sequence;
+		for (size_t i = 0; i < bursts.size(); i++) {
+			sequence.push_back(bursts[i]);
+			if (3 == i % 4) {
+				sequence.push_back(bursts[i - 1]);
+			}
+		}
+		bursts = sequence;
+	}
+	std::vector<bool> written(blocks, false);
+	size_t remaining = blocks;
+	bool complete = false;
+	for (uint32_t first : bursts) {
+		const uint32_t count = std::min<uint32_t>(_burst, blocks - first);
+		queue(kind::blocks, SCSI_WRITE10, lba + first, count, false);
+		command &c = _commands.back();
+		for (uint32_t i = 0; i < count; i++) {
+			const uint32_t n = first + i;
+			const uint32_t payload = (uint32_t)std::min<size_t>(256, _image.size() - (size_t)n * 256);
+			usb_uf2_block_t block;
+			std::memset(&block, 0, sizeof(block));
+			block.dwMagicStart0 = USB_UF2_MAGIC_START0;
+			block.dwMagicStart1 = USB_UF2_MAGIC_START1;
+			block.dwFlags = USB_UF2_FLAG_FAMILY_ID;
+			block.dwTargetAddr = _start + n * 256;
+			block.dwPayloadSize = payload;
+			block.dwBlockNo = n;
+			block.dwNumBlocks = blocks;
+			block.dwFileSize = USB_UF2_FAMILY_SAMD51;
+			block.dwMagicEnd = USB_UF2_MAGIC_END;
+			std::memcpy(block.bData, &_image[(size_t)n * 256], payload);
+			std::memcpy(&c.data[i * MSCDF_BLOCK_SIZE], &block, sizeof(block));
+			if (!written[n]) {
+				written[n] = true;
+				remaining--;
+			}
+		}
+		c.last = (0 == remaining) && !complete;
+		complete = (0 == remaining);
+	}
+}
+
+bool uf2_host::check(const command &c)
+{
+	const std::vector<uint8_t> &d = c.data;
+	switch (c.what) {
+	case kind::inquiry:
+		if (0x00 != d[0] || !(d[1] & 0x80)) {
+			fail("not a removable direct access device");
+			return false;
+		}
+		break;
+	case kind::capacity:
+		_sectors = (uint32_t)((d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3]) + 1;
+		if (MSCDF_BLOCK_SIZE != ((d[4] << 24) | (d[5] << 16) | (d[6] << 8) | d[7])) {
+			fail("unexpected sector size");
+			return false;
+		}
+		break;
+	case kind::boot_sector: {
+		const uint16_t reserved = (uint16_t)(d[14] | (d[15] << 8));
+		const uint16_t fat_sectors = (uint16_t)(d[22] | (d[23] << 8));
+		if (0x55 != d[510] || 0xAA != d[511] || MSCDF_BLOCK_SIZE != (d[11] | (d[12] << 8))
+		    || (uint32_t)(d[19] | (d[20] << 8)) != _sectors || 0 != std::memcmp(&d[54], "FAT16   ", 8)) {
+			fail("invalid FAT16 boot sector");
+			return false;
+		}
+		_root = reserved + d[16] * fat_sectors;
+		queue(kind::root_directory, SCSI_READ10, _root, 1, true);
+		break;
+	}
+	case kind::root_directory: {
+		bool info = false, current = false;
+		for (size_t entry = 0; entry < d.size() && d[entry]; entry += 32) {
+			info = info || 0 == std::memcmp(&d[entry], "INFO_UF2TXT", 11);
+			current = current || 0 == std::memcmp(&d[entry], "CURRENT UF2", 11);
+		}
+		if (!info || !current) {
+			fail("INFO_UF2.TXT or CURRENT.UF2 missing in the root directory");
+			return false;
+		}
+		_root_sector = d;
+		queue_file();
+		break;
+	}
+	case kind::ready:
+	case kind::metadata:
+	case kind::blocks:
+		break;
+	}
+	return true;
+}
+
+uint64_t uf2_host::due() const
+{
+	if (_wait_ep && !_done) {
+		return usb_model_bulk_ready(_wait_ep) ? port_time_ns : PORT_TIME_NEVER;
+	}
+	return bench_host::due();
+}
+
+/** Handle the outcome of a bulk transaction: false if the host waits for the device, or the session is over */
+bool uf2_host::transferred(enum usb_model_result rc, uint8_t ep)
+{
+	switch (rc) {
+	case USB_MODEL_OK:
+		return true;
+	case USB_MODEL_NAK:
+		_wait_ep = ep;
+		return false;
+	case USB_MODEL_NO_DEVICE:
+		if (_manifest) {
+			_done = true; // the device reset to start the application
+			return false;
+		}
+		break;
+	default:
+		break;
+	}
+	fail("bulk transfer failed on endpoint " + std::to_string(ep));
+	return false;
+}
+
+/** Clear the halt of a bulk endpoint, as the host does when the device ends a data stage early or stalls the status */
+bool uf2_host::clear_halt(uint8_t ep)
+{
+	if (USB_MODEL_OK != control(0x02, USB_REQ_CLEAR_FTR, USB_EP_FTR_HALT, ep, nullptr, 0)) {
+		fail("CLEAR_FEATURE(ENDPOINT_HALT) failed");
+		return false;
+	}
+	_first = true;
+	return true;
+}
+
+void uf2_host::run()
+{
+	uint32_t count;
+	enum usb_model_result rc;
+
+	_wait_ep = 0;
+	if (_current >= _commands.size()) { // the file is written: the device resets
+		_due = PORT_TIME_NEVER;
+		return;
+	}
+	command &c = _commands[_current];
+	switch (_stage) {
+	case stage::cbw: {
+		usb_msc_cbw_t cbw;
+		std::memset(&cbw, 0, sizeof(cbw));
+		cbw.dCBWSignature = USB_MSC_CBW_SIGNATURE;
+		cbw.dCBWTag = _tag;
+		cbw.dCBWDataTransferLength = (uint32_t)c.data.size();
+		cbw.bmCBWFlags = c.in ? USB_MSC_CBW_DIR_IN : 0;
+		cbw.bCBWCBLength = c.cdb_length;
+		std::memcpy(cbw.CBWCB, c.cdb, c.cdb_length);
+		if (_first) {
+			_issued = port_time_ns;
+		}
+		rc = usb_model_bulk(_ep_out, (uint8_t *)&cbw, USB_MSC_CBW_LEN, _first, &count);
+		_first = false;
+		if (!transferred(rc, _ep_out)) {
+			return;
+		}
+		_stage = c.data.empty() ? stage::csw : stage::data;
+		_offset = 0;
+		_first = true;
+		break;
+	}
+	case stage::data: {
+		const uint8_t ep = c.in ? _ep_in : _ep_out;
+		rc = usb_model_bulk(ep, &c.data[_offset], (uint32_t)c.data.size() - _offset, _first, &count);
+		_first = false;
+		if (USB_MODEL_STALL == rc) { // the device ended the data stage early
+			if (!clear_halt(ep)) {
+				return;
+			}
+			_stage = stage::csw;
+			break;
+		}
+		if (!transferred(rc, ep)) {
+			return;
+		}
+		_offset += count;
+		if (_offset == c.data.size() || (c.in && count % CONF_USB_MSCD_BULKIN_MAXPKSZ)) { // complete, or short packet
+			_stage = stage::csw;
+			_first = true;
+		}
+		break;
+	}
+	case stage::csw: {
+		usb_msc_csw_t csw;
+		rc = usb_model_bulk(_ep_in, (uint8_t *)&csw, USB_MSC_CSW_LEN, _first, &count);
+		_first = false;
+		if (USB_MODEL_STALL == rc) { // read the status again once the halt is cleared
+			clear_halt(_ep_in);
+			break;
+		}
+		if (!transferred(rc, _ep_in)) {
+			return;
+		}
+		if (USB_MSC_CSW_LEN != count || USB_MSC_CSW_SIGNATURE != csw.dCSWSignature || _tag != csw.dCSWTag) {
+			fail("invalid command status wrapper");
+			return;
+		}
+		if (USB_MSC_CSW_PASSED != csw.bCSWStatus) {
+			fail("SCSI command " + std::to_string(c.cdb[0]) + " failed with status " + std::to_string(csw.bCSWStatus));
+			return;
+		}
+		_max_response_ns = std::max<uint64_t>(_max_response_ns, port_time_ns - _issued);
+		if (!check(_commands[_current])) { // may queue commands
+			return;
+		}
+		if (_commands[_current].last) {
+			_manifest = true;
+		}
+		std::vector<uint8_t>().swap(_commands[_current].data);
+		_current++;
+		_tag++;
+		_stage = stage::cbw;
+		_first = true;
+		break;
+	}
+	}
+	_due = port_time_ns;
+}
+
+/** Generate the flash content before the session and the image to download */
+void generate(pattern p, size_t size, uint32_t seed, uint32_t start, std::vector<uint8_t> &flash,
+              std::vector<uint8_t> &image)
+{
+	std::mt19937 rng(seed);
+	auto fill_random = [&rng](uint8_t *buf, size_t length) {
+		for (size_t i = 0; i < length; i++) {
+			buf[i] = (uint8_t)rng();
+		}
+	};
+
+	flash.assign(size, 0xFF);
+	image.assign(size, 0xFF);
+	switch (p) {
+	case pattern::random:
+		fill_random(flash.data(), size);
+		fill_random(image.data(), size);
+		break;
+	case pattern::ff:
+		for (size_t offset = 0; offset < size; offset += 8 * NVMCTRL_PAGE_SIZE) {
+			fill_random(&image[offset], std::min<size_t>(NVMCTRL_PAGE_SIZE, size - offset));
+		}
+		break;
+	case pattern::unchanged:
+		fill_random(flash.data(), size);
+		image = flash;
+		for (size_t offset = 0; offset < size; offset += 16 * NVMCTRL_PAGE_SIZE) {
+			fill_random(&image[offset], std::min<size_t>(NVMCTRL_PAGE_SIZE, size - offset));
+		}
+		break;
+	case pattern::patch:
+		fill_random(flash.data(), size);
+		image = flash;
+		for (size_t offset = 0; offset < size; offset += 8 * NVMCTRL_BLOCK_SIZE) {
+			fill_random(&image[offset], std::min<size_t>(NVMCTRL_BLOCK_SIZE, size - offset));
+		}
+		break;
+	case pattern::sparse: {
+		const size_t table = std::min<size_t>(NVMCTRL_BLOCK_SIZE, size);
+		fill_random(flash.data(), size);
+		fill_random(image.data(), size / 8);
+		fill_random(&image[size - table], table);
+		break;
+	}
+	}
+	// the image starts with a vector table: initial stack pointer at the end of RAM, and reset handler
+	const uint32_t vectors[2] = {0x20040000, (start + 0x200) | 1};
+	for (size_t i = 0; i < sizeof(vectors) && i < size; i++) {
+		image[i] = (uint8_t)(vectors[i / 4] >> ((i % 4) * 8));
+	}
+}
+
+#if CONF_AES_ENABLE
+/** Encrypt the image as the bootloader expects it: the header alone in the first transfer, then the payload
+ *  (see usb_dfu_encrypted_header_t), with the key of the bootloader configuration */
+std::vector<uint8_t> encrypt(const std::vector<uint8_t> &image, encryption mode, uint32_t seed)
+{
+	static const uint8_t key[32] = {CONF_USB_DFUD_DECRYPT_KEY};
+	struct _aes_sync_device aes;
+	usb_dfu_encrypted_header_t header;
+	std::mt19937 rng(seed);
+	std::vector<uint8_t> download(sizeof(dfu_download_data) + image.size(), 0);
+	uint8_t *const payload = &download[sizeof(dfu_download_data)];
+
+	std::memset(&header, 0, sizeof(header));
+	header.dwMagic = USB_DFU_ENCRYPTED_MAGIC;
+	header.bVersion = USB_DFU_ENCRYPTED_VERSION;
+	header.bMode = (encryption::gcm == mode) ? USB_DFU_ENCRYPTED_GCM : USB_DFU_ENCRYPTED_CTR;
+	header.dwLength = (uint32_t)image.size();
+	for (size_t i = 0; i < AES_IV_SIZE; i++) {
+		header.bIV[i] = (uint8_t)rng();
+	}
+	_aes_sync_init(&aes, nullptr);
+	_aes_sync_set_key(&aes, key, (enum _aes_keysize)CONF_AES_KEYSIZE);
+	if (encryption::gcm == mode) {
+		// the keystream is the same both ways, but the GHASH covers the input: decrypt the ciphertext again for the tag
+		std::vector<uint8_t> plaintext(image.size());
+		_aes_sync_gcm_start(&aes, header.bIV, (const uint8_t *)&header, offsetof(usb_dfu_encrypted_header_t, bTag));
+		_aes_sync_gcm_decrypt(&aes, image.data(), payload, (uint32_t)image.size());
+		_aes_sync_gcm_start(&aes, header.bIV, (const uint8_t *)&header, offsetof(usb_dfu_encrypted_header_t, bTag));
+		_aes_sync_gcm_decrypt(&aes, payload, plaintext.data(), (uint32_t)image.size());
+		_aes_sync_gcm_finish(&aes, header.bTag);
+	} else {
+		_aes_sync_ctr_crypt(&aes, header.bIV, 0, image.data(), payload, (uint32_t)image.size());
+	}
+	std::memcpy(download.data(), &header, sizeof(header));
+	return download;
+}
+#endif
+
+/** Boot the bootloader and let the host download the image, until the session is over */
+void boot(const bench_params &params, bench_host &host)
+{
+	struct port_irq_source source = bench_host::irq_source;
+	source.context = &host;
+	port_init(&source);
+	nvm_model_init(&params.nvm); // the flash and the user row are mapped, and keep their content
+	qspi_model_init(&params.qspi); // mapped as well
+	usb_model_init(&params.usb);
+
+	// what main() and system_init() do for the DFU path
+	if (params.cache) { // selectable at run time
+		cache_init();
+	}
+	if (params.dma) { // selectable at run time
+		_dma_init();
+		_dma_copy_init();
+	}
+	flash_init(&FLASH_0, NVMCTRL);
+#if CONF_QSPI_ENABLE
+	_qspi_sync_init(&QSPI_INSTANCE, QSPI);
+#endif
+#if CONF_AES_ENABLE
+	_aes_sync_init(&CRYPTOGRAPHY_0, AES);
+#endif
+	hri_nvmctrl_write_CTRLA_WMODE_bf(NVMCTRL, params.wmode); // selectable at run time
+	hri_nvmctrl_write_CTRLA_SUSPEN_bit(NVMCTRL, params.suspend);
+	usb_init();
+
+	if (host.enumerate()) {
+		bool started = false;
+		while (!port_reset_requested && !port_stopped && !host.done()) {
+			if (!started && dfudf_is_enabled()) {
+				usb_dfu_start();
+				started = true;
+			}
+			if (!started) {
+				if (!port_idle()) {
+					break;
+				}
+				continue;
+			}
+			usb_dfu_task();
+			if (!port_reset_requested) {
+				usb_dfu_wait(); // as usb_dfu(): sleep until the next interrupt, unless events are pending
+			}
+		}
+	}
+}
+
+/** Run a complete download session against a freshly booted bootloader (called in a child process)
+ *
+ *  If requested, a first download is interrupted in another child process, and the session resumes it.
+ */
+session_result run_session(const bench_params &params, pattern p, size_t size)
+{
+	session_result result;
+	std::memset(&result, 0, sizeof(result));
+
+	std::vector<uint8_t> flash, image;
+	const uint32_t start = application_start(params);
+	generate(p, size, params.seed ^ (uint32_t)size ^ ((uint32_t)p << 24), start, flash, image);
+	std::vector<uint8_t> download = image; // as sent by the host
+#if CONF_AES_ENABLE
+	if (encryption::off != params.encrypt) {
+		download = encrypt(image, params.encrypt, params.seed ^ (uint32_t)size);
+	}
+#endif
+
+	if (ERR_NONE != nvm_model_map(nullptr) || ERR_NONE != qspi_model_map()) {
+		std::snprintf(result.error, sizeof(result.error), "could not map the flash");
+		return result;
+	}
+	uint8_t *const target = params.target_qspi ? &qspi_model_flash[CONF_USB_DFUD_QSPI_OFFSET] : &nvm_model_flash[start];
+	const uint8_t alt = params.target_qspi ? 1 : 0;
+	std::memcpy(target, flash.data(), size);
+	for (uint32_t i = 0; i < start; i++) { // stand-in for the bootloader, which must survive (and be copied by dual-bank updates)
+		nvm_model_flash[i] = (uint8_t)(i * 7);
+	}
+
+	if (params.interrupt) {
+		std::fflush(stdout);
+		pid_t pid = fork();
+		if (0 == pid) { // the first download is interrupted and the process ends, as the bootloader would by losing power
+			virtual_host interrupted(download, alt, download.size() * params.interrupt / 100);
+			boot(params, interrupted);
+			_exit(interrupted.failed() ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+		int wstatus;
+		if (pid < 0 || pid != waitpid(pid, &wstatus, 0) || !WIFEXITED(wstatus) || EXIT_SUCCESS != WEXITSTATUS(wstatus)) {
+			std::snprintf(result.error, sizeof(result.error), "interrupted download failed");
+			return result;
+		}
+	}
+
+	std::unique_ptr<bench_host> host;
+	if (protocol::uf2 == params.proto) {
+		host.reset(new uf2_host(download, start, params.order, params.uf2_burst, params.seed ^ (uint32_t)size));
+	} else {
+		virtual_host *dfu_host = new virtual_host(download, alt);
+		if (protocol::dfuse == params.proto) {
+			dfu_host->dfuse(start, start + size == FLASH_SIZE / (CONF_USB_DFUD_DUAL_BANK_EN ? 2 : 1)); // the image fills the application region
+		}
+		host.reset(dfu_host);
+	}
+	boot(params, *host);
+
+	result.transfer_size = host->transfer_size();
+	result.time_ns = port_time_ns - host->start_ns();
+	result.block_erases = nvm_model_stats.block_erases;
+	result.page_writes = nvm_model_stats.page_writes + nvm_model_stats.quad_word_writes;
+	result.page_buffer_clears = nvm_model_stats.page_buffer_clears;
+	result.nvm_commands = nvm_model_stats.commands;
+	result.status_reads = nvm_model_stats.status_reads;
+	result.buffer_loads = nvm_model_stats.buffer_loads;
+	result.nvm_busy_ns = nvm_model_stats.busy_ns;
+	result.suspends = nvm_model_stats.suspends;
+	result.control_transfers = usb_model_stats.control_transfers;
+	result.status_polls = host->status_polls();
+	result.max_response_ns = host->max_response_ns();
+	result.skipped_bytes = host->skipped_bytes();
+	result.user_row_erases = nvm_model_stats.user_row_erases;
+	result.see_writes = nvm_model_stats.see_writes;
+	result.sleeps = port_stats.sleeps;
+	result.sleep_ns = port_stats.sleep_ns;
+	result.wake_ns = port_stats.wake_ns;
+	result.wake_max_ns = port_stats.wake_max_ns;
+	result.cache_hits = port_stats.cache_hits;
+	result.cache_invalidations = port_stats.cache_invalidations;
+	result.stale_cache = nvm_model_stats.stale_cache;
+	result.dma_transactions = port_stats.dma_transactions;
+	result.dma_bytes = port_stats.dma_bytes;
+	result.dma_buffer_loads = port_stats.dma_buffer_loads;
+	result.qspi_erases = qspi_model_stats.sector_erases + qspi_model_stats.block_erases;
+	result.qspi_page_programs = qspi_model_stats.page_programs;
+	result.qspi_busy_ns = qspi_model_stats.busy_ns;
+	result.qspi_errors = qspi_model_stats.errors;
+	result.bulk_transfers = usb_model_stats.bulk_transfers;
+	result.bulk_bytes = usb_model_stats.bulk_bytes;
+	result.dnload_bytes = host->dnload_bytes();
+	result.verified = (0 == std::memcmp(target, image.data(), size));
+	for (uint32_t i = 0; i < start; i++) {
+		result.verified = result.verified && nvm_model_flash[i] == (uint8_t)(i * 7);
+	}
+	if (host->failed()) {
+		std::snprintf(result.error, sizeof(result.error), "%s", host->error().c_str());
+	} else if (!port_reset_requested && !host->done()) {
+		std::snprintf(result.error, sizeof(result.error), "session stalled");
+	} else if (!host->manifesting()) {
+		std::snprintf(result.error, sizeof(result.error), "device reset before the download completed");
+	} else if (!result.verified) {
+		std::snprintf(result.error, sizeof(result.error), "flash content does not match the image and bootloader");
+	} else if (result.qspi_errors) {
+		std::snprintf(result.error, sizeof(result.error), "%u commands ignored by the QSPI flash", result.qspi_errors);
+	} else if (result.stale_cache) {
+		std::snprintf(result.error, sizeof(result.error), "%u flash erases or writes left stale lines in the CMCC",
+		              result.stale_cache);
+	} else {
+		result.ok = true;
+	}
+	return result;
+}
+
+/** Run the session in a child process, so that every session starts with the bootloader in its reset state */
+session_result run_isolated(const bench_params &params, pattern p, size_t size)
+{
+	session_result result;
+	std::memset(&result, 0, sizeof(result));
+	std::snprintf(result.error, sizeof(result.error), "session process failed");
+
+	int fds[2];
+	if (pipe(fds)) {
+		return result;
+	}
+	std::fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return result;
+	}
+	if (0 == pid) {
+		close(fds[0]);
+		session_result r = run_session(params, p, size);
+		ssize_t written = write(fds[1], &r, sizeof(r));
+		_exit(sizeof(r) == written ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(fds[1]);
+	session_result r;
+	if (sizeof(r) == read(fds[0], &r, sizeof(r))) {
+		result = r;
+	}
+	close(fds[0]);
+	int wstatus;
+	if (pid == waitpid(pid, &wstatus, 0) && WIFSIGNALED(wstatus)) {
+		std::snprintf(result.error, sizeof(result.error), "session process killed by signal %d", WTERMSIG(wstatus));
+	}
+	return result;
+}
+
+/** Parse a size with an optional K or M suffix (powers of 1024), or "max" for the whole application region */
+bool parse_size(const std::string &text, size_t max, size_t &size)
+{
+	if ("max" == text) {
+		size = max;
+		return true;
+	}
+	char *end;
+	unsigned long value = std::strtoul(text.c_str(), &end, 0);
+	if ('K' == *end || 'k' == *end) {
+		value *= 1024;
+		end++;
+	} else if ('M' == *end || 'm' == *end) {
+		value *= 1024 * 1024;
+		end++;
+	}
+	if (*end || 0 == value || value > max) {
+		return false;
+	}
+	size = value;
+	return true;
+}
+
+std::vector<std::string> split(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		items.push_back(item);
+	}
+	return items;
+}
+
+void usage(const char *argv0)
+{
+	std::printf("Usage: %s [options]\n"
+	            "Benchmark DFU download sessions of the bootloader code against timed NVMCTRL and USB models.\n\n"
+	            "  -s, --sizes LIST           image sizes, with K/M suffix or \"max\" (default 16K,64K,256K,max)\n"
+	            "  -p, --patterns LIST        image patterns: random, ff, unchanged, patch, sparse\n"
+	            "                             (default random,ff,unchanged,patch)\n"
+	            "      --block-erase-us US    duration of a block erase (default %u)\n"
+	            "      --page-write-us US     duration of a page write (default %u)\n"
+	            "      --xfer-overhead-us US  fixed cost of a control transfer (default %u)\n"
+	            "      --bootprot N           BOOTPROT fuse value, giving the bootloader size (default %u)\n"
+	            "      --see-blocks N         SEESBLK fuse value, 0 for no SmartEEPROM (default %u)\n"
+	            "      --seed N               seed of the synthetic images (default %u)\n"
+	            "      --wmode MODE           NVMCTRL write mode: man, adw, aqw, ap (default %s)\n"
+	            "      --suspend on|off       suspend erases and writes for reads of the same bank (default %s)\n"
+	            "      --suspend-us US        time to suspend and resume an erase or write (default %u)\n"
+	            "      --cache on|off         enable the CMCC, keeping the interrupt handlers out of the flash (default %s)\n"
+	            "      --access-cycles N      CPU cycles of an NVMCTRL register access, for the estimate (default %u)\n"
+	            "      --load-cycles N        CPU cycles to load a page buffer word, for the estimate (default %u)\n"
+	            "      --dma on|off           copy by the DMAC above %u bytes, the page buffer loads included (default %s)\n"
+	            "      --dma-setup-cycles N   CPU cycles to set up a DMAC copy, for the estimate (default %u)\n"
+	            "      --dma-beat-cycles N    DMAC cycles to copy a word, for the estimate (default %u)\n"
+	            "      --cpu-mhz N            CPU frequency of the DFU clock profile, for the estimate (default %u)\n"
+	            "      --interrupt PERCENT    interrupt a first download after PERCENT of the image, as on a power loss,\n"
+	            "                             and measure the session downloading the image again (default 0: none)\n"
+	            "      --target nvm|qspi      memory downloaded to: internal flash, or QSPI flash (alternate setting 1,\n"
+	            "                             the bootloader must be built with CONF_QSPI_ENABLE) (default nvm)\n"
+	            "      --qspi-program-us US   duration of a QSPI flash page program (default %u)\n"
+	            "      --qspi-erase-us US     duration of a QSPI flash sector or block erase (default %u)\n"
+	            "      --encrypt off|ctr|gcm  encrypt the image with AES-CTR or AES-GCM (the bootloader must be built\n"
+	            "                             with CONF_AES_ENABLE) (default off)\n"
+	            "      --decrypt-hw-cycles N  CPU cycles to decrypt a block with the AES peripheral, for the estimate\n"
+	            "                             (default %u for CTR, %u for GCM)\n"
+	            "      --decrypt-sw-cycles N  CPU cycles to decrypt a block in software, for the estimate\n"
+	            "                             (default %u for CTR, %u for GCM)\n"
+	            "      --protocol PROTOCOL    dfu: download with DFU requests, uf2: copy a UF2 file to the mass storage\n"
+	            "                             interface (the bootloader must be built with CONF_USB_MSCD_UF2_EN), dfuse:\n"
+	            "                             erase with DfuSe commands and only download the populated segments (the\n"
+	            "                             bootloader must be built with CONF_USB_DFUD_DFUSE_EN) (default dfu, or dfuse)\n"
+	            "      --uf2-order ORDER      order of the UF2 blocks: sequential, shuffled, duplicates (default sequential)\n"
+	            "      --uf2-burst N          sectors written by a WRITE(10) command, 1 to 128 (default %u)\n"
+	            "      --bulk-overhead-us US  fixed cost of a bulk transfer (default %u)\n"
+	            "  -j, --json                 output JSON instead of CSV\n"
+	            "  -h, --help                 show this help\n",
+	            argv0, 6000, 2500, 1000, 13, 1, 1, wmode_names[CONF_NVM_WMODE], CONF_NVM_SUSPEN ? "on" : "off", 20,
+	            CONF_CMCC_ENABLE ? "on" : "off", 6, 3, CONF_DMA_COPY_THRESHOLD, CONF_DMAC_ENABLE ? "on" : "off", 80, 2,
+	            CONF_USB_DFUD_CPU_FREQUENCY / 1000000, 1500, 25000, 110, 115, 900, 1550, 128, 1000);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	bench_params params;
+	std::memset(&params, 0, sizeof(params));
+	params.nvm.block_erase_ns = 6000 * 1000;
+	params.nvm.page_write_ns = 2500 * 1000;
+	params.nvm.quad_word_write_ns = 100 * 1000;
+	params.nvm.page_buffer_clear_ns = 0;
+	params.nvm.suspend_ns = 20 * 1000;
+	params.nvm.bootprot = 13;
+	params.nvm.see_sblk = 1;
+	params.usb.xfer_overhead_ns = 1000 * 1000;
+	params.usb.bulk_overhead_ns = 1000 * 1000;
+	params.uf2_burst = 128; // 64 KiB, as usual host stacks
+	params.proto = CONF_USB_DFUD_DFUSE_EN ? protocol::dfuse : protocol::dfu; // plain block numbers are DfuSe commands then
+	params.seed = 1;
+	params.wmode = CONF_NVM_WMODE;
+	params.suspend = CONF_NVM_SUSPEN;
+	params.cache = CONF_CMCC_ENABLE;
+	params.access_cycles = 6;
+	params.load_cycles = 3;
+	params.dma = CONF_DMAC_ENABLE;
+	params.dma_setup_cycles = 80;
+	params.dma_beat_cycles = 2;
+	params.cpu_mhz = CONF_USB_DFUD_CPU_FREQUENCY / 1000000;
+	// SST26VF064B maximum program and erase times, SCK of the QSPI configuration
+	params.qspi.page_program_ns = 1500 * 1000;
+	params.qspi.sector_erase_ns = 25000 * 1000;
+	params.qspi.block_erase_ns = 25000 * 1000;
+	params.qspi.sck_hz = CONF_USB_DFUD_CPU_FREQUENCY / (CONF_QSPI_SCBR + 1);
+	params.qspi.command_ns = 1000;
+	params.qspi.manufacturer = CONF_QSPI_NOR_MANUFACTURER;
+	std::string sizes_list = "16K,64K,256K,max";
+	std::string patterns_list = "random,ff,unchanged,patch";
+	bool json = false;
+
+	enum {
+		OPT_BLOCK_ERASE = 0x100,
+		OPT_PAGE_WRITE,
+		OPT_XFER_OVERHEAD,
+		OPT_BOOTPROT,
+		OPT_SEE_BLOCKS,
+		OPT_SEED,
+		OPT_WMODE,
+		OPT_SUSPEND,
+		OPT_SUSPEND_TIME,
+		OPT_CACHE,
+		OPT_ACCESS_CYCLES,
+		OPT_LOAD_CYCLES,
+		OPT_DMA,
+		OPT_DMA_SETUP_CYCLES,
+		OPT_DMA_BEAT_CYCLES,
+		OPT_CPU_MHZ,
+		OPT_INTERRUPT,
+		OPT_TARGET,
+		OPT_QSPI_PROGRAM,
+		OPT_QSPI_ERASE,
+		OPT_ENCRYPT,
+		OPT_DECRYPT_HW_CYCLES,
+		OPT_DECRYPT_SW_CYCLES,
+		OPT_PROTOCOL,
+		OPT_UF2_ORDER,
+		OPT_UF2_BURST,
+		OPT_BULK_OVERHEAD
+	};
+	static const struct option long_options[] = {
+		{"sizes", required_argument, nullptr, 's'},
+		{"patterns", required_argument, nullptr, 'p'},
+		{"block-erase-us", required_argument, nullptr, OPT_BLOCK_ERASE},
+		{"page-write-us", required_argument, nullptr, OPT_PAGE_WRITE},
+		{"xfer-overhead-us", required_argument, nullptr, OPT_XFER_OVERHEAD},
+		{"bootprot", required_argument, nullptr, OPT_BOOTPROT},
+		{"see-blocks", required_argument, nullptr, OPT_SEE_BLOCKS},
+		{"seed", required_argument, nullptr, OPT_SEED},
+		{"wmode", required_argument, nullptr, OPT_WMODE},
+		{"suspend", required_argument, nullptr, OPT_SUSPEND},
+		{"suspend-us", required_argument, nullptr, OPT_SUSPEND_TIME},
+		{"cache", required_argument, nullptr, OPT_CACHE},
+		{"access-cycles", required_argument, nullptr, OPT_ACCESS_CYCLES},
+		{"load-cycles", required_argument, nullptr, OPT_LOAD_CYCLES},
+		{"dma", required_argument, nullptr, OPT_DMA},
+		{"dma-setup-cycles", required_argument, nullptr, OPT_DMA_SETUP_CYCLES},
+		{"dma-beat-cycles", required_argument, nullptr, OPT_DMA_BEAT_CYCLES},
+		{"cpu-mhz", required_argument, nullptr, OPT_CPU_MHZ},
+		{"interrupt", required_argument, nullptr, OPT_INTERRUPT},
+		{"target", required_argument, nullptr, OPT_TARGET},
+		{"qspi-program-us", required_argument, nullptr, OPT_QSPI_PROGRAM},
+		{"qspi-erase-us", required_argument, nullptr, OPT_QSPI_ERASE},
+		{"encrypt", required_argument, nullptr, OPT_ENCRYPT},
+		{"decrypt-hw-cycles", required_argument, nullptr, OPT_DECRYPT_HW_CYCLES},
+		{"decrypt-sw-cycles", required_argument, nullptr, OPT_DECRYPT_SW_CYCLES},
+		{"protocol", required_argument, nullptr, OPT_PROTOCOL},
+		{"uf2-order", required_argument, nullptr, OPT_UF2_ORDER},
+		{"uf2-burst", required_argument, nullptr, OPT_UF2_BURST},
+		{"bulk-overhead-us", required_argument, nullptr, OPT_BULK_OVERHEAD},
+		{"json", no_argument, nullptr, 'j'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "s:p:jh", long_options, nullptr)) != -1) {
+		switch (opt) {
+		case 's':
+			sizes_list = optarg;
+			break;
+		case 'p':
+			patterns_list = optarg;
+			break;
+		case OPT_BLOCK_ERASE:
+			params.nvm.block_erase_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case OPT_PAGE_WRITE:
+			params.nvm.page_write_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case OPT_XFER_OVERHEAD:
+			params.usb.xfer_overhead_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case OPT_BOOTPROT:
+			params.nvm.bootprot = (uint8_t)std::strtoul(optarg, nullptr, 0);
+			if (params.nvm.bootprot >= 15) {
+				std::fprintf(stderr, "BOOTPROT must leave room for the bootloader (0-14)\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_SEE_BLOCKS:
+			params.nvm.see_sblk = (uint8_t)std::strtoul(optarg, nullptr, 0);
+			if (params.nvm.see_sblk > NVM_SEE_SBLK_MAX) {
+				std::fprintf(stderr, "SEESBLK must be 0-%u\n", NVM_SEE_SBLK_MAX);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_SEED:
+			params.seed = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_WMODE: {
+			uint8_t mode = 0;
+			while (mode < 4 && 0 != std::strcmp(optarg, wmode_names[mode])) {
+				mode++;
+			}
+			if (4 == mode) {
+				std::fprintf(stderr, "unknown write mode %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			params.wmode = mode;
+			break;
+		}
+		case OPT_SUSPEND:
+			if (0 != std::strcmp(optarg, "on") && 0 != std::strcmp(optarg, "off")) {
+				std::fprintf(stderr, "--suspend takes on or off\n");
+				return EXIT_FAILURE;
+			}
+			params.suspend = (0 == std::strcmp(optarg, "on"));
+			break;
+		case OPT_SUSPEND_TIME:
+			params.nvm.suspend_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case OPT_CACHE:
+			if (0 != std::strcmp(optarg, "on") && 0 != std::strcmp(optarg, "off")) {
+				std::fprintf(stderr, "--cache takes on or off\n");
+				return EXIT_FAILURE;
+			}
+			params.cache = (0 == std::strcmp(optarg, "on"));
+			break;
+		case OPT_ACCESS_CYCLES:
+			params.access_cycles = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_LOAD_CYCLES:
+			params.load_cycles = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_DMA:
+			if (0 != std::strcmp(optarg, "on") && 0 != std::strcmp(optarg, "off")) {
+				std::fprintf(stderr, "--dma takes on or off\n");
+				return EXIT_FAILURE;
+			}
+			params.dma = (0 == std::strcmp(optarg, "on"));
+			break;
+		case OPT_DMA_SETUP_CYCLES:
+			params.dma_setup_cycles = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_DMA_BEAT_CYCLES:
+			params.dma_beat_cycles = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_CPU_MHZ:
+			params.cpu_mhz = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			if (0 == params.cpu_mhz) {
+				std::fprintf(stderr, "--cpu-mhz must not be 0\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_INTERRUPT:
+			params.interrupt = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			if (params.interrupt >= 100) {
+				std::fprintf(stderr, "--interrupt takes a percentage below 100\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_TARGET:
+			if (0 != std::strcmp(optarg, "nvm") && 0 != std::strcmp(optarg, "qspi")) {
+				std::fprintf(stderr, "--target takes nvm or qspi\n");
+				return EXIT_FAILURE;
+			}
+			params.target_qspi = (0 == std::strcmp(optarg, "qspi"));
+			if (params.target_qspi && !CONF_QSPI_ENABLE) {
+				std::fprintf(stderr, "the bootloader is built without QSPI (make clean; make FW_CONF=-DCONF_QSPI_ENABLE=1)\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_QSPI_PROGRAM:
+			params.qspi.page_program_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case OPT_QSPI_ERASE:
+			params.qspi.sector_erase_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			params.qspi.block_erase_ns = params.qspi.sector_erase_ns;
+			break;
+		case OPT_ENCRYPT: {
+			uint8_t mode = 0;
+			while (mode < 3 && 0 != std::strcmp(optarg, encryption_names[mode])) {
+				mode++;
+			}
+			if (3 == mode) {
+				std::fprintf(stderr, "--encrypt takes off, ctr or gcm\n");
+				return EXIT_FAILURE;
+			}
+			params.encrypt = (encryption)mode;
+			if (encryption::off != params.encrypt && !CONF_AES_ENABLE) {
+				std::fprintf(stderr, "the bootloader is built without AES (make clean; make FW_CONF=-DCONF_AES_ENABLE=1)\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		}
+		case OPT_DECRYPT_HW_CYCLES:
+			params.decrypt_hw_cycles = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_DECRYPT_SW_CYCLES:
+			params.decrypt_sw_cycles = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_PROTOCOL: {
+			uint8_t proto = 0;
+			while (proto < 3 && 0 != std::strcmp(optarg, protocol_names[proto])) {
+				proto++;
+			}
+			if (3 == proto) {
+				std::fprintf(stderr, "--protocol takes dfu, uf2 or dfuse\n");
+				return EXIT_FAILURE;
+			}
+			params.proto = (protocol)proto;
+			if (protocol::uf2 == params.proto && !CONF_USB_MSCD_UF2_EN) {
+				std::fprintf(stderr, "the bootloader is built without UF2 (make clean; make FW_CONF=-DCONF_USB_MSCD_UF2_EN=1)\n");
+				return EXIT_FAILURE;
+			}
+			if (protocol::dfuse == params.proto && !CONF_USB_DFUD_DFUSE_EN) {
+				std::fprintf(stderr, "the bootloader is built without DfuSe (make clean; make FW_CONF=-DCONF_USB_DFUD_DFUSE_EN=1)\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		}
+		case OPT_UF2_ORDER: {
+			uint8_t order = 0;
+			while (order < 3 && 0 != std::strcmp(optarg, uf2_order_names[order])) {
+				order++;
+			}
+			if (3 == order) {
+				std::fprintf(stderr, "--uf2-order takes sequential, shuffled or duplicates\n");
+				return EXIT_FAILURE;
+			}
+			params.order = (uf2_order)order;
+			break;
+		}
+		case OPT_UF2_BURST:
+			params.uf2_burst = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			if (0 == params.uf2_burst || params.uf2_burst > 128) {
+				std::fprintf(stderr, "--uf2-burst takes 1 to 128 sectors\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_BULK_OVERHEAD:
+			params.usb.bulk_overhead_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case 'j':
+			json = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (protocol::dfu != params.proto && (params.interrupt || params.target_qspi || encryption::off != params.encrypt)) {
+		std::fprintf(stderr, "--protocol %s downloads plain images to the internal flash, without interruption\n",
+		             protocol_names[(int)params.proto]);
+		return EXIT_FAILURE;
+	}
+	if (CONF_USB_DFUD_DFUSE_EN && protocol::dfu == params.proto) {
+		std::fprintf(stderr, "the bootloader is built with DfuSe: use --protocol dfuse\n");
+		return EXIT_FAILURE;
+	}
+	if (0 == params.decrypt_hw_cycles) { // peripheral: 57-cycle AES-128 core, register accesses and copies
+		params.decrypt_hw_cycles = (encryption::gcm == params.encrypt) ? 115 : 110;
+	}
+	if (0 == params.decrypt_sw_cycles) { // hpl_aes_soft.c: T-table rounds, and the 4-bit GHASH multiplication for GCM
+		params.decrypt_sw_cycles = (encryption::gcm == params.encrypt) ? 1550 : 900;
+	}
+
+	const size_t max_size = params.target_qspi ? CONF_USB_DFUD_QSPI_SIZE
+	                                           : FLASH_SIZE / (CONF_USB_DFUD_DUAL_BANK_EN ? 2 : 1) - application_start(params); // one bank
+	std::vector<size_t> sizes;
+	for (const std::string &item : split(sizes_list)) {
+		size_t size;
+		if (!parse_size(item, max_size, size)) {
+			std::fprintf(stderr, "invalid size %s (the region is %zu bytes)\n", item.c_str(), max_size);
+			return EXIT_FAILURE;
+		}
+		sizes.push_back(size);
+	}
+	std::vector<pattern> patterns;
+	for (const std::string &item : split(patterns_list)) {
+		bool found = false;
+		for (pattern p : {pattern::random, pattern::ff, pattern::unchanged, pattern::patch, pattern::sparse}) {
+			if (item == pattern_name(p)) {
+				patterns.push_back(p);
+				found = true;
+			}
+		}
+		if (!found) {
+			std::fprintf(stderr, "unknown pattern %s\n", item.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (json) {
+		std::printf("{\"parameters\": {\"block_erase_us\": %u, \"page_write_us\": %u, \"xfer_overhead_us\": %u, "
+		            "\"bootprot\": %u, \"see_blocks\": %u, \"seed\": %u, \"wmode\": \"%s\", \"suspend\": %s, \"suspend_us\": %u, "
+		            "\"cache\": %s, \"access_cycles\": %u, \"load_cycles\": %u, \"dma\": %s, "
+		            "\"dma_setup_cycles\": %u, \"dma_beat_cycles\": %u, \"cpu_mhz\": %u, "
+		            "\"interrupt\": %u, \"target\": \"%s\", \"qspi_program_us\": %u, \"qspi_erase_us\": %u, "
+		            "\"encrypt\": \"%s\", \"decrypt_hw_cycles\": %u, \"decrypt_sw_cycles\": %u, \"protocol\": \"%s\", "
+		            "\"uf2_order\": \"%s\", \"uf2_burst\": %u, \"bulk_overhead_us\": %u},\n"
+		            " \"results\": [",
+		            params.nvm.block_erase_ns / 1000, params.nvm.page_write_ns / 1000,
+		            params.usb.xfer_overhead_ns / 1000, params.nvm.bootprot, params.nvm.see_sblk, params.seed, wmode_names[params.wmode],
+		            params.suspend ? "true" : "false", params.nvm.suspend_ns / 1000,
+		            params.cache ? "true" : "false", params.access_cycles,
+		            params.load_cycles, params.dma ? "true" : "false", params.dma_setup_cycles,
+		            params.dma_beat_cycles, params.cpu_mhz, params.interrupt, params.target_qspi ? "qspi" : "nvm",
+		            params.qspi.page_program_ns / 1000, params.qspi.sector_erase_ns / 1000,
+		            encryption_names[(int)params.encrypt], params.decrypt_hw_cycles, params.decrypt_sw_cycles,
+		            protocol_names[(int)params.proto], uf2_order_names[(int)params.order], params.uf2_burst,
+		            params.usb.bulk_overhead_ns / 1000);
+	} else {
+		std::printf("pattern,size,transfer_size,seconds,bytes_per_second,block_erases,page_writes,"
+		            "page_buffer_clears,nvm_busy_seconds,control_transfers,status_polls,nvm_commands,nvm_status_reads,"
+		            "cycles_per_page,suspends,max_response_ms,skipped_bytes,user_row_erases,see_writes,sleeps,sleep_seconds,"
+		            "mean_wake_us,max_wake_us,cache_hits,cache_invalidations,nvm_cpu_seconds,dma_transactions,dma_bytes,"
+		            "dma_busy_seconds,cpu_freed_seconds,qspi_erases,qspi_page_programs,qspi_busy_seconds,"
+		            "decrypt_bytes,decrypt_hw_seconds,decrypt_sw_seconds,bulk_transfers,bulk_bytes,dnload_bytes,result\n");
+	}
+	unsigned failures = 0;
+	bool first = true;
+	for (pattern p : patterns) {
+		for (size_t size : sizes) {
+			const session_result r = run_isolated(params, p, size);
+			const double seconds = r.time_ns / 1e9;
+			const double rate = seconds > 0 ? size / seconds : 0;
+			// CPU cycles spent on the NVMCTRL per downloaded page, waiting for READY apart
+			const double cycles_per_page =
+			    (double)((uint64_t)(r.nvm_commands + r.status_reads) * params.access_cycles
+			             + (uint64_t)(r.buffer_loads - r.dma_buffer_loads) * params.load_cycles)
+			    / (size / NVMCTRL_PAGE_SIZE);
+			// the same cycles at the CPU frequency, over the session
+			const double nvm_cpu_seconds = cycles_per_page * (size / NVMCTRL_PAGE_SIZE) / (params.cpu_mhz * 1e6);
+			// time the DMAC copied, while the CPU only polled and served interrupts
+			const double dma_busy_seconds = (double)(r.dma_bytes / 4) * params.dma_beat_cycles / (params.cpu_mhz * 1e6);
+			// word copies the CPU did not execute, less the setup of the DMAC copies
+			const double cpu_freed_seconds =
+			    ((double)(r.dma_bytes / 4) * params.load_cycles - (double)r.dma_transactions * params.dma_setup_cycles)
+			    / (params.cpu_mhz * 1e6);
+			const double mean_wake_us = r.sleeps ? r.wake_ns / 1e3 / r.sleeps : 0;
+			// CPU time to decrypt the payload, with the peripheral and in software
+			const size_t decrypt_bytes = (encryption::off == params.encrypt) ? 0 : size;
+			const double decrypt_hw_seconds =
+			    (double)((decrypt_bytes + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE) * params.decrypt_hw_cycles / (params.cpu_mhz * 1e6);
+			const double decrypt_sw_seconds =
+			    (double)((decrypt_bytes + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE) * params.decrypt_sw_cycles / (params.cpu_mhz * 1e6);
+			if (!r.ok) {
+				failures++;
+			}
+			if (json) {
+				std::printf("%s\n  {\"pattern\": \"%s\", \"size\": %zu, \"transfer_size\": %u, \"seconds\": %.6f, "
+				            "\"bytes_per_second\": %.1f, \"block_erases\": %u, \"page_writes\": %u, "
+				            "\"page_buffer_clears\": %u, \"nvm_busy_seconds\": %.6f, \"control_transfers\": %u, "
+				            "\"status_polls\": %u, \"nvm_commands\": %u, \"nvm_status_reads\": %u, "
+				            "\"cycles_per_page\": %.1f, \"suspends\": %u, \"max_response_ms\": %.3f, "
+				            "\"skipped_bytes\": %llu, \"user_row_erases\": %u, \"see_writes\": %u, \"sleeps\": %u, \"sleep_seconds\": %.6f, "
+				            "\"mean_wake_us\": %.3f, \"max_wake_us\": %.3f, \"cache_hits\": %u, "
+				            "\"cache_invalidations\": %u, \"nvm_cpu_seconds\": %.6f, \"dma_transactions\": %u, "
+				            "\"dma_bytes\": %llu, \"dma_busy_seconds\": %.6f, \"cpu_freed_seconds\": %.6f, "
+				            "\"qspi_erases\": %u, \"qspi_page_programs\": %u, \"qspi_busy_seconds\": %.6f, "
+				            "\"decrypt_bytes\": %zu, \"decrypt_hw_seconds\": %.6f, \"decrypt_sw_seconds\": %.6f, "
+				            "\"bulk_transfers\": %u, \"bulk_bytes\": %llu, \"dnload_bytes\": %llu, \"result\": \"%s\"}",
+				            first ? "" : ",", pattern_name(p), size, r.transfer_size, seconds, rate, r.block_erases,
+				            r.page_writes, r.page_buffer_clears, r.nvm_busy_ns / 1e9, r.control_transfers,
+				            r.status_polls, r.nvm_commands, r.status_reads, cycles_per_page, r.suspends,
+				            r.max_response_ns / 1e6, (unsigned long long)r.skipped_bytes, r.user_row_erases, r.see_writes, r.sleeps,
+				            r.sleep_ns / 1e9, mean_wake_us, r.wake_max_ns / 1e3, r.cache_hits, r.cache_invalidations,
+				            nvm_cpu_seconds, r.dma_transactions, (unsigned long long)r.dma_bytes, dma_busy_seconds,
+				            cpu_freed_seconds, r.qspi_erases, r.qspi_page_programs, r.qspi_busy_ns / 1e9,
+				            decrypt_bytes, decrypt_hw_seconds, decrypt_sw_seconds, r.bulk_transfers,
+				            (unsigned long long)r.bulk_bytes, (unsigned long long)r.dnload_bytes, r.ok ? "ok" : r.error);
+			} else {
+				std::printf("%s,%zu,%u,%.6f,%.1f,%u,%u,%u,%.6f,%u,%u,%u,%u,%.1f,%u,%.3f,%llu,%u,%u,%u,%.6f,%.3f,%.3f,%u,%u,%.6f,%u,%llu,%.6f,%.6f,%u,%u,%.6f,%zu,%.6f,%.6f,%u,%llu,%llu,%s\n",
+				            pattern_name(p), size, r.transfer_size, seconds, rate, r.block_erases, r.page_writes,
+				            r.page_buffer_clears, r.nvm_busy_ns / 1e9, r.control_transfers, r.status_polls,
+				            r.nvm_commands, r.status_reads, cycles_per_page, r.suspends, r.max_response_ns / 1e6,
+				            (unsigned long long)r.skipped_bytes, r.user_row_erases, r.see_writes, r.sleeps, r.sleep_ns / 1e9,
+				            mean_wake_us, r.wake_max_ns / 1e3, r.cache_hits, r.cache_invalidations,
+				            nvm_cpu_seconds, r.dma_transactions, (unsigned long long)r.dma_bytes, dma_busy_seconds,
+				            cpu_freed_seconds, r.qspi_erases, r.qspi_page_programs, r.qspi_busy_ns / 1e9,
+				            decrypt_bytes, decrypt_hw_seconds, decrypt_sw_seconds, r.bulk_transfers,
+				            (unsigned long long)r.bulk_bytes, (unsigned long long)r.dnload_bytes, r.ok ? "ok" : r.error);
+			}
+			first = false;
+		}
+	}
+	if (json) {
+		std::printf("\n]}\n");
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
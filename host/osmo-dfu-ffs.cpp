@@ -0,0 +1,247 @@
+/**
+ * \file
+ * \brief Run the bootloader DFU stack as a Linux USB gadget
+ *
+ * The bootloader sources (DFU class, USB device stack, usb_start.c main loop, flash HAL and NVMCTRL HPL)
+ * are built for the host. The USB device peripheral is backed by FunctionFS (see host/port/usb_ffs.h),
+ * so that real USB hosts such as dfu-util drive the stack, e.g. through dummy_hcd on a plain Linux machine.
+ * The NVMCTRL model runs in real time and its flash can be backed by a file.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+
+#include "dfu_protocol.h"
+
+#include "hal_flash.h"
+#include "hpl_aes.h"
+#include "hpl_qspi.h"
+#include "nvm_model.h"
+#include "port.h"
+#include "qspi_model.h"
+#include "usb_ffs.h"
+#include "usb_start.h"
+
+/* from driver_init.h, which can not be included with unistd.h since hal_sleep.h declares sleep() */
+extern "C" struct flash_descriptor FLASH_0;
+extern "C" struct _qspi_sync_dev QSPI_INSTANCE;
+#if CONF_AES_ENABLE
+extern "C" struct _aes_sync_device CRYPTOGRAPHY_0;
+#endif
+
+namespace {
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void on_signal(int)
+{
+	stop_requested = 1;
+}
+
+/** Protocol-level statistics of the download, as seen by the device */
+struct protocol_stats {
+	uint32_t downloads = 0;      /**< DNLOAD requests with data */
+	uint64_t bytes = 0;          /**< downloaded bytes */
+	uint32_t status_polls = 0;   /**< GETSTATUS requests */
+	uint32_t stalls = 0;         /**< stalled requests */
+	uint64_t first_ns = 0;       /**< time of the first DNLOAD */
+	uint64_t last_ns = 0;        /**< time of the last DFU request */
+	uint64_t previous_ns = 0;    /**< time of the previous DFU request */
+	uint64_t poll_gap_min_ns = UINT64_MAX; /**< shortest time between a DFU request and the next GETSTATUS */
+	uint64_t poll_gap_max_ns = 0;
+	uint64_t poll_gap_total_ns = 0;
+};
+
+protocol_stats stats;
+
+/** Record the DFU class requests (usb_ffs_monitor) */
+extern "C" void monitor(const uint8_t setup[8], uint16_t length, bool stalled)
+{
+	const uint64_t now = port_now();
+
+	if (dfu::request_type_out != setup[0] && dfu::request_type_in != setup[0]) {
+		return;
+	}
+	if (stalled) {
+		stats.stalls++;
+	} else if (dfu::DNLOAD == setup[1] && length) {
+		if (0 == stats.downloads++) {
+			stats.first_ns = now;
+		}
+		stats.bytes += length;
+	} else if (dfu::GETSTATUS == setup[1]) {
+		const uint64_t gap = now - stats.previous_ns;
+		stats.status_polls++;
+		if (gap < stats.poll_gap_min_ns) {
+			stats.poll_gap_min_ns = gap;
+		}
+		if (gap > stats.poll_gap_max_ns) {
+			stats.poll_gap_max_ns = gap;
+		}
+		stats.poll_gap_total_ns += gap;
+	}
+	stats.previous_ns = now;
+	stats.last_ns = now;
+}
+
+void print_stats()
+{
+	const double seconds = (stats.last_ns - stats.first_ns) / 1e9;
+	std::printf("downloaded %llu bytes in %u requests, %.3f s (%.0f B/s)\n", (unsigned long long)stats.bytes,
+	            stats.downloads, seconds, (seconds > 0) ? stats.bytes / seconds : 0.0);
+	if (stats.status_polls) {
+		std::printf("%u GETSTATUS polls, %.3f/%.3f/%.3f ms min/avg/max after the previous request\n",
+		            stats.status_polls, stats.poll_gap_min_ns / 1e6,
+		            stats.poll_gap_total_ns / 1e6 / stats.status_polls, stats.poll_gap_max_ns / 1e6);
+	}
+	std::printf("%u control transfers, %u stalled; %u block erases, %u page writes, NVM busy %.3f s\n",
+	            usb_ffs_stats.control_transfers, usb_ffs_stats.stalls, nvm_model_stats.block_erases,
+	            nvm_model_stats.page_writes + nvm_model_stats.quad_word_writes, nvm_model_stats.busy_ns / 1e9);
+}
+
+void usage(const char *argv0)
+{
+	std::printf("Usage: %s [options] FFS_DIR\n"
+	            "Run the bootloader DFU stack on the FunctionFS instance mounted at FFS_DIR.\n"
+	            "The program exits when the bootloader resets after a download, or on SIGINT/SIGTERM.\n\n"
+	            "  -f, --flash FILE        back the flash, user row and SmartEEPROM with FILE, created if needed (default: in memory)\n"
+	            "      --block-erase-us US duration of a block erase (default %u)\n"
+	            "      --page-write-us US  duration of a page write (default %u)\n"
+	            "      --bootprot N        BOOTPROT fuse value, giving the bootloader size (default %u)\n"
+	            "  -h, --help              show this help\n",
+	            argv0, 6000, 2500, 13);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	struct nvm_model_params nvm;
+	std::memset(&nvm, 0, sizeof(nvm));
+	nvm.block_erase_ns = 6000 * 1000;
+	nvm.page_write_ns = 2500 * 1000;
+	nvm.quad_word_write_ns = 100 * 1000;
+	nvm.suspend_ns = 20 * 1000;
+	nvm.bootprot = 13;
+	nvm.see_sblk = 1; // the smallest SmartEEPROM, for the resume record
+	const char *flash_file = nullptr;
+
+	enum { OPT_BLOCK_ERASE = 0x100, OPT_PAGE_WRITE, OPT_BOOTPROT };
+	static const struct option long_options[] = {
+		{"flash", required_argument, nullptr, 'f'},
+		{"block-erase-us", required_argument, nullptr, OPT_BLOCK_ERASE},
+		{"page-write-us", required_argument, nullptr, OPT_PAGE_WRITE},
+		{"bootprot", required_argument, nullptr, OPT_BOOTPROT},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "f:h", long_options, nullptr)) != -1) {
+		switch (opt) {
+		case 'f':
+			flash_file = optarg;
+			break;
+		case OPT_BLOCK_ERASE:
+			nvm.block_erase_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case OPT_PAGE_WRITE:
+			nvm.page_write_ns = (uint32_t)std::strtoul(optarg, nullptr, 0) * 1000;
+			break;
+		case OPT_BOOTPROT:
+			nvm.bootprot = (uint8_t)std::strtoul(optarg, nullptr, 0);
+			if (nvm.bootprot >= 15) {
+				std::fprintf(stderr, "BOOTPROT must leave room for the bootloader (0-14)\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (CONF_USB_MSCD_UF2_EN) { // the FunctionFS backend serves the control endpoint only
+		std::fprintf(stderr, "the UF2 mass storage interface needs bulk endpoints (make clean; make without CONF_USB_MSCD_UF2_EN)\n");
+		return EXIT_FAILURE;
+	}
+
+	if (flash_file && ERR_NONE != nvm_model_map(flash_file)) {
+		return EXIT_FAILURE;
+	}
+	nvm_model_init(&nvm);
+#if CONF_QSPI_ENABLE
+	// SST26VF064B maximum program and erase times, the content is not kept
+	const struct qspi_model_params qspi = {1500000, 25000000, 25000000, 60000000, 1000, CONF_QSPI_NOR_MANUFACTURER};
+	qspi_model_init(&qspi);
+#endif
+
+	// what main() and system_init() do for the DFU path
+	port_init(nullptr);
+	flash_init(&FLASH_0, NVMCTRL);
+#if CONF_QSPI_ENABLE
+	_qspi_sync_init(&QSPI_INSTANCE, QSPI);
+#endif
+#if CONF_AES_ENABLE
+	_aes_sync_init(&CRYPTOGRAPHY_0, AES);
+#endif
+	usb_init();
+	const int fd = usb_ffs_open(argv[optind]);
+	if (fd < 0) {
+		return EXIT_FAILURE;
+	}
+	struct port_irq_source source = {nullptr, usb_ffs_irq, nullptr, fd};
+	port_init(&source); // real time from now on
+	usb_ffs_monitor = monitor;
+
+	struct sigaction sa;
+	std::memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal; // no SA_RESTART: the wait for the host is interrupted
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+
+	std::printf("descriptors written to %s, bind the gadget to a UDC to attach\n", argv[optind]);
+	std::fflush(stdout);
+	bool started = false;
+	while (!port_reset_requested && !stop_requested) {
+		if (!started && dfudf_is_enabled()) {
+			usb_dfu_start();
+			started = true;
+		}
+		if (!started) {
+			port_idle();
+			continue;
+		}
+		usb_dfu_task();
+		if (!port_reset_requested) {
+			usb_dfu_wait(); // as usb_dfu(): sleep until the next interrupt, unless events are pending
+		}
+	}
+	usb_ffs_close();
+	std::printf("%s\n", port_reset_requested ? "bootloader reset" : "stopped");
+	print_stats();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,232 @@
+/**
+ * \file
+ * \brief Flash all attached osmo-ASF4-DFU devices concurrently
+ *
+ * All devices are driven from a single event loop using asynchronous control transfers.
+ * Each device runs its own download pipeline, so a device waiting for flashing to complete never delays the others.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iterator>
+
+#include "dfu_file.h"
+#include "dfu_pipeline.h"
+#include "dfu_protocol.h"
+#include "dfu_transport.h"
+
+namespace {
+
+void usage(const char *argv0)
+{
+	std::printf("Usage: %s [options] FIRMWARE\n"
+	            "Download the firmware (binary or DfuSe file) to all attached osmo-ASF4-DFU devices concurrently.\n\n"
+	            "  -d, --device VID:PID       USB IDs to look for (default %04x:%04x)\n"
+	            "  -s, --simulate N           use N simulated devices instead of USB\n"
+	            "      --sim-poll-ms MS       bwPollTimeout reported by the simulated devices\n"
+	            "      --sim-latency-us US    control transfer latency of the simulated devices\n"
+	            "      --no-resume            download the whole image, even the blocks a device already holds\n"
+	            "  -v, --verbose              print per device details\n"
+	            "  -h, --help                 show this help\n",
+	            argv0, dfu::default_vid, dfu::default_pid);
+}
+
+/** Load the firmware file: a raw binary with an optional DFU suffix (DFU specification 1.1, appendix B), or a DfuSe file
+ *  whose elements are downloaded as one image, the gaps being filled with 0xFF
+ *  \return an error message, or nullptr
+ */
+const char *load_firmware(const char *path, std::vector<uint8_t> &image)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return "could not open the file";
+	}
+	image.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	if (dfu::suffix_check::bad_crc == dfu::strip_suffix(image)) {
+		return "the file does not match the CRC of its DFU suffix";
+	}
+	if (dfu::is_dfuse_file(image)) {
+		std::vector<dfu::element> elements;
+		uint32_t address;
+		if (!dfu::parse_dfuse_file(image, 0, elements) || !dfu::flatten_elements(elements, image, address)) {
+			return "malformed DfuSe file";
+		}
+	}
+	if (image.empty()) {
+		return "firmware file is empty";
+	}
+	return nullptr;
+}
+
+double seconds(dfu::clock::duration d)
+{
+	return std::chrono::duration<double>(d).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	uint16_t vid = dfu::default_vid, pid = dfu::default_pid;
+	bool simulate = false, verbose = false, resume = true;
+	dfu::sim_params sim;
+
+	enum { OPT_SIM_POLL = 0x100, OPT_SIM_LATENCY, OPT_NO_RESUME };
+	static const struct option long_options[] = {
+		{"device", required_argument, nullptr, 'd'},
+		{"simulate", required_argument, nullptr, 's'},
+		{"sim-poll-ms", required_argument, nullptr, OPT_SIM_POLL},
+		{"sim-latency-us", required_argument, nullptr, OPT_SIM_LATENCY},
+		{"no-resume", no_argument, nullptr, OPT_NO_RESUME},
+		{"verbose", no_argument, nullptr, 'v'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "d:s:vh", long_options, nullptr)) != -1) {
+		switch (opt) {
+		case 'd': {
+			unsigned int v, p;
+			if (2 != std::sscanf(optarg, "%x:%x", &v, &p) || v > 0xFFFF || p > 0xFFFF) {
+				std::fprintf(stderr, "invalid USB IDs: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			vid = (uint16_t)v;
+			pid = (uint16_t)p;
+			break;
+		}
+		case 's':
+			simulate = true;
+			sim.devices = (unsigned)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_SIM_POLL:
+			sim.poll_timeout_ms = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_SIM_LATENCY:
+			sim.xfer_latency_us = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case OPT_NO_RESUME:
+			resume = false;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint8_t> image;
+	const char *error = load_firmware(argv[optind], image);
+	if (error) {
+		std::fprintf(stderr, "%s: %s\n", argv[optind], error);
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<dfu::bus> bus;
+	if (simulate) {
+		bus = dfu::make_sim_bus(sim);
+	} else {
+#ifdef HAVE_LIBUSB
+		bus = dfu::make_libusb_bus();
+#else
+		std::fprintf(stderr, "built without libusb support, only --simulate is available\n");
+		return EXIT_FAILURE;
+#endif
+	}
+
+	std::vector<std::unique_ptr<dfu::device>> devices = bus->discover(vid, pid);
+	if (devices.empty()) {
+		std::fprintf(stderr, "no DFU device %04x:%04x found\n", vid, pid);
+		return EXIT_FAILURE;
+	}
+	std::printf("flashing %zu bytes to %zu device(s)\n", image.size(), devices.size());
+
+	std::vector<std::unique_ptr<dfu::pipeline>> pipelines;
+	for (auto &dev : devices) {
+		pipelines.emplace_back(new dfu::pipeline(*dev, image, resume));
+	}
+
+	const dfu::clock::time_point start = dfu::clock::now();
+	for (auto &p : pipelines) {
+		p->start();
+	}
+	while (true) {
+		dfu::clock::time_point deadline = dfu::clock::time_point::max();
+		bool running = false;
+		for (auto &p : pipelines) {
+			if (!p->finished()) {
+				running = true;
+				if (p->deadline() < deadline) {
+					deadline = p->deadline();
+				}
+			}
+		}
+		if (!running) {
+			break;
+		}
+		bus->handle_events(deadline);
+		for (auto &p : pipelines) {
+			p->on_timer();
+		}
+	}
+	const dfu::clock::duration elapsed = dfu::clock::now() - start;
+
+	size_t total = 0;
+	unsigned failures = 0;
+	for (size_t i = 0; i < pipelines.size(); i++) {
+		const dfu::pipeline &p = *pipelines[i];
+		const dfu::pipeline::statistics &st = p.stats();
+		total += st.bytes;
+		if (p.failed()) {
+			failures++;
+			std::printf("%s: FAILED after %zu bytes: %s\n", p.name().c_str(), st.bytes, p.error().c_str());
+		} else {
+			std::printf("%s: OK, %.2f s, %.1f kB/s", p.name().c_str(), seconds(st.end - st.start),
+			            st.bytes / 1000.0 / seconds(st.end - st.start));
+			if (st.skipped) {
+				std::printf(", skipped: %zu bytes already in flash", st.skipped);
+			}
+			std::printf("\n");
+		}
+		if (verbose) {
+			std::printf("  %u blocks, %u GETSTATUS, %.2f s waiting for bwPollTimeout\n", st.blocks, st.status_polls,
+			            seconds(st.poll_wait));
+			std::string diag = devices[i]->diagnostics();
+			if (!diag.empty()) {
+				std::printf("  %s\n", diag.c_str());
+			}
+		}
+	}
+	std::printf("%zu device(s), %u failed, %.2f s, aggregate %.1f kB/s\n", pipelines.size(), failures,
+	            seconds(elapsed), total / 1000.0 / seconds(elapsed));
+
+	pipelines.clear();
+	devices.clear(); // devices must be closed before their bus
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,389 @@
+/**
+ * \file
+ * \brief Prepare firmware images for fast and verifiable downloads to osmo-ASF4-DFU devices
+ *
+ * The image (ELF, raw binary or DfuSe file) is laid out on the NVM geometry: the pages only holding 0xFF are dropped,
+ * and the remaining data is cut into segments of whole pages, written as a DfuSe file (or a raw binary) with its DFU suffix.
+ * The CRC-32 of every block written can be saved as a manifest, and the download is predicted for the device.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iterator>
+
+#include "dfu_file.h"
+#include "dfu_protocol.h"
+
+namespace {
+
+/** NVM geometry of the SAM D5x/E5x (see hpl/nvmctrl/hpl_nvmctrl.c) */
+constexpr uint32_t page_size = 512;
+constexpr uint32_t block_size = 8192;
+constexpr uint32_t flash_size = 0x100000;
+
+/** Output file formats */
+enum class format {
+	dfuse, /**< DfuSe file, one element per segment (for bootloaders built with CONF_USB_DFUD_DFUSE_EN) */
+	bin, /**< raw binary from the application start, as downloaded by plain DFU */
+};
+
+/** Memory region the image is downloaded to */
+struct region {
+	uint32_t start;
+	uint32_t end;
+};
+
+void usage(const char *argv0)
+{
+	std::printf("Usage: %s [options] INPUT OUTPUT\n"
+	            "Prepare a firmware (ELF, binary or DfuSe file) for osmo-ASF4-DFU devices: drop the pages only holding 0xFF,\n"
+	            "lay the data out in pages, and add the DFU suffix.\n\n"
+	            "  -f, --format dfuse|bin     DfuSe file with a segment per run of pages holding data (the bootloader must\n"
+	            "                             be built with CONF_USB_DFUD_DFUSE_EN), or raw binary from the application\n"
+	            "                             start, only trimmed at its end (default dfuse)\n"
+	            "  -a, --address ADDR         address of a binary input (default the application start)\n"
+	            "      --bootprot N           BOOTPROT fuse value, giving the application start (default 13)\n"
+	            "      --dual-bank            the application region is one bank (CONF_USB_DFUD_DUAL_BANK_EN)\n"
+	            "  -g, --min-gap BYTES        erased bytes needed to split a segment, in whole pages (default %u)\n"
+	            "  -t, --transfer-size BYTES  wTransferSize of the device, for the predictions (default %u)\n"
+	            "  -m, --manifest FILE        save the address, size and CRC-32 of every block written\n"
+	            "  -d, --device VID:PID       USB IDs of the DFU suffix (default %04x:%04x)\n"
+	            "  -h, --help                 show this help\n",
+	            argv0, page_size, page_size, dfu::default_vid, dfu::default_pid);
+}
+
+bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return !file.bad();
+}
+
+bool write_file(const char *path, const std::vector<uint8_t> &data)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char *>(data.data()), data.size());
+	return (bool)file;
+}
+
+bool is_elf_file(const std::vector<uint8_t> &data)
+{
+	return data.size() >= 4 && 0x7F == data[0] && 'E' == data[1] && 'L' == data[2] && 'F' == data[3];
+}
+
+/** Load the segments of an ELF file holding data, at their load (physical) address
+ *  \return an error message, or nullptr
+ */
+const char *load_elf(const std::vector<uint8_t> &data, std::vector<dfu::element> &elements)
+{
+	constexpr size_t header_length = 52, phdr_length = 32;
+	constexpr uint32_t pt_load = 1;
+
+	if (data.size() < header_length || 1 != data[4] || 1 != data[5]) {
+		return "only 32-bit little-endian ELF files are supported";
+	}
+	const uint32_t phoff = dfu::get_le32(&data[28]);
+	const uint16_t phentsize = dfu::get_le16(&data[42]);
+	const uint16_t phnum = dfu::get_le16(&data[44]);
+	if (phentsize < phdr_length || phoff > data.size() || (size_t)phnum * phentsize > data.size() - phoff) {
+		return "malformed ELF program headers";
+	}
+	for (uint16_t i = 0; i < phnum; i++) {
+		const uint8_t *phdr = &data[phoff + (size_t)i * phentsize];
+		const uint32_t offset = dfu::get_le32(phdr + 4);
+		const uint32_t paddr = dfu::get_le32(phdr + 12);
+		const uint32_t filesz = dfu::get_le32(phdr + 16);
+		if (pt_load != dfu::get_le32(phdr) || 0 == filesz) { // .bss and the stack are not downloaded
+			continue;
+		}
+		if (offset > data.size() || filesz > data.size() - offset) {
+			return "ELF segment beyond the end of the file";
+		}
+		elements.push_back(dfu::element{paddr, std::vector<uint8_t>(data.begin() + offset, data.begin() + offset + filesz)});
+	}
+	return nullptr;
+}
+
+bool page_erased(const uint8_t *page)
+{
+	static const std::vector<uint8_t> erased(page_size, 0xFF);
+	return 0 == std::memcmp(page, erased.data(), page_size);
+}
+
+/** Cut the image into segments of whole pages holding data
+ *  \param[in] image page aligned image
+ *  \param[in] min_gap erased bytes needed between two segments (a multiple of the page size)
+ */
+std::vector<dfu::segment> page_segments(const std::vector<uint8_t> &image, uint32_t min_gap)
+{
+	std::vector<dfu::segment> segments;
+	for (size_t offset = 0; offset < image.size(); offset += page_size) {
+		if (page_erased(&image[offset])) {
+			continue;
+		}
+		if (!segments.empty() && offset - (segments.back().offset + segments.back().length) < min_gap) {
+			segments.back().length = offset + page_size - segments.back().offset;
+		} else {
+			segments.push_back(dfu::segment{offset, page_size});
+		}
+	}
+	return segments;
+}
+
+/** Addresses of the blocks touched by the segments
+ *  \param[in] address address of the image
+ */
+std::vector<uint32_t> touched_blocks(const std::vector<dfu::segment> &segments, uint32_t address)
+{
+	std::vector<uint32_t> blocks;
+	for (const dfu::segment &seg : segments) {
+		const uint32_t first = (uint32_t)(address + seg.offset) / block_size * block_size;
+		for (uint32_t block = first; block < address + seg.offset + seg.length; block += block_size) {
+			if (blocks.empty() || blocks.back() != block) {
+				blocks.push_back(block);
+			}
+		}
+	}
+	return blocks;
+}
+
+size_t transfers(size_t length, uint32_t transfer_size)
+{
+	return (length + transfer_size - 1) / transfer_size;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	format fmt = format::dfuse;
+	bool address_set = false, dual_bank = false;
+	uint32_t address = 0, bootprot = 13, min_gap = page_size, transfer_size = page_size;
+	uint16_t vid = dfu::default_vid, pid = dfu::default_pid;
+	const char *manifest = nullptr;
+
+	enum { OPT_BOOTPROT = 0x100, OPT_DUAL_BANK };
+	static const struct option long_options[] = {
+		{"format", required_argument, nullptr, 'f'},
+		{"address", required_argument, nullptr, 'a'},
+		{"bootprot", required_argument, nullptr, OPT_BOOTPROT},
+		{"dual-bank", no_argument, nullptr, OPT_DUAL_BANK},
+		{"min-gap", required_argument, nullptr, 'g'},
+		{"transfer-size", required_argument, nullptr, 't'},
+		{"manifest", required_argument, nullptr, 'm'},
+		{"device", required_argument, nullptr, 'd'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "f:a:g:t:m:d:h", long_options, nullptr)) != -1) {
+		switch (opt) {
+		case 'f':
+			if (0 == std::strcmp(optarg, "dfuse")) {
+				fmt = format::dfuse;
+			} else if (0 == std::strcmp(optarg, "bin")) {
+				fmt = format::bin;
+			} else {
+				std::fprintf(stderr, "unknown format: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'a':
+			address = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			address_set = true;
+			break;
+		case OPT_BOOTPROT:
+			bootprot = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			if (bootprot >= 15) {
+				std::fprintf(stderr, "BOOTPROT must leave room for the bootloader (0-14)\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_DUAL_BANK:
+			dual_bank = true;
+			break;
+		case 'g':
+			min_gap = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			min_gap = std::max<uint32_t>(page_size, (min_gap + page_size - 1) / page_size * page_size);
+			break;
+		case 't':
+			transfer_size = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			if (0 == transfer_size || transfer_size > 0xFFFF) {
+				std::fprintf(stderr, "invalid transfer size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'm':
+			manifest = optarg;
+			break;
+		case 'd': {
+			unsigned int v, p;
+			if (2 != std::sscanf(optarg, "%x:%x", &v, &p) || v > 0xFFFF || p > 0xFFFF) {
+				std::fprintf(stderr, "invalid USB IDs: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			vid = (uint16_t)v;
+			pid = (uint16_t)p;
+			break;
+		}
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind + 2 != argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	const region app = {(15 - bootprot) * block_size, flash_size / (dual_bank ? 2 : 1)};
+
+	std::vector<uint8_t> input;
+	if (!read_file(argv[optind], input)) {
+		std::fprintf(stderr, "could not read %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	std::vector<dfu::element> elements;
+	const char *kind = "binary";
+	if (is_elf_file(input)) {
+		kind = "ELF";
+		const char *error = load_elf(input, elements);
+		if (error) {
+			std::fprintf(stderr, "%s: %s\n", argv[optind], error);
+			return EXIT_FAILURE;
+		}
+	} else {
+		if (dfu::suffix_check::bad_crc == dfu::strip_suffix(input)) {
+			std::fprintf(stderr, "%s: the file does not match the CRC of its DFU suffix\n", argv[optind]);
+			return EXIT_FAILURE;
+		}
+		if (dfu::is_dfuse_file(input)) {
+			kind = "DfuSe";
+			if (!dfu::parse_dfuse_file(input, 0, elements)) {
+				std::fprintf(stderr, "%s: malformed DfuSe file\n", argv[optind]);
+				return EXIT_FAILURE;
+			}
+		} else if (!input.empty()) {
+			elements.push_back(dfu::element{address_set ? address : app.start, std::move(input)});
+		}
+	}
+	size_t input_bytes = 0;
+	for (const dfu::element &e : elements) {
+		input_bytes += e.data.size();
+		if (e.address < app.start || e.address > app.end || e.data.size() > app.end - e.address) {
+			std::fprintf(stderr, "%s: data at 0x%08x-0x%08zx is outside the application region 0x%08x-0x%08x\n",
+			             argv[optind], e.address, e.address + e.data.size(), app.start, app.end);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// lay the image out in whole pages, the bytes not downloaded being erased
+	std::vector<uint8_t> image;
+	uint32_t image_address;
+	if (!dfu::flatten_elements(elements, image, image_address)) {
+		std::fprintf(stderr, "%s: overlapping segments\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	const uint32_t lead = (format::bin == fmt) ? image_address - app.start : image_address % page_size;
+	image.insert(image.begin(), lead, 0xFF);
+	image_address -= lead;
+	image.resize((image.size() + page_size - 1) / page_size * page_size, 0xFF);
+
+	std::vector<dfu::segment> segments = page_segments(image, min_gap);
+	if (segments.empty()) {
+		std::fprintf(stderr, "%s: the image holds no data\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	const size_t laid_out = image.size();
+	const size_t end = segments.back().offset + segments.back().length;
+	if (format::bin == fmt) { // plain DFU downloads write the whole image from the application start
+		segments.assign(1, dfu::segment{0, end});
+	}
+	image.resize(end);
+
+	std::vector<uint8_t> output;
+	if (format::dfuse == fmt) {
+		std::vector<dfu::element> out_elements;
+		for (const dfu::segment &seg : segments) {
+			out_elements.push_back(dfu::element{(uint32_t)(image_address + seg.offset),
+			                                    std::vector<uint8_t>(image.begin() + seg.offset, image.begin() + seg.offset + seg.length)});
+		}
+		output = dfu::dfuse_file(out_elements, 0, "Internal Flash");
+		dfu::append_suffix(output, dfu::dfuse_version, vid, pid);
+	} else {
+		output = image;
+		dfu::append_suffix(output, dfu::suffix_version, vid, pid);
+	}
+	if (!write_file(argv[optind + 1], output)) {
+		std::fprintf(stderr, "could not write %s\n", argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+
+	// the blocks as in flash after the download: with DfuSe, the blocks are erased before being written
+	const std::vector<uint32_t> blocks = touched_blocks(segments, image_address);
+	if (manifest) {
+		std::FILE *file = std::fopen(manifest, "w");
+		if (!file) {
+			std::fprintf(stderr, "could not write %s\n", manifest);
+			return EXIT_FAILURE;
+		}
+		std::fprintf(file, "# address size crc32: CRC-32 of the flash content of each block written, up to the image end\n");
+		std::vector<uint8_t> content(block_size);
+		for (uint32_t block : blocks) {
+			// up to the image end, the rest of the block not being written by plain DFU downloads
+			const size_t length = std::min<size_t>(block_size, image_address + image.size() - block);
+			const size_t start = std::max<uint32_t>(block, image_address);
+			std::fill(content.begin(), content.end(), 0xFF);
+			std::copy(image.begin() + (start - image_address), image.begin() + (block + length - image_address),
+			          content.begin() + (start - block));
+			std::fprintf(file, "0x%08x %zu 0x%08x\n", block, length, dfu::crc32(content.data(), length));
+		}
+		if (std::fclose(file)) {
+			std::fprintf(stderr, "could not write %s\n", manifest);
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t payload = 0, data_transfers = 0;
+	for (const dfu::segment &seg : segments) {
+		payload += seg.length;
+		data_transfers += transfers(seg.length, transfer_size);
+	}
+	std::printf("input: %s, %zu segment(s), %zu bytes, 0x%08x-0x%08zx\n", kind, elements.size(), input_bytes,
+	            image_address + lead, (size_t)image_address + laid_out);
+	std::printf("output: %s, %zu segment(s), %zu bytes of data (%zu erased bytes dropped), %zu bytes file, CRC 0x%08x\n",
+	            format::dfuse == fmt ? "DfuSe" : "binary", segments.size(), payload, laid_out - payload, output.size(),
+	            dfu::get_le32(&output[output.size() - 4]));
+	if (format::dfuse == fmt) {
+		// as dfu-util and osmo-dfu-bench: an erase per block, then an address and the data for each segment
+		std::printf("predicted: %zu DNLOAD (%zu erase, %zu set address, %zu data, 1 final), %zu block erases, %zu page writes\n",
+		            blocks.size() + segments.size() + data_transfers + 1, blocks.size(), segments.size(), data_transfers,
+		            blocks.size(), payload / page_size);
+	} else {
+		std::printf("predicted: %zu DNLOAD (%zu data, 1 final), %zu block erases, %zu page writes, without resumable downloads\n",
+		            data_transfers + 1, data_transfers, blocks.size(), payload / page_size);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/**
+ * \file
+ * \brief Host port of the bootloader: DMAC model, behind the DMA HPL interface (hpl_dma.h)
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+
+#include "atmel_start.h"
+#include <hpl_dma.h>
+#include "port.h"
+
+/* The descriptors hold host pointers, which do not fit in the 32-bit address registers of the DMAC:
+ * the model replaces hpl_dmac.c instead of modelling the registers.
+ * Only software triggered memory copies with 32-bit beats are modelled, as used by hpl_dma_copy.c.
+ * A transaction takes no model time: it completes when triggered, and its interrupt is served right away. */
+
+/** Descriptor of a channel */
+struct dma_model_descriptor {
+	uint8_t *      dst;
+	const uint8_t *src;
+	uint32_t       beats;
+	int            next;  /**< channel whose descriptor follows, -1 for the last one */
+	bool           valid; /**< set by _dma_enable_transaction, and by _dma_set_next_descriptor for the next one */
+};
+
+static struct dma_model_descriptor dma_descriptors[DMAC_CH_NUM];
+static struct _dma_resource        dma_resources[DMAC_CH_NUM];
+/** Transfer complete and error interrupts enabled, per channel */
+static bool dma_irq_complete[DMAC_CH_NUM];
+static bool dma_irq_error[DMAC_CH_NUM];
+
+int32_t _dma_init(void)
+{
+	memset(dma_descriptors, 0, sizeof(dma_descriptors));
+	memset(dma_resources, 0, sizeof(dma_resources));
+	memset(dma_irq_complete, 0, sizeof(dma_irq_complete));
+	memset(dma_irq_error, 0, sizeof(dma_irq_error));
+	return ERR_NONE;
+}
+
+int32_t _dma_set_destination_address(const uint8_t channel, const void *const dst)
+{
+	dma_descriptors[channel].dst = (uint8_t *)dst;
+	return ERR_NONE;
+}
+
+int32_t _dma_set_source_address(const uint8_t channel, const void *const src)
+{
+	dma_descriptors[channel].src = (const uint8_t *)src;
+	return ERR_NONE;
+}
+
+int32_t _dma_srcinc_enable(const uint8_t channel, const bool enable)
+{
+	(void)channel;
+	return enable ? ERR_NONE : ERR_UNSUPPORTED_OP;
+}
+
+int32_t _dma_dstinc_enable(const uint8_t channel, const bool enable)
+{
+	(void)channel;
+	return enable ? ERR_NONE : ERR_UNSUPPORTED_OP;
+}
+
+int32_t _dma_set_data_amount(const uint8_t channel, const uint32_t amount)
+{
+	dma_descriptors[channel].beats = amount;
+	return ERR_NONE;
+}
+
+int32_t _dma_set_next_descriptor(const uint8_t current_channel, const uint8_t next_channel)
+{
+	dma_descriptors[current_channel].next = next_channel;
+	dma_descriptors[next_channel].valid   = true;
+	return ERR_NONE;
+}
+
+int32_t _dma_set_last_descriptor(const uint8_t channel)
+{
+	dma_descriptors[channel].next = -1;
+	return ERR_NONE;
+}
+
+/** Copy the block of a descriptor, 32-bit beat by beat: the page buffer is loaded through the NVMCTRL model */
+static void dma_model_block(const struct dma_model_descriptor *d)
+{
+	const uintptr_t flash = (uintptr_t)nvm_model_flash;
+	uint32_t        i;
+
+	for (i = 0; i < d->beats; i++) {
+		const uintptr_t dst = (uintptr_t)d->dst + i * 4;
+		uint32_t        word;
+
+		memcpy(&word, d->src + i * 4, sizeof(word));
+		if (dst >= flash && dst < flash + FLASH_SIZE) {
+			nvm_model_load((uint32_t)(dst - flash), word);
+			port_stats.dma_buffer_loads++;
+		} else {
+			memcpy((void *)dst, &word, sizeof(word));
+		}
+	}
+	port_stats.dma_bytes += d->beats * 4;
+}
+
+int32_t _dma_enable_transaction(const uint8_t channel, const bool software_trigger)
+{
+	int c = channel;
+
+	if (!software_trigger) { // peripheral triggers are not modelled
+		return ERR_UNSUPPORTED_OP;
+	}
+	dma_descriptors[channel].valid = true;
+	while (c >= 0 && dma_descriptors[c].valid) {
+		dma_model_block(&dma_descriptors[c]);
+		c = dma_descriptors[c].next;
+	}
+	port_stats.dma_transactions++;
+	if (dma_irq_complete[channel] && dma_resources[channel].dma_cb.transfer_done) {
+		dma_resources[channel].dma_cb.transfer_done(&dma_resources[channel]);
+	}
+	return ERR_NONE;
+}
+
+int32_t _dma_get_transaction_status(const uint8_t channel)
+{
+	(void)channel;
+	return ERR_NONE; // complete once triggered
+}
+
+int32_t _dma_get_channel_resource(struct _dma_resource **resource, const uint8_t channel)
+{
+	*resource = &dma_resources[channel];
+	return ERR_NONE;
+}
+
+void _dma_set_irq_state(const uint8_t channel, const enum _dma_callback_type type, const bool state)
+{
+	if (DMA_TRANSFER_COMPLETE_CB == type) {
+		dma_irq_complete[channel] = state;
+	} else if (DMA_TRANSFER_ERROR_CB == type) {
+		dma_irq_error[channel] = state;
+	}
+}
@@ -0,0 +1,63 @@
+/**
+ * \file
+ * \brief GPIO functions for building the bootloader sources on the host
+ *
+ * This replaces hpl/port/hpl_gpio_base.h. There is no PORT model: pin accesses do nothing and pins read low.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+static inline void _gpio_set_direction(const enum gpio_port port, const uint32_t mask,
+                                       const enum gpio_direction direction)
+{
+	(void)port;
+	(void)mask;
+	(void)direction;
+}
+
+static inline void _gpio_set_level(const enum gpio_port port, const uint32_t mask, const bool level)
+{
+	(void)port;
+	(void)mask;
+	(void)level;
+}
+
+static inline void _gpio_toggle_level(const enum gpio_port port, const uint32_t mask)
+{
+	(void)port;
+	(void)mask;
+}
+
+static inline uint32_t _gpio_get_level(const enum gpio_port port)
+{
+	(void)port;
+	return 0;
+}
+
+static inline void _gpio_set_pin_pull_mode(const enum gpio_port port, const uint8_t pin,
+                                           const enum gpio_pull_mode pull_mode)
+{
+	(void)port;
+	(void)pin;
+	(void)pull_mode;
+}
+
+static inline void _gpio_set_pin_function(const uint32_t gpio, const uint32_t function)
+{
+	(void)gpio;
+	(void)function;
+}
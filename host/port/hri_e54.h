@@ -0,0 +1,145 @@
+/**
+ * \file
+ * \brief Register interface for building the bootloader sources on the host
+ *
+ * This replaces hri/hri_e54.h: only the NVMCTRL, CMCC, DSU and PAC are available, and the accesses starting commands go to the models.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_HRI_E54_H
+#define HOST_HRI_E54_H
+
+#include "same54.h"
+
+/* use the real register interface, except for the accesses which trigger the NVMCTRL model */
+#define hri_nvmctrl_get_STATUS_READY_bit hri_nvmctrl_get_STATUS_READY_bit_unused
+#define hri_nvmctrl_get_STATUS_reg hri_nvmctrl_get_STATUS_reg_unused
+#define hri_nvmctrl_write_CTRLB_reg hri_nvmctrl_write_CTRLB_reg_unused
+#define hri_nvmctrl_clear_INTFLAG_DONE_bit hri_nvmctrl_clear_INTFLAG_DONE_bit_unused
+#define hri_nvmctrl_clear_INTFLAG_reg hri_nvmctrl_clear_INTFLAG_reg_unused
+#define hri_nvmctrl_write_INTEN_DONE_bit hri_nvmctrl_write_INTEN_DONE_bit_unused
+#define hri_nvmctrl_write_INTEN_reg hri_nvmctrl_write_INTEN_reg_unused
+#define hri_nvmctrl_clear_INTEN_reg hri_nvmctrl_clear_INTEN_reg_unused
+#define hri_nvmctrl_get_SEESTAT_BUSY_bit hri_nvmctrl_get_SEESTAT_BUSY_bit_unused
+#include "hri_nvmctrl_e54.h"
+#undef hri_nvmctrl_get_STATUS_READY_bit
+#undef hri_nvmctrl_get_STATUS_reg
+#undef hri_nvmctrl_write_CTRLB_reg
+#undef hri_nvmctrl_clear_INTFLAG_DONE_bit
+#undef hri_nvmctrl_clear_INTFLAG_reg
+#undef hri_nvmctrl_write_INTEN_DONE_bit
+#undef hri_nvmctrl_write_INTEN_reg
+#undef hri_nvmctrl_clear_INTEN_reg
+#undef hri_nvmctrl_get_SEESTAT_BUSY_bit
+
+/* the firmware only reads the READY bit in busy loops, the model lets the time pass until the command completes */
+static inline bool hri_nvmctrl_get_STATUS_READY_bit(const void *const hw)
+{
+	(void)hw;
+	return nvm_model_ready();
+}
+
+/* likewise for the SmartEEPROM writes */
+static inline bool hri_nvmctrl_get_SEESTAT_BUSY_bit(const void *const hw)
+{
+	(void)hw;
+	return nvm_model_see_busy();
+}
+
+/* polling the whole register does not wait */
+static inline hri_nvmctrl_status_reg_t hri_nvmctrl_get_STATUS_reg(const void *const hw, hri_nvmctrl_status_reg_t mask)
+{
+	(void)hw;
+	return nvm_model_status() & mask;
+}
+
+static inline void hri_nvmctrl_write_CTRLB_reg(const void *const hw, hri_nvmctrl_ctrlb_reg_t data)
+{
+	(void)hw;
+	nvm_model_command(data);
+}
+
+/* the interrupt flags are cleared by writing one, and INTENSET holds the enabled interrupts (INTENCLR is not used) */
+static inline void hri_nvmctrl_clear_INTFLAG_reg(const void *const hw, hri_nvmctrl_intflag_reg_t mask)
+{
+	((Nvmctrl *)hw)->INTFLAG.reg &= ~mask;
+}
+
+static inline void hri_nvmctrl_clear_INTFLAG_DONE_bit(const void *const hw)
+{
+	hri_nvmctrl_clear_INTFLAG_reg(hw, NVMCTRL_INTFLAG_DONE);
+}
+
+static inline void hri_nvmctrl_write_INTEN_reg(const void *const hw, hri_nvmctrl_intenset_reg_t data)
+{
+	((Nvmctrl *)hw)->INTENSET.reg = data;
+}
+
+static inline void hri_nvmctrl_clear_INTEN_reg(const void *const hw, hri_nvmctrl_intenset_reg_t mask)
+{
+	((Nvmctrl *)hw)->INTENSET.reg &= ~mask;
+}
+
+static inline void hri_nvmctrl_write_INTEN_DONE_bit(const void *const hw, bool value)
+{
+	if (value) {
+		((Nvmctrl *)hw)->INTENSET.reg |= NVMCTRL_INTENSET_DONE;
+	} else {
+		hri_nvmctrl_clear_INTEN_reg(hw, NVMCTRL_INTENSET_DONE);
+	}
+}
+
+#define hri_cmcc_get_SR_CSTS_bit hri_cmcc_get_SR_CSTS_bit_unused
+#define hri_cmcc_write_CTRL_reg hri_cmcc_write_CTRL_reg_unused
+#define hri_cmcc_write_MAINT0_reg hri_cmcc_write_MAINT0_reg_unused
+#include "hri_cmcc_e54.h"
+#undef hri_cmcc_get_SR_CSTS_bit
+#undef hri_cmcc_write_CTRL_reg
+#undef hri_cmcc_write_MAINT0_reg
+
+static inline bool hri_cmcc_get_SR_CSTS_bit(const void *const hw)
+{
+	(void)hw;
+	return port_cmcc_enabled();
+}
+
+static inline void hri_cmcc_write_CTRL_reg(const void *const hw, hri_cmcc_ctrl_reg_t data)
+{
+	(void)hw;
+	port_cmcc_control(data);
+}
+
+static inline void hri_cmcc_write_MAINT0_reg(const void *const hw, hri_cmcc_maint0_reg_t data)
+{
+	(void)hw;
+	if (data & CMCC_MAINT0_INVALL) {
+		port_cmcc_invalidate();
+	}
+}
+
+#define hri_dsu_write_CTRL_reg hri_dsu_write_CTRL_reg_unused
+#include "hri_dsu_e54.h"
+#undef hri_dsu_write_CTRL_reg
+#include "hri_pac_e54.h"
+
+static inline void hri_dsu_write_CTRL_reg(const void *const hw, hri_dsu_ctrl_reg_t data)
+{
+	(void)hw;
+	port_dsu_command(data);
+}
+
+#endif /* HOST_HRI_E54_H */
@@ -0,0 +1,368 @@
+/**
+ * \file
+ * \brief Timed model of the SAM D5x/E5x NVMCTRL
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <err_codes.h>
+
+#include "nvm_model.h"
+#include "port.h"
+
+/** Main array, user row and SmartEEPROM, unless they are mapped */
+static uint8_t nvm_model_ram[FLASH_SIZE + NVMCTRL_PAGE_SIZE + NVM_MODEL_SEE_SIZE] __attribute__((aligned(4)));
+uint8_t *      nvm_model_flash = nvm_model_ram;
+uint8_t *      nvm_model_user  = &nvm_model_ram[FLASH_SIZE];
+uint8_t *      nvm_model_see   = &nvm_model_ram[FLASH_SIZE + NVMCTRL_PAGE_SIZE];
+Nvmctrl nvm_model_hw;
+
+struct nvm_model_stats nvm_model_stats;
+
+/** Write access to the registers which are read-only for the firmware */
+#define NVM_MODEL_STATUS (*(volatile uint16_t *)&nvm_model_hw.STATUS.reg)
+#define NVM_MODEL_PARAM (*(volatile uint32_t *)&nvm_model_hw.PARAM.reg)
+#define NVM_MODEL_RUNLOCK (*(volatile uint32_t *)&nvm_model_hw.RUNLOCK.reg)
+#define NVM_MODEL_SEESTAT (*(volatile uint32_t *)&nvm_model_hw.SEESTAT.reg)
+
+/** Configuration of the model */
+static struct nvm_model_params nvm_params;
+/** Model time at which the current command completes */
+static uint64_t nvm_busy_until;
+/** Address of the current command, giving the bank which is busy */
+static uint32_t nvm_busy_addr;
+/** Model time at which the last SmartEEPROM write completes */
+static uint64_t nvm_see_busy_until;
+/** If INTFLAG.DONE is raised once the current command completes */
+static bool nvm_done_pending;
+/** The CMCC may hold content of the flash modified by the current or last command: set when it starts with the cache
+ *  enabled, cleared by an invalidation of the cache once it completed */
+static bool nvm_cache_stale;
+/** Page buffer of the main array (the user row is written directly) */
+static uint8_t nvm_page_buffer[NVMCTRL_PAGE_SIZE];
+
+void nvm_model_init(const struct nvm_model_params *params)
+{
+	nvm_params     = *params;
+	nvm_busy_until   = 0;
+	nvm_busy_addr    = 0;
+	nvm_done_pending = false;
+	nvm_cache_stale  = false;
+	nvm_see_busy_until = 0;
+	memset(&nvm_model_stats, 0, sizeof(nvm_model_stats));
+	memset(&nvm_model_hw, 0, sizeof(nvm_model_hw));
+	if (nvm_model_flash == nvm_model_ram) {
+		memset(nvm_model_ram, 0xFF, sizeof(nvm_model_ram));
+	}
+	memset(nvm_page_buffer, 0xFF, sizeof(nvm_page_buffer));
+
+	NVM_MODEL_STATUS  = NVMCTRL_STATUS_READY | NVMCTRL_STATUS_AFIRST | NVMCTRL_STATUS_BOOTPROT(params->bootprot);
+	NVM_MODEL_PARAM   = NVMCTRL_PARAM_NVMP(FLASH_NB_OF_PAGES) | NVMCTRL_PARAM_PSZ(3); // 512 bytes pages
+	NVM_MODEL_RUNLOCK = 0xFFFFFFFF; // all regions unlocked
+	NVM_MODEL_SEESTAT = NVMCTRL_SEESTAT_SBLK(params->see_sblk) | NVMCTRL_SEESTAT_PSZ(0); // 4-byte SmartEEPROM pages
+}
+
+int32_t nvm_model_map(const char *path)
+{
+	const off_t size = FLASH_SIZE + NVMCTRL_PAGE_SIZE + NVM_MODEL_SEE_SIZE;
+	struct stat st = {.st_size = 0};
+	uint8_t *   map;
+	int         fd = -1;
+
+	if (NULL == path) { // shared with the child processes
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	} else {
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0 || fstat(fd, &st) < 0 || (st.st_size < size && ftruncate(fd, size) < 0)) {
+			perror(path);
+			if (fd >= 0) {
+				close(fd);
+			}
+			return ERR_IO;
+		}
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd); // the mapping keeps the file open
+	}
+	if (MAP_FAILED == map) {
+		perror(path ? path : "mmap");
+		return ERR_IO;
+	}
+	if (st.st_size < size) {
+		memset(&map[st.st_size], 0xFF, size - st.st_size);
+	}
+	nvm_model_flash = map;
+	nvm_model_user  = &map[FLASH_SIZE];
+	nvm_model_see   = &map[FLASH_SIZE + NVMCTRL_PAGE_SIZE];
+	return ERR_NONE;
+}
+
+/** Raise INTFLAG.DONE if the current command completed */
+static void nvm_model_complete(void)
+{
+	if (nvm_done_pending && port_now() >= nvm_busy_until) {
+		nvm_model_hw.INTFLAG.reg |= NVMCTRL_INTFLAG_DONE;
+		nvm_done_pending = false;
+	}
+}
+
+bool nvm_model_ready(void)
+{
+	nvm_model_stats.status_reads++;
+	while (port_now() < nvm_busy_until) {
+		port_wait_until(nvm_busy_until); // the CPU spins on the READY bit, interrupts are still served (and may suspend the operation)
+	}
+	NVM_MODEL_STATUS |= NVMCTRL_STATUS_READY;
+	nvm_model_complete();
+	return true;
+}
+
+uint16_t nvm_model_status(void)
+{
+	nvm_model_stats.status_reads++;
+	if (port_now() >= nvm_busy_until) {
+		NVM_MODEL_STATUS |= NVMCTRL_STATUS_READY;
+		nvm_model_complete();
+	}
+	return NVM_MODEL_STATUS;
+}
+
+/** Start an operation at the given address, the controller being busy for the given duration */
+static void nvm_model_start(uint32_t addr, uint32_t duration)
+{
+	nvm_model_complete(); // the previous command completed before this one could start
+	nvm_busy_until = port_time_ns + duration;
+	nvm_busy_addr  = addr;
+	nvm_model_stats.busy_ns += duration;
+	if (duration) {
+		NVM_MODEL_STATUS &= ~NVMCTRL_STATUS_READY;
+		nvm_done_pending = true;
+	} else {
+		nvm_model_hw.INTFLAG.reg |= NVMCTRL_INTFLAG_DONE;
+	}
+}
+
+/** A command modifying the flash (erase or write) starts */
+static void nvm_model_modify(void)
+{
+	if (nvm_cache_stale) { // the previous modification was not followed by an invalidation once completed
+		nvm_model_stats.stale_cache++;
+	}
+	nvm_cache_stale = port_cmcc_enabled();
+}
+
+void nvm_model_cache_invalidated(void)
+{
+	if (port_now() >= nvm_busy_until) { // else lines read while the command runs survive the invalidation
+		nvm_cache_stale = false;
+	}
+}
+
+/** Write the page buffer content at the given address (bits can only be cleared), and clear the written part of the buffer */
+static void nvm_model_write(uint32_t addr, uint32_t length)
+{
+	const uint32_t offset = addr % NVMCTRL_PAGE_SIZE;
+	uint32_t       i;
+
+	if (addr + length > FLASH_SIZE) {
+		return;
+	}
+	for (i = 0; i < length; i++) {
+		nvm_model_flash[addr + i] &= nvm_page_buffer[offset + i];
+		nvm_page_buffer[offset + i] = 0xFF;
+	}
+}
+
+void nvm_model_load(uint32_t addr, uint32_t data)
+{
+	const uint32_t offset = addr % NVMCTRL_PAGE_SIZE;
+	const uint32_t wmode  = (nvm_model_hw.CTRLA.reg & NVMCTRL_CTRLA_WMODE_Msk) >> NVMCTRL_CTRLA_WMODE_Pos;
+	uint32_t       granule;
+
+	nvm_model_stats.buffer_loads++;
+	if (port_now() < nvm_busy_until) {
+		nvm_model_stats.busy_commands++;
+		nvm_model_hw.INTFLAG.reg |= NVMCTRL_INTFLAG_PROGE;
+		return;
+	}
+	memcpy(&nvm_page_buffer[offset & ~3], &data, sizeof(data));
+	nvm_model_hw.ADDR.reg = addr; // updated by the page buffer loads
+
+	switch (wmode) {
+	case NVMCTRL_CTRLA_WMODE_AP_Val: // the last word of the page starts the write
+		if (NVMCTRL_PAGE_SIZE - 4 == (offset & ~3)) {
+			nvm_model_modify();
+			nvm_model_write(addr & ~(NVMCTRL_PAGE_SIZE - 1), NVMCTRL_PAGE_SIZE);
+			nvm_model_stats.page_writes++;
+			nvm_model_start(addr, nvm_params.page_write_ns);
+		}
+		break;
+	case NVMCTRL_CTRLA_WMODE_AQW_Val:
+	case NVMCTRL_CTRLA_WMODE_ADW_Val: // the last word of the quad (double) word starts the write
+		granule = (NVMCTRL_CTRLA_WMODE_AQW_Val == wmode) ? 16 : 8;
+		if (granule - 4 == (offset & (granule - 1) & ~3)) {
+			nvm_model_modify();
+			nvm_model_write(addr & ~(granule - 1), granule);
+			nvm_model_stats.quad_word_writes++;
+			nvm_model_start(addr, nvm_params.quad_word_write_ns);
+		}
+		break;
+	default: // manual write
+		break;
+	}
+}
+
+/** Exchange the two banks of the main array, as seen at address 0 */
+static void nvm_model_swap_banks(void)
+{
+	uint8_t  tmp[NVMCTRL_BLOCK_SIZE];
+	uint32_t addr;
+
+	for (addr = 0; addr < FLASH_SIZE / 2; addr += sizeof(tmp)) {
+		memcpy(tmp, &nvm_model_flash[addr], sizeof(tmp));
+		memcpy(&nvm_model_flash[addr], &nvm_model_flash[FLASH_SIZE / 2 + addr], sizeof(tmp));
+		memcpy(&nvm_model_flash[FLASH_SIZE / 2 + addr], tmp, sizeof(tmp));
+	}
+}
+
+void nvm_model_command(uint16_t ctrlb)
+{
+	const uint32_t addr = nvm_model_hw.ADDR.reg;
+	uint32_t       duration;
+
+	nvm_model_stats.commands++;
+	if ((ctrlb & NVMCTRL_CTRLB_CMDEX_Msk) != NVMCTRL_CTRLB_CMDEX_KEY) {
+		nvm_model_hw.INTFLAG.reg |= NVMCTRL_INTFLAG_PROGE; // command is ignored without key
+		return;
+	}
+	if (port_now() < nvm_busy_until) {
+		nvm_model_stats.busy_commands++;
+		nvm_model_hw.INTFLAG.reg |= NVMCTRL_INTFLAG_PROGE;
+		return;
+	}
+
+	switch (ctrlb & NVMCTRL_CTRLB_CMD_Msk) {
+	case NVMCTRL_CTRLB_CMD_EB:
+		if (addr < FLASH_SIZE) {
+			memset(&nvm_model_flash[addr & ~(NVMCTRL_BLOCK_SIZE - 1)], 0xFF, NVMCTRL_BLOCK_SIZE);
+		}
+		nvm_model_modify();
+		nvm_model_stats.block_erases++;
+		duration = nvm_params.block_erase_ns;
+		break;
+	case NVMCTRL_CTRLB_CMD_WP:
+		nvm_model_modify();
+		nvm_model_write(addr & ~(NVMCTRL_PAGE_SIZE - 1), NVMCTRL_PAGE_SIZE);
+		nvm_model_stats.page_writes++;
+		duration = nvm_params.page_write_ns;
+		break;
+	case NVMCTRL_CTRLB_CMD_EP: // only used for the user row
+		nvm_model_modify();
+		if ((uint32_t)NVMCTRL_USER == addr) {
+			memset(nvm_model_user, 0xFF, NVMCTRL_PAGE_SIZE);
+			nvm_model_stats.user_row_erases++;
+		}
+		duration = nvm_params.block_erase_ns; // assumed to take as long as a block erase
+		break;
+	case NVMCTRL_CTRLB_CMD_WQW: // only used for the user row, which is written directly
+		nvm_model_modify();
+		nvm_model_stats.quad_word_writes++;
+		duration = nvm_params.quad_word_write_ns;
+		break;
+	case NVMCTRL_CTRLB_CMD_PBC:
+		memset(nvm_page_buffer, 0xFF, sizeof(nvm_page_buffer));
+		nvm_model_stats.page_buffer_clears++;
+		duration = nvm_params.page_buffer_clear_ns;
+		break;
+	case NVMCTRL_CTRLB_CMD_BKSWRST: // the flash array keeps the mapped view: exchange the halves
+		nvm_model_swap_banks();
+		nvm_model_stats.bank_swaps++;
+		NVM_MODEL_STATUS ^= NVMCTRL_STATUS_AFIRST;
+		NVIC_SystemReset();
+		duration = 0;
+		break;
+	default: // other commands (lock, user page, SmartEEPROM) complete immediately
+		duration = 0;
+		break;
+	}
+
+	nvm_model_start(addr, duration);
+}
+
+void nvm_model_see_write(uintptr_t addr, uint32_t data)
+{
+	const uintptr_t offset = addr - (uintptr_t)nvm_model_see;
+
+	if (0 == nvm_params.see_sblk || offset > NVM_MODEL_SEE_SIZE - 4 || port_now() < nvm_see_busy_until) {
+		nvm_model_stats.busy_commands++; // ignored by the NVMCTRL
+		return;
+	}
+	memcpy(&nvm_model_see[offset & ~3], &data, sizeof(data)); // the page is rewritten in another place, without erasing the old one first
+	nvm_model_stats.see_writes++;
+	nvm_model_stats.busy_ns += nvm_params.quad_word_write_ns;
+	nvm_see_busy_until = port_now() + nvm_params.quad_word_write_ns; // programming the page takes as long as a quad word
+}
+
+bool nvm_model_see_busy(void)
+{
+	nvm_model_stats.status_reads++;
+	while (port_now() < nvm_see_busy_until) {
+		port_wait_until(nvm_see_busy_until);
+	}
+	return false;
+}
+
+void nvm_model_fetch(void)
+{
+	const uint64_t now = port_now();
+
+	if (now >= nvm_busy_until || nvm_busy_addr >= FLASH_SIZE / 2) {
+		return; // the other bank can be read while an operation runs
+	}
+	if (nvm_model_hw.CTRLA.reg & NVMCTRL_CTRLA_SUSPEN) { // the read preempts the operation, which resumes after it
+		nvm_busy_until += nvm_params.suspend_ns;
+		nvm_model_stats.busy_ns += nvm_params.suspend_ns;
+		nvm_model_stats.suspends++;
+		nvm_model_hw.INTFLAG.reg |= NVMCTRL_INTFLAG_SUSP;
+		port_wait_until(now + nvm_params.suspend_ns);
+	} else {
+		nvm_model_stats.fetch_stall_ns += nvm_busy_until - now;
+		port_wait_until(nvm_busy_until);
+	}
+}
+
+uint64_t nvm_model_irq_due(void)
+{
+	if (!(nvm_model_hw.INTENSET.reg & NVMCTRL_INTENSET_DONE)) {
+		return PORT_TIME_NEVER;
+	}
+	if (nvm_model_hw.INTFLAG.reg & NVMCTRL_INTFLAG_DONE) {
+		return port_time_ns;
+	}
+	return nvm_done_pending ? nvm_busy_until : PORT_TIME_NEVER;
+}
+
+void nvm_model_irq(void)
+{
+	nvm_model_complete();
+	NVMCTRL_0_Handler();
+}
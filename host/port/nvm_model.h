@@ -0,0 +1,129 @@
+/**
+ * \file
+ * \brief Timed model of the SAM D5x/E5x NVMCTRL
+ *
+ * Commands written to CTRLB make the controller busy for the configured time and are counted.
+ * The main array, the user row and the SmartEEPROM are host buffers (nvm_model_flash, nvm_model_user, nvm_model_see), optionally backed by a file.
+ * SmartEEPROM writes keep SEESTAT.BUSY set for a quad word write; its sector reallocations are not modelled.
+ * Words loaded in the page buffer are programmed by the write commands, or by the automatic write modes.
+ * Reads of the bank being erased or written (instruction fetches at interrupt entry, see nvm_model_fetch())
+ * wait for the end of the operation, or suspend it if CTRLA.SUSPEN is set.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_NVM_MODEL_H
+#define HOST_NVM_MODEL_H
+
+#include <compiler.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of the SmartEEPROM of the model: the smallest allocation, whatever the SEESBLK value */
+#define NVM_MODEL_SEE_SIZE 512
+
+/** Timing and configuration of the NVMCTRL model */
+struct nvm_model_params {
+	uint32_t block_erase_ns;      /**< duration of the EB (erase block) command */
+	uint32_t page_write_ns;       /**< duration of the WP (write page) command */
+	uint32_t quad_word_write_ns;  /**< duration of the WQW (write quad word) command */
+	uint32_t page_buffer_clear_ns; /**< duration of the PBC (page buffer clear) command */
+	uint32_t suspend_ns;          /**< time to suspend an erase or write for a read of the same bank, and to resume it */
+	uint8_t  bootprot;            /**< BOOTPROT fuse value reported in STATUS */
+	uint8_t  see_sblk;            /**< SEESBLK fuse value reported in SEESTAT, 0 if no SmartEEPROM is allocated */
+};
+
+/** Operations executed by the NVMCTRL model */
+struct nvm_model_stats {
+	uint32_t block_erases;
+	uint32_t page_writes;
+	uint32_t quad_word_writes;
+	uint32_t page_buffer_clears;
+	uint32_t bank_swaps;
+	uint32_t user_row_erases;
+	uint32_t see_writes;    /**< words written in the SmartEEPROM */
+	uint32_t suspends;      /**< operations suspended by a read of the same bank */
+	uint32_t commands;      /**< commands written to CTRLB */
+	uint32_t status_reads;  /**< reads of the STATUS register, a busy wait counting as one */
+	uint32_t buffer_loads;  /**< 32-bit words loaded in the page buffer */
+	uint32_t busy_commands; /**< commands issued (or words loaded) while the controller was busy (programming errors) */
+	uint64_t busy_ns;       /**< total time the controller was busy */
+	uint64_t fetch_stall_ns; /**< time the CPU waited to read the bank being erased or written */
+	uint32_t stale_cache;   /**< erases and writes not followed by a CMCC invalidation once completed, before the next one */
+};
+
+/** Counters since the last nvm_model_init() */
+extern struct nvm_model_stats nvm_model_stats;
+
+/**
+ * \brief Reset the NVMCTRL model: registers, counters, and erase the whole flash, user row and SmartEEPROM unless they are mapped
+ * \param[in] params Timing and configuration, copied
+ */
+void nvm_model_init(const struct nvm_model_params *params);
+
+/**
+ * \brief Back the main array, the user row and the SmartEEPROM with memory mapped from a file, so that their content persists across runs
+ *
+ * The file holds the main array followed by the user row and the SmartEEPROM.
+ * It is created or extended to FLASH_SIZE + NVMCTRL_PAGE_SIZE + NVM_MODEL_SEE_SIZE,
+ * new bytes being erased (0xFF). Without file, the memory is shared with the child processes forked afterwards,
+ * so that the content persists across sessions run in child processes.
+ * Call before nvm_model_init().
+ * \param[in] path File to map, or NULL for anonymous memory
+ * \return Operation status
+ * \retval ERR_NONE The flash is backed by the file
+ * \retval ERR_IO The file could not be created or mapped
+ */
+int32_t nvm_model_map(const char *path);
+
+/**
+ * \brief The CPU reads the bank holding the bootloader (the lower half of the flash)
+ *
+ * Called at interrupt entry: the vector table and the handlers are read from the flash,
+ * while the main loop is assumed to run from the cache.
+ * If an erase or write is running in this bank, the read waits for its end,
+ * or suspends it for the suspend time if CTRLA.SUSPEN is set.
+ */
+void nvm_model_fetch(void);
+
+/**
+ * \brief All CMCC lines are invalidated
+ *
+ * Only an invalidation once the current erase or write completed drops the content it modified:
+ * lines filled while it runs would else survive it (see nvm_model_stats.stale_cache).
+ */
+void nvm_model_cache_invalidated(void);
+
+/**
+ * \brief Model time at which the NVMCTRL interrupt is due
+ *
+ * Only the DONE interrupt is modelled: INTFLAG.DONE is raised when a command completes.
+ * \return Model time, PORT_TIME_NEVER if the interrupt is disabled or no command is running
+ */
+uint64_t nvm_model_irq_due(void);
+
+/**
+ * \brief Serve the NVMCTRL interrupt (NVMCTRL_0_Handler), once due
+ */
+void nvm_model_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_NVM_MODEL_H */
@@ -0,0 +1,320 @@
+/**
+ * \file
+ * \brief Host port of the bootloader: model time, interrupt dispatching and board support
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#define _GNU_SOURCE // ppoll()
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "atmel_start.h"
+#include "nvm_model.h"
+#include "port.h"
+
+uint64_t port_time_ns;
+bool     port_reset_requested;
+bool     port_stopped;
+struct port_stats port_stats;
+Cmcc     port_cmcc;
+Dsu      port_dsu;
+Pac      port_pac;
+uint32_t port_serial_number[4] = {0x504f5254, 0x484f5354, 0x4d4f4445, 0x4c000001};
+uint8_t  port_dfu_staging[PORT_DFU_STAGING_SIZE] __attribute__((aligned(4)));
+
+/** Interrupt source, if any */
+static struct port_irq_source irq_source;
+/** Set while an interrupt is served, since interrupts do not nest */
+static bool in_irq;
+/** Model time at which the last interrupt was taken, and at which its handler started to run */
+static uint64_t irq_taken_ns;
+static uint64_t irq_served_ns;
+/** Set while the interrupt handlers are in the CMCC: loaded by the first interrupt once the cache is enabled, dropped by invalidations */
+static bool irq_cached;
+/** Host monotonic clock at port_init() in real time mode, 0 in model time mode */
+static uint64_t real_time_epoch;
+
+/** Host monotonic clock, in nanoseconds */
+static uint64_t port_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void port_init(const struct port_irq_source *source)
+{
+	port_time_ns         = 0;
+	port_reset_requested = false;
+	port_stopped         = false;
+	in_irq               = false;
+	irq_taken_ns         = 0;
+	irq_served_ns        = 0;
+	irq_cached           = false;
+	port_cmcc.CTRL.reg   = 0;
+	real_time_epoch      = 0;
+	memset(&port_stats, 0, sizeof(port_stats));
+	if (source) {
+		irq_source = *source;
+	} else {
+		irq_source.due     = NULL;
+		irq_source.handler = NULL;
+		irq_source.fd      = -1;
+	}
+	if (irq_source.fd >= 0) {
+		real_time_epoch = port_clock() - 1; // model time 0 is reserved for "not started"
+	}
+}
+
+uint64_t port_now(void)
+{
+	if (real_time_epoch) {
+		port_time_ns = port_clock() - real_time_epoch;
+	}
+	return port_time_ns;
+}
+
+/** Serve an interrupt, at the current model time */
+static void port_serve(bool nvm)
+{
+	in_irq        = true;
+	irq_taken_ns  = port_time_ns;
+	if (irq_cached && port_cmcc_enabled()) {
+		port_stats.cache_hits++;
+	} else {
+		nvm_model_fetch(); // the interrupt handler is read from the flash
+		irq_cached = port_cmcc_enabled();
+	}
+	irq_served_ns = port_now();
+	if (nvm) {
+		nvm_model_irq();
+	} else {
+		irq_source.handler(irq_source.context);
+	}
+	in_irq = false;
+}
+
+/**
+ * \brief Sleep until the interrupt file descriptor is readable, the NVMCTRL interrupt or the given model time, and serve the interrupt
+ * \return false if no interrupt has been served
+ */
+static bool port_real_time_wait(uint64_t time_ns)
+{
+	struct pollfd   pfd     = {.fd = irq_source.fd, .events = POLLIN};
+	const uint64_t  nvm_due = in_irq ? PORT_TIME_NEVER : nvm_model_irq_due();
+	const uint64_t  wake_ns = (nvm_due < time_ns) ? nvm_due : time_ns;
+	struct timespec timeout;
+	uint64_t        now = port_now();
+	int             rc;
+
+	if (wake_ns != PORT_TIME_NEVER) {
+		if (now >= wake_ns) {
+			if (now < nvm_due) {
+				return false;
+			}
+			port_serve(true);
+			return true;
+		}
+		timeout.tv_sec  = (time_t)((wake_ns - now) / 1000000000);
+		timeout.tv_nsec = (long)((wake_ns - now) % 1000000000);
+	}
+	if (in_irq) { // interrupts do not nest: only let the time pass
+		if (wake_ns != PORT_TIME_NEVER) {
+			nanosleep(&timeout, NULL);
+		}
+		port_now();
+		return false;
+	}
+	rc = ppoll(&pfd, 1, (wake_ns == PORT_TIME_NEVER) ? NULL : &timeout, NULL);
+	port_now();
+	if (rc < 0 && errno != EINTR) {
+		perror("ppoll");
+		abort();
+	}
+	if (rc <= 0 || !(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+		if (rc == 0 && port_time_ns >= nvm_due) {
+			port_serve(true);
+			return true;
+		}
+		return false;
+	}
+	port_serve(false);
+	return true;
+}
+
+/**
+ * \brief Time of the next interrupt, PORT_TIME_NEVER if none can be served now
+ * \param[out] nvm If the interrupt is the one of the NVMCTRL model
+ */
+static uint64_t port_next_irq(bool *nvm)
+{
+	uint64_t due     = PORT_TIME_NEVER;
+	uint64_t nvm_due = PORT_TIME_NEVER;
+
+	if (!in_irq) {
+		if (irq_source.due) {
+			due = irq_source.due(irq_source.context);
+		}
+		nvm_due = nvm_model_irq_due();
+	}
+	*nvm = nvm_due < due;
+	return *nvm ? nvm_due : due;
+}
+
+/** Serve the interrupt due at the given time */
+static void port_serve_irq(uint64_t due, bool nvm)
+{
+	if (due > port_time_ns) {
+		port_time_ns = due;
+	}
+	port_serve(nvm);
+}
+
+void port_wait_until(uint64_t time_ns)
+{
+	uint64_t due;
+	bool     nvm;
+
+	if (real_time_epoch) {
+		while (port_now() < time_ns) {
+			port_real_time_wait(time_ns);
+		}
+		return;
+	}
+	while ((due = port_next_irq(&nvm)) <= time_ns) {
+		port_serve_irq(due, nvm);
+	}
+	if (time_ns > port_time_ns) {
+		port_time_ns = time_ns;
+	}
+}
+
+bool port_idle(void)
+{
+	uint64_t due;
+	bool     nvm;
+
+	if (real_time_epoch) {
+		return port_real_time_wait(PORT_TIME_NEVER);
+	}
+	due = port_next_irq(&nvm);
+	if (PORT_TIME_NEVER == due) {
+		return false;
+	}
+	port_serve_irq(due, nvm);
+	return true;
+}
+
+int port_sleep(const uint8_t mode)
+{
+	const uint64_t asleep_ns = port_now();
+	uint64_t       wake_ns;
+
+	(void)mode; // the peripherals are modelled as running in any mode
+	if (!port_idle()) {
+		port_stopped = true; // the firmware would sleep forever
+		return ERR_NONE;
+	}
+	wake_ns = irq_served_ns - irq_taken_ns;
+	port_stats.sleeps++;
+	port_stats.sleep_ns += irq_taken_ns - asleep_ns;
+	port_stats.wake_ns += wake_ns;
+	if (wake_ns > port_stats.wake_max_ns) {
+		port_stats.wake_max_ns = wake_ns;
+	}
+	return ERR_NONE;
+}
+
+void NVIC_SystemReset(void)
+{
+	port_reset_requested = true;
+}
+
+/** Estimated time for the DSU to read a flash word and update the CRC (a few cycles at 120 MHz) */
+#define PORT_DSU_CRC_WORD_NS 25
+
+void port_cmcc_control(uint32_t ctrl)
+{
+	port_cmcc.CTRL.reg = ctrl;
+}
+
+/* the cache has no line fill pending in the model: the status follows the enable at once */
+bool port_cmcc_enabled(void)
+{
+	return port_cmcc.CTRL.reg & CMCC_CTRL_CEN;
+}
+
+void port_cmcc_invalidate(void)
+{
+	irq_cached = false;
+	port_stats.cache_invalidations++;
+	nvm_model_cache_invalidated();
+}
+
+void port_dsu_command(uint32_t ctrl)
+{
+	const uint32_t addr   = port_dsu.ADDR.reg & DSU_ADDR_ADDR_Msk;
+	const uint32_t length = port_dsu.LENGTH.reg & DSU_LENGTH_LENGTH_Msk;
+	uint32_t       crc    = port_dsu.DATA.reg;
+	uint32_t       i;
+	uint8_t        bit;
+
+	if (!(ctrl & DSU_CTRL_CRC)) {
+		return;
+	}
+	if (addr >= FLASH_SIZE || length > FLASH_SIZE - addr) { // only the flash is on the bus of the model
+		port_dsu.STATUSA.reg = DSU_STATUSA_DONE | DSU_STATUSA_BERR;
+		return;
+	}
+	for (i = 0; i < length; i++) { // reflected IEEE 802.3 polynomial, as the DSU
+		crc ^= nvm_model_flash[addr + i];
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	port_wait_until(port_now() + (uint64_t)(length / 4) * PORT_DSU_CRC_WORD_NS); // the main loop polls STATUSA.DONE meanwhile
+	port_dsu.DATA.reg    = crc;
+	port_dsu.STATUSA.reg = DSU_STATUSA_DONE;
+}
+
+/* replaces hal/utils/src/utils_assert.c */
+void assert(const bool condition, const char *const file, const int line)
+{
+	if (!(condition)) {
+		fprintf(stderr, "assertion failed at %s:%d\n", file, line);
+		abort();
+	}
+}
+
+/* replaces driver_init.c: the peripherals are initialized by the harness using the host port */
+struct flash_descriptor FLASH_0;
+#if CONF_AES_ENABLE
+struct _aes_sync_device CRYPTOGRAPHY_0;
+#endif
+
+void LED_SYSTEM_on(void)
+{
+}
+
+void LED_SYSTEM_off(void)
+{
+}
@@ -0,0 +1,111 @@
+/**
+ * \file
+ * \brief Host port of the bootloader: model time and interrupt dispatching
+ *
+ * The bootloader main loop and interrupt handlers run on the host against peripheral models.
+ * Time only passes in the models: when the main loop waits for a peripheral (e.g. polling the NVMCTRL READY bit),
+ * or when the main loop is idle and the next interrupt is due.
+ * Interrupts preempt the main loop at these points only, which is where the bootloader spends its time.
+ *
+ * In real time mode the model time follows the host monotonic clock instead, waiting really sleeps,
+ * and interrupts are raised by a file descriptor becoming readable (e.g. the FunctionFS control endpoint).
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_PORT_H
+#define HOST_PORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Time value meaning "never" */
+#define PORT_TIME_NEVER UINT64_MAX
+
+/** Model time, in nanoseconds (only up to date after port_now() in real time mode) */
+extern uint64_t port_time_ns;
+
+/** Set when the firmware requested a system reset (NVIC_SystemReset) */
+extern bool port_reset_requested;
+
+/** Set when the firmware went to sleep (port_sleep) while no interrupt would ever wake it up, or in real time mode a signal interrupted the sleep */
+extern bool port_stopped;
+
+/** Sleeps of the main loop and cache of the interrupt handlers since port_init() */
+struct port_stats {
+	uint32_t sleeps;           /**< sleeps ended by an interrupt */
+	uint64_t sleep_ns;         /**< total time from falling asleep to the waking interrupt */
+	uint64_t wake_ns;          /**< total wake-to-service latency: from the waking interrupt to its handler running (fetched from the flash or the cache) */
+	uint64_t wake_max_ns;      /**< longest wake-to-service latency */
+	uint32_t cache_hits;       /**< interrupts whose handler was in the CMCC, without reading the flash */
+	uint32_t cache_invalidations; /**< invalidations of all CMCC lines */
+	uint32_t dma_transactions; /**< DMAC transactions, of one or more chained blocks */
+	uint64_t dma_bytes;        /**< bytes copied by the DMAC */
+	uint32_t dma_buffer_loads; /**< 32-bit words loaded in the NVM page buffer by the DMAC, instead of the CPU */
+};
+
+/** Counters since the last port_init() */
+extern struct port_stats port_stats;
+
+/** Source of interrupts preempting the main loop (e.g. the USB host driving the device) */
+struct port_irq_source {
+	/** Return the model time at which the next interrupt is due, or PORT_TIME_NEVER (model time mode only) */
+	uint64_t (*due)(void *context);
+	/** Serve the due interrupt, this may let the model time pass */
+	void (*handler)(void *context);
+	/** Context passed to the callbacks */
+	void *context;
+	/** Real time mode: the interrupt is pending while this file descriptor is readable. -1 for model time mode */
+	int fd;
+};
+
+/**
+ * \brief Reset the model time and the reset request, and set the interrupt source
+ * \param[in] source Interrupt source, or NULL for none
+ */
+void port_init(const struct port_irq_source *source);
+
+/**
+ * \brief Get the current model time
+ * \return Model time in nanoseconds
+ */
+uint64_t port_now(void);
+
+/**
+ * \brief Busy-wait in the main loop until the given model time
+ *
+ * Interrupts due in the meantime are served.
+ * \param[in] time_ns Model time to wait for
+ */
+void port_wait_until(uint64_t time_ns);
+
+/**
+ * \brief The main loop has nothing to do: let the model time pass until the next interrupt and serve it
+ *
+ * Interrupts are the ones of the interrupt source and the NVMCTRL model.
+ * \return false if no interrupt will ever happen, or in real time mode if a signal interrupted the wait
+ */
+bool port_idle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_PORT_H */
@@ -0,0 +1,289 @@
+/**
+ * \file
+ * \brief Timed model of a serial NOR flash of the SST26 family on the QSPI
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <hpl_qspi.h>
+#include <utils.h>
+
+#include "qspi_model.h"
+#include "port.h"
+
+/* the QSPI device of driver_init.c, which is not built for the host */
+struct _qspi_sync_dev QSPI_INSTANCE;
+uint32_t              port_qspi;
+
+/** Flash content, unless it is mapped */
+static uint8_t qspi_model_ram[CONF_QSPI_NOR_SIZE];
+uint8_t *      qspi_model_flash = qspi_model_ram;
+
+struct qspi_model_stats qspi_model_stats;
+
+/** Status register: program or erase running */
+#define QSPI_MODEL_SR_BUSY (1u << 0)
+/** Status register: write enable latch */
+#define QSPI_MODEL_SR_WEL (1u << 1)
+/** Configuration register: I/O configuration for the quad I/O commands */
+#define QSPI_MODEL_CR_IOC (1u << 1)
+
+/** Configuration of the model */
+static struct qspi_model_params qspi_params;
+/** Model time at which the current program or erase completes */
+static uint64_t qspi_busy_until;
+/** Write enable latch, set by WREN and cleared by the next write command */
+static bool qspi_wel;
+/** Reset enabled by RSTEN, for the next command */
+static bool qspi_rsten;
+/** Configuration register */
+static uint8_t qspi_config;
+/** The block protection has been removed (ULBPR) */
+static bool qspi_unlocked;
+
+void qspi_model_init(const struct qspi_model_params *params)
+{
+	qspi_params     = *params;
+	qspi_busy_until = 0;
+	qspi_wel        = false;
+	qspi_rsten      = false;
+	qspi_config     = 0;
+	qspi_unlocked   = false;
+	memset(&qspi_model_stats, 0, sizeof(qspi_model_stats));
+	if (qspi_model_flash == qspi_model_ram) {
+		memset(qspi_model_ram, 0xFF, sizeof(qspi_model_ram));
+	}
+}
+
+int32_t qspi_model_map(void)
+{
+	uint8_t *map = mmap(NULL, CONF_QSPI_NOR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (MAP_FAILED == map) {
+		perror("mmap");
+		return ERR_IO;
+	}
+	memset(map, 0xFF, CONF_QSPI_NOR_SIZE);
+	qspi_model_flash = map;
+	return ERR_NONE;
+}
+
+/**
+ * \brief Size of the block erased at an address (SST26VF064B): 8 KB blocks in the first and last 32 KB,
+ * 32 KB blocks next to them, and CONF_QSPI_NOR_BLOCK_SIZE blocks in between
+ */
+static uint32_t qspi_model_block_size(uint32_t addr)
+{
+	if (addr < 0x8000 || addr >= CONF_QSPI_NOR_SIZE - 0x8000) {
+		return 0x2000;
+	}
+	if (addr < 0x10000 || addr >= CONF_QSPI_NOR_SIZE - 0x10000) {
+		return 0x8000;
+	}
+	return CONF_QSPI_NOR_BLOCK_SIZE;
+}
+
+/** Lines of the instruction, address and data phases of a frame width */
+static void qspi_model_lines(uint32_t width, uint32_t *inst, uint32_t *addr, uint32_t *data)
+{
+	static const uint8_t lines[][3] = {
+	    [QSPI_INST1_ADDR1_DATA1] = {1, 1, 1}, [QSPI_INST1_ADDR1_DATA2] = {1, 1, 2}, [QSPI_INST1_ADDR1_DATA4] = {1, 1, 4},
+	    [QSPI_INST1_ADDR2_DATA2] = {1, 2, 2}, [QSPI_INST1_ADDR4_DATA4] = {1, 4, 4}, [QSPI_INST2_ADDR2_DATA2] = {2, 2, 2},
+	    [QSPI_INST4_ADDR4_DATA4] = {4, 4, 4},
+	};
+
+	if (width >= ARRAY_SIZE(lines)) {
+		width = QSPI_INST1_ADDR1_DATA1;
+	}
+	*inst = lines[width][0];
+	*addr = lines[width][1];
+	*data = lines[width][2];
+}
+
+/** Let the time pass for the transfer of a command */
+static void qspi_model_transfer(const struct _qspi_command *cmd)
+{
+	const union _qspi_inst_frame frame = cmd->inst_frame;
+	uint32_t inst_lines, addr_lines, data_lines;
+	uint64_t cycles = frame.bits.dummy_cycles;
+
+	qspi_model_lines(frame.bits.width, &inst_lines, &addr_lines, &data_lines);
+	if (frame.bits.inst_en) {
+		cycles += 8 / inst_lines;
+	}
+	if (frame.bits.addr_en) {
+		cycles += (frame.bits.addr_len ? 32 : 24) / addr_lines;
+	}
+	if (frame.bits.opt_en) {
+		cycles += ((1u << frame.bits.opt_len) + addr_lines - 1) / addr_lines;
+	}
+	if (frame.bits.data_en) {
+		cycles += (uint64_t)cmd->buf_len * 8 / data_lines;
+	}
+	port_wait_until(port_now() + qspi_params.command_ns + cycles * 1000000000 / qspi_params.sck_hz);
+}
+
+/** Start a program or erase, the flash being busy for the given duration */
+static void qspi_model_start(uint32_t duration)
+{
+	qspi_busy_until = port_now() + duration;
+	qspi_model_stats.busy_ns += duration;
+	qspi_wel = false;
+}
+
+int32_t _qspi_sync_init(struct _qspi_sync_dev *dev, void *const hw)
+{
+	dev->prvt = hw;
+	return ERR_NONE;
+}
+
+int32_t _qspi_sync_deinit(struct _qspi_sync_dev *dev)
+{
+	(void)dev;
+	return ERR_NONE;
+}
+
+int32_t _qspi_sync_serial_run_command(struct _qspi_sync_dev *dev, const struct _qspi_command *cmd)
+{
+	const bool     quad = QSPI_INST1_ADDR4_DATA4 == cmd->inst_frame.bits.width;
+	const bool     busy = port_now() < qspi_busy_until;
+	const uint32_t addr = cmd->address % CONF_QSPI_NOR_SIZE;
+	uint8_t *      rx   = cmd->rx_buf;
+	const uint8_t *tx   = cmd->tx_buf;
+	uint32_t       i, size;
+	bool           error = false;
+
+	(void)dev;
+	qspi_model_stats.commands++;
+	if (cmd->inst_frame.bits.data_en && port_cmcc_enabled()) {
+		/* as hpl/qspi/hpl_qspi.c: the data phase through the AHB window bypasses the CMCC (the interrupt handlers
+		 * served meanwhile are read from the flash), which is invalidated afterwards */
+		qspi_model_stats.uncached_transfers++;
+		port_cmcc_control(0);
+		qspi_model_transfer(cmd);
+		port_cmcc_invalidate();
+		port_cmcc_control(CMCC_CTRL_CEN);
+	} else {
+		qspi_model_transfer(cmd);
+	}
+	if (QSPI_READ_ACCESS == cmd->inst_frame.bits.tfr_type || QSPI_READMEM_ACCESS == cmd->inst_frame.bits.tfr_type) {
+		memset(rx, 0xFF, cmd->inst_frame.bits.data_en ? cmd->buf_len : 0); // nothing drives the data lines
+	}
+	if (0xFF == qspi_params.manufacturer) { // no flash
+		return ERR_NONE;
+	}
+	if (busy && 0x05 != cmd->instruction) { // only the status can be read while programming or erasing
+		qspi_model_stats.errors++;
+		return ERR_NONE;
+	}
+
+	switch (cmd->instruction) {
+	case 0x66: // RSTEN
+		qspi_rsten = true;
+		return ERR_NONE;
+	case 0x99: // RST
+		if (qspi_rsten) {
+			qspi_wel      = false;
+			qspi_config   = 0;
+			qspi_unlocked = false;
+		} else {
+			error = true;
+		}
+		break;
+	case 0x9F: // JEDEC ID
+		for (i = 0; i < cmd->buf_len; i++) {
+			rx[i] = (0 == i) ? qspi_params.manufacturer : (1 == i) ? 0x26 : (2 == i) ? 0x43 : 0xFF; // SST26VF064B
+		}
+		break;
+	case 0x05: // RDSR
+		qspi_model_stats.status_reads++;
+		for (i = 0; i < cmd->buf_len; i++) {
+			rx[i] = (busy ? QSPI_MODEL_SR_BUSY : 0) | (qspi_wel ? QSPI_MODEL_SR_WEL : 0);
+		}
+		break;
+	case 0x06: // WREN
+		qspi_wel = true;
+		break;
+	case 0x01: // WRSR: status (read-only bits) and configuration
+		if (qspi_wel && 2 == cmd->buf_len) {
+			qspi_config = tx[1];
+			qspi_wel    = false;
+		} else {
+			error = true;
+		}
+		break;
+	case 0x98: // ULBPR
+		if (qspi_wel) {
+			qspi_unlocked = true;
+			qspi_wel      = false;
+		} else {
+			error = true;
+		}
+		break;
+	case 0xEB: // SQOR
+		if (quad && (qspi_config & QSPI_MODEL_CR_IOC)) {
+			qspi_model_stats.reads++;
+			qspi_model_stats.read_bytes += cmd->buf_len;
+			for (i = 0; i < cmd->buf_len; i++) {
+				rx[i] = qspi_model_flash[(addr + i) % CONF_QSPI_NOR_SIZE];
+			}
+		} else {
+			error = true;
+		}
+		break;
+	case 0x32: // SQPP: the address wraps around in the page
+		if (quad && (qspi_config & QSPI_MODEL_CR_IOC) && qspi_wel && qspi_unlocked
+		    && cmd->buf_len <= CONF_QSPI_NOR_PAGE_SIZE) {
+			const uint32_t page = addr & ~(CONF_QSPI_NOR_PAGE_SIZE - 1);
+			for (i = 0; i < cmd->buf_len; i++) {
+				qspi_model_flash[page + (addr + i) % CONF_QSPI_NOR_PAGE_SIZE] &= tx[i];
+			}
+			qspi_model_stats.page_programs++;
+			qspi_model_start(qspi_params.page_program_ns);
+		} else {
+			error = true;
+		}
+		break;
+	case 0x20: // SE
+	case 0xD8: // BE
+		if (qspi_wel && qspi_unlocked) {
+			size = (0x20 == cmd->instruction) ? CONF_QSPI_NOR_SECTOR_SIZE : qspi_model_block_size(addr);
+			memset(&qspi_model_flash[addr & ~(size - 1)], 0xFF, size);
+			if (0x20 == cmd->instruction) {
+				qspi_model_stats.sector_erases++;
+				qspi_model_start(qspi_params.sector_erase_ns);
+			} else {
+				qspi_model_stats.block_erases++;
+				qspi_model_start(qspi_params.block_erase_ns);
+			}
+		} else {
+			error = true;
+		}
+		break;
+	default:
+		error = true;
+		break;
+	}
+	qspi_rsten = false;
+	if (error) {
+		qspi_model_stats.errors++;
+	}
+	return ERR_NONE;
+}
@@ -0,0 +1,86 @@
+/**
+ * \file
+ * \brief Timed model of a serial NOR flash of the SST26 family on the QSPI
+ *
+ * The model replaces hpl/qspi/hpl_qspi.c: the commands of the QSPI HPL (hpl_qspi.h) are interpreted by the flash model,
+ * and take the time to transfer them at the SCK frequency. Page programs and erases make the flash busy
+ * for the configured time, which the firmware sees when reading the status register.
+ * Commands violating the protocol (no write enable, flash busy, blocks locked, quad I/O disabled) are ignored and counted.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_QSPI_MODEL_H
+#define HOST_QSPI_MODEL_H
+
+#include <compiler.h>
+#include <hpl_qspi_config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Timing and identity of the flash model (the geometry is the one of hpl_qspi_config.h) */
+struct qspi_model_params {
+	uint32_t page_program_ns; /**< duration of a page program (tPP) */
+	uint32_t sector_erase_ns; /**< duration of a sector erase (tSE) */
+	uint32_t block_erase_ns;  /**< duration of a block erase (tBE) */
+	uint32_t sck_hz;          /**< SCK frequency, giving the transfer time of the commands */
+	uint32_t command_ns;      /**< time to set up a command and wait for its end, besides the transfer */
+	uint8_t  manufacturer;    /**< first byte of the JEDEC ID, 0xFF for no flash */
+};
+
+/** Operations executed by the flash model */
+struct qspi_model_stats {
+	uint32_t sector_erases;
+	uint32_t block_erases;
+	uint32_t page_programs;
+	uint32_t reads;         /**< read commands */
+	uint64_t read_bytes;    /**< bytes read by the read commands */
+	uint32_t status_reads;  /**< reads of the status register */
+	uint32_t commands;      /**< all commands */
+	uint32_t errors;        /**< commands ignored by the flash (programming errors) */
+	uint32_t uncached_transfers; /**< data phases run with the CMCC disabled, then invalidated */
+	uint64_t busy_ns;       /**< total time the flash was programming or erasing */
+};
+
+/** Counters since the last qspi_model_init() */
+extern struct qspi_model_stats qspi_model_stats;
+
+/** Flash content (CONF_QSPI_NOR_SIZE bytes) */
+extern uint8_t *qspi_model_flash;
+
+/**
+ * \brief Reset the flash model: as after power-up (blocks locked, quad I/O disabled), counters cleared, and erase the whole flash unless it is mapped
+ * \param[in] params Timing and identity, copied
+ */
+void qspi_model_init(const struct qspi_model_params *params);
+
+/**
+ * \brief Back the flash with memory shared with the child processes forked afterwards, so that the content persists across sessions
+ *
+ * The memory is erased (0xFF) when mapped. Call before qspi_model_init().
+ * \return Operation status
+ * \retval ERR_NONE The flash is mapped
+ * \retval ERR_IO The memory could not be mapped
+ */
+int32_t qspi_model_map(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_QSPI_MODEL_H */
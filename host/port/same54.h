@@ -0,0 +1,228 @@
+/**
+ * \file
+ * \brief Device definitions for building the bootloader sources on the host
+ *
+ * This replaces include/same54.h when the bootloader sources are compiled for the host (see host/Makefile).
+ * The peripheral register layouts and bit definitions come from the device headers,
+ * but the peripheral instances are host models (see nvm_model.c) and the Cortex-M specific functions do nothing.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_SAME54_H
+#define HOST_SAME54_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* IO definitions (from core_cm4.h) */
+#define __I volatile const
+#define __O volatile
+#define __IO volatile
+
+/* register types and integer literal macros (from same54p20a.h) */
+typedef volatile const uint32_t RoReg;
+typedef volatile const uint16_t RoReg16;
+typedef volatile const uint8_t  RoReg8;
+typedef volatile uint32_t       WoReg;
+typedef volatile uint16_t       WoReg16;
+typedef volatile uint8_t        WoReg8;
+typedef volatile uint32_t       RwReg;
+typedef volatile uint16_t       RwReg16;
+typedef volatile uint8_t        RwReg8;
+
+#define _U_(x) x##U
+#define _L_(x) x##L
+#define _UL_(x) x##UL
+
+/** Interrupt numbers of the modelled peripherals */
+typedef enum IRQn {
+	NVMCTRL_0_IRQn = 29,
+	NVMCTRL_1_IRQn = 30,
+	USB_0_IRQn     = 80,
+	USB_1_IRQn     = 81,
+	USB_2_IRQn     = 82,
+	USB_3_IRQn     = 83,
+} IRQn_Type;
+
+#include "component/cmcc.h"
+#include "component/dsu.h"
+#include "component/nvmctrl.h"
+#include "component/pac.h"
+#include "component/pm.h"
+#include "instance/nvmctrl.h"
+
+/* peripheral identifiers (from same54p20a.h) */
+#define ID_DSU 33
+/* number of DMAC channels (from instance/dmac.h), the DMAC is modelled behind hpl_dma.h */
+#define DMAC_CH_NUM 32
+
+/* flash and RAM parameters (from same54p20a.h and same54n19a.h) */
+#if defined(__SAME54N19A__) || defined(__SAME54P19A__)
+#define FLASH_SIZE _UL_(0x00080000)
+#define HSRAM_SIZE _UL_(0x00030000)
+#elif defined(__SAME54N20A__) || defined(__SAME54P20A__)
+#define FLASH_SIZE _UL_(0x00100000)
+#define HSRAM_SIZE _UL_(0x00040000)
+#else
+#error Library does not support the specified device.
+#endif
+#define FLASH_PAGE_SIZE 512
+#define FLASH_NB_OF_PAGES (FLASH_SIZE / FLASH_PAGE_SIZE)
+/* target RAM address, only used to check vector tables */
+#define HSRAM_ADDR _UL_(0x20000000)
+
+/** RAM left after the stack on the target (see same54p20a_flash.ld): the RAM minus the DFU magic and the 16 KB RAM_BUDGET of gcc/Makefile */
+#define PORT_DFU_STAGING_SIZE (HSRAM_SIZE - 16 * 1024 - 4)
+
+/** Flash content, the main array of the NVMCTRL model */
+extern uint8_t *nvm_model_flash;
+/** User page of the NVMCTRL model (NVMCTRL_PAGE_SIZE bytes) */
+extern uint8_t *nvm_model_user;
+/** SmartEEPROM of the NVMCTRL model (NVM_MODEL_SEE_SIZE bytes) */
+extern uint8_t *nvm_model_see;
+/** Chip serial number words of the model */
+extern uint32_t port_serial_number[4];
+/** RAM staging area for the downloaded image */
+extern uint8_t port_dfu_staging[PORT_DFU_STAGING_SIZE];
+/** Registers of the NVMCTRL model */
+extern Nvmctrl nvm_model_hw;
+/** Registers of the CMCC model (only the enable and the invalidation of all lines are modelled) */
+extern Cmcc port_cmcc;
+/** Registers of the DSU (only the CRC-32 computation is modelled) */
+extern Dsu port_dsu;
+/** Registers of the PAC (not modelled) */
+extern Pac port_pac;
+/** QSPI instance, only passed to the model replacing hpl_qspi.c (see qspi_model.c) */
+extern uint32_t port_qspi;
+
+#define FLASH_ADDR ((uintptr_t)nvm_model_flash)
+#define NVMCTRL_USER ((uintptr_t)nvm_model_user)
+#define _NVM_USER_ROW_BASE NVMCTRL_USER /* used by hpl_nvmctrl.c instead of the fixed address */
+#define _NVM_PAGE_BUFFER_LOAD(addr, data) nvm_model_load(addr, data) /* used by hpl_nvmctrl.c to load the page buffer */
+#define SEEPROM_ADDR ((uintptr_t)nvm_model_see)
+#define _NVM_SEE_WRITE(addr, data) nvm_model_see_write((uintptr_t)(addr), data) /* used by hpl_nvmctrl.c to write the SmartEEPROM */
+#define NVMCTRL (&nvm_model_hw)
+/* used by usb_start.c instead of the fixed addresses */
+#define SERIAL_NUMBER_WORD0_ADDR ((uintptr_t)&port_serial_number[0])
+#define SERIAL_NUMBER_WORD1_ADDR ((uintptr_t)&port_serial_number[1])
+#define SERIAL_NUMBER_WORD2_ADDR ((uintptr_t)&port_serial_number[2])
+#define SERIAL_NUMBER_WORD3_ADDR ((uintptr_t)&port_serial_number[3])
+#define CMCC (&port_cmcc)
+#define DSU (&port_dsu)
+#define PAC (&port_pac)
+#define QSPI ((void *)&port_qspi)
+#define AES NULL /* not used by the software implementation (hpl_aes_soft.c) */
+/* used by usb_start.c instead of the linker symbols */
+#define DFU_STAGING_START (&port_dfu_staging[0])
+#define DFU_STAGING_END (&port_dfu_staging[PORT_DFU_STAGING_SIZE])
+
+/* the interrupt controller is not modelled: interrupts are dispatched by port_wait_until() */
+static inline void NVIC_EnableIRQ(IRQn_Type irq)
+{
+	(void)irq;
+}
+
+static inline void NVIC_DisableIRQ(IRQn_Type irq)
+{
+	(void)irq;
+}
+
+static inline void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+	(void)irq;
+}
+
+/** Record the reset request (see port_reset_requested), the caller continues to run */
+void NVIC_SystemReset(void);
+
+/* interrupt handlers (from same54p20a.h), called by the host port */
+void NVMCTRL_0_Handler(void);
+void NVMCTRL_1_Handler(void);
+
+static inline uint32_t __get_PRIMASK(void)
+{
+	return 0;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+	(void)primask;
+}
+
+static inline void __disable_irq(void)
+{
+}
+
+static inline void __enable_irq(void)
+{
+}
+
+static inline void __DMB(void)
+{
+}
+
+static inline void __DSB(void)
+{
+}
+
+static inline void __ISB(void)
+{
+}
+
+static inline void __NOP(void)
+{
+}
+
+static inline void __WFI(void)
+{
+}
+
+/** Wait for the NVMCTRL model to be ready, letting the model time pass */
+bool nvm_model_ready(void);
+/** Load a word in the page buffer of the NVMCTRL model */
+void nvm_model_load(uint32_t addr, uint32_t data);
+/** Read the STATUS register of the NVMCTRL model, without waiting */
+uint16_t nvm_model_status(void);
+/** Write a word in the SmartEEPROM of the NVMCTRL model */
+void nvm_model_see_write(uintptr_t addr, uint32_t data);
+/** Wait for the SmartEEPROM write of the NVMCTRL model to complete (SEESTAT.BUSY), letting the model time pass */
+bool nvm_model_see_busy(void);
+/** Execute a command written to the CTRLB register of the NVMCTRL model */
+void nvm_model_command(uint16_t ctrlb);
+/** Enable or disable the CMCC model, written to its CTRL register */
+void port_cmcc_control(uint32_t ctrl);
+/** Status of the CMCC model, read from its SR register */
+bool port_cmcc_enabled(void);
+/** Invalidate all lines of the CMCC model, written to its MAINT0 register */
+void port_cmcc_invalidate(void);
+/** Execute a command written to the CTRL register of the DSU model */
+void port_dsu_command(uint32_t ctrl);
+
+/* replaces hal_sleep.c (the host C library has its own sleep(), declared by unistd.h, which has to be included first) */
+#define sleep(mode) port_sleep(mode)
+/** Sleep until the next interrupt and serve it, letting the model time pass */
+int port_sleep(const uint8_t mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SAME54_H */
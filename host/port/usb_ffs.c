@@ -0,0 +1,551 @@
+/**
+ * \file
+ * \brief USB device peripheral backed by Linux FunctionFS
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <usb_protocol.h>
+#include <utils.h>
+/* after usb_protocol.h, which uses some of the linux/usb/ch9.h macro names as enumerators */
+#include <linux/usb/functionfs.h>
+
+#include "port.h"
+#include "usb_ffs.h"
+
+/** Largest data stage the backend can buffer */
+#define USB_FFS_BUFFER_SIZE 4096
+/** Largest number of strings referenced by the interface descriptors */
+#define USB_FFS_MAX_STRINGS 8
+
+/** Transfer requested by the device on one direction of the control endpoint */
+struct usb_ffs_ep {
+	bool     stall;
+	bool     pending;
+	uint8_t *buf;
+	uint32_t size;
+};
+
+struct usb_ffs_stats usb_ffs_stats;
+void (*usb_ffs_monitor)(const uint8_t setup[8], uint16_t length, bool stalled);
+
+static struct _usb_d_dev_callbacks    usb_dev_cb;
+static struct _usb_d_dev_ep_callbacks usb_ep_cb;
+static bool                           usb_enabled;
+static bool                           usb_attached;
+static uint8_t                        usb_address;
+/** Control endpoint of the FunctionFS instance */
+static int usb_ffs_ep0 = -1;
+/** Configuration value replayed to the stack when the host enables the function */
+static uint8_t usb_ffs_config_value;
+/** Last setup packet */
+static uint8_t usb_setup[8];
+/** Control endpoint OUT [0] and IN [1] directions */
+static struct usb_ffs_ep usb_ep0[2];
+/** IN data is copied when the transfer is requested, as the peripheral does with its endpoint cache */
+static uint8_t usb_in_data[USB_FFS_BUFFER_SIZE];
+/** Data stage of control writes */
+static uint8_t usb_out_data[USB_FFS_BUFFER_SIZE];
+
+static void usb_ffs_dummy_cb(void)
+{
+}
+
+static struct usb_ffs_ep *usb_ffs_ep(const uint8_t ep)
+{
+	if (ep & USB_EP_N_MASK) {
+		return NULL; // DFU only uses the control endpoint
+	}
+	return &usb_ep0[(ep & USB_EP_DIR) ? 1 : 0];
+}
+
+int32_t _usb_d_dev_init(void)
+{
+	usb_dev_cb.sof   = (_usb_d_dev_sof_cb_t)usb_ffs_dummy_cb;
+	usb_dev_cb.event = (_usb_d_dev_event_cb_t)usb_ffs_dummy_cb;
+	usb_ep_cb.setup  = (_usb_d_dev_ep_cb_setup_t)usb_ffs_dummy_cb;
+	usb_ep_cb.more   = (_usb_d_dev_ep_cb_more_t)usb_ffs_dummy_cb;
+	usb_ep_cb.done   = (_usb_d_dev_ep_cb_done_t)usb_ffs_dummy_cb;
+	usb_enabled      = false;
+	usb_attached     = false;
+	usb_address      = 0;
+	memset(usb_ep0, 0, sizeof(usb_ep0));
+	return ERR_NONE;
+}
+
+void _usb_d_dev_deinit(void)
+{
+	usb_enabled  = false;
+	usb_attached = false;
+}
+
+void _usb_d_dev_register_callback(const enum usb_d_cb_type type, const FUNC_PTR func)
+{
+	FUNC_PTR f = (func == NULL) ? (FUNC_PTR)usb_ffs_dummy_cb : (FUNC_PTR)func;
+	if (type == USB_D_CB_EVENT) {
+		usb_dev_cb.event = (_usb_d_dev_event_cb_t)f;
+	} else if (type == USB_D_CB_SOF) {
+		usb_dev_cb.sof = (_usb_d_dev_sof_cb_t)f;
+	}
+}
+
+void _usb_d_dev_register_ep_callback(const enum usb_d_dev_ep_cb_type type, const FUNC_PTR func)
+{
+	FUNC_PTR f = (func == NULL) ? (FUNC_PTR)usb_ffs_dummy_cb : (FUNC_PTR)func;
+	if (type == USB_D_DEV_EP_CB_SETUP) {
+		usb_ep_cb.setup = (_usb_d_dev_ep_cb_setup_t)f;
+	} else if (type == USB_D_DEV_EP_CB_MORE) {
+		usb_ep_cb.more = (_usb_d_dev_ep_cb_more_t)f;
+	} else if (type == USB_D_DEV_EP_CB_DONE) {
+		usb_ep_cb.done = (_usb_d_dev_ep_cb_done_t)f;
+	}
+}
+
+int32_t _usb_d_dev_enable(void)
+{
+	usb_enabled = true;
+	return ERR_NONE;
+}
+
+int32_t _usb_d_dev_disable(void)
+{
+	usb_enabled = false;
+	return ERR_NONE;
+}
+
+void _usb_d_dev_attach(void)
+{
+	usb_attached = usb_enabled;
+}
+
+void _usb_d_dev_detach(void)
+{
+	usb_attached = false;
+}
+
+void _usb_d_dev_send_remotewakeup(void)
+{
+}
+
+enum usb_speed _usb_d_dev_get_speed(void)
+{
+	return USB_SPEED_FS;
+}
+
+void _usb_d_dev_set_address(const uint8_t addr)
+{
+	usb_address = addr;
+}
+
+uint8_t _usb_d_dev_get_address(void)
+{
+	return usb_address;
+}
+
+uint16_t _usb_d_dev_get_frame_n(void)
+{
+	return (uint16_t)((port_now() / 1000000) & 0x7FF);
+}
+
+uint8_t _usb_d_dev_get_uframe_n(void)
+{
+	return 0;
+}
+
+int32_t _usb_d_dev_ep0_init(const uint8_t max_pkt_siz)
+{
+	return _usb_d_dev_ep_init(0, USB_EP_XTYPE_CTRL, max_pkt_siz);
+}
+
+int32_t _usb_d_dev_ep_init(const uint8_t ep, const uint8_t attr, uint16_t max_pkt_siz)
+{
+	(void)attr;
+	(void)max_pkt_siz;
+	if (NULL == usb_ffs_ep(ep)) {
+		return -USB_ERR_PARAM;
+	}
+	memset(usb_ep0, 0, sizeof(usb_ep0));
+	return ERR_NONE;
+}
+
+void _usb_d_dev_ep_deinit(const uint8_t ep)
+{
+	(void)ep;
+	memset(usb_ep0, 0, sizeof(usb_ep0));
+}
+
+int32_t _usb_d_dev_ep_enable(const uint8_t ep)
+{
+	return (NULL == usb_ffs_ep(ep)) ? -USB_ERR_PARAM : ERR_NONE;
+}
+
+void _usb_d_dev_ep_disable(const uint8_t ep)
+{
+	_usb_d_dev_ep_abort(ep);
+}
+
+int32_t _usb_d_dev_ep_stall(const uint8_t ep, const enum usb_ep_stall_ctrl ctrl)
+{
+	struct usb_ffs_ep *ept = usb_ffs_ep(ep);
+	if (NULL == ept) {
+		return -USB_ERR_PARAM;
+	}
+	if (ctrl == USB_EP_STALL_SET) {
+		ept->stall   = true;
+		ept->pending = false;
+	} else if (ctrl == USB_EP_STALL_CLR) {
+		ept->stall = false;
+	} else {
+		return ept->stall;
+	}
+	return ERR_NONE;
+}
+
+int32_t _usb_d_dev_ep_read_req(const uint8_t ep, uint8_t *req_buf)
+{
+	if (ep & USB_EP_N_MASK) {
+		return -USB_ERR_PARAM;
+	}
+	memcpy(req_buf, usb_setup, sizeof(usb_setup));
+	return sizeof(usb_setup);
+}
+
+int32_t _usb_d_dev_ep_trans(const struct usb_d_transfer *trans)
+{
+	struct usb_ffs_ep *ept = usb_ffs_ep(trans->ep);
+	if (NULL == ept) {
+		return -USB_ERR_PARAM;
+	}
+	if (ept->stall) {
+		return USB_HALTED;
+	}
+	if ((trans->ep & USB_EP_DIR) && trans->size) {
+		if (trans->size > sizeof(usb_in_data)) {
+			return -USB_ERR_PARAM;
+		}
+		memcpy(usb_in_data, trans->buf, trans->size);
+	}
+	ept->pending = true;
+	ept->buf     = trans->buf;
+	ept->size    = trans->size;
+	return ERR_NONE;
+}
+
+void _usb_d_dev_ep_abort(const uint8_t ep)
+{
+	struct usb_ffs_ep *ept = usb_ffs_ep(ep);
+	if (ept) {
+		ept->pending = false;
+	}
+}
+
+int32_t _usb_d_dev_ep_get_status(const uint8_t ep, struct usb_d_trans_status *stat)
+{
+	struct usb_ffs_ep *ept = usb_ffs_ep(ep);
+	if (NULL == ept) {
+		return -USB_ERR_PARAM;
+	}
+	if (stat) {
+		memset(stat, 0, sizeof(*stat));
+		stat->ep    = ep;
+		stat->size  = ept->size;
+		stat->xtype = USB_EP_XTYPE_CTRL;
+		stat->busy  = ept->pending;
+		stat->stall = ept->stall;
+		stat->dir   = (ep & USB_EP_DIR) ? 1 : 0;
+	}
+	return ept->pending ? USB_BUSY : USB_OK;
+}
+
+/** Complete the pending transfer of one direction of the control endpoint */
+static void usb_ffs_done(const uint8_t ep, uint32_t count)
+{
+	usb_ep0[(ep & USB_EP_DIR) ? 1 : 0].pending = false;
+	usb_ep_cb.done(ep, USB_TRANS_DONE, count);
+}
+
+/**
+ * \brief Run a control transfer through the stack
+ *
+ * The data stage is exchanged with the host on the FunctionFS control endpoint, or with the data buffer for
+ * local transfers (used to read the descriptors and to replay SET_CONFIGURATION).
+ * \param[in] setup Setup packet
+ * \param[in] local The transfer does not come from the host
+ * \param[in,out] data Data stage of local transfers
+ * \param[out] length Number of IN bytes of local transfers, can be NULL
+ * \return ERR_NONE, ERR_DENIED if the device stalled the request, or ERR_IO
+ */
+static int32_t usb_ffs_control(const uint8_t setup[8], bool local, uint8_t *data, uint16_t *length)
+{
+	const bool     dir_in   = (setup[0] & USB_REQ_TYPE_IN) != 0;
+	const uint16_t w_length = (uint16_t)(setup[6] | (setup[7] << 8));
+	struct usb_ffs_ep *ept  = &usb_ep0[dir_in ? 1 : 0];
+	uint32_t           n    = 0;
+	ssize_t            rc;
+
+	// a setup packet cancels any previous control transfer and clears the stall condition
+	memcpy(usb_setup, setup, sizeof(usb_setup));
+	memset(usb_ep0, 0, sizeof(usb_ep0));
+	usb_ep_cb.setup(0);
+
+	if (w_length && !dir_in && !ept->stall && ept->pending) {
+		// read the data stage even if the stack expects less, the host sends wLength bytes
+		if (w_length > sizeof(usb_out_data)) {
+			ept->stall = true;
+		} else if (local) {
+			memcpy(usb_out_data, data, w_length);
+		} else if (read(usb_ffs_ep0, usb_out_data, w_length) != w_length) {
+			return ERR_IO;
+		}
+	}
+	if (usb_ep0[0].stall || usb_ep0[1].stall || (w_length && !ept->pending) || (!w_length && !usb_ep0[1].pending)) {
+		usb_ffs_stats.stalls++;
+		if (usb_ffs_monitor && !local) {
+			usb_ffs_monitor(setup, 0, true);
+		}
+		if (!local) {
+			// FunctionFS stalls when the data stage is accessed in the wrong direction
+			rc = dir_in ? read(usb_ffs_ep0, NULL, 0) : write(usb_ffs_ep0, NULL, 0);
+			if (rc >= 0 || errno != EL2HLT) {
+				return ERR_IO;
+			}
+		}
+		return ERR_DENIED;
+	}
+
+	if (0 == w_length) {
+		if (!local && (dir_in ? write(usb_ffs_ep0, NULL, 0) : read(usb_ffs_ep0, NULL, 0)) < 0) {
+			return ERR_IO;
+		}
+		usb_ffs_done(USB_EP_DIR, 0);
+	} else if (dir_in) {
+		n = min(ept->size, w_length);
+		if (local) {
+			memcpy(data, usb_in_data, n);
+			if (length) {
+				*length = (uint16_t)n;
+			}
+		} else if (write(usb_ffs_ep0, usb_in_data, n) != (ssize_t)n) {
+			return ERR_IO;
+		}
+		usb_ffs_done(USB_EP_DIR, n);
+		if (usb_ep0[0].pending) { // status stage, handled by the kernel
+			usb_ffs_done(0, 0);
+		}
+	} else {
+		n = min(ept->size, w_length);
+		memcpy(ept->buf, usb_out_data, n);
+		usb_ffs_done(0, n);
+		if (usb_ep0[1].pending) { // status stage, already sent by the kernel
+			usb_ffs_done(USB_EP_DIR, 0);
+		}
+	}
+	if (!local) {
+		usb_ffs_stats.control_transfers++;
+		if (usb_ffs_monitor) {
+			usb_ffs_monitor(setup, (uint16_t)n, false);
+		}
+	}
+	return ERR_NONE;
+}
+
+/** Run a local standard request reading a descriptor */
+static int32_t usb_ffs_get_desc(uint8_t type, uint8_t index, uint16_t lang, uint8_t *desc, uint16_t size,
+                                uint16_t *length)
+{
+	const uint8_t setup[8] = {USB_REQ_TYPE_IN, USB_REQ_GET_DESC, index, type,
+	                          (uint8_t)lang,   (uint8_t)(lang >> 8), (uint8_t)size, (uint8_t)(size >> 8)};
+	return usb_ffs_control(setup, true, desc, length);
+}
+
+/** Append a little-endian 32-bit value */
+static uint8_t *usb_ffs_put_le32(uint8_t *p, uint32_t value)
+{
+	value = htole32(value);
+	memcpy(p, &value, sizeof(value));
+	return p + sizeof(value);
+}
+
+/**
+ * \brief Write the interface descriptors and their strings to the FunctionFS control endpoint
+ *
+ * FunctionFS numbers the function strings from 1, the string indexes of the descriptors are remapped.
+ */
+static int32_t usb_ffs_write_descs(void)
+{
+	static uint8_t cfg[USB_FFS_BUFFER_SIZE];
+	static uint8_t descs[USB_FFS_BUFFER_SIZE];
+	static uint8_t strs[USB_FFS_BUFFER_SIZE];
+	uint8_t        str_index[USB_FFS_MAX_STRINGS];
+	uint8_t        str_count = 0;
+	uint8_t        str_desc[256];
+	uint16_t       length, cfg_length, lang = 0x0409, i, j;
+	uint32_t       desc_count = 0;
+	uint8_t *      p;
+
+	if (ERR_NONE != usb_ffs_get_desc(USB_DT_CONFIG, 0, 0, cfg, 9, &length) || length < 9) {
+		return ERR_NOT_FOUND;
+	}
+	cfg_length = (uint16_t)(cfg[2] | (cfg[3] << 8));
+	if (cfg_length > sizeof(cfg) || ERR_NONE != usb_ffs_get_desc(USB_DT_CONFIG, 0, 0, cfg, cfg_length, &length)
+	    || length != cfg_length) {
+		return ERR_NOT_FOUND;
+	}
+	usb_ffs_config_value = cfg[5];
+	if (ERR_NONE == usb_ffs_get_desc(USB_DT_STRING, 0, 0, str_desc, sizeof(str_desc), &length) && length >= 4) {
+		lang = (uint16_t)(str_desc[2] | (str_desc[3] << 8));
+	}
+
+	// the configuration descriptor is provided by the gadget framework, keep the interface descriptors
+	for (i = cfg[0]; i + 1 < cfg_length && cfg[i] >= 2 && i + cfg[i] <= cfg_length; i += cfg[i]) {
+		desc_count++;
+		if (USB_DT_INTERFACE != cfg[i + 1] || cfg[i] < 9 || 0 == cfg[i + 8]) {
+			continue;
+		}
+		for (j = 0; j < str_count && str_index[j] != cfg[i + 8]; j++) {
+		}
+		if (j == str_count && str_count < USB_FFS_MAX_STRINGS) {
+			str_index[str_count++] = cfg[i + 8];
+		}
+		cfg[i + 8] = (j < USB_FFS_MAX_STRINGS) ? (uint8_t)(j + 1) : 0;
+	}
+
+	// same descriptors at full, high and super speed: DFU has no endpoints besides the control endpoint
+	p = descs + sizeof(struct usb_functionfs_descs_head_v2);
+	p = usb_ffs_put_le32(p, desc_count);
+	p = usb_ffs_put_le32(p, desc_count);
+	p = usb_ffs_put_le32(p, desc_count);
+	for (j = 0; j < 3; j++) {
+		memcpy(p, &cfg[cfg[0]], cfg_length - cfg[0]);
+		p += cfg_length - cfg[0];
+	}
+	usb_ffs_put_le32(descs, FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+	usb_ffs_put_le32(descs + 4, (uint32_t)(p - descs));
+	usb_ffs_put_le32(descs + 8, FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC | FUNCTIONFS_HAS_SS_DESC);
+	if (write(usb_ffs_ep0, descs, p - descs) != p - descs) {
+		return ERR_IO;
+	}
+
+	// strings are converted from UTF-16LE, characters outside of ASCII are replaced
+	p = strs + sizeof(struct usb_functionfs_strings_head);
+	if (str_count) {
+		*p++ = (uint8_t)lang;
+		*p++ = (uint8_t)(lang >> 8);
+	}
+	for (j = 0; j < str_count; j++) {
+		if (ERR_NONE != usb_ffs_get_desc(USB_DT_STRING, str_index[j], lang, str_desc, sizeof(str_desc), &length)) {
+			length = 0;
+		}
+		for (i = 2; i + 1 < length && i < str_desc[0]; i += 2) {
+			*p++ = (str_desc[i + 1] || str_desc[i] >= 0x80 || !str_desc[i]) ? '?' : str_desc[i];
+		}
+		*p++ = '\0';
+	}
+	usb_ffs_put_le32(strs, FUNCTIONFS_STRINGS_MAGIC);
+	usb_ffs_put_le32(strs + 4, (uint32_t)(p - strs));
+	usb_ffs_put_le32(strs + 8, str_count);
+	usb_ffs_put_le32(strs + 12, str_count ? 1 : 0);
+	if (write(usb_ffs_ep0, strs, p - strs) != p - strs) {
+		return ERR_IO;
+	}
+	return ERR_NONE;
+}
+
+int usb_ffs_open(const char *dir)
+{
+	char path[256];
+
+	memset(&usb_ffs_stats, 0, sizeof(usb_ffs_stats));
+	if (!usb_attached) {
+		fprintf(stderr, "USB device is not attached\n");
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/ep0", dir);
+	usb_ffs_ep0 = open(path, O_RDWR);
+	if (usb_ffs_ep0 < 0) {
+		perror(path);
+		return -1;
+	}
+	usb_dev_cb.event(USB_EV_RESET, 0); // initializes the control endpoint of the stack
+	if (ERR_NONE != usb_ffs_write_descs()) {
+		fprintf(stderr, "%s: could not set up the FunctionFS descriptors\n", path);
+		usb_ffs_close();
+		return -1;
+	}
+	return usb_ffs_ep0;
+}
+
+void usb_ffs_close(void)
+{
+	if (usb_ffs_ep0 >= 0) {
+		close(usb_ffs_ep0);
+		usb_ffs_ep0 = -1;
+	}
+}
+
+void usb_ffs_irq(void *context)
+{
+	struct usb_functionfs_event event;
+	uint8_t                     setup[8] = {0, USB_REQ_SET_CONFIG, 0, 0, 0, 0, 0, 0};
+	ssize_t                     rc;
+
+	(void)context;
+	rc = read(usb_ffs_ep0, &event, sizeof(event));
+	if (rc < 0 && (EINTR == errno || EAGAIN == errno)) {
+		return;
+	}
+	if (rc < 0) {
+		perror("FunctionFS event");
+		exit(EXIT_FAILURE);
+	} else if (rc != sizeof(event)) {
+		fprintf(stderr, "FunctionFS event: short read\n");
+		exit(EXIT_FAILURE);
+	}
+
+	switch (event.type) {
+	case FUNCTIONFS_SETUP:
+		memcpy(setup, &event.u.setup, sizeof(setup)); // usb_ctrlrequest is the little-endian setup packet
+		if (ERR_IO == usb_ffs_control(setup, false, NULL, NULL)) {
+			perror("FunctionFS control transfer");
+		}
+		break;
+	case FUNCTIONFS_ENABLE: // the host set the configuration: replay it after the bus reset it implies
+		usb_dev_cb.event(USB_EV_RESET, 0);
+		setup[2] = usb_ffs_config_value;
+		usb_ffs_control(setup, true, NULL, NULL);
+		break;
+	case FUNCTIONFS_DISABLE:
+	case FUNCTIONFS_UNBIND:
+		usb_dev_cb.event(USB_EV_RESET, 0);
+		break;
+	case FUNCTIONFS_SUSPEND:
+		usb_dev_cb.event(USB_EV_SUSPEND, 0);
+		break;
+	case FUNCTIONFS_RESUME:
+		usb_dev_cb.event(USB_EV_WAKEUP, 0);
+		break;
+	default:
+		break;
+	}
+}
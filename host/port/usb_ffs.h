@@ -0,0 +1,81 @@
+/**
+ * \file
+ * \brief USB device peripheral backed by Linux FunctionFS
+ *
+ * Alternative implementation of the USB device HPL (hpl_usb_device.h) for the host port:
+ * the control endpoint traffic of a FunctionFS instance is fed to the bootloader USB stack,
+ * so that real USB hosts (e.g. dfu-util through dummy_hcd) drive usbdc.c and dfudf.c.
+ *
+ * The gadget framework handles the standard requests (descriptors, address, configuration).
+ * The interface descriptors and strings given to FunctionFS are taken from the USB stack itself,
+ * and SET_CONFIGURATION is replayed to the stack when the host enables the function.
+ * The status stage of control writes with a data stage is sent by the kernel, the stack can not stall it.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_USB_FFS_H
+#define HOST_USB_FFS_H
+
+#include <hpl_usb_device.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Transfers handled by the FunctionFS backend */
+struct usb_ffs_stats {
+	uint32_t control_transfers;
+	uint32_t stalls;
+};
+
+/** Counters since usb_ffs_open() */
+extern struct usb_ffs_stats usb_ffs_stats;
+
+/**
+ * \brief Observer of the control transfers, called once the data stage completed (can be NULL)
+ * \param[in] setup Setup packet
+ * \param[in] length Length of the data stage
+ * \param[in] stalled The device stalled the request
+ */
+extern void (*usb_ffs_monitor)(const uint8_t setup[8], uint16_t length, bool stalled);
+
+/**
+ * \brief Open the control endpoint of a mounted FunctionFS instance and write the descriptors and strings
+ *
+ * The USB stack must be initialized and attached (usb_init()), its descriptors are read through a local
+ * control transfer. The gadget can be bound to the UDC once this returns.
+ * \param[in] dir Mount point of the FunctionFS instance
+ * \return File descriptor of the control endpoint, to use as interrupt source (see port_init()), or -1 on error
+ */
+int usb_ffs_open(const char *dir);
+
+/**
+ * \brief Serve one event of the control endpoint (interrupt handler)
+ * \param[in] context Unused
+ */
+void usb_ffs_irq(void *context);
+
+/**
+ * \brief Close the control endpoint, which removes the function from the bus
+ */
+void usb_ffs_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_USB_FFS_H */
@@ -0,0 +1,453 @@
+/**
+ * \file
+ * \brief Model of the USB device peripheral and of a full-speed host using its control and bulk endpoints
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+
+#include <hpl_usb_config.h>
+#include <utils.h>
+
+#include "port.h"
+#include "usb_model.h"
+
+/** Maximum packet size of the control endpoint */
+#define USB_MODEL_EP0_SIZE 64
+/** Bus bytes added to each transaction: sync, PID, CRC, token and handshake packets, inter-packet gaps */
+#define USB_MODEL_PACKET_OVERHEAD 16
+/** Largest IN data stage the model can buffer */
+#define USB_MODEL_IN_BUFFER_SIZE 4096
+
+/** Transfer requested by the device on one direction of an endpoint */
+struct usb_model_ep {
+	bool     stall;
+	bool     pending;
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t count;   /**< bytes of a bulk transfer already moved */
+	uint16_t max_pkt; /**< maximum packet size */
+};
+
+struct usb_model_stats usb_model_stats;
+
+static struct usb_model_params       usb_params;
+static struct _usb_d_dev_callbacks    usb_dev_cb;
+static struct _usb_d_dev_ep_callbacks usb_ep_cb;
+static bool                           usb_enabled;
+static bool                           usb_attached;
+static uint8_t                        usb_address;
+/** Last setup packet */
+static uint8_t usb_setup[8];
+/** Endpoints, OUT [0] and IN [1] directions */
+static struct usb_model_ep usb_eps[CONF_USB_D_MAX_EP_N + 1][2];
+/** Control endpoint */
+#define usb_ep0 usb_eps[0]
+/** IN data of the control endpoint is copied when the transfer is requested, as the peripheral does with its endpoint cache */
+static uint8_t usb_in_data[USB_MODEL_IN_BUFFER_SIZE];
+
+static void usb_model_dummy_cb(void)
+{
+}
+
+static struct usb_model_ep *usb_model_ep(const uint8_t ep)
+{
+	if ((ep & USB_EP_N_MASK) > CONF_USB_D_MAX_EP_N) {
+		return NULL;
+	}
+	return &usb_eps[ep & USB_EP_N_MASK][(ep & USB_EP_DIR) ? 1 : 0];
+}
+
+void usb_model_init(const struct usb_model_params *params)
+{
+	usb_params = *params;
+	memset(&usb_model_stats, 0, sizeof(usb_model_stats));
+}
+
+int32_t _usb_d_dev_init(void)
+{
+	usb_dev_cb.sof   = (_usb_d_dev_sof_cb_t)usb_model_dummy_cb;
+	usb_dev_cb.event = (_usb_d_dev_event_cb_t)usb_model_dummy_cb;
+	usb_ep_cb.setup  = (_usb_d_dev_ep_cb_setup_t)usb_model_dummy_cb;
+	usb_ep_cb.more   = (_usb_d_dev_ep_cb_more_t)usb_model_dummy_cb;
+	usb_ep_cb.done   = (_usb_d_dev_ep_cb_done_t)usb_model_dummy_cb;
+	usb_enabled      = false;
+	usb_attached     = false;
+	usb_address      = 0;
+	memset(usb_eps, 0, sizeof(usb_eps));
+	return ERR_NONE;
+}
+
+void _usb_d_dev_deinit(void)
+{
+	usb_enabled  = false;
+	usb_attached = false;
+}
+
+void _usb_d_dev_register_callback(const enum usb_d_cb_type type, const FUNC_PTR func)
+{
+	FUNC_PTR f = (func == NULL) ? (FUNC_PTR)usb_model_dummy_cb : (FUNC_PTR)func;
+	if (type == USB_D_CB_EVENT) {
+		usb_dev_cb.event = (_usb_d_dev_event_cb_t)f;
+	} else if (type == USB_D_CB_SOF) {
+		usb_dev_cb.sof = (_usb_d_dev_sof_cb_t)f;
+	}
+}
+
+void _usb_d_dev_register_ep_callback(const enum usb_d_dev_ep_cb_type type, const FUNC_PTR func)
+{
+	FUNC_PTR f = (func == NULL) ? (FUNC_PTR)usb_model_dummy_cb : (FUNC_PTR)func;
+	if (type == USB_D_DEV_EP_CB_SETUP) {
+		usb_ep_cb.setup = (_usb_d_dev_ep_cb_setup_t)f;
+	} else if (type == USB_D_DEV_EP_CB_MORE) {
+		usb_ep_cb.more = (_usb_d_dev_ep_cb_more_t)f;
+	} else if (type == USB_D_DEV_EP_CB_DONE) {
+		usb_ep_cb.done = (_usb_d_dev_ep_cb_done_t)f;
+	}
+}
+
+int32_t _usb_d_dev_enable(void)
+{
+	usb_enabled = true;
+	return ERR_NONE;
+}
+
+int32_t _usb_d_dev_disable(void)
+{
+	usb_enabled = false;
+	return ERR_NONE;
+}
+
+void _usb_d_dev_attach(void)
+{
+	usb_attached = usb_enabled;
+}
+
+void _usb_d_dev_detach(void)
+{
+	usb_attached = false;
+}
+
+void _usb_d_dev_send_remotewakeup(void)
+{
+}
+
+enum usb_speed _usb_d_dev_get_speed(void)
+{
+	return USB_SPEED_FS;
+}
+
+void _usb_d_dev_set_address(const uint8_t addr)
+{
+	usb_address = addr;
+}
+
+uint8_t _usb_d_dev_get_address(void)
+{
+	return usb_address;
+}
+
+uint16_t _usb_d_dev_get_frame_n(void)
+{
+	return (uint16_t)((port_time_ns / 1000000) & 0x7FF);
+}
+
+uint8_t _usb_d_dev_get_uframe_n(void)
+{
+	return 0;
+}
+
+int32_t _usb_d_dev_ep0_init(const uint8_t max_pkt_siz)
+{
+	return _usb_d_dev_ep_init(0, USB_EP_XTYPE_CTRL, max_pkt_siz);
+}
+
+int32_t _usb_d_dev_ep_init(const uint8_t ep, const uint8_t attr, uint16_t max_pkt_siz)
+{
+	struct usb_model_ep *ept = usb_model_ep(ep);
+	if (NULL == ept) {
+		return -USB_ERR_PARAM;
+	}
+	if (USB_EP_XTYPE_CTRL == (attr & USB_EP_XTYPE_MASK)) { // both directions
+		memset(usb_ep0, 0, sizeof(usb_ep0));
+		usb_ep0[0].max_pkt = max_pkt_siz;
+		usb_ep0[1].max_pkt = max_pkt_siz;
+	} else {
+		memset(ept, 0, sizeof(*ept));
+		ept->max_pkt = max_pkt_siz;
+	}
+	return ERR_NONE;
+}
+
+void _usb_d_dev_ep_deinit(const uint8_t ep)
+{
+	struct usb_model_ep *ept = usb_model_ep(ep);
+	if (0 == (ep & USB_EP_N_MASK)) {
+		memset(usb_ep0, 0, sizeof(usb_ep0));
+	} else if (ept) {
+		memset(ept, 0, sizeof(*ept));
+	}
+}
+
+int32_t _usb_d_dev_ep_enable(const uint8_t ep)
+{
+	return (NULL == usb_model_ep(ep)) ? -USB_ERR_PARAM : ERR_NONE;
+}
+
+void _usb_d_dev_ep_disable(const uint8_t ep)
+{
+	_usb_d_dev_ep_abort(ep);
+}
+
+int32_t _usb_d_dev_ep_stall(const uint8_t ep, const enum usb_ep_stall_ctrl ctrl)
+{
+	struct usb_model_ep *ept = usb_model_ep(ep);
+	if (NULL == ept) {
+		return -USB_ERR_PARAM;
+	}
+	if (ctrl == USB_EP_STALL_SET) {
+		ept->stall   = true;
+		ept->pending = false;
+	} else if (ctrl == USB_EP_STALL_CLR) {
+		ept->stall = false;
+	} else {
+		return ept->stall;
+	}
+	return ERR_NONE;
+}
+
+int32_t _usb_d_dev_ep_read_req(const uint8_t ep, uint8_t *req_buf)
+{
+	if (ep & USB_EP_N_MASK) {
+		return -USB_ERR_PARAM;
+	}
+	memcpy(req_buf, usb_setup, sizeof(usb_setup));
+	return sizeof(usb_setup);
+}
+
+int32_t _usb_d_dev_ep_trans(const struct usb_d_transfer *trans)
+{
+	struct usb_model_ep *ept = usb_model_ep(trans->ep);
+	if (NULL == ept) {
+		return -USB_ERR_PARAM;
+	}
+	if (ept->stall) {
+		return USB_HALTED;
+	}
+	if (0 == (trans->ep & USB_EP_N_MASK) && (trans->ep & USB_EP_DIR) && trans->size) {
+		if (trans->size > sizeof(usb_in_data)) {
+			return -USB_ERR_PARAM;
+		}
+		memcpy(usb_in_data, trans->buf, trans->size);
+	}
+	ept->pending = true;
+	ept->buf     = trans->buf;
+	ept->size    = trans->size;
+	ept->count   = 0;
+	return ERR_NONE;
+}
+
+void _usb_d_dev_ep_abort(const uint8_t ep)
+{
+	struct usb_model_ep *ept = usb_model_ep(ep);
+	if (ept) {
+		ept->pending = false;
+	}
+}
+
+int32_t _usb_d_dev_ep_get_status(const uint8_t ep, struct usb_d_trans_status *stat)
+{
+	struct usb_model_ep *ept = usb_model_ep(ep);
+	if (NULL == ept) {
+		return -USB_ERR_PARAM;
+	}
+	if (stat) {
+		memset(stat, 0, sizeof(*stat));
+		stat->ep    = ep;
+		stat->size  = ept->size;
+		stat->count = ept->count;
+		stat->xtype = (ep & USB_EP_N_MASK) ? USB_EP_XTYPE_BULK : USB_EP_XTYPE_CTRL;
+		stat->busy  = ept->pending;
+		stat->stall = ept->stall;
+		stat->dir   = (ep & USB_EP_DIR) ? 1 : 0;
+	}
+	return ept->pending ? USB_BUSY : USB_OK;
+}
+
+bool usb_model_bus_reset(void)
+{
+	if (!usb_attached) {
+		return false;
+	}
+	usb_address = 0;
+	usb_dev_cb.event(USB_EV_RESET, 0);
+	return true;
+}
+
+/** Complete the pending OUT transfer of the control endpoint with the host data */
+static enum usb_model_result usb_model_stage_out(const uint8_t *data, uint16_t length)
+{
+	struct usb_model_ep *ept = &usb_ep0[0];
+	uint32_t             n;
+
+	if (ept->stall) {
+		return USB_MODEL_STALL;
+	}
+	if (!ept->pending) {
+		return USB_MODEL_ERROR; // the host would time out
+	}
+	n            = min(ept->size, length);
+	ept->pending = false;
+	if (n) {
+		memcpy(ept->buf, data, n);
+	}
+	usb_ep_cb.done(0, USB_TRANS_DONE, n);
+	return USB_MODEL_OK;
+}
+
+/** Complete the pending IN transfer of the control endpoint, giving its data to the host */
+static enum usb_model_result usb_model_stage_in(uint8_t *data, uint16_t length, uint16_t *received)
+{
+	struct usb_model_ep *ept = &usb_ep0[1];
+	uint32_t             n;
+
+	if (ept->stall) {
+		return USB_MODEL_STALL;
+	}
+	if (!ept->pending) {
+		return USB_MODEL_ERROR; // the host would time out
+	}
+	n            = min(ept->size, length);
+	ept->pending = false;
+	if (n) {
+		memcpy(data, usb_in_data, n);
+	}
+	if (received) {
+		*received = (uint16_t)n;
+	}
+	usb_ep_cb.done(USB_EP_DIR, USB_TRANS_DONE, n);
+	return USB_MODEL_OK;
+}
+
+enum usb_model_result usb_model_control(const uint8_t setup[8], uint8_t *data, uint16_t *length)
+{
+	const bool     dir_in   = (setup[0] & USB_REQ_TYPE_IN) != 0;
+	const uint16_t w_length = (uint16_t)(setup[6] | (setup[7] << 8));
+	uint32_t       bus_bytes;
+	uint64_t       duration;
+	enum usb_model_result result;
+
+	if (length) {
+		*length = 0;
+	}
+	if (!usb_attached) {
+		return USB_MODEL_NO_DEVICE;
+	}
+
+	// the device handles the stages once they are complete on the bus: account the whole transfer first
+	bus_bytes = 8 + USB_MODEL_PACKET_OVERHEAD; // setup stage
+	bus_bytes += w_length + ((w_length + USB_MODEL_EP0_SIZE - 1) / USB_MODEL_EP0_SIZE) * USB_MODEL_PACKET_OVERHEAD;
+	bus_bytes += USB_MODEL_PACKET_OVERHEAD; // status stage
+	duration = usb_params.xfer_overhead_ns + (uint64_t)bus_bytes * 2000 / 3; // 12 Mbit/s
+	port_time_ns += duration;
+	usb_model_stats.busy_ns += duration;
+	usb_model_stats.control_transfers++;
+
+	// a setup packet cancels any previous control transfer and clears the stall condition
+	memcpy(usb_setup, setup, sizeof(usb_setup));
+	usb_ep0[0].pending = false;
+	usb_ep0[1].pending = false;
+	usb_ep0[0].stall   = false;
+	usb_ep0[1].stall   = false;
+	usb_ep_cb.setup(0);
+
+	if (0 == w_length) {
+		result = usb_model_stage_in(NULL, 0, NULL);
+	} else if (dir_in) {
+		result = usb_model_stage_in(data, w_length, length);
+		if (USB_MODEL_OK == result) {
+			result = usb_model_stage_out(NULL, 0);
+		}
+	} else {
+		result = usb_model_stage_out(data, w_length);
+		if (USB_MODEL_OK == result) {
+			result = usb_model_stage_in(NULL, 0, NULL);
+		}
+	}
+	if (USB_MODEL_STALL == result) {
+		usb_model_stats.stalls++;
+	}
+	return result;
+}
+
+bool usb_model_bulk_ready(const uint8_t ep)
+{
+	const struct usb_model_ep *ept = usb_model_ep(ep);
+	return !usb_attached || (ept && (ept->pending || ept->stall));
+}
+
+enum usb_model_result usb_model_bulk(const uint8_t ep, uint8_t *data, uint32_t length, bool first, uint32_t *count)
+{
+	struct usb_model_ep *ept = usb_model_ep(ep);
+	uint32_t             n, packets;
+	uint64_t             duration;
+	bool                 end;
+
+	*count = 0;
+	if (!usb_attached) {
+		return USB_MODEL_NO_DEVICE;
+	}
+	if (NULL == ept || 0 == (ep & USB_EP_N_MASK)) {
+		return USB_MODEL_ERROR;
+	}
+	duration = first ? usb_params.bulk_overhead_ns : 0;
+	if (first) {
+		usb_model_stats.bulk_transfers++;
+	}
+	if (ept->stall) {
+		usb_model_stats.stalls++;
+		duration += (uint64_t)USB_MODEL_PACKET_OVERHEAD * 2000 / 3; // token and STALL handshake
+	} else if (ept->pending) {
+		n       = min(length, ept->size - ept->count);
+		packets = n ? (n + ept->max_pkt - 1) / ept->max_pkt : 1;
+		duration += (uint64_t)(n + packets * USB_MODEL_PACKET_OVERHEAD) * 2000 / 3; // 12 Mbit/s
+		usb_model_stats.bulk_bytes += n;
+		*count = n;
+	}
+	port_time_ns += duration;
+	usb_model_stats.busy_ns += duration;
+	if (ept->stall) {
+		return USB_MODEL_STALL;
+	}
+	if (!ept->pending) {
+		return USB_MODEL_NAK; // the host retries once the device armed the endpoint
+	}
+	n = *count;
+	if (ep & USB_EP_DIR) {
+		memcpy(data, &ept->buf[ept->count], n);
+	} else {
+		memcpy(&ept->buf[ept->count], data, n);
+	}
+	ept->count += n;
+	// the transfer ends once complete, or with a short packet
+	end = (ept->count == ept->size) || (n % ept->max_pkt) || (0 == n);
+	if (end) {
+		ept->pending = false;
+		usb_ep_cb.done(ep, USB_TRANS_DONE, ept->count);
+	}
+	return USB_MODEL_OK;
+}
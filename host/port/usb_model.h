@@ -0,0 +1,111 @@
+/**
+ * \file
+ * \brief Model of the USB device peripheral and of a full-speed host using its control and bulk endpoints
+ *
+ * The model implements the USB device HPL (hal/include/hpl_usb_device.h) under the real USB device HAL and stack.
+ * The host side issues complete control transfers (setup, data and status stages) and moves bulk data,
+ * calling the endpoint callbacks as the USB interrupt handler would, and accounts their duration in the model time.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef HOST_USB_MODEL_H
+#define HOST_USB_MODEL_H
+
+#include <hpl_usb_device.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Timing of the USB model */
+struct usb_model_params {
+	/** Fixed cost of a control transfer: host stack latency and frame scheduling */
+	uint32_t xfer_overhead_ns;
+	/** Fixed cost of a bulk transfer of the host, however many transactions it takes */
+	uint32_t bulk_overhead_ns;
+};
+
+/** Outcome of a control transfer */
+enum usb_model_result {
+	USB_MODEL_OK,        /**< transfer completed */
+	USB_MODEL_STALL,     /**< device stalled the request */
+	USB_MODEL_NO_DEVICE, /**< device is detached */
+	USB_MODEL_ERROR,     /**< device did not handle a stage of the transfer */
+	USB_MODEL_NAK,       /**< bulk endpoint not armed by the device yet */
+};
+
+/** Transfers handled by the USB model */
+struct usb_model_stats {
+	uint32_t control_transfers;
+	uint32_t stalls;
+	uint64_t busy_ns; /**< total duration of the control and bulk transfers */
+	uint32_t bulk_transfers;
+	uint64_t bulk_bytes;
+};
+
+/** Counters since the last usb_model_init() */
+extern struct usb_model_stats usb_model_stats;
+
+/**
+ * \brief Reset the USB model
+ * \param[in] params Timing, copied
+ */
+void usb_model_init(const struct usb_model_params *params);
+
+/**
+ * \brief Signal a bus reset to the device, as the host does after the device attached
+ * \return false if the device is not attached
+ */
+bool usb_model_bus_reset(void);
+
+/**
+ * \brief Run a complete control transfer on endpoint 0
+ *
+ * The model time advances by the duration of the transfer.
+ * \param[in] setup Setup packet; its wLength gives the length of the data stage
+ * \param[in,out] data Data to send (OUT) or buffer for the received data (IN), can be NULL if wLength is 0
+ * \param[out] length Number of bytes received for IN transfers, can be NULL
+ * \return Outcome of the transfer
+ */
+enum usb_model_result usb_model_control(const uint8_t setup[8], uint8_t *data, uint16_t *length);
+
+/**
+ * \brief Check whether a bulk endpoint would not NAK: the device armed a transfer or stalled it (or detached)
+ * \param[in] ep Endpoint address
+ */
+bool usb_model_bulk_ready(uint8_t ep);
+
+/**
+ * \brief Move the data of a bulk transfer of the host, as far as the transfer armed by the device allows
+ *
+ * The host calls it again for the rest of its transfer once the device armed the next one.
+ * The transfer of the device ends when complete or with a short packet.
+ * The model time advances by the duration of the transactions.
+ * \param[in] ep Endpoint address, USB_EP_DIR set for IN
+ * \param[in,out] data Data to send (OUT) or buffer for the received data (IN)
+ * \param[in] length Bytes left in the transfer of the host
+ * \param[in] first First call for the transfer of the host, accounting its fixed cost
+ * \param[out] count Number of bytes moved
+ * \return Outcome: USB_MODEL_NAK if the device did not arm the endpoint
+ */
+enum usb_model_result usb_model_bulk(uint8_t ep, uint8_t *data, uint32_t length, bool first, uint32_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_USB_MODEL_H */
@@ -0,0 +1,391 @@
+/**
+ * \file
+ * \brief Simulated DFU devices, following the bootloader DFU state machine
+ *
+ * The request handling mirrors dfudf_in_req()/dfudf_out_req() in usb/class/dfu/device/dfudf.c,
+ * and the flashing time mirrors the main loop in usb_dfu() (usb_start.c) which re-writes the whole 8 KB block for each downloaded chunk.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <thread>
+
+#include "dfu_protocol.h"
+#include "dfu_transport.h"
+
+namespace dfu {
+
+namespace {
+
+/** Flash page size of the SAM D5x/E5x */
+constexpr uint32_t page_size = 512;
+/** Flash block (erase unit) size of the SAM D5x/E5x */
+constexpr uint32_t block_size = 8192;
+
+/** Pending transfer completion */
+struct completion {
+	clock::time_point due;
+	uint64_t seq; /**< keeps completions due at the same time in submission order */
+	std::function<void()> fn;
+
+	bool operator>(const completion &other) const
+	{
+		return due != other.due ? due > other.due : seq > other.seq;
+	}
+};
+
+class sim_bus;
+
+class sim_device : public device {
+public:
+	sim_device(sim_bus &bus, const sim_params &params, unsigned index)
+		: _bus(bus), _params(params), _name("sim-" + std::to_string(index)), _flash(params.flash_size, 0xFF)
+	{
+	}
+
+	std::string name() const override { return _name; }
+	uint8_t interface() const override { return 0; }
+	uint8_t attributes() const override { return CAN_DOWNLOAD | WILL_DETACH; }
+	uint16_t transfer_size() const override { return page_size; }
+
+	bool control_out(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, xfer_callback cb) override;
+	bool control_in(uint8_t request, uint16_t value, uint16_t length, xfer_callback cb) override;
+	bool vendor_out(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, xfer_callback cb) override;
+	bool vendor_in(uint8_t request, uint16_t value, uint16_t length, xfer_callback cb) override;
+
+	std::string diagnostics() const override
+	{
+		return std::to_string(_erases) + " block erases, " + std::to_string(_page_writes) + " page writes, "
+		       + std::to_string(_early_polls) + " GETSTATUS before bwPollTimeout elapsed";
+	}
+
+private:
+	/** Run the non-USB part of the state machine, as the main loop in usb_dfu() would have */
+	void run_main_loop(clock::time_point now);
+	/** Out request handling, returns false to stall */
+	bool out_request(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, clock::time_point now);
+	/** Record the blocks completed by the downloaded data, as the bootloader does for resumable downloads */
+	void record_progress(size_t offset, uint16_t length);
+
+	sim_bus &_bus;
+	const sim_params &_params;
+	std::string _name;
+	std::vector<uint8_t> _flash;
+
+	uint8_t _state = DFU_IDLE;
+	uint8_t _status = 0;
+	size_t _download_offset = 0;
+	uint16_t _download_length = 0;
+	uint8_t _download_data[page_size];
+	bool _manifestation_complete = false;
+	bool _gone = false; /**< device reset after manifestation */
+	image_id _image{0, 0}; /**< image identified by the host (SET_IMAGE) */
+	bool _identified = false;
+	std::vector<bool> _done = std::vector<bool>(_params.flash_size / block_size); /**< blocks completed for _image */
+	size_t _chain_start = 0; /**< contiguous downloaded data */
+	size_t _chain_end = 0;
+	clock::time_point _busy_until; /**< time at which the current flash operation completes */
+	clock::time_point _poll_allowed; /**< earliest time the host should poll again */
+
+	unsigned _erases = 0;
+	unsigned _page_writes = 0;
+	unsigned _early_polls = 0;
+};
+
+class sim_bus : public bus {
+public:
+	explicit sim_bus(const sim_params &params) : _params(params) {}
+
+	std::vector<std::unique_ptr<device>> discover(uint16_t vid, uint16_t pid) override
+	{
+		std::vector<std::unique_ptr<device>> devices;
+		if (vid != default_vid || pid != default_pid) {
+			return devices;
+		}
+		for (unsigned i = 0; i < _params.devices; i++) {
+			devices.emplace_back(new sim_device(*this, _params, i));
+		}
+		return devices;
+	}
+
+	void handle_events(clock::time_point deadline) override
+	{
+		clock::time_point wake = deadline;
+		if (!_pending.empty() && _pending.top().due < wake) {
+			wake = _pending.top().due;
+		}
+		if (clock::time_point::max() == wake) {
+			return; // nothing will ever happen
+		}
+		std::this_thread::sleep_until(wake);
+
+		clock::time_point now = clock::now();
+		while (!_pending.empty() && _pending.top().due <= now) {
+			std::function<void()> fn = _pending.top().fn;
+			_pending.pop();
+			fn(); // may schedule new completions
+		}
+	}
+
+	/** Schedule a completion callback after the simulated transfer latency */
+	void complete(std::function<void()> fn)
+	{
+		_pending.push(completion{clock::now() + std::chrono::microseconds(_params.xfer_latency_us), _seq++, fn});
+	}
+
+private:
+	const sim_params _params;
+	std::priority_queue<completion, std::vector<completion>, std::greater<completion>> _pending;
+	uint64_t _seq = 0;
+};
+
+void sim_device::run_main_loop(clock::time_point now)
+{
+	if (DFU_DNLOAD_SYNC == _state || DFU_DNBUSY == _state) {
+		if (now < _busy_until) {
+			return; // still flashing
+		}
+		if (_download_offset + _download_length > _flash.size()) {
+			_state = DFU_ERROR;
+			_status = 8; // errADDRESS
+			return;
+		}
+		std::memcpy(&_flash[_download_offset], _download_data, _download_length);
+		record_progress(_download_offset, _download_length);
+		_state = DFU_DNLOAD_IDLE;
+	}
+	if (DFU_MANIFEST == _state) {
+		_identified = false; // nothing left to resume
+		std::fill(_done.begin(), _done.end(), false);
+		_manifestation_complete = true;
+		_state = DFU_MANIFEST_WAIT_RESET;
+	}
+	if (DFU_MANIFEST_WAIT_RESET == _state) {
+		_gone = true; // will detach: the device resets immediately
+	}
+}
+
+void sim_device::record_progress(size_t offset, uint16_t length)
+{
+	if (!_identified) {
+		return;
+	}
+	if (offset != _chain_end) {
+		_chain_start = offset;
+	}
+	_chain_end = offset + length;
+	for (size_t block = (_chain_start + block_size - 1) / block_size; block < _done.size(); block++) {
+		if ((block + 1) * block_size <= _chain_end || (block * block_size < _chain_end && _chain_end >= _image.size)) {
+			_done[block] = true;
+		}
+	}
+}
+
+bool sim_device::out_request(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, clock::time_point now)
+{
+	switch (request) {
+	case CLRSTATUS:
+		if (DFU_ERROR == _state || 0 != _status) {
+			_status = 0;
+			_state = DFU_IDLE;
+		}
+		return true;
+	case ABORT:
+		_download_offset = 0;
+		_state = DFU_IDLE;
+		return true;
+	case DNLOAD:
+		if (DFU_IDLE != _state && DFU_DNLOAD_IDLE != _state) {
+			_status = 6; // errPROG
+			_state = DFU_ERROR;
+			return false;
+		}
+		_poll_allowed = now; // a new operation starts, the previous poll timeout does not apply anymore
+		if (0 == length) {
+			if (DFU_IDLE == _state) {
+				_status = 6;
+				_state = DFU_ERROR;
+				return false;
+			}
+			_manifestation_complete = false;
+			_state = DFU_MANIFEST_SYNC;
+			return true;
+		}
+		if (length > sizeof(_download_data)) {
+			_status = 6;
+			_state = DFU_ERROR;
+			return false;
+		}
+		std::memcpy(_download_data, data, length);
+		_download_offset = (size_t)value * sizeof(_download_data);
+		for (size_t block = _download_offset / block_size; block * block_size < _download_offset + length && block < _done.size(); block++) {
+			_done[block] = false; // a block being written is not complete anymore
+		}
+		_download_length = length;
+		_state = DFU_DNLOAD_SYNC;
+		// flash_write() erases the 8 KB block and re-programs all its pages for every chunk
+		_erases++;
+		_page_writes += block_size / page_size;
+		_busy_until = now + std::chrono::microseconds(_params.block_erase_us)
+		              + std::chrono::microseconds((uint64_t)_params.page_write_us * (block_size / page_size));
+		return true;
+	default:
+		_state = DFU_ERROR;
+		return false;
+	}
+}
+
+bool sim_device::control_out(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, xfer_callback cb)
+{
+	std::vector<uint8_t> payload(data, data + length);
+	_bus.complete([this, request, value, payload, cb]() {
+		if (_gone) {
+			cb(xfer_result::no_device, nullptr, 0);
+			return;
+		}
+		clock::time_point now = clock::now();
+		run_main_loop(now);
+		bool ok = out_request(request, value, payload.data(), (uint16_t)payload.size(), now);
+		cb(ok ? xfer_result::ok : xfer_result::stall, nullptr, 0);
+	});
+	return true;
+}
+
+bool sim_device::control_in(uint8_t request, uint16_t value, uint16_t length, xfer_callback cb)
+{
+	(void)value;
+	_bus.complete([this, request, length, cb]() {
+		if (_gone) {
+			cb(xfer_result::no_device, nullptr, 0);
+			return;
+		}
+		clock::time_point now = clock::now();
+		run_main_loop(now);
+		if (_gone) {
+			cb(xfer_result::no_device, nullptr, 0);
+			return;
+		}
+		uint8_t response[status_length];
+		switch (request) {
+		case GETSTATUS:
+			if (now < _poll_allowed) {
+				_early_polls++;
+			}
+			response[0] = _status;
+			response[1] = (uint8_t)(_params.poll_timeout_ms);
+			response[2] = (uint8_t)(_params.poll_timeout_ms >> 8);
+			response[3] = (uint8_t)(_params.poll_timeout_ms >> 16);
+			response[4] = _state;
+			response[5] = 0;
+			_poll_allowed = now + std::chrono::milliseconds(_params.poll_timeout_ms);
+			if (DFU_DNLOAD_SYNC == _state) {
+				_state = DFU_DNBUSY;
+			} else if (DFU_MANIFEST_SYNC == _state) {
+				_state = _manifestation_complete ? DFU_MANIFEST_WAIT_RESET : DFU_MANIFEST;
+			}
+			cb(xfer_result::ok, response, std::min<size_t>(length, status_length));
+			break;
+		case GETSTATE:
+			response[0] = _state;
+			cb(xfer_result::ok, response, std::min<size_t>(length, 1));
+			break;
+		default:
+			_state = DFU_ERROR;
+			cb(xfer_result::stall, nullptr, 0);
+			break;
+		}
+	});
+	return true;
+}
+
+bool sim_device::vendor_out(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, xfer_callback cb)
+{
+	(void)value;
+	std::vector<uint8_t> payload(data, data + length);
+	_bus.complete([this, request, payload, cb]() {
+		if (_gone) {
+			cb(xfer_result::no_device, nullptr, 0);
+			return;
+		}
+		run_main_loop(clock::now());
+		if (SET_BLOCK_CRCS == request && DFU_IDLE == _state && _identified
+		    && payload.size() == (_image.size + block_size - 1) / block_size * 4 && _image.size <= _flash.size()) {
+			for (size_t block = 0; block * block_size < _image.size; block++) { // record the blocks already holding the image
+				const uint32_t crc = (uint32_t)payload[block * 4] | ((uint32_t)payload[block * 4 + 1] << 8)
+				                     | ((uint32_t)payload[block * 4 + 2] << 16) | ((uint32_t)payload[block * 4 + 3] << 24);
+				if (crc == crc32(&_flash[block * block_size], std::min<size_t>(block_size, _image.size - block * block_size))) {
+					_done[block] = true;
+				}
+			}
+			cb(xfer_result::ok, nullptr, 0);
+			return;
+		}
+		if (SET_IMAGE != request || image_id_length != payload.size() || DFU_IDLE != _state) {
+			cb(xfer_result::stall, nullptr, 0); // the DFU state is not affected
+			return;
+		}
+		const image_id id = image_id::parse(payload.data());
+		if (!_identified || !(id == _image)) {
+			std::fill(_done.begin(), _done.end(), false);
+		}
+		_image = id;
+		_identified = true;
+		_chain_start = _chain_end = 0;
+		cb(xfer_result::ok, nullptr, 0);
+	});
+	return true;
+}
+
+bool sim_device::vendor_in(uint8_t request, uint16_t value, uint16_t length, xfer_callback cb)
+{
+	(void)value;
+	_bus.complete([this, request, length, cb]() {
+		if (_gone) {
+			cb(xfer_result::no_device, nullptr, 0);
+			return;
+		}
+		run_main_loop(clock::now());
+		if (GET_RESUME != request) {
+			cb(xfer_result::stall, nullptr, 0);
+			return;
+		}
+		uint8_t response[resume_info_length] = {};
+		if (_identified) {
+			_image.serialize(response);
+		}
+		response[8] = (uint8_t)block_size;
+		response[9] = (uint8_t)(block_size >> 8);
+		for (size_t block = 0; block < _done.size() && block < 16 * 8; block++) {
+			if (_identified && _done[block]) {
+				response[10 + block / 8] |= (uint8_t)(1 << (block % 8));
+			}
+		}
+		cb(xfer_result::ok, response, std::min<size_t>(length, resume_info_length));
+	});
+	return true;
+}
+
+} // namespace
+
+std::unique_ptr<bus> make_sim_bus(const sim_params &params)
+{
+	return std::unique_ptr<bus>(new sim_bus(params));
+}
+
+} // namespace dfu
@@ -0,0 +1,216 @@
+/**
+ * \file
+ * \brief Two-thread stress test of the single-producer single-consumer queue (hal/utils/src/utils_spsc.c)
+ *
+ * A producer thread puts job descriptors carrying a sequence number and a buffer pointer, as the USB interrupt does,
+ * and a consumer thread takes them, as the main loop does.
+ * The consumer checks that the sequence numbers are consecutive and that each descriptor and its buffer arrive whole,
+ * then the throughput of the queue is reported.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <thread>
+#include <vector>
+
+#include "utils_spsc.h"
+
+/* replaces hal/utils/src/utils_assert.c */
+extern "C" void assert(const bool condition, const char *const file, const int line)
+{
+	if (!(condition)) {
+		std::fprintf(stderr, "assertion failed at %s:%d\n", file, line);
+		std::abort();
+	}
+}
+
+namespace {
+
+/** Job descriptor, shaped like struct usb_dfu_job (usb/class/dfu/device/dfudf.h) */
+struct job {
+	uint32_t sequence; /**< Number of jobs put before this one */
+	uint8_t *data;     /**< Buffer filled by the producer, only valid until the job is released */
+	uint32_t length;   /**< Length of the buffer in bytes */
+	uint32_t check;    /**< Check value of the descriptor fields above, to detect torn copies */
+};
+
+/** How the consumer takes the jobs */
+enum class mode {
+	get,  /**< spsc_queue_get(): the descriptor is copied and released at once, the buffer is not accessed */
+	peek, /**< spsc_queue_peek() then spsc_queue_drop(): the buffer is checked while the job is held */
+};
+
+uint32_t job_check(const struct job &j)
+{
+	return ~(j.sequence * 0x9E3779B1u ^ (uint32_t)(uintptr_t)j.data ^ j.length);
+}
+
+uint8_t pattern(uint32_t sequence, uint32_t i)
+{
+	return (uint8_t)(sequence * 7 + i);
+}
+
+void usage(const char *argv0)
+{
+	std::printf("Usage: %s [options]\n"
+	            "Pass jobs between a producer and a consumer thread through the SPSC queue, check their order and\n"
+	            "content, and report the throughput.\n\n"
+	            "  -n, --jobs N       number of jobs per mode (default 10000000)\n"
+	            "  -s, --size N       number of queue slots, a power of 2 (default 4, as dfu_jobs)\n"
+	            "  -b, --buffer BYTES bytes of each job buffer (default 64)\n"
+	            "  -h, --help         show this help\n",
+	            argv0);
+}
+
+/**
+ * \brief Pass jobs jobs through a queue of size slots
+ *
+ * The producer fills one buffer per slot: the buffer of a job is only reused once the job size positions earlier
+ * has been released, which spsc_queue_put() guarantees.
+ *
+ * \return The number of errors found by the consumer.
+ */
+uint64_t run(enum mode m, uint32_t jobs, uint32_t size, uint32_t buffer_size)
+{
+	struct spsc_queue queue;
+	std::vector<struct job> slots(size);
+	std::vector<uint8_t> buffers((size_t)size * buffer_size);
+	uint64_t errors = 0;
+
+	if (ERR_NONE != spsc_queue_init(&queue, slots.data(), sizeof(struct job), size)) {
+		std::fprintf(stderr, "invalid queue size: %u\n", size);
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	std::thread producer([&] {
+		for (uint32_t sequence = 0; sequence < jobs; sequence++) {
+			struct job j;
+			j.sequence = sequence;
+			j.data     = &buffers[(size_t)(sequence & (size - 1)) * buffer_size];
+			j.length   = buffer_size;
+			j.check    = job_check(j);
+			if (mode::peek == m) {
+				// the slot the buffer belongs to has been released: wait for it before writing the buffer
+				while (spsc_queue_num(&queue) >= size) {
+					std::this_thread::yield();
+				}
+				for (uint32_t i = 0; i < buffer_size; i++) {
+					j.data[i] = pattern(sequence, i);
+				}
+			}
+			while (ERR_NONE != spsc_queue_put(&queue, &j)) {
+				std::this_thread::yield();
+			}
+		}
+	});
+	std::thread consumer([&] {
+		for (uint32_t expected = 0; expected < jobs; expected++) {
+			struct job j;
+			if (mode::get == m) {
+				while (ERR_NONE != spsc_queue_get(&queue, &j)) {
+					std::this_thread::yield();
+				}
+			} else {
+				const struct job *head;
+				while (NULL == (head = (const struct job *)spsc_queue_peek(&queue))) {
+					std::this_thread::yield();
+				}
+				j = *head;
+				for (uint32_t i = 0; i < j.length && j.check == job_check(j); i++) {
+					if (j.data[i] != pattern(j.sequence, i)) {
+						if (errors++ < 10) {
+							std::fprintf(stderr, "job %u: buffer byte %u is 0x%02x instead of 0x%02x\n", j.sequence, i,
+							             j.data[i], pattern(j.sequence, i));
+						}
+						break;
+					}
+				}
+				spsc_queue_drop(&queue);
+			}
+			if (j.check != job_check(j)) {
+				if (errors++ < 10) {
+					std::fprintf(stderr, "job %u: torn descriptor\n", expected);
+				}
+			} else if (j.sequence != expected) {
+				if (errors++ < 10) {
+					std::fprintf(stderr, "job %u received instead of %u\n", j.sequence, expected);
+				}
+				expected = j.sequence; // resynchronize to report each reordering once
+			}
+		}
+	});
+	producer.join();
+	consumer.join();
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	if (0 != spsc_queue_num(&queue)) {
+		std::fprintf(stderr, "%u jobs left in the queue\n", spsc_queue_num(&queue));
+		errors++;
+	}
+	std::printf("%-4s  %u jobs  %.3f s  %.2f Mjobs/s  %s\n", mode::get == m ? "get" : "peek", jobs, elapsed.count(),
+	            jobs / elapsed.count() / 1e6, errors ? "FAILED" : "ok");
+	return errors;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	uint32_t jobs = 10000000, size = 4, buffer_size = 64;
+
+	static const struct option long_options[] = {
+		{"jobs", required_argument, nullptr, 'n'},
+		{"size", required_argument, nullptr, 's'},
+		{"buffer", required_argument, nullptr, 'b'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "n:s:b:h", long_options, nullptr)) != -1) {
+		switch (opt) {
+		case 'n':
+			jobs = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case 's':
+			size = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			if (0 == size || (size & (size - 1))) {
+				std::fprintf(stderr, "the queue size must be a power of 2: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b':
+			buffer_size = (uint32_t)std::strtoul(optarg, nullptr, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	uint64_t errors = run(mode::get, jobs, size, buffer_size);
+	errors += run(mode::peek, jobs, size, buffer_size);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
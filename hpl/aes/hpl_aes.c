@@ -0,0 +1,231 @@
+/**
+ * \file
+ *
+ * \brief AES decryption (CTR and GCM modes) with the AES peripheral.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <hpl_aes.h>
+#include <utils_assert.h>
+
+#if CONF_AES_ENABLE && !CONF_AES_SOFTWARE
+
+/**
+ * \internal Configure and enable the peripheral in a mode, with the key
+ * \param[in] dev AES device
+ * \param[in] mode AES_CTRLA_AESMODE value
+ */
+static void _aes_configure(struct _aes_sync_device *const dev, const uint32_t mode)
+{
+	uint8_t i;
+
+	hri_aes_clear_CTRLA_ENABLE_bit(dev->hw); // CTRLA is enable-protected
+	hri_aes_write_CTRLA_reg(dev->hw,
+	                        AES_CTRLA_AESMODE(mode) | AES_CTRLA_KEYSIZE(dev->keysize) | AES_CTRLA_CIPHER_ENC
+	                            | AES_CTRLA_STARTMODE_MANUAL);
+	hri_aes_set_CTRLA_ENABLE_bit(dev->hw);
+	for (i = 0; i < 4 + 2 * dev->keysize; i++) {
+		hri_aes_write_KEYWORD_reg(dev->hw, i, dev->key[i]);
+	}
+}
+
+/**
+ * \internal Write the initialization vector (counter block)
+ * \param[in] dev AES device
+ * \param[in] block Counter block
+ */
+static void _aes_write_intvect(struct _aes_sync_device *const dev, const uint8_t *block)
+{
+	uint32_t words[4];
+	uint8_t  i;
+
+	memcpy(words, block, sizeof(words));
+	for (i = 0; i < 4; i++) {
+		hri_aes_write_INTVECTV_reg(dev->hw, i, words[i]);
+	}
+}
+
+/**
+ * \internal Process one block: write it in INDATA, run the operation and read the result back
+ * \param[in] dev AES device
+ * \param[in] input Input block, of which length bytes are used and the rest is zero
+ * \param[out] output Output block, of which length bytes are written, or NULL for none
+ * \param[in] length Length of the block
+ * \param[in] ctrlb AES_CTRLB_START (with AES_CTRLB_NEWMSG for the first block of a message) or AES_CTRLB_GFMUL
+ */
+static void _aes_process(struct _aes_sync_device *const dev, const uint8_t *input, uint8_t *output,
+                         const uint32_t length, const uint32_t ctrlb)
+{
+	uint32_t words[4] = {0};
+	uint8_t  i;
+
+	memcpy(words, input, length);
+	hri_aes_write_DATABUFPTR_reg(dev->hw, 0);
+	for (i = 0; i < 4; i++) {
+		hri_aes_write_INDATA_reg(dev->hw, words[i]);
+	}
+	hri_aes_write_CTRLB_reg(dev->hw, ctrlb);
+	if (AES_CTRLB_GFMUL == ctrlb) {
+		while (!hri_aes_get_INTFLAG_GFMCMP_bit(dev->hw));
+		hri_aes_clear_INTFLAG_GFMCMP_bit(dev->hw);
+		return;
+	}
+	while (!hri_aes_get_INTFLAG_ENCCMP_bit(dev->hw));
+	hri_aes_write_DATABUFPTR_reg(dev->hw, 0);
+	for (i = 0; i < 4; i++) {
+		words[i] = hri_aes_read_INDATA_reg(dev->hw); // reading the last word clears ENCCMP
+	}
+	if (output) {
+		memcpy(output, words, length);
+	}
+}
+
+int32_t _aes_sync_init(struct _aes_sync_device *const dev, void *const hw)
+{
+	ASSERT(dev && hw);
+
+	memset(dev, 0, sizeof(*dev));
+	dev->hw = hw;
+	hri_aes_write_CTRLA_reg(hw, AES_CTRLA_SWRST);
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_set_key(struct _aes_sync_device *const dev, const uint8_t *key, const enum _aes_keysize size)
+{
+	ASSERT(dev && key && size <= AES_KEY_256);
+
+	dev->keysize = size;
+	memcpy(dev->key, key, (4 + 2 * size) * 4); // written in KEYWORD when the peripheral is configured
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_ctr_crypt(struct _aes_sync_device *const dev, const uint8_t *nonce, const uint32_t position,
+                            const uint8_t *input, uint8_t *output, const uint32_t length)
+{
+	uint8_t  counter[AES_BLOCK_SIZE];
+	uint32_t done;
+
+	ASSERT(dev && nonce && input && output);
+	if (position % AES_BLOCK_SIZE) {
+		return ERR_INVALID_ARG;
+	}
+
+	_aes_configure(dev, AES_CTRLA_AESMODE_COUNTER_Val);
+	memcpy(counter, nonce, AES_IV_SIZE);
+	counter[12] = (uint8_t)((position / AES_BLOCK_SIZE) >> 24);
+	counter[13] = (uint8_t)((position / AES_BLOCK_SIZE) >> 16);
+	counter[14] = (uint8_t)((position / AES_BLOCK_SIZE) >> 8);
+	counter[15] = (uint8_t)(position / AES_BLOCK_SIZE);
+	_aes_write_intvect(dev, counter);
+	for (done = 0; done < length; done += AES_BLOCK_SIZE) { // the peripheral increments the 32-bit counter
+		_aes_process(dev, input + done, output + done, min(AES_BLOCK_SIZE, length - done),
+		             AES_CTRLB_START | (0 == done ? AES_CTRLB_NEWMSG : 0));
+	}
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_gcm_start(struct _aes_sync_device *const dev, const uint8_t *iv, const uint8_t *aad,
+                            const uint32_t aad_length)
+{
+	uint8_t  block[AES_BLOCK_SIZE] = {0};
+	uint32_t words[4];
+	uint32_t done;
+	uint8_t  i;
+
+	ASSERT(dev && iv && (aad || 0 == aad_length));
+
+	// hash subkey H = E(K, 0)
+	_aes_configure(dev, AES_CTRLA_AESMODE_ECB_Val);
+	_aes_process(dev, block, block, sizeof(block), AES_CTRLB_START);
+	memcpy(words, block, sizeof(words));
+
+	_aes_configure(dev, AES_CTRLA_AESMODE_GCM_Val);
+	for (i = 0; i < 4; i++) {
+		hri_aes_write_HASHKEY_reg(dev->hw, i, words[i]);
+		hri_aes_write_GHASH_reg(dev->hw, i, 0);
+	}
+	memcpy(dev->j0, iv, AES_IV_SIZE);
+	dev->j0[12] = 0;
+	dev->j0[13] = 0;
+	dev->j0[14] = 0;
+	dev->j0[15] = 1;
+	memcpy(block, dev->j0, sizeof(block));
+	block[15] = 2; // the data starts at inc32(J0)
+	_aes_write_intvect(dev, block);
+	for (done = 0; done < aad_length; done += AES_BLOCK_SIZE) {
+		_aes_process(dev, aad + done, NULL, min(AES_BLOCK_SIZE, aad_length - done), AES_CTRLB_GFMUL);
+	}
+	dev->gcm_aad_length = aad_length;
+	dev->gcm_length     = 0;
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_gcm_decrypt(struct _aes_sync_device *const dev, const uint8_t *input, uint8_t *output,
+                              const uint32_t length)
+{
+	uint32_t done;
+
+	ASSERT(dev && input && output);
+	if (dev->gcm_length % AES_BLOCK_SIZE) { // a partial block ended the message
+		return ERR_INVALID_ARG;
+	}
+
+	hri_aes_clear_CTRLA_ENABLE_bit(dev->hw);
+	hri_aes_clear_CTRLA_CIPHER_bit(dev->hw); // GHASH of the input, the ciphertext
+	hri_aes_set_CTRLA_ENABLE_bit(dev->hw);
+	for (done = 0; done < length; done += AES_BLOCK_SIZE) { // the GHASH is updated with the input, padded with zeros
+		_aes_process(dev, input + done, output + done, min(AES_BLOCK_SIZE, length - done),
+		             AES_CTRLB_START | (0 == dev->gcm_length + done ? AES_CTRLB_NEWMSG : 0));
+	}
+	dev->gcm_length += length;
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_gcm_finish(struct _aes_sync_device *const dev, uint8_t *tag)
+{
+	uint8_t  lengths[AES_BLOCK_SIZE] = {0};
+	uint32_t words[4];
+	uint8_t  i;
+
+	ASSERT(dev && tag);
+
+	lengths[3]  = (uint8_t)(dev->gcm_aad_length >> 29); // bit lengths, 64-bit big-endian
+	lengths[4]  = (uint8_t)(dev->gcm_aad_length >> 21);
+	lengths[5]  = (uint8_t)(dev->gcm_aad_length >> 13);
+	lengths[6]  = (uint8_t)(dev->gcm_aad_length >> 5);
+	lengths[7]  = (uint8_t)(dev->gcm_aad_length << 3);
+	lengths[11] = (uint8_t)(dev->gcm_length >> 29);
+	lengths[12] = (uint8_t)(dev->gcm_length >> 21);
+	lengths[13] = (uint8_t)(dev->gcm_length >> 13);
+	lengths[14] = (uint8_t)(dev->gcm_length >> 5);
+	lengths[15] = (uint8_t)(dev->gcm_length << 3);
+	_aes_process(dev, lengths, NULL, sizeof(lengths), AES_CTRLB_GFMUL);
+	for (i = 0; i < 4; i++) {
+		words[i] = hri_aes_read_GHASH_reg(dev->hw, i);
+	}
+
+	_aes_configure(dev, AES_CTRLA_AESMODE_ECB_Val); // tag = E(K, J0) xor GHASH
+	_aes_process(dev, dev->j0, tag, AES_BLOCK_SIZE, AES_CTRLB_START);
+	for (i = 0; i < AES_BLOCK_SIZE; i++) {
+		tag[i] ^= ((const uint8_t *)words)[i];
+	}
+	return ERR_NONE;
+}
+
+#endif /* CONF_AES_ENABLE && !CONF_AES_SOFTWARE */
@@ -0,0 +1,355 @@
+/**
+ * \file
+ *
+ * \brief AES decryption (CTR and GCM modes), software implementation.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <hpl_aes.h>
+#include <utils_assert.h>
+
+#if CONF_AES_ENABLE && CONF_AES_SOFTWARE
+
+/** S-box */
+static const uint8_t aes_sbox[256] = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+};
+
+/** Forward round table: S-box output multiplied by the MixColumns column {02, 01, 01, 03}, the other columns being its rotations */
+static const uint32_t aes_te[256] = {
+	0xC66363A5, 0xF87C7C84, 0xEE777799, 0xF67B7B8D, 0xFFF2F20D, 0xD66B6BBD, 0xDE6F6FB1, 0x91C5C554,
+	0x60303050, 0x02010103, 0xCE6767A9, 0x562B2B7D, 0xE7FEFE19, 0xB5D7D762, 0x4DABABE6, 0xEC76769A,
+	0x8FCACA45, 0x1F82829D, 0x89C9C940, 0xFA7D7D87, 0xEFFAFA15, 0xB25959EB, 0x8E4747C9, 0xFBF0F00B,
+	0x41ADADEC, 0xB3D4D467, 0x5FA2A2FD, 0x45AFAFEA, 0x239C9CBF, 0x53A4A4F7, 0xE4727296, 0x9BC0C05B,
+	0x75B7B7C2, 0xE1FDFD1C, 0x3D9393AE, 0x4C26266A, 0x6C36365A, 0x7E3F3F41, 0xF5F7F702, 0x83CCCC4F,
+	0x6834345C, 0x51A5A5F4, 0xD1E5E534, 0xF9F1F108, 0xE2717193, 0xABD8D873, 0x62313153, 0x2A15153F,
+	0x0804040C, 0x95C7C752, 0x46232365, 0x9DC3C35E, 0x30181828, 0x379696A1, 0x0A05050F, 0x2F9A9AB5,
+	0x0E070709, 0x24121236, 0x1B80809B, 0xDFE2E23D, 0xCDEBEB26, 0x4E272769, 0x7FB2B2CD, 0xEA75759F,
+	0x1209091B, 0x1D83839E, 0x582C2C74, 0x341A1A2E, 0x361B1B2D, 0xDC6E6EB2, 0xB45A5AEE, 0x5BA0A0FB,
+	0xA45252F6, 0x763B3B4D, 0xB7D6D661, 0x7DB3B3CE, 0x5229297B, 0xDDE3E33E, 0x5E2F2F71, 0x13848497,
+	0xA65353F5, 0xB9D1D168, 0x00000000, 0xC1EDED2C, 0x40202060, 0xE3FCFC1F, 0x79B1B1C8, 0xB65B5BED,
+	0xD46A6ABE, 0x8DCBCB46, 0x67BEBED9, 0x7239394B, 0x944A4ADE, 0x984C4CD4, 0xB05858E8, 0x85CFCF4A,
+	0xBBD0D06B, 0xC5EFEF2A, 0x4FAAAAE5, 0xEDFBFB16, 0x864343C5, 0x9A4D4DD7, 0x66333355, 0x11858594,
+	0x8A4545CF, 0xE9F9F910, 0x04020206, 0xFE7F7F81, 0xA05050F0, 0x783C3C44, 0x259F9FBA, 0x4BA8A8E3,
+	0xA25151F3, 0x5DA3A3FE, 0x804040C0, 0x058F8F8A, 0x3F9292AD, 0x219D9DBC, 0x70383848, 0xF1F5F504,
+	0x63BCBCDF, 0x77B6B6C1, 0xAFDADA75, 0x42212163, 0x20101030, 0xE5FFFF1A, 0xFDF3F30E, 0xBFD2D26D,
+	0x81CDCD4C, 0x180C0C14, 0x26131335, 0xC3ECEC2F, 0xBE5F5FE1, 0x359797A2, 0x884444CC, 0x2E171739,
+	0x93C4C457, 0x55A7A7F2, 0xFC7E7E82, 0x7A3D3D47, 0xC86464AC, 0xBA5D5DE7, 0x3219192B, 0xE6737395,
+	0xC06060A0, 0x19818198, 0x9E4F4FD1, 0xA3DCDC7F, 0x44222266, 0x542A2A7E, 0x3B9090AB, 0x0B888883,
+	0x8C4646CA, 0xC7EEEE29, 0x6BB8B8D3, 0x2814143C, 0xA7DEDE79, 0xBC5E5EE2, 0x160B0B1D, 0xADDBDB76,
+	0xDBE0E03B, 0x64323256, 0x743A3A4E, 0x140A0A1E, 0x924949DB, 0x0C06060A, 0x4824246C, 0xB85C5CE4,
+	0x9FC2C25D, 0xBDD3D36E, 0x43ACACEF, 0xC46262A6, 0x399191A8, 0x319595A4, 0xD3E4E437, 0xF279798B,
+	0xD5E7E732, 0x8BC8C843, 0x6E373759, 0xDA6D6DB7, 0x018D8D8C, 0xB1D5D564, 0x9C4E4ED2, 0x49A9A9E0,
+	0xD86C6CB4, 0xAC5656FA, 0xF3F4F407, 0xCFEAEA25, 0xCA6565AF, 0xF47A7A8E, 0x47AEAEE9, 0x10080818,
+	0x6FBABAD5, 0xF0787888, 0x4A25256F, 0x5C2E2E72, 0x381C1C24, 0x57A6A6F1, 0x73B4B4C7, 0x97C6C651,
+	0xCBE8E823, 0xA1DDDD7C, 0xE874749C, 0x3E1F1F21, 0x964B4BDD, 0x61BDBDDC, 0x0D8B8B86, 0x0F8A8A85,
+	0xE0707090, 0x7C3E3E42, 0x71B5B5C4, 0xCC6666AA, 0x904848D8, 0x06030305, 0xF7F6F601, 0x1C0E0E12,
+	0xC26161A3, 0x6A35355F, 0xAE5757F9, 0x69B9B9D0, 0x17868691, 0x99C1C158, 0x3A1D1D27, 0x279E9EB9,
+	0xD9E1E138, 0xEBF8F813, 0x2B9898B3, 0x22111133, 0xD26969BB, 0xA9D9D970, 0x078E8E89, 0x339494A7,
+	0x2D9B9BB6, 0x3C1E1E22, 0x15878792, 0xC9E9E920, 0x87CECE49, 0xAA5555FF, 0x50282878, 0xA5DFDF7A,
+	0x038C8C8F, 0x59A1A1F8, 0x09898980, 0x1A0D0D17, 0x65BFBFDA, 0xD7E6E631, 0x844242C6, 0xD06868B8,
+	0x824141C3, 0x299999B0, 0x5A2D2D77, 0x1E0F0F11, 0x7BB0B0CB, 0xA85454FC, 0x6DBBBBD6, 0x2C16163A,
+};
+
+/** GHASH reduction of the 4 bits shifted out of the 4-bit table multiplication */
+static const uint16_t aes_ghash_last4[16] = {
+	0x0000, 0x1C20, 0x3840, 0x2460, 0x7080, 0x6CA0, 0x48C0, 0x54E0,
+	0xE100, 0xFD20, 0xD940, 0xC560, 0x9180, 0x8DA0, 0xA9C0, 0xB5E0,
+};
+
+#define AES_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define AES_GET32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+#define AES_PUT32(p, x)                                                                                                \
+	do {                                                                                                               \
+		(p)[0] = (uint8_t)((x) >> 24);                                                                                 \
+		(p)[1] = (uint8_t)((x) >> 16);                                                                                 \
+		(p)[2] = (uint8_t)((x) >> 8);                                                                                  \
+		(p)[3] = (uint8_t)(x);                                                                                         \
+	} while (0)
+
+/** Column of a round: the 4 table lookups and the round key */
+#define AES_ROUND_COLUMN(a, b, c, d, k)                                                                                \
+	(aes_te[(a) >> 24] ^ AES_ROR(aes_te[((b) >> 16) & 0xFF], 8) ^ AES_ROR(aes_te[((c) >> 8) & 0xFF], 16)             \
+	 ^ AES_ROR(aes_te[(d)&0xFF], 24) ^ (k))
+/** Column of the last round: S-box only */
+#define AES_LAST_COLUMN(a, b, c, d, k)                                                                                 \
+	(((uint32_t)aes_sbox[(a) >> 24] << 24) ^ ((uint32_t)aes_sbox[((b) >> 16) & 0xFF] << 16)                          \
+	 ^ ((uint32_t)aes_sbox[((c) >> 8) & 0xFF] << 8) ^ (uint32_t)aes_sbox[(d)&0xFF] ^ (k))
+
+/**
+ * \internal Encrypt one block
+ * \param[in] dev AES device, with the round keys
+ * \param[in] input Block to encrypt
+ * \param[out] output Encrypted block, which can be the input block
+ */
+static void _aes_encrypt_block(const struct _aes_sync_device *const dev, const uint8_t *input, uint8_t *output)
+{
+	const uint32_t *rk = dev->rk;
+	uint32_t        s0, s1, s2, s3, t0, t1, t2, t3;
+	uint8_t         round;
+
+	s0 = AES_GET32(input) ^ rk[0];
+	s1 = AES_GET32(input + 4) ^ rk[1];
+	s2 = AES_GET32(input + 8) ^ rk[2];
+	s3 = AES_GET32(input + 12) ^ rk[3];
+	for (round = 1; round < dev->rounds; round++) {
+		rk += 4;
+		t0 = AES_ROUND_COLUMN(s0, s1, s2, s3, rk[0]);
+		t1 = AES_ROUND_COLUMN(s1, s2, s3, s0, rk[1]);
+		t2 = AES_ROUND_COLUMN(s2, s3, s0, s1, rk[2]);
+		t3 = AES_ROUND_COLUMN(s3, s0, s1, s2, rk[3]);
+		s0 = t0;
+		s1 = t1;
+		s2 = t2;
+		s3 = t3;
+	}
+	rk += 4;
+	t0 = AES_LAST_COLUMN(s0, s1, s2, s3, rk[0]);
+	t1 = AES_LAST_COLUMN(s1, s2, s3, s0, rk[1]);
+	t2 = AES_LAST_COLUMN(s2, s3, s0, s1, rk[2]);
+	t3 = AES_LAST_COLUMN(s3, s0, s1, s2, rk[3]);
+	AES_PUT32(output, t0);
+	AES_PUT32(output + 4, t1);
+	AES_PUT32(output + 8, t2);
+	AES_PUT32(output + 12, t3);
+}
+
+/**
+ * \internal Multiply the GHASH by the hash subkey, in GF(2^128)
+ * \param[in,out] dev AES device, with the tables of the hash subkey
+ */
+static void _aes_ghash_multiply(struct _aes_sync_device *const dev)
+{
+	const uint8_t *x = dev->ghash;
+	uint64_t       zh, zl;
+	uint8_t        rem, nibble;
+	int8_t         i;
+
+	zh = dev->hh[x[15] & 0xF];
+	zl = dev->hl[x[15] & 0xF];
+	for (i = 15; i >= 0; i--) {
+		if (i != 15) {
+			nibble = x[i] & 0xF;
+			rem    = zl & 0xF;
+			zl     = (zh << 60) | (zl >> 4);
+			zh     = (zh >> 4) ^ ((uint64_t)aes_ghash_last4[rem] << 48) ^ dev->hh[nibble];
+			zl ^= dev->hl[nibble];
+		}
+		nibble = x[i] >> 4;
+		rem    = zl & 0xF;
+		zl     = (zh << 60) | (zl >> 4);
+		zh     = (zh >> 4) ^ ((uint64_t)aes_ghash_last4[rem] << 48) ^ dev->hh[nibble];
+		zl ^= dev->hl[nibble];
+	}
+	AES_PUT32(dev->ghash, (uint32_t)(zh >> 32));
+	AES_PUT32(dev->ghash + 4, (uint32_t)zh);
+	AES_PUT32(dev->ghash + 8, (uint32_t)(zl >> 32));
+	AES_PUT32(dev->ghash + 12, (uint32_t)zl);
+}
+
+/**
+ * \internal Add data to the GHASH
+ * \param[in,out] dev AES device
+ * \param[in] data Data, padded with zeros to a full block
+ * \param[in] length Length of the data
+ */
+static void _aes_ghash_update(struct _aes_sync_device *const dev, const uint8_t *data, uint32_t length)
+{
+	uint32_t i;
+
+	while (length > 0) {
+		for (i = 0; i < AES_BLOCK_SIZE && i < length; i++) {
+			dev->ghash[i] ^= data[i];
+		}
+		_aes_ghash_multiply(dev);
+		data += i;
+		length -= i;
+	}
+}
+
+/**
+ * \internal Set the counter block of a block of the stream
+ * \param[out] counter Counter block
+ * \param[in] iv Nonce or IV
+ * \param[in] index Block counter
+ */
+static void _aes_counter(uint8_t *counter, const uint8_t *iv, const uint32_t index)
+{
+	memcpy(counter, iv, AES_IV_SIZE);
+	AES_PUT32(counter + AES_IV_SIZE, index);
+}
+
+int32_t _aes_sync_init(struct _aes_sync_device *const dev, void *const hw)
+{
+	ASSERT(dev);
+
+	memset(dev, 0, sizeof(*dev));
+	dev->hw = hw;
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_set_key(struct _aes_sync_device *const dev, const uint8_t *key, const enum _aes_keysize size)
+{
+	const uint8_t nk   = 4 + 2 * size; // key words
+	uint8_t       rcon = 0x01;
+	uint8_t       i;
+	uint32_t      t;
+
+	ASSERT(dev && key && size <= AES_KEY_256);
+
+	dev->keysize = size;
+	dev->rounds  = nk + 6;
+	memcpy(dev->key, key, nk * 4);
+	for (i = 0; i < nk; i++) {
+		dev->rk[i] = AES_GET32(key + 4 * i);
+	}
+	for (i = nk; i < 4 * (dev->rounds + 1); i++) {
+		t = dev->rk[i - 1];
+		if (0 == i % nk) {
+			t = ((uint32_t)aes_sbox[(t >> 16) & 0xFF] << 24) ^ ((uint32_t)aes_sbox[(t >> 8) & 0xFF] << 16)
+			    ^ ((uint32_t)aes_sbox[t & 0xFF] << 8) ^ (uint32_t)aes_sbox[t >> 24] ^ ((uint32_t)rcon << 24);
+			rcon = (uint8_t)((rcon << 1) ^ ((rcon & 0x80) ? 0x1B : 0));
+		} else if (nk > 6 && 4 == i % nk) {
+			t = ((uint32_t)aes_sbox[t >> 24] << 24) ^ ((uint32_t)aes_sbox[(t >> 16) & 0xFF] << 16)
+			    ^ ((uint32_t)aes_sbox[(t >> 8) & 0xFF] << 8) ^ (uint32_t)aes_sbox[t & 0xFF];
+		}
+		dev->rk[i] = dev->rk[i - nk] ^ t;
+	}
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_ctr_crypt(struct _aes_sync_device *const dev, const uint8_t *nonce, const uint32_t position,
+                            const uint8_t *input, uint8_t *output, const uint32_t length)
+{
+	uint8_t  stream[AES_BLOCK_SIZE];
+	uint32_t done, i;
+
+	ASSERT(dev && nonce && input && output);
+	if (position % AES_BLOCK_SIZE) {
+		return ERR_INVALID_ARG;
+	}
+
+	for (done = 0; done < length; done += AES_BLOCK_SIZE) {
+		_aes_counter(stream, nonce, (position + done) / AES_BLOCK_SIZE);
+		_aes_encrypt_block(dev, stream, stream);
+		for (i = 0; i < AES_BLOCK_SIZE && done + i < length; i++) {
+			output[done + i] = input[done + i] ^ stream[i];
+		}
+	}
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_gcm_start(struct _aes_sync_device *const dev, const uint8_t *iv, const uint8_t *aad,
+                            const uint32_t aad_length)
+{
+	uint8_t  h[AES_BLOCK_SIZE];
+	uint64_t vh, vl;
+	uint8_t  i, j;
+
+	ASSERT(dev && iv && (aad || 0 == aad_length));
+
+	// 4-bit tables of the hash subkey H = E(K, 0)
+	memset(h, 0, sizeof(h));
+	_aes_encrypt_block(dev, h, h);
+	vh         = ((uint64_t)AES_GET32(h) << 32) | AES_GET32(h + 4);
+	vl         = ((uint64_t)AES_GET32(h + 8) << 32) | AES_GET32(h + 12);
+	dev->hl[8] = vl;
+	dev->hh[8] = vh;
+	dev->hl[0] = 0;
+	dev->hh[0] = 0;
+	for (i = 4; i > 0; i >>= 1) {
+		const uint64_t reduce = (vl & 1) ? 0xE100000000000000ULL : 0;
+		vl         = (vh << 63) | (vl >> 1);
+		vh         = (vh >> 1) ^ reduce;
+		dev->hl[i] = vl;
+		dev->hh[i] = vh;
+	}
+	for (i = 2; i <= 8; i *= 2) {
+		for (j = 1; j < i; j++) {
+			dev->hh[i + j] = dev->hh[i] ^ dev->hh[j];
+			dev->hl[i + j] = dev->hl[i] ^ dev->hl[j];
+		}
+	}
+
+	_aes_counter(dev->j0, iv, 1);
+	memset(dev->ghash, 0, sizeof(dev->ghash));
+	_aes_ghash_update(dev, aad, aad_length);
+	dev->gcm_aad_length = aad_length;
+	dev->gcm_length     = 0;
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_gcm_decrypt(struct _aes_sync_device *const dev, const uint8_t *input, uint8_t *output,
+                              const uint32_t length)
+{
+	uint8_t  stream[AES_BLOCK_SIZE];
+	uint32_t done, i;
+
+	ASSERT(dev && input && output);
+	if (dev->gcm_length % AES_BLOCK_SIZE) { // a partial block ended the message
+		return ERR_INVALID_ARG;
+	}
+
+	_aes_ghash_update(dev, input, length); // before the input is overwritten
+	for (done = 0; done < length; done += AES_BLOCK_SIZE) {
+		_aes_counter(stream, dev->j0, 2 + (dev->gcm_length + done) / AES_BLOCK_SIZE);
+		_aes_encrypt_block(dev, stream, stream);
+		for (i = 0; i < AES_BLOCK_SIZE && done + i < length; i++) {
+			output[done + i] = input[done + i] ^ stream[i];
+		}
+	}
+	dev->gcm_length += length;
+	return ERR_NONE;
+}
+
+int32_t _aes_sync_gcm_finish(struct _aes_sync_device *const dev, uint8_t *tag)
+{
+	uint8_t lengths[AES_BLOCK_SIZE] = {0};
+	uint8_t i;
+
+	ASSERT(dev && tag);
+
+	AES_PUT32(lengths, dev->gcm_aad_length >> 29); // bit lengths, 64-bit
+	AES_PUT32(lengths + 4, dev->gcm_aad_length << 3);
+	AES_PUT32(lengths + 8, dev->gcm_length >> 29);
+	AES_PUT32(lengths + 12, dev->gcm_length << 3);
+	_aes_ghash_update(dev, lengths, sizeof(lengths));
+	_aes_encrypt_block(dev, dev->j0, tag);
+	for (i = 0; i < AES_BLOCK_SIZE; i++) {
+		tag[i] ^= dev->ghash[i];
+	}
+	return ERR_NONE;
+}
+
+#endif /* CONF_AES_ENABLE && CONF_AES_SOFTWARE */
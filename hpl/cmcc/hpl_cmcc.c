@@ -239,6 +239,8 @@ int32_t _cmcc_unlock_way(const void *hw, enum way_num_index num)
 /**
  * \brief Invalidate the mentioned cache line in CMCC module
  *
+ * The cache is enabled again afterwards if it was enabled.
+ *
  * \param[in] pointer pointing to the starting address of CMCC module
  * \param[in] element from "way_num" enumerator (valid arg is 0-3)
  * \param[in] line number (valid arg is 0-63 as each way will have 64 lines)
@@ -247,13 +249,17 @@ int32_t _cmcc_unlock_way(const void *hw, enum way_num_index num)
  */
 int32_t _cmcc_invalidate_by_line(const void *hw, uint8_t way_num, uint8_t line_num)
 {
-	int32_t return_value;
+	int32_t    return_value;
+	const bool enabled = _is_cache_enabled(hw);
 
 	if ((way_num < CMCC_WAY_NOS) && (line_num < CMCC_LINE_NOS)) {
 		_cmcc_disable(hw);
 		while (!(_is_cache_disabled(hw)))
 			;
 		hri_cmcc_write_MAINT1_reg(hw, (CMCC_MAINT1_INDEX(line_num) | CMCC_MAINT1_WAY(way_num)));
+		if (enabled) { // the cache has to be disabled during the maintenance only
+			_cmcc_enable(hw);
+		}
 		return_value = ERR_NONE;
 	} else {
 		return_value = ERR_INVALID_ARG;
@@ -265,17 +271,23 @@ int32_t _cmcc_invalidate_by_line(const void *hw, uint8_t way_num, uint8_t line_n
 /**
  * \brief Invalidate entire cache entries in CMCC module
  *
+ * The cache is enabled again afterwards if it was enabled.
+ *
  * \param[in] pointer pointing to the starting address of CMCC module
  *
  * \return status of operation
  */
 int32_t _cmcc_invalidate_all(const void *hw)
 {
-	int32_t return_value;
+	int32_t    return_value;
+	const bool enabled = _is_cache_enabled(hw);
 
 	_cmcc_disable(hw);
 	if (_is_cache_disabled(hw)) {
 		hri_cmcc_write_MAINT0_reg(hw, CMCC_MAINT0_INVALL);
+		if (enabled) { // the cache has to be disabled during the maintenance only
+			_cmcc_enable(hw);
+		}
 		return_value = ERR_NONE;
 	} else {
 		return_value = ERR_FAILURE;
@@ -37,6 +37,7 @@
 #include <hpl_mclk_config.h>
 
 #include <hpl_dma.h>
+#include <hpl_dma_copy.h>
 #include <hpl_dmac_config.h>
 #include <hpl_cmcc_config.h>
 #include <hal_cache.h>
@@ -66,6 +67,7 @@ void _init_chip(void)
 #if CONF_DMAC_ENABLE
 	hri_mclk_set_AHBMASK_DMAC_bit(MCLK);
 	_dma_init();
+	_dma_copy_init();
 #endif
 
 #if (CONF_PORT_EVCTRL_PORT_0 | CONF_PORT_EVCTRL_PORT_1 | CONF_PORT_EVCTRL_PORT_2 | CONF_PORT_EVCTRL_PORT_3)
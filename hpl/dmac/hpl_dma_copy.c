@@ -0,0 +1,235 @@
+/**
+ * \file
+ *
+ * \brief Memory copy service on the DMAC.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <hal_atomic.h>
+#include <hpl_dma.h>
+#include <hpl_dma_copy.h>
+#include <hpl_dmac_config.h>
+
+#if CONF_DMAC_ENABLE
+
+/* channel settings of the configuration, for the copy channel */
+#define _DMA_COPY_CONF_(name, channel) CONF_DMAC_##name##_##channel
+#define _DMA_COPY_CONF(name, channel) _DMA_COPY_CONF_(name, channel)
+#if _DMA_COPY_CONF(BEATSIZE, CONF_DMA_COPY_CHANNEL) != 2 || !_DMA_COPY_CONF(SRCINC, CONF_DMA_COPY_CHANNEL)           \
+    || !_DMA_COPY_CONF(DSTINC, CONF_DMA_COPY_CHANNEL) || _DMA_COPY_CONF(TRIGACT, CONF_DMA_COPY_CHANNEL) != 3
+#error the copy channel needs 32-bit beats, source and destination increment, and one trigger per transaction
+#endif
+#if CONF_DMA_COPY_BLOCKS < 1 || CONF_DMA_COPY_CHANNEL + CONF_DMA_COPY_BLOCKS > DMAC_CH_NUM
+#error the chained blocks use the descriptors of the channels following the copy channel
+#endif
+
+/** Bytes moved by a beat */
+#define DMA_COPY_BEAT_SIZE 4
+/** Maximum size of a block: the block transfer count is 16-bit */
+#define DMA_COPY_BLOCK_MAX (0xFFFFul * DMA_COPY_BEAT_SIZE)
+
+/** If _dma_copy_init has been called */
+static bool _dma_copy_ready;
+/** If the channel is taken, by a synchronous or asynchronous copy */
+static volatile bool _dma_copy_busy;
+/** Callback of the asynchronous copy in progress, NULL for a synchronous copy */
+static _dma_copy_cb_t _dma_copy_cb;
+
+/**
+ * \internal Release the channel at the end of an asynchronous copy, and report it
+ */
+static void _dma_copy_complete(const int32_t status)
+{
+	const _dma_copy_cb_t cb = _dma_copy_cb;
+
+	(void)_dma_get_transaction_status(CONF_DMA_COPY_CHANNEL); // clear the interrupt flags
+	_dma_copy_cb   = NULL;
+	_dma_copy_busy = false;
+	if (cb) {
+		cb(status);
+	}
+}
+
+static void _dma_copy_transfer_done(struct _dma_resource *resource)
+{
+	(void)resource;
+	_dma_copy_complete(ERR_NONE);
+}
+
+static void _dma_copy_error(struct _dma_resource *resource)
+{
+	(void)resource;
+	_dma_copy_complete(ERR_IO);
+}
+
+void _dma_copy_init(void)
+{
+	struct _dma_resource *resource;
+
+	_dma_get_channel_resource(&resource, CONF_DMA_COPY_CHANNEL);
+	resource->dma_cb.transfer_done = _dma_copy_transfer_done;
+	resource->dma_cb.error         = _dma_copy_error;
+	_dma_copy_ready                = true;
+}
+
+/**
+ * \internal Check whether the DMAC can copy the blocks
+ */
+static bool _dma_copy_possible(const struct _dma_copy_block *const blocks, const uint8_t count)
+{
+	uint8_t i;
+
+	if (0 == count || count > CONF_DMA_COPY_BLOCKS) {
+		return false;
+	}
+	for (i = 0; i < count; i++) {
+		if (((uint32_t)(uintptr_t)blocks[i].dst | (uint32_t)(uintptr_t)blocks[i].src | blocks[i].size)
+		        & (DMA_COPY_BEAT_SIZE - 1)
+		    || 0 == blocks[i].size || blocks[i].size > DMA_COPY_BLOCK_MAX) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * \internal Take the channel and start the copy
+ * \param[in] cb Callback, NULL for a synchronous copy (without interrupt)
+ * \return ERR_NONE if started, else ERR_BUSY
+ */
+static int32_t _dma_copy_trigger(const struct _dma_copy_block *const blocks, const uint8_t count,
+                                 const _dma_copy_cb_t cb)
+{
+	bool    taken = false;
+	uint8_t i;
+
+	CRITICAL_SECTION_ENTER(); // the copies are also used from interrupt handlers
+	if (!_dma_copy_busy) {
+		_dma_copy_busy = true;
+		taken          = true;
+	}
+	CRITICAL_SECTION_LEAVE();
+	if (!taken) {
+		return ERR_BUSY;
+	}
+
+	_dma_copy_cb = cb;
+	for (i = 0; i < count; i++) {
+		const uint8_t channel = CONF_DMA_COPY_CHANNEL + i;
+		_dma_set_destination_address(channel, blocks[i].dst);
+		_dma_set_source_address(channel, blocks[i].src);
+		_dma_set_data_amount(channel, blocks[i].size / DMA_COPY_BEAT_SIZE); // the addresses have to be set before
+		if (i + 1 < count) {
+			_dma_set_next_descriptor(channel, channel + 1);
+		} else {
+			_dma_set_last_descriptor(channel);
+		}
+	}
+	_dma_set_irq_state(CONF_DMA_COPY_CHANNEL, DMA_TRANSFER_COMPLETE_CB, NULL != cb);
+	_dma_set_irq_state(CONF_DMA_COPY_CHANNEL, DMA_TRANSFER_ERROR_CB, NULL != cb);
+	_dma_enable_transaction(CONF_DMA_COPY_CHANNEL, true);
+	return ERR_NONE;
+}
+
+int32_t _dma_copy_wait(const struct _dma_copy_block *const blocks, const uint8_t count)
+{
+	int32_t rc;
+
+	if (!_dma_copy_ready) {
+		return ERR_NOT_INITIALIZED;
+	}
+	if (!_dma_copy_possible(blocks, count)) {
+		return ERR_INVALID_ARG;
+	}
+	rc = _dma_copy_trigger(blocks, count, NULL);
+	if (ERR_NONE != rc) {
+		return rc;
+	}
+	while (ERR_BUSY == (rc = _dma_get_transaction_status(CONF_DMA_COPY_CHANNEL))) {
+		/* Wait for the end of the transaction, interrupts are served meanwhile */
+	}
+	_dma_copy_busy = false;
+	return rc;
+}
+
+int32_t _dma_copy_start(const struct _dma_copy_block *const blocks, const uint8_t count, const _dma_copy_cb_t cb)
+{
+	if (!_dma_copy_ready) {
+		return ERR_NOT_INITIALIZED;
+	}
+	if (!cb || !_dma_copy_possible(blocks, count)) {
+		return ERR_INVALID_ARG;
+	}
+	return _dma_copy_trigger(blocks, count, cb);
+}
+
+#else
+
+void _dma_copy_init(void)
+{
+}
+
+int32_t _dma_copy_wait(const struct _dma_copy_block *const blocks, const uint8_t count)
+{
+	(void)blocks;
+	(void)count;
+	return ERR_NOT_INITIALIZED;
+}
+
+int32_t _dma_copy_start(const struct _dma_copy_block *const blocks, const uint8_t count, const _dma_copy_cb_t cb)
+{
+	(void)blocks;
+	(void)count;
+	(void)cb;
+	return ERR_NOT_INITIALIZED;
+}
+
+#endif /* CONF_DMAC_ENABLE */
+
+void _dma_copy_blocks(const struct _dma_copy_block *const blocks, const uint8_t count)
+{
+	uint32_t size = 0;
+	uint8_t  i;
+
+	for (i = 0; i < count; i++) {
+		size += blocks[i].size;
+	}
+	if (size >= CONF_DMA_COPY_THRESHOLD && ERR_NONE == _dma_copy_wait(blocks, count)) {
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		memcpy(blocks[i].dst, blocks[i].src, blocks[i].size);
+	}
+}
+
+void _dma_copy(void *const dst, const void *const src, const uint32_t size)
+{
+	const struct _dma_copy_block block = {dst, src, size};
+
+	_dma_copy_blocks(&block, 1);
+}
+
+bool _dma_copy_is_busy(void)
+{
+#if CONF_DMAC_ENABLE
+	return _dma_copy_busy && NULL != _dma_copy_cb;
+#else
+	return false;
+#endif
+}
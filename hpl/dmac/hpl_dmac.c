@@ -151,10 +151,33 @@ int32_t _dma_set_next_descriptor(const uint8_t current_channel, const uint8_t ne
 {
 	hri_dmacdescriptor_write_DESCADDR_reg(&_descriptor_section[current_channel],
 	                                      (uint32_t)&_descriptor_section[next_channel]);
+	hri_dmacdescriptor_write_BTCTRL_BLOCKACT_bf(&_descriptor_section[current_channel], DMAC_BTCTRL_BLOCKACT_NOACT_Val);
+	hri_dmacdescriptor_set_BTCTRL_VALID_bit(&_descriptor_section[next_channel]);
 
 	return ERR_NONE;
 }
 
+int32_t _dma_set_last_descriptor(const uint8_t channel)
+{
+	hri_dmacdescriptor_write_DESCADDR_reg(&_descriptor_section[channel], 0);
+	hri_dmacdescriptor_write_BTCTRL_BLOCKACT_bf(&_descriptor_section[channel], DMAC_BTCTRL_BLOCKACT_INT_Val);
+
+	return ERR_NONE;
+}
+
+int32_t _dma_get_transaction_status(const uint8_t channel)
+{
+	bool error;
+
+	if (hri_dmac_get_CHCTRLA_ENABLE_bit(DMAC, channel)) {
+		return ERR_BUSY;
+	}
+	error = hri_dmac_get_CHINTFLAG_TERR_bit(DMAC, channel);
+	hri_dmac_clear_CHINTFLAG_reg(DMAC, channel, DMAC_CHINTFLAG_TERR | DMAC_CHINTFLAG_TCMPL);
+
+	return error ? ERR_IO : ERR_NONE;
+}
+
 int32_t _dma_srcinc_enable(const uint8_t channel, const bool enable)
 {
 	hri_dmacdescriptor_write_BTCTRL_SRCINC_bit(&_descriptor_section[channel], enable);
@@ -38,13 +38,31 @@
 #include <utils_assert.h>
 #include <utils.h>
 #include <hpl_nvmctrl_config.h>
+#include <hpl_cmcc.h>
+#include <hpl_cmcc_config.h>
+#include <hpl_dma_copy.h>
+#include <hpl_dmac_config.h>
+#include <hpl_nvmctrl_geometry.h>
 
 #define NVM_MEMORY ((volatile uint32_t *)FLASH_ADDR)
-#define NVMCTRL_BLOCK_PAGES (NVMCTRL_BLOCK_SIZE / NVMCTRL_PAGE_SIZE)
-#define NVMCTRL_REGIONS_NUM 32
+#ifndef _NVM_PAGE_BUFFER_LOAD
+/* Writing in the flash address space loads the page buffer */
+#define _NVM_PAGE_BUFFER_LOAD(addr, data) (NVM_MEMORY[(addr) / 4] = (data))
+#endif
 #define NVMCTRL_INTFLAG_ERR                                                                                            \
 	(NVMCTRL_INTFLAG_ADDRE | NVMCTRL_INTFLAG_PROGE | NVMCTRL_INTFLAG_LOCKE | NVMCTRL_INTFLAG_ECCSE                     \
 	 | NVMCTRL_INTFLAG_NVME | NVMCTRL_INTFLAG_SEESOVF)
+#if CONF_CMCC_ENABLE
+/* The CMCC does not see the NVMCTRL commands: the cached flash content is marked stale once a command modifying it
+ * is issued, and dropped once the command completed, by the DONE interrupt or the next wait for STATUS.READY,
+ * whichever comes first. Lines filled while the command runs (e.g. by a read suspending it) are dropped too.
+ * The whole cache is invalidated, since a block covers every line index, and each line invalidation
+ * disables and enables the cache as long as an invalidation of all. */
+static volatile bool _nvm_cache_stale = false;
+#define _NVM_CACHE_STALE() (_nvm_cache_stale = true)
+#else
+#define _NVM_CACHE_STALE()
+#endif
 /**
  * \brief NVM configuration type
  */
@@ -57,13 +75,16 @@ struct nvm_configuration {
  */
 static struct nvm_configuration _nvm
     = {(CONF_NVM_CACHE0 << NVMCTRL_CTRLA_CACHEDIS0_Pos) | (CONF_NVM_CACHE1 << NVMCTRL_CTRLA_CACHEDIS1_Pos)
-       | (NVMCTRL_CTRLA_PRM(CONF_NVM_SLEEPPRM))};
+       | (NVMCTRL_CTRLA_PRM(CONF_NVM_SLEEPPRM)) | (NVMCTRL_CTRLA_WMODE(CONF_NVM_WMODE))
+       | (CONF_NVM_SUSPEN << NVMCTRL_CTRLA_SUSPEN_Pos)};
 
 /*!< Pointer to hpl device */
 static struct _flash_device *_nvm_dev = NULL;
 
 static void _flash_erase_block(void *const hw, const uint32_t dst_addr);
+static void _nvm_wait_ready(void *const hw);
 static void _flash_program(void *const hw, const uint32_t dst_addr, const uint8_t *buffer, const uint16_t size);
+static void _flash_load_page_buffer(const uint32_t dst_addr, const uint32_t *buffer, const uint16_t size);
 
 /**
  * \brief Initialize NVM
@@ -76,7 +97,8 @@ int32_t _flash_init(struct _flash_device *const device, void *const hw)
 
 	device->hw = hw;
 	ctrla      = hri_nvmctrl_read_CTRLA_reg(hw);
-	ctrla &= ~(NVMCTRL_CTRLA_CACHEDIS0 | NVMCTRL_CTRLA_CACHEDIS1 | NVMCTRL_CTRLA_PRM_Msk);
+	ctrla &= ~(NVMCTRL_CTRLA_CACHEDIS0 | NVMCTRL_CTRLA_CACHEDIS1 | NVMCTRL_CTRLA_PRM_Msk | NVMCTRL_CTRLA_WMODE_Msk
+	           | NVMCTRL_CTRLA_SUSPEN);
 	ctrla |= _nvm.ctrla;
 	hri_nvmctrl_write_CTRLA_reg(hw, ctrla);
 
@@ -112,11 +134,13 @@ uint32_t _flash_get_page_size(struct _flash_device *const device)
 
 /**
  * \brief Get the numbers of flash page.
+ *
+ * The device is known at build time: NVMCTRL.PARAM.NVMP is not read.
  */
 uint32_t _flash_get_total_pages(struct _flash_device *const device)
 {
 	(void)device;
-	return (uint32_t)hri_nvmctrl_read_PARAM_NVMP_bf(device->hw);
+	return (uint32_t)NVM_TOTAL_PAGES;
 }
 
 /**
@@ -141,16 +165,11 @@ void _flash_set_wait_state(struct _flash_device *const device, uint8_t state)
 void _flash_read(struct _flash_device *const device, const uint32_t src_addr, uint8_t *buffer, uint32_t length)
 {
 	uint8_t *nvm_addr = (uint8_t *)NVM_MEMORY;
-	uint32_t i;
 
 	/* Check if the module is busy */
-	while (!hri_nvmctrl_get_STATUS_READY_bit(device->hw)) {
-		/* Wait until this module isn't busy */
-	}
+	_nvm_wait_ready(device->hw);
 
-	for (i = 0; i < length; i++) {
-		buffer[i] = nvm_addr[src_addr + i];
-	}
+	_dma_copy(buffer, &nvm_addr[src_addr], length);
 }
 
 /**
@@ -158,41 +177,39 @@ void _flash_read(struct _flash_device *const device, const uint32_t src_addr, ui
  */
 void _flash_write(struct _flash_device *const device, const uint32_t dst_addr, uint8_t *buffer, uint32_t length)
 {
-	uint8_t  tmp_buffer[NVMCTRL_BLOCK_PAGES][NVMCTRL_PAGE_SIZE];
-	uint32_t block_start_addr, block_end_addr;
-	uint32_t i, j, k;
-	uint32_t wr_start_addr = dst_addr;
+	/* static to keep the 8 KB block off the stack: not reentrant, the flash is only written from the main loop */
+	static COMPILER_ALIGNED(4) uint8_t tmp_buffer[NVM_BLOCK_PAGES][NVMCTRL_PAGE_SIZE];
+	struct _dma_copy_block      copy[2];
+	uint32_t                    block_start_addr, block_end_addr;
+	uint32_t                    i, offset, size;
+	uint32_t                    wr_start_addr = dst_addr;
 
 	do {
 		block_start_addr = wr_start_addr & ~(NVMCTRL_BLOCK_SIZE - 1);
 		block_end_addr   = block_start_addr + NVMCTRL_BLOCK_SIZE - 1;
+		offset           = wr_start_addr - block_start_addr;
+		size             = min(length, NVMCTRL_BLOCK_SIZE - offset);
 
-		/* store the erase data into temp buffer before write */
-		for (i = 0; i < NVMCTRL_BLOCK_PAGES; i++) {
-			_flash_read(device, block_start_addr + i * NVMCTRL_PAGE_SIZE, tmp_buffer[i], NVMCTRL_PAGE_SIZE);
-		}
-
-		/* temp buffer update */
-		j = (wr_start_addr - block_start_addr) / NVMCTRL_PAGE_SIZE;
-		k = wr_start_addr - block_start_addr - j * NVMCTRL_PAGE_SIZE;
-		while ((wr_start_addr <= block_end_addr) && (length > 0)) {
-			tmp_buffer[j][k] = *buffer;
-			k                = (k + 1) % NVMCTRL_PAGE_SIZE;
+		_nvm_wait_ready(device->hw);
 
-			if (0 == k) {
-				j++;
-			}
+		/* store the erase data into temp buffer before write, and update it, in one chained copy */
+		copy[0].dst  = tmp_buffer;
+		copy[0].src  = (uint8_t *)NVM_MEMORY + block_start_addr;
+		copy[0].size = NVMCTRL_BLOCK_SIZE;
+		copy[1].dst  = &tmp_buffer[0][0] + offset;
+		copy[1].src  = buffer;
+		copy[1].size = size;
+		_dma_copy_blocks(copy, 2);
 
-			wr_start_addr++;
-			buffer++;
-			length--;
-		}
+		wr_start_addr += size;
+		buffer += size;
+		length -= size;
 
 		/* erase row before write */
 		_flash_erase_block(device->hw, block_start_addr);
 
 		/* write buffer to flash */
-		for (i = 0; i < NVMCTRL_BLOCK_PAGES; i++) {
+		for (i = 0; i < NVM_BLOCK_PAGES; i++) {
 			_flash_program(device->hw, block_start_addr + i * NVMCTRL_PAGE_SIZE, tmp_buffer[i], NVMCTRL_PAGE_SIZE);
 		}
 	} while (block_end_addr < (wr_start_addr + length - 1));
@@ -239,7 +256,7 @@ void _flash_erase(struct _flash_device *const device, uint32_t dst_addr, uint32_
 	/* when address is not aligned with block start address */
 	if (dst_addr != block_start_addr) {
 		block_start_addr += NVMCTRL_BLOCK_SIZE;
-		for (i = 0; i < NVMCTRL_BLOCK_PAGES - 1; i++) {
+		for (i = 0; i < NVM_BLOCK_PAGES - 1; i++) {
 			_flash_write(device, dst_addr, tmp_buffer, NVMCTRL_PAGE_SIZE);
 
 			if (--page_nums == 0) {
@@ -254,10 +271,10 @@ void _flash_erase(struct _flash_device *const device, uint32_t dst_addr, uint32_
 		}
 	}
 
-	while (page_nums >= NVMCTRL_BLOCK_PAGES) {
+	while (page_nums >= NVM_BLOCK_PAGES) {
 		_flash_erase_block(device->hw, block_start_addr);
 		block_start_addr += NVMCTRL_BLOCK_SIZE;
-		page_nums -= NVMCTRL_BLOCK_PAGES;
+		page_nums -= NVM_BLOCK_PAGES;
 	}
 
 	if (page_nums != 0) {
@@ -276,21 +293,19 @@ int32_t _flash_lock(struct _flash_device *const device, const uint32_t dst_addr,
 	uint32_t region_pages;
 	uint32_t block_start_addr;
 
-	region_pages     = (uint32_t)FLASH_SIZE / (NVMCTRL_REGIONS_NUM * NVMCTRL_PAGE_SIZE);
+	region_pages     = NVM_REGION_PAGES;
 	block_start_addr = dst_addr & ~(NVMCTRL_BLOCK_SIZE - 1);
 
 	if ((page_nums != region_pages) || (dst_addr != block_start_addr)) {
 		return ERR_INVALID_ARG;
 	}
 
-	while (!hri_nvmctrl_get_STATUS_READY_bit(device->hw)) {
-		/* Wait until this module isn't busy */
-	}
+	_nvm_wait_ready(device->hw);
 
 	hri_nvmctrl_write_ADDR_reg(device->hw, dst_addr);
 	hri_nvmctrl_write_CTRLB_reg(device->hw, NVMCTRL_CTRLB_CMD_LR | NVMCTRL_CTRLB_CMDEX_KEY);
 
-	return (int32_t)FLASH_SIZE / (NVMCTRL_REGIONS_NUM * NVMCTRL_PAGE_SIZE);
+	return (int32_t)NVM_REGION_PAGES;
 }
 
 /**
@@ -301,21 +316,19 @@ int32_t _flash_unlock(struct _flash_device *const device, const uint32_t dst_add
 	uint32_t region_pages;
 	uint32_t block_start_addr;
 
-	region_pages     = (uint32_t)FLASH_SIZE / (NVMCTRL_REGIONS_NUM * NVMCTRL_PAGE_SIZE);
+	region_pages     = NVM_REGION_PAGES;
 	block_start_addr = dst_addr & ~(NVMCTRL_BLOCK_SIZE - 1);
 
 	if ((page_nums != region_pages) || (dst_addr != block_start_addr)) {
 		return ERR_INVALID_ARG;
 	}
 
-	while (!hri_nvmctrl_get_STATUS_READY_bit(device->hw)) {
-		/* Wait until this module isn't busy */
-	}
+	_nvm_wait_ready(device->hw);
 
 	hri_nvmctrl_write_ADDR_reg(device->hw, dst_addr);
 	hri_nvmctrl_write_CTRLB_reg(device->hw, NVMCTRL_CTRLB_CMD_UR | NVMCTRL_CTRLB_CMDEX_KEY);
 
-	return (int32_t)FLASH_SIZE / (NVMCTRL_REGIONS_NUM * NVMCTRL_PAGE_SIZE);
+	return (int32_t)NVM_REGION_PAGES;
 }
 
 /**
@@ -326,7 +339,7 @@ bool _flash_is_locked(struct _flash_device *const device, const uint32_t dst_add
 	uint16_t region_id;
 
 	/* Get region for given page */
-	region_id = dst_addr / (FLASH_SIZE / NVMCTRL_REGIONS_NUM);
+	region_id = dst_addr >> NVM_REGION_SHIFT;
 
 	return !(hri_nvmctrl_get_RUNLOCK_reg(device->hw, 1 << region_id));
 }
@@ -356,17 +369,20 @@ void _flash_set_irq_state(struct _flash_device *const device, const enum _flash_
  */
 static void _flash_erase_block(void *const hw, const uint32_t dst_addr)
 {
-	while (!hri_nvmctrl_get_STATUS_READY_bit(hw)) {
-		/* Wait until this module isn't busy */
-	}
+	_nvm_wait_ready(hw);
 
 	/* Set address and command */
 	hri_nvmctrl_write_ADDR_reg(hw, dst_addr);
 	hri_nvmctrl_write_CTRLB_reg(hw, NVMCTRL_CTRLB_CMD_EB | NVMCTRL_CTRLB_CMDEX_KEY);
+	_NVM_CACHE_STALE();
 }
 
 /**
  * \internal   write a page in flash
+ *
+ * In the automatic write modes (CTRLA.WMODE), whole pages are written by loading the page buffer only:
+ * the NVMCTRL writes each page (AP), quad word (AQW) or double word (ADW) once its last word is loaded.
+ * Other writes use the manual mode.
  * \param[in]  hw            The pointer to hardware instance
  * \param[in]  dst_addr      Destination page address to write
  * \param[in]  buffer        Pointer to buffer where the data to
@@ -375,33 +391,117 @@ static void _flash_erase_block(void *const hw, const uint32_t dst_addr)
  */
 static void _flash_program(void *const hw, const uint32_t dst_addr, const uint8_t *buffer, const uint16_t size)
 {
-	uint32_t *ptr_read    = (uint32_t *)buffer;
-	uint32_t  nvm_address = dst_addr / 4;
+	uint32_t *ptr_read = (uint32_t *)buffer;
+	uint32_t  wmode    = hri_nvmctrl_read_CTRLA_WMODE_bf(hw);
 	uint16_t  i;
 
-	while (!hri_nvmctrl_get_STATUS_READY_bit(hw)) {
-		/* Wait until this module isn't busy */
+	_nvm_wait_ready(hw);
+
+	if (NVMCTRL_CTRLA_WMODE_MAN_Val != wmode && NVMCTRL_PAGE_SIZE == size
+	    && 0 == (dst_addr & (NVMCTRL_PAGE_SIZE - 1))) {
+		/* Every word of the page buffer is loaded: no need to clear it */
+		const uint16_t granule = (NVMCTRL_CTRLA_WMODE_AP_Val == wmode)
+		                             ? NVMCTRL_PAGE_SIZE
+		                             : ((NVMCTRL_CTRLA_WMODE_AQW_Val == wmode) ? 16 : 8);
+		if (NVMCTRL_PAGE_SIZE == granule) {
+			_flash_load_page_buffer(dst_addr, ptr_read, size);
+			_NVM_CACHE_STALE();
+			return;
+		}
+		for (i = 0; i < size; i += 4) {
+			if (i && 0 == i % granule) {
+				_nvm_wait_ready(hw); /* Wait for the previous automatic write */
+			}
+			_NVM_PAGE_BUFFER_LOAD(dst_addr + i, *ptr_read);
+			_NVM_CACHE_STALE();
+			ptr_read++;
+		}
+		return;
+	}
+	if (NVMCTRL_CTRLA_WMODE_MAN_Val != wmode) {
+		/* Partial pages are written manually, without automatic writes while loading the page buffer */
+		hri_nvmctrl_write_CTRLA_WMODE_bf(hw, NVMCTRL_CTRLA_WMODE_MAN_Val);
 	}
 
 	hri_nvmctrl_write_CTRLB_reg(hw, NVMCTRL_CTRLB_CMD_PBC | NVMCTRL_CTRLB_CMDEX_KEY);
 
-	while (!hri_nvmctrl_get_STATUS_READY_bit(hw)) {
-		/* Wait until this module isn't busy */
+	_nvm_wait_ready(hw);
+
+	_flash_load_page_buffer(dst_addr, ptr_read, size);
+
+	_nvm_wait_ready(hw);
+
+	hri_nvmctrl_write_ADDR_reg(hw, dst_addr);
+	hri_nvmctrl_write_CTRLB_reg(hw, NVMCTRL_CTRLB_CMD_WP | NVMCTRL_CTRLB_CMDEX_KEY);
+	_NVM_CACHE_STALE();
+
+	if (NVMCTRL_CTRLA_WMODE_MAN_Val != wmode) {
+		_nvm_wait_ready(hw); /* Wait until the page is written before going back to the automatic mode */
+		hri_nvmctrl_write_CTRLA_WMODE_bf(hw, wmode);
 	}
+}
 
+/**
+ * \internal Load data in the page buffer with 32-bit writes, by the DMAC when it can, else by the CPU
+ *
+ * \param[in] dst_addr Destination address in the page
+ * \param[in] buffer Data to load
+ * \param[in] size Size of the data, a multiple of 4
+ */
+static void _flash_load_page_buffer(const uint32_t dst_addr, const uint32_t *buffer, const uint16_t size)
+{
+	const struct _dma_copy_block copy = {(void *)&NVM_MEMORY[dst_addr / 4], buffer, size};
+	uint16_t                     i;
+
+	if (size >= CONF_DMA_COPY_THRESHOLD && ERR_NONE == _dma_copy_wait(&copy, 1)) {
+		return;
+	}
 	/* Writes to the page buffer must be 32 bits, perform manual copy
 	 * to ensure alignment */
 	for (i = 0; i < size; i += 4) {
-		NVM_MEMORY[nvm_address++] = *ptr_read;
-		ptr_read++;
+		_NVM_PAGE_BUFFER_LOAD(dst_addr + i, *buffer);
+		buffer++;
+	}
+}
+
+/**
+ * \internal Drop the cached flash content if a command modified the flash since the last invalidation, and completed
+ *
+ * STATUS.READY is checked since INTFLAG.DONE may belong to an earlier command (e.g. a page buffer clear)
+ * while the one marking the cache stale still runs.
+ * \param[in] hw The pointer to hardware instance
+ */
+static inline void _nvm_cache_sync(void *const hw)
+{
+#if CONF_CMCC_ENABLE
+	if (_nvm_cache_stale && hri_nvmctrl_get_STATUS_reg(hw, NVMCTRL_STATUS_READY)) {
+		_nvm_cache_stale = false;
+		_cmcc_invalidate_all(CMCC);
 	}
+#else
+	(void)hw;
+#endif
+}
 
+/**
+ * \internal Wait until the NVMCTRL is ready, the flash then being read without stale cached content
+ *
+ * \param[in] hw The pointer to hardware instance
+ */
+static void _nvm_wait_ready(void *const hw)
+{
 	while (!hri_nvmctrl_get_STATUS_READY_bit(hw)) {
 		/* Wait until this module isn't busy */
 	}
+	_nvm_cache_sync(hw);
+}
 
-	hri_nvmctrl_write_ADDR_reg(hw, dst_addr);
-	hri_nvmctrl_write_CTRLB_reg(hw, NVMCTRL_CTRLB_CMD_WP | NVMCTRL_CTRLB_CMDEX_KEY);
+/**
+ * \brief Wait for the last erase or write of the internal Flash to complete
+ */
+void _flash_wait_ready(struct _flash_device *const device)
+{
+	_nvm_wait_ready(device->hw);
 }
 
 /**
@@ -415,6 +515,7 @@ static void _nvm_interrupt_handler(struct _flash_device *device)
 
 	if (hri_nvmctrl_get_INTFLAG_DONE_bit(hw)) {
 		hri_nvmctrl_clear_INTFLAG_DONE_bit(hw);
+		_nvm_cache_sync(hw);
 
 		if (NULL != device->flash_cb.ready_cb) {
 			device->flash_cb.ready_cb(device);
@@ -477,6 +578,24 @@ void NVMCTRL_1_Handler(void)
 	(((uint8_t *)(b) >= (uint8_t *)_NVM_SW_CALIB_AREA_BASE) && ((uint8_t *)(b) <= (uint8_t *)_NVM_SW_CALIB_AREA_END))
 #define _IN_NVM_SW_CALIB_AREA(b, o) (((uint8_t *)(b) + (o)) <= (uint8_t *)(_NVM_SW_CALIB_AREA_END))
 
+/*
+   The SmartEEPROM can be read and written at address 0x44000000, once the SEESBLK
+   and SEEPSZ fuses allocated it. Only its first 512 bytes, available with any
+   allocation, are accessed here. The words are written one by one, in unbuffered
+   mode: the NVMCTRL programs each of them without erasing the user row, and a
+   power loss can only corrupt the word being written.
+ */
+#ifndef _NVM_SEE_BASE
+#define _NVM_SEE_BASE SEEPROM_ADDR
+#endif
+#ifndef _NVM_SEE_WRITE
+#define _NVM_SEE_WRITE(addr, data) (*(volatile uint32_t *)(addr) = (data))
+#endif
+#define _NVM_SEE_N_BYTES 512
+#define _NVM_SEE_END (((uint8_t *)_NVM_SEE_BASE) + _NVM_SEE_N_BYTES - 1)
+#define _IS_NVM_SEE(b) (((uint8_t *)(b) >= (uint8_t *)_NVM_SEE_BASE) && ((uint8_t *)(b) <= (uint8_t *)_NVM_SEE_END))
+#define _IN_NVM_SEE(b, o) (((uint8_t *)(b) + (o)) <= (uint8_t *)(_NVM_SEE_END))
+
 /**
  * \internal Read left aligned data bits
  * \param[in] base       Base address for the data
@@ -524,6 +643,17 @@ int32_t _user_area_read(const void *base, const uint32_t offset, uint8_t *buf, u
 		if (!_IN_NVM_SW_CALIB_AREA(base, offset + size - 1)) {
 			return ERR_INVALID_ARG;
 		}
+	} else if (_IS_NVM_SEE(base)) {
+		if (!_IN_NVM_SEE(base, offset)) {
+			return ERR_BAD_ADDRESS;
+		} else if (!_IN_NVM_SEE(base, offset + size - 1)) {
+			return ERR_INVALID_ARG;
+		} else if (0 == hri_nvmctrl_read_SEESTAT_SBLK_bf(NVMCTRL)) {
+			return ERR_NOT_INITIALIZED; /* No SmartEEPROM allocated */
+		}
+		while (hri_nvmctrl_get_SEESTAT_BUSY_bit(NVMCTRL)) {
+			/* Wait until the last write is programmed */
+		}
 	} else {
 		return ERR_UNSUPPORTED_OP;
 	}
@@ -584,24 +714,19 @@ static int32_t _user_row_write_exec(const uint32_t *_row)
 	/* Do Save */
 
 	/* - Prepare. */
-	while (!hri_nvmctrl_get_STATUS_READY_bit(hw)) {
-		/* Wait until this module isn't busy */
-	}
+	_nvm_wait_ready(hw);
 	hri_nvmctrl_clear_CTRLA_WMODE_bf(NVMCTRL, NVMCTRL_CTRLA_WMODE_Msk);
 
 	/* - Erase AUX row. */
 	hri_nvmctrl_write_ADDR_reg(hw, (hri_nvmctrl_addr_reg_t)_NVM_USER_ROW_BASE);
 	hri_nvmctrl_write_CTRLB_reg(hw, NVMCTRL_CTRLB_CMD_EP | NVMCTRL_CTRLB_CMDEX_KEY);
-	while (!hri_nvmctrl_get_STATUS_READY_bit(hw)) {
-		/* Wait until this module isn't busy */
-	}
+	_NVM_CACHE_STALE();
+	_nvm_wait_ready(hw);
 
 	for (i = 0; i < 32; i++) { /* 32 Quad words for User row: 32 * (4 bytes * 4) = 512 bytes */
 		/* - Page buffer clear & write. */
 		hri_nvmctrl_write_CTRLB_reg(hw, NVMCTRL_CTRLB_CMD_PBC | NVMCTRL_CTRLB_CMDEX_KEY);
-		while (!hri_nvmctrl_get_STATUS_READY_bit(hw)) {
-			/* Wait until this module isn't busy */
-		}
+		_nvm_wait_ready(hw);
 		*(((uint32_t *)NVMCTRL_USER) + i * 4)     = _row[i * 4];
 		*(((uint32_t *)NVMCTRL_USER) + i * 4 + 1) = _row[i * 4 + 1];
 		*(((uint32_t *)NVMCTRL_USER) + i * 4 + 2) = _row[i * 4 + 2];
@@ -610,9 +735,8 @@ static int32_t _user_row_write_exec(const uint32_t *_row)
 		/* - Write AUX row. */
 		hri_nvmctrl_write_ADDR_reg(hw, (hri_nvmctrl_addr_reg_t)(_NVM_USER_ROW_BASE + i * 16));
 		hri_nvmctrl_write_CTRLB_reg(hw, NVMCTRL_CTRLB_CMD_WQW | NVMCTRL_CTRLB_CMDEX_KEY);
-		while (!hri_nvmctrl_get_STATUS_READY_bit(hw)) {
-			/* Wait until this module isn't busy */
-		}
+		_NVM_CACHE_STALE();
+		_nvm_wait_ready(hw);
 	}
 
 	/* Restore CTRLA */
@@ -621,6 +745,42 @@ static int32_t _user_row_write_exec(const uint32_t *_row)
 	return ERR_NONE;
 }
 
+/** \internal Write words in the SmartEEPROM, skipping the ones already holding the data
+ *  \param[in] dst  Address of the first word in the SmartEEPROM
+ *  \param[in] buf  Data to write
+ *  \param[in] size Size of the data, in whole words
+ */
+static int32_t _see_write_exec(volatile uint32_t *dst, const uint8_t *buf, const uint32_t size)
+{
+	Nvmctrl *hw = NVMCTRL;
+	uint32_t word;
+	uint32_t i;
+
+	if (0 == hri_nvmctrl_read_SEESTAT_SBLK_bf(hw)) {
+		return ERR_NOT_INITIALIZED; /* No SmartEEPROM allocated */
+	}
+	if (hri_nvmctrl_get_SEESTAT_LOCK_bit(hw)) {
+		return ERR_DENIED;
+	}
+	_nvm_wait_ready(hw); /* Wait until an erase or write of the main array completes */
+	hri_nvmctrl_clear_SEECFG_WMODE_bit(hw); /* Unbuffered: each word is programmed once written */
+
+	for (i = 0; i < size / 4; i++) {
+		memcpy(&word, &buf[i * 4], sizeof(word));
+		while (hri_nvmctrl_get_SEESTAT_BUSY_bit(hw)) {
+			/* Wait until the previous word is programmed */
+		}
+		if (dst[i] != word) {
+			_NVM_SEE_WRITE(&dst[i], word);
+		}
+	}
+	while (hri_nvmctrl_get_SEESTAT_BUSY_bit(hw)) {
+		/* Wait until the last word is programmed */
+	}
+
+	return ERR_NONE;
+}
+
 int32_t _user_area_write(void *base, const uint32_t offset, const uint8_t *buf, const uint32_t size)
 {
 	uint32_t _row[NVMCTRL_PAGE_SIZE / 4]; /* Copy of user row. */
@@ -634,6 +794,13 @@ int32_t _user_area_write(void *base, const uint32_t offset, const uint8_t *buf,
 		}
 	} else if (_IS_NVM_SW_CALIB_AREA(base)) {
 		return ERR_DENIED;
+	} else if (_IS_NVM_SEE(base)) {
+		if (!_IN_NVM_SEE(base, offset)) {
+			return ERR_BAD_ADDRESS;
+		} else if (!_IN_NVM_SEE(base, offset + size - 1) || (((uintptr_t)base + offset) & 3) || (size & 3)) {
+			return ERR_INVALID_ARG; /* The SmartEEPROM is written by words */
+		}
+		return _see_write_exec((volatile uint32_t *)((uint8_t *)base + offset), buf, size);
 	} else {
 		return ERR_UNSUPPORTED_OP;
 	}
@@ -0,0 +1,96 @@
+/**
+ * \file
+ *
+ * \brief NVM geometry of the SAM D5x/E5x device selected at build time
+ *
+ * The sizes are derived from the device header (FLASH_SIZE, NVMCTRL_PAGE_SIZE and NVMCTRL_BLOCK_SIZE),
+ * so that address checks and offset computations are constant shifts and masks instead of
+ * reading NVMCTRL.PARAM at run time. All members of the family share the page and block sizes,
+ * and differ by their flash size: 256 KB (18A), 512 KB (19A) or 1 MB (20A).
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HPL_NVMCTRL_GEOMETRY_H_INCLUDED
+#define _HPL_NVMCTRL_GEOMETRY_H_INCLUDED
+
+#include <compiler.h>
+
+/** log2 of the page size: the smallest unit written in the main array */
+#define NVM_PAGE_SHIFT 9
+/** log2 of the block size: the smallest unit erased */
+#define NVM_BLOCK_SHIFT 13
+
+#if NVMCTRL_PAGE_SIZE != (1 << NVM_PAGE_SHIFT) || NVMCTRL_BLOCK_SIZE != (1 << NVM_BLOCK_SHIFT)
+#error "the SAM D5x/E5x NVM has 512-byte pages and 8 KB blocks"
+#endif
+
+/** log2 of the flash size */
+#if FLASH_SIZE == 0x40000
+#define NVM_FLASH_SHIFT 18
+#elif FLASH_SIZE == 0x80000
+#define NVM_FLASH_SHIFT 19
+#elif FLASH_SIZE == 0x100000
+#define NVM_FLASH_SHIFT 20
+#else
+#error "unsupported flash size: the SAM D5x/E5x have 256 KB, 512 KB or 1 MB of flash"
+#endif
+
+#define NVM_PAGE_SIZE (1UL << NVM_PAGE_SHIFT)
+#define NVM_BLOCK_SIZE (1UL << NVM_BLOCK_SHIFT)
+#define NVM_FLASH_SIZE (1UL << NVM_FLASH_SHIFT)
+/** Pages in a block */
+#define NVM_BLOCK_PAGES (1UL << (NVM_BLOCK_SHIFT - NVM_PAGE_SHIFT))
+/** Pages and blocks of the main array */
+#define NVM_TOTAL_PAGES (1UL << (NVM_FLASH_SHIFT - NVM_PAGE_SHIFT))
+#define NVM_TOTAL_BLOCKS (1UL << (NVM_FLASH_SHIFT - NVM_BLOCK_SHIFT))
+
+/** The main array is made of two banks of equal size, the upper one being the inactive bank after a bank swap */
+#define NVM_BANKS 2
+#define NVM_BANK_SHIFT (NVM_FLASH_SHIFT - 1)
+#define NVM_BANK_SIZE (1UL << NVM_BANK_SHIFT)
+
+/** Lock regions: one bit of the RUNLOCK register each */
+#define NVM_REGIONS 32
+#define NVM_REGION_SHIFT (NVM_FLASH_SHIFT - 5)
+#define NVM_REGION_SIZE (1UL << NVM_REGION_SHIFT)
+#define NVM_REGION_PAGES (1UL << (NVM_REGION_SHIFT - NVM_PAGE_SHIFT))
+
+/** BOOTPROT fuse (4 bits): the first 15 - BOOTPROT blocks are protected and hold the bootloader */
+#define NVM_BOOTPROT_MAX 15
+#define NVM_BOOTPROT_SIZE(bootprot) ((uint32_t)(NVM_BOOTPROT_MAX - (bootprot)) << NVM_BLOCK_SHIFT)
+
+/** SmartEEPROM: the SEESBLK fuse allocates 1 to 10 blocks at the end of each bank, whose content is not addressed as flash */
+#define NVM_SEE_SBLK_MAX 10
+#define NVM_SEE_BANK_SIZE(sblk) ((uint32_t)(sblk) << NVM_BLOCK_SHIFT)
+#define NVM_SEE_SIZE(sblk) (NVM_SEE_BANK_SIZE(sblk) * NVM_BANKS)
+
+/* the layouts the hardware can not have */
+#if NVM_BLOCK_SHIFT >= NVM_REGION_SHIFT
+#error "a lock region must hold several blocks"
+#endif
+#if (NVM_BOOTPROT_MAX << NVM_BLOCK_SHIFT) >= NVM_BANK_SIZE
+#error "the largest bootloader must leave room for an application in each bank"
+#endif
+#if (NVM_SEE_SBLK_MAX << NVM_BLOCK_SHIFT) >= NVM_BANK_SIZE
+#error "the largest SmartEEPROM must leave room in each bank"
+#endif
+
+/** Check if a range of bytes is in the main array, without overflowing */
+#define NVM_RANGE_VALID(addr, length) ((addr) <= NVM_FLASH_SIZE && (length) <= NVM_FLASH_SIZE - (addr))
+
+#endif /* _HPL_NVMCTRL_GEOMETRY_H_INCLUDED */
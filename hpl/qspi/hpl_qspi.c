@@ -0,0 +1,100 @@
+/**
+ * \file
+ *
+ * \brief QSPI serial memory mode related functionality implementation.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <hpl_qspi.h>
+#include <hpl_cmcc.h>
+#include <hpl_cmcc_config.h>
+#include <hpl_dma_copy.h>
+#include <hpl_qspi_config.h>
+#include <utils_assert.h>
+
+#if CONF_QSPI_ENABLE
+
+int32_t _qspi_sync_init(struct _qspi_sync_dev *dev, void *const hw)
+{
+	ASSERT(dev && hw);
+
+	dev->prvt = hw;
+	hri_qspi_write_CTRLA_reg(hw, QSPI_CTRLA_SWRST);
+	hri_qspi_write_CTRLB_reg(hw, QSPI_CTRLB_MODE_MEMORY | QSPI_CTRLB_CSMODE_LASTXFER | QSPI_CTRLB_DATALEN_8BITS);
+	hri_qspi_write_BAUD_reg(hw, QSPI_BAUD_BAUD(CONF_QSPI_SCBR)); // SPI mode 0 (CPOL = CPHA = 0)
+	hri_qspi_write_CTRLA_reg(hw, QSPI_CTRLA_ENABLE);
+	return ERR_NONE;
+}
+
+int32_t _qspi_sync_deinit(struct _qspi_sync_dev *dev)
+{
+	ASSERT(dev && dev->prvt);
+
+	hri_qspi_write_CTRLA_reg(dev->prvt, QSPI_CTRLA_SWRST); // also disables it
+	return ERR_NONE;
+}
+
+int32_t _qspi_sync_serial_run_command(struct _qspi_sync_dev *dev, const struct _qspi_command *cmd)
+{
+	void *const hw     = dev->prvt;
+	uint8_t *   window = (uint8_t *)QSPI_AHB;
+#if CONF_CMCC_ENABLE
+	bool cached = false;
+#endif
+
+	ASSERT(hw && cmd);
+
+	if (cmd->inst_frame.bits.addr_en) {
+		hri_qspi_write_INSTRADDR_reg(hw, cmd->address);
+		window += cmd->address;
+	}
+	hri_qspi_write_INSTRCTRL_reg(hw, QSPI_INSTRCTRL_INSTR(cmd->instruction) | QSPI_INSTRCTRL_OPTCODE(cmd->option));
+	hri_qspi_write_INSTRFRAME_reg(hw, cmd->inst_frame.word);
+	(void)hri_qspi_read_INSTRFRAME_reg(hw); // the frame must be set before the AHB window is accessed
+
+	if (cmd->inst_frame.bits.data_en) { // the accesses to the AHB window clock the data phase
+#if CONF_CMCC_ENABLE
+		/* The AHB window is in the code region cached by the CMCC: a CPU copy would hit lines of an earlier command
+		 * (e.g. the status register while polling for BUSY) instead of clocking the data phase */
+		cached = _is_cache_enabled(CMCC);
+		if (cached) {
+			_cmcc_disable(CMCC);
+		}
+#endif
+		if (QSPI_READ_ACCESS == cmd->inst_frame.bits.tfr_type || QSPI_READMEM_ACCESS == cmd->inst_frame.bits.tfr_type) {
+			_dma_copy(cmd->rx_buf, window, cmd->buf_len);
+		} else {
+			_dma_copy(window, cmd->tx_buf, cmd->buf_len);
+		}
+		__DSB();
+		__ISB();
+#if CONF_CMCC_ENABLE
+		if (cached) { // drop what the window may have left in the cache, the flash content changing with each command
+			hri_cmcc_write_MAINT0_reg(CMCC, CMCC_MAINT0_INVALL);
+			_cmcc_enable(CMCC);
+		}
+#endif
+	}
+
+	hri_qspi_write_CTRLA_reg(hw, QSPI_CTRLA_ENABLE | QSPI_CTRLA_LASTXFER); // release the chip select
+	while (!hri_qspi_get_INTFLAG_INSTREND_bit(hw));
+	hri_qspi_clear_INTFLAG_reg(hw, QSPI_INTFLAG_INSTREND);
+	return ERR_NONE;
+}
+
+#endif /* CONF_QSPI_ENABLE */
@@ -0,0 +1,197 @@
+/**
+ * \file
+ *
+ * \brief Serial NOR flash on the QSPI.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <hpl_qspi_nor.h>
+#include <hpl_qspi_config.h>
+
+#if CONF_QSPI_ENABLE
+
+/** \name Commands of the SST26 family */
+//@{
+#define QSPI_NOR_RSTEN 0x66   //!< reset enable
+#define QSPI_NOR_RST 0x99     //!< reset
+#define QSPI_NOR_RDSR 0x05    //!< read status register
+#define QSPI_NOR_WRSR 0x01    //!< write status and configuration registers
+#define QSPI_NOR_WREN 0x06    //!< write enable
+#define QSPI_NOR_JEDEC_ID 0x9F //!< read manufacturer and device ID
+#define QSPI_NOR_ULBPR 0x98   //!< global block protection unlock
+#define QSPI_NOR_SQOR 0xEB    //!< quad I/O read: address and mode byte on 4 lines, 4 dummy cycles
+#define QSPI_NOR_SQPP 0x32    //!< quad I/O page program: address and data on 4 lines
+#define QSPI_NOR_SE 0x20      //!< sector erase
+#define QSPI_NOR_BE 0xD8      //!< block erase
+//@}
+
+/** Status register: program or erase running */
+#define QSPI_NOR_SR_BUSY (1u << 0)
+/** Configuration register: WP# and HOLD# disabled, so that they carry SIO2 and SIO3 */
+#define QSPI_NOR_CR_IOC (1u << 1)
+
+#if CONF_QSPI_NOR_SIZE > 0x1000000
+#error "the flash must fit in the 16 MB of the QSPI AHB window, with 24-bit addresses"
+#endif
+
+/**
+ * \internal Run a command without data phase, in single-bit SPI
+ * \param[in] dev QSPI device
+ * \param[in] instruction Instruction code
+ * \param[in] addr_en Send the address
+ * \param[in] addr Address
+ */
+static void _qspi_nor_instruction(struct _qspi_sync_dev *dev, const uint8_t instruction, const bool addr_en,
+                                  const uint32_t addr)
+{
+	struct _qspi_command cmd = {
+	    .inst_frame.bits.width    = QSPI_INST1_ADDR1_DATA1,
+	    .inst_frame.bits.inst_en  = 1,
+	    .inst_frame.bits.addr_en  = addr_en,
+	    .inst_frame.bits.tfr_type = QSPI_WRITE_ACCESS,
+	    .instruction              = instruction,
+	    .address                  = addr,
+	};
+
+	_qspi_sync_serial_run_command(dev, &cmd);
+}
+
+/**
+ * \internal Run a register command with a data phase, in single-bit SPI
+ * \param[in] dev QSPI device
+ * \param[in] instruction Instruction code
+ * \param[in] tfr_type QSPI_READ_ACCESS or QSPI_WRITE_ACCESS
+ * \param[in,out] buffer Data
+ * \param[in] length Length of the data
+ */
+static void _qspi_nor_register(struct _qspi_sync_dev *dev, const uint8_t instruction,
+                               const enum _qspi_tfr_type tfr_type, uint8_t *const buffer, const uint32_t length)
+{
+	struct _qspi_command cmd = {
+	    .inst_frame.bits.width    = QSPI_INST1_ADDR1_DATA1,
+	    .inst_frame.bits.inst_en  = 1,
+	    .inst_frame.bits.data_en  = 1,
+	    .inst_frame.bits.tfr_type = tfr_type,
+	    .instruction              = instruction,
+	    .buf_len                  = length,
+	    .tx_buf                   = buffer,
+	    .rx_buf                   = buffer,
+	};
+
+	_qspi_sync_serial_run_command(dev, &cmd);
+}
+
+bool _qspi_nor_is_busy(struct _qspi_sync_dev *dev)
+{
+	uint8_t status;
+
+	_qspi_nor_register(dev, QSPI_NOR_RDSR, QSPI_READ_ACCESS, &status, sizeof(status));
+	return status & QSPI_NOR_SR_BUSY;
+}
+
+void _qspi_nor_wait_ready(struct _qspi_sync_dev *dev)
+{
+	while (_qspi_nor_is_busy(dev));
+}
+
+int32_t _qspi_nor_init(struct _qspi_sync_dev *dev)
+{
+	uint8_t id[3];
+	uint8_t regs[2] = {0x00, QSPI_NOR_CR_IOC}; // status (read-only bits), configuration
+
+	_qspi_nor_instruction(dev, QSPI_NOR_RSTEN, false, 0); // a reset of the MCU does not reset the flash
+	_qspi_nor_instruction(dev, QSPI_NOR_RST, false, 0);
+	_qspi_nor_register(dev, QSPI_NOR_JEDEC_ID, QSPI_READ_ACCESS, id, sizeof(id));
+	if (CONF_QSPI_NOR_MANUFACTURER != id[0]) {
+		return ERR_NOT_FOUND;
+	}
+	_qspi_nor_wait_ready(dev);
+	_qspi_nor_instruction(dev, QSPI_NOR_WREN, false, 0);
+	_qspi_nor_register(dev, QSPI_NOR_WRSR, QSPI_WRITE_ACCESS, regs, sizeof(regs));
+	_qspi_nor_wait_ready(dev);
+	_qspi_nor_instruction(dev, QSPI_NOR_WREN, false, 0);
+	_qspi_nor_instruction(dev, QSPI_NOR_ULBPR, false, 0); // the blocks are write-protected after power-up
+	return ERR_NONE;
+}
+
+int32_t _qspi_nor_read(struct _qspi_sync_dev *dev, const uint32_t addr, uint8_t *const buffer, const uint32_t length)
+{
+	struct _qspi_command cmd = {
+	    .inst_frame.bits.width        = QSPI_INST1_ADDR4_DATA4,
+	    .inst_frame.bits.inst_en      = 1,
+	    .inst_frame.bits.addr_en      = 1,
+	    .inst_frame.bits.opt_en       = 1,
+	    .inst_frame.bits.opt_len      = 3, // 8-bit mode byte, which does not enter the continuous read mode
+	    .inst_frame.bits.data_en      = 1,
+	    .inst_frame.bits.tfr_type     = QSPI_READMEM_ACCESS,
+	    .inst_frame.bits.dummy_cycles = 4,
+	    .instruction                  = QSPI_NOR_SQOR,
+	    .option                       = 0x00,
+	    .address                      = addr,
+	    .buf_len                      = length,
+	    .rx_buf                       = buffer,
+	};
+
+	if (addr + length > CONF_QSPI_NOR_SIZE) {
+		return ERR_BAD_ADDRESS;
+	}
+	_qspi_nor_wait_ready(dev);
+	return _qspi_sync_serial_run_command(dev, &cmd);
+}
+
+int32_t _qspi_nor_program(struct _qspi_sync_dev *dev, const uint32_t addr, const uint8_t *const buffer,
+                          const uint32_t length)
+{
+	struct _qspi_command cmd = {
+	    .inst_frame.bits.width    = QSPI_INST1_ADDR4_DATA4,
+	    .inst_frame.bits.inst_en  = 1,
+	    .inst_frame.bits.addr_en  = 1,
+	    .inst_frame.bits.data_en  = 1,
+	    .inst_frame.bits.tfr_type = QSPI_WRITEMEM_ACCESS,
+	    .instruction              = QSPI_NOR_SQPP,
+	    .address                  = addr,
+	    .buf_len                  = length,
+	    .tx_buf                   = buffer,
+	};
+
+	if (addr + length > CONF_QSPI_NOR_SIZE) {
+		return ERR_BAD_ADDRESS;
+	}
+	if (0 == length || addr / CONF_QSPI_NOR_PAGE_SIZE != (addr + length - 1) / CONF_QSPI_NOR_PAGE_SIZE) {
+		return ERR_INVALID_ARG; // the address would wrap around in the page
+	}
+	_qspi_nor_wait_ready(dev);
+	_qspi_nor_instruction(dev, QSPI_NOR_WREN, false, 0);
+	return _qspi_sync_serial_run_command(dev, &cmd);
+}
+
+int32_t _qspi_nor_erase(struct _qspi_sync_dev *dev, const uint32_t addr, const uint32_t size)
+{
+	if (CONF_QSPI_NOR_SECTOR_SIZE != size && CONF_QSPI_NOR_BLOCK_SIZE != size) {
+		return ERR_INVALID_ARG;
+	}
+	if (addr % size || addr + size > CONF_QSPI_NOR_SIZE) {
+		return ERR_BAD_ADDRESS;
+	}
+	_qspi_nor_wait_ready(dev);
+	_qspi_nor_instruction(dev, QSPI_NOR_WREN, false, 0);
+	_qspi_nor_instruction(dev, CONF_QSPI_NOR_BLOCK_SIZE == size ? QSPI_NOR_BE : QSPI_NOR_SE, true, addr);
+	return ERR_NONE;
+}
+
+#endif /* CONF_QSPI_ENABLE */
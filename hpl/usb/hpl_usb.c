@@ -33,6 +33,7 @@
 
 #include <compiler.h>
 #include <hal_atomic.h>
+#include <hpl_dma_copy.h>
 #include <hpl_usb.h>
 #include <hpl_usb_device.h>
 
@@ -1043,7 +1044,7 @@ static void _usb_d_dev_in_next(struct _usb_d_dev_ep *ept, bool isr)
 			if (trans_next > ept->size) {
 				trans_next = ept->size;
 			}
-			memcpy(ept->cache, &ept->trans_buf[ept->trans_count], trans_next);
+			_dma_copy(ept->cache, &ept->trans_buf[ept->trans_count], trans_next);
 			_usbd_ep_set_buf(epn, 1, (uint32_t)ept->cache);
 		} else {
 			if (trans_next > USB_D_DEV_TRANS_MAX) {
@@ -1121,7 +1122,7 @@ static void _usb_d_dev_out_next(struct _usb_d_dev_ep *ept, bool isr)
 	/* If cache is used, copy data to buffer. */
 	if (ept->flags.bits.use_cache && ept->trans_size) {
 		uint16_t buf_remain = ept->trans_size - ept->trans_count;
-		memcpy(&ept->trans_buf[ept->trans_count], ept->cache, (buf_remain > last_pkt) ? last_pkt : buf_remain);
+		_dma_copy(&ept->trans_buf[ept->trans_count], ept->cache, (buf_remain > last_pkt) ? last_pkt : buf_remain);
 	}
 
 	/* Force wait ZLP */
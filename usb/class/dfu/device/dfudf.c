@@ -20,6 +20,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <hal_atomic.h>
 #include "dfudf.h"
 #include "usb_protocol_dfu.h"
 #include "dfudf_desc.h"
@@ -28,6 +29,8 @@
 struct dfudf_func_data {
 	/** DFU Interface information */
 	uint8_t func_iface;
+	/** Alternate setting of the interface (the memory downloaded to) */
+	uint8_t func_alt;
 	/** DFU Enable Flag */
 	bool enabled;
 };
@@ -39,14 +42,35 @@ static struct dfudf_func_data _dfudf_funcd;
 static const uint8_t usb_dfu_func_desc_bytes[] = {DFUD_IFACE_DESCB};
 static const usb_dfu_func_desc_t* usb_dfu_func_desc = (usb_dfu_func_desc_t*)&usb_dfu_func_desc_bytes;
 
-enum usb_dfu_state dfu_state = USB_DFU_STATE_DFU_IDLE;
-enum usb_dfu_status dfu_status = USB_DFU_STATUS_OK;
+volatile enum usb_dfu_state dfu_state = USB_DFU_STATE_DFU_IDLE;
+volatile enum usb_dfu_status dfu_status = USB_DFU_STATUS_OK;
+volatile uint32_t dfu_events = 0;
 
-uint8_t dfu_download_data[512];
-uint16_t dfu_download_length = 0;
-size_t dfu_download_offset = 0;
+COMPILER_ALIGNED(4) uint8_t dfu_download_data[512];
+struct spsc_queue dfu_jobs;
+/** Storage of dfu_jobs (the DFU protocol only has one job in flight, the rest is margin) */
+static struct usb_dfu_job dfu_jobs_buf[4];
 bool dfu_manifestation_complete = false;
 
+#if CONF_USB_DFUD_DFUSE_EN
+volatile uint32_t dfu_address_pointer = 0;
+/** Length of the DfuSe command in dfu_download_data, run once the host polls the status (0 if none is pending) */
+static uint16_t dfuse_command_length = 0;
+/** Commands reported by Get Commands, the first being Get Commands itself */
+static const uint8_t dfuse_commands[] = {USB_DFUSE_CMD_GET_COMMANDS, USB_DFUSE_CMD_SET_ADDRESS, USB_DFUSE_CMD_ERASE};
+#endif
+
+#if CONF_USB_DFUD_RESUME_EN
+usb_dfu_resume_info_t dfu_resume_info;
+usb_dfu_image_id_t dfu_image_id;
+volatile bool dfu_image_id_pending = false;
+#if CONF_USB_DFUD_BLOCK_CRC_EN
+le32_t dfu_block_crcs[128];
+uint16_t dfu_block_crcs_count = 0;
+volatile bool dfu_block_crcs_pending = false;
+#endif
+#endif
+
 /**
  * \brief Enable DFU Function
  * \param[in] drv Pointer to USB device function driver
@@ -65,8 +89,9 @@ static int32_t dfudf_enable(struct usbdf_driver *drv, struct usbd_descriptors *d
 		return ERR_NOT_FOUND;
 	}
 
-	ifc_desc.bInterfaceNumber = ifc[2];
-	ifc_desc.bInterfaceClass  = ifc[5];
+	ifc_desc.bInterfaceNumber  = ifc[2];
+	ifc_desc.bAlternateSetting = ifc[3];
+	ifc_desc.bInterfaceClass   = ifc[5];
 
 	if (USB_DFU_CLASS == ifc_desc.bInterfaceClass) {
 		if (func_data->func_iface == ifc_desc.bInterfaceNumber) { // Initialized
@@ -75,6 +100,7 @@ static int32_t dfudf_enable(struct usbdf_driver *drv, struct usbd_descriptors *d
 			return ERR_NO_RESOURCE;
 		} else {
 			func_data->func_iface = ifc_desc.bInterfaceNumber;
+			func_data->func_alt   = ifc_desc.bAlternateSetting;
 		}
 	} else { // Not supported by this function driver
 		return ERR_NOT_FOUND;
@@ -86,6 +112,7 @@ static int32_t dfudf_enable(struct usbdf_driver *drv, struct usbd_descriptors *d
 
 	// Installed
 	_dfudf_funcd.enabled = true;
+	dfudf_post_events(USB_DFU_EVENT_ENABLED); // wake up the main application waiting for it
 	return ERR_NONE;
 }
 
@@ -107,6 +134,10 @@ static int32_t dfudf_disable(struct usbdf_driver *drv, struct usbd_descriptors *
 		if (ifc_desc.bInterfaceClass != USB_DFU_CLASS) {
 			return ERR_NOT_FOUND;
 		}
+		// the alternate setting can't change during a download or manifestation (SET_INTERFACE is then stalled)
+		if (USB_DFU_STATE_DFU_IDLE != dfu_state && USB_DFU_STATE_DFU_ERROR != dfu_state) {
+			return ERR_DENIED;
+		}
 	}
 
 	func_data->func_iface = 0xFF;
@@ -132,7 +163,10 @@ static int32_t dfudf_ctrl(struct usbdf_driver *drv, enum usbdf_control ctrl, voi
 		return dfudf_disable(drv, (struct usbd_descriptors *)param);
 
 	case USBDF_GET_IFACE:
-		return ERR_UNSUPPORTED_OP;
+		if (((struct usb_req *)param)->wIndex != _dfudf_funcd.func_iface) {
+			return ERR_NOT_FOUND;
+		}
+		return _dfudf_funcd.func_alt;
 
 	default:
 		return ERR_INVALID_ARG;
@@ -156,12 +190,37 @@ static int32_t dfudf_in_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stage
 	uint8_t response[6]; // buffer for the response to this request
 	switch (req->bRequest) {
 	case USB_DFU_UPLOAD: // upload firmware from flash not supported
+#if CONF_USB_DFUD_DFUSE_EN
+		if (0 == req->wValue && (USB_DFU_STATE_DFU_IDLE == dfu_state || USB_DFU_STATE_DFU_UPLOAD_IDLE == dfu_state)) { // DfuSe Get Commands
+			dfu_state = USB_DFU_STATE_DFU_UPLOAD_IDLE; // until the host aborts
+			to_return = usbdc_xfer(ep, (uint8_t *)dfuse_commands, min(req->wLength, sizeof(dfuse_commands)), false);
+			break;
+		}
+#endif
 		dfu_state = USB_DFU_STATE_DFU_ERROR; // unsupported class request
 		to_return = ERR_UNSUPPORTED_OP; // stall control pipe (don't reply to the request)
 		break;
 	case USB_DFU_GETSTATUS: // get status
+#if CONF_USB_DFUD_DFUSE_EN
+		if (USB_DFU_STATE_DFU_DNLOAD_SYNC == dfu_state && dfuse_command_length) { // dfu-util expects dfuDNBUSY while the command runs
+			const struct usb_dfu_job job = {
+			    .type = USB_DFU_JOB_COMMAND,
+			    .alt = _dfudf_funcd.func_alt,
+			    .data = dfu_download_data,
+			    .length = dfuse_command_length,
+			};
+			dfuse_command_length = 0;
+			if (ERR_NONE == spsc_queue_put(&dfu_jobs, &job)) {
+				dfu_state = USB_DFU_STATE_DFU_DNBUSY; // reported with this status
+				dfudf_post_events(USB_DFU_EVENT_DOWNLOAD); // wake up the main application to run the command
+			} else { // this should not happen since the host waits for the previous job to complete
+				dfu_status = USB_DFU_STATUS_ERR_UNKNOWN;
+				dfu_state = USB_DFU_STATE_DFU_ERROR;
+			}
+		}
+#endif
 		response[0] = dfu_status; // set status
-		response[1] = 10; // set poll timeout (24 bits, in milliseconds) to small value for periodical poll
+		response[1] = _dfudf_funcd.func_alt ? CONF_USB_DFUD_QSPI_POLL_TIMEOUT : CONF_USB_DFUD_POLL_TIMEOUT; // set poll timeout (24 bits, in milliseconds) to small value for periodical poll
 		response[2] = 0; // set poll timeout (24 bits, in milliseconds) to small value for periodical poll
 		response[3] = 0; // set poll timeout (24 bits, in milliseconds) to small value for periodical poll
 		response[4] = dfu_state; // set state
@@ -171,7 +230,14 @@ static int32_t dfudf_in_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stage
 			dfu_state = USB_DFU_STATE_DFU_DNBUSY; // switch to busy state
 		} else if (USB_DFU_STATE_DFU_MANIFEST_SYNC == dfu_state) {
 			if (!dfu_manifestation_complete) {
-				dfu_state = USB_DFU_STATE_DFU_MANIFEST; // go to manifest mode
+				const struct usb_dfu_job job = {.type = USB_DFU_JOB_MANIFEST, .alt = _dfudf_funcd.func_alt};
+				if (ERR_NONE == spsc_queue_put(&dfu_jobs, &job)) {
+					dfu_state = USB_DFU_STATE_DFU_MANIFEST; // go to manifest mode
+					dfudf_post_events(USB_DFU_EVENT_MANIFEST); // let the main application finish flashing
+				} else { // this should not happen since the main application processes the jobs before going to idle states
+					dfu_status = USB_DFU_STATUS_ERR_UNKNOWN;
+					dfu_state = USB_DFU_STATE_DFU_ERROR;
+				}
 			} else if (usb_dfu_func_desc->bmAttributes & USB_DFU_ATTRIBUTES_MANIFEST_TOLERANT) {
 				dfu_state = USB_DFU_STATE_DFU_IDLE; // go back to idle mode
 			} else { // this should not happen (after manifestation the state should be dfuMANIFEST-WAIT-RESET if we are not manifest tolerant)
@@ -215,7 +281,6 @@ static int32_t dfudf_out_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stag
 		to_return = usbdc_xfer(ep, NULL, 0, false); // send ACK
 		break;
 	case USB_DFU_ABORT: // abort current operation
-		dfu_download_offset = 0; // reset download progress
 		dfu_state = USB_DFU_STATE_DFU_IDLE; // put back in idle state (nothing else to do)
 		to_return = usbdc_xfer(ep, NULL, 0, false); // send ACK
 		break;
@@ -245,12 +310,42 @@ static int32_t dfudf_out_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stag
 		} else { // there is data to be flash
 			if (USB_SETUP_STAGE == stage) { // there will be data to be flash
 				to_return = usbdc_xfer(ep, dfu_download_data, req->wLength, false); // send ack to the setup request to get the data
+#if CONF_USB_DFUD_DFUSE_EN
+			} else if (req->wValue < USB_DFUSE_FIRST_BLOCK) { // DfuSe command (wValue 1 is reserved)
+				dfuse_command_length = req->wValue ? 0 : req->wLength;
+				if (dfuse_command_length) {
+					dfu_state = USB_DFU_STATE_DFU_DNLOAD_SYNC; // the command is run once the host polls the status
+				} else {
+					dfu_status = USB_DFU_STATUS_ERR_STALLEDPKT;
+					dfu_state = USB_DFU_STATE_DFU_ERROR;
+				}
+				to_return = usbdc_xfer(ep, NULL, 0, false); // ACK the command, the host gets its outcome with the status
+#endif
 			} else { // now there is data to be flashed
-				dfu_download_offset = req->wValue * sizeof(dfu_download_data); // remember which block to flash
-				dfu_download_length = req->wLength; // remember the data size to be flash
-				dfu_state = USB_DFU_STATE_DFU_DNLOAD_SYNC; // go to sync state
-				to_return = usbdc_xfer(ep, NULL, 0, false); // ACK the data
+				const struct usb_dfu_job job = {
+				    .type = USB_DFU_JOB_DOWNLOAD,
+				    .alt = _dfudf_funcd.func_alt,
+				    .data = dfu_download_data,
+#if CONF_USB_DFUD_DFUSE_EN
+				    .offset = dfu_address_pointer + (req->wValue - USB_DFUSE_FIRST_BLOCK) * sizeof(dfu_download_data), // where to flash the block
+#else
+				    .offset = req->wValue * sizeof(dfu_download_data), // which block to flash
+#endif
+				    .length = req->wLength,
+				};
+#if CONF_USB_DFUD_DFUSE_EN
+				dfuse_command_length = 0; // a command aborted before the status poll is dropped
+#endif
 				// we let the main application flash the data because this can be long and would stall the USB ISR
+				if (ERR_NONE == spsc_queue_put(&dfu_jobs, &job)) {
+					dfu_state = USB_DFU_STATE_DFU_DNLOAD_SYNC; // go to sync state
+					dfudf_post_events(USB_DFU_EVENT_DOWNLOAD); // wake up the main application to flash the data
+					to_return = usbdc_xfer(ep, NULL, 0, false); // ACK the data
+				} else { // this should not happen since the host waits for the data to be flashed before sending more
+					dfu_status = USB_DFU_STATUS_ERR_UNKNOWN;
+					dfu_state = USB_DFU_STATE_DFU_ERROR;
+					to_return = ERR_NO_RESOURCE; // stall control pipe to indicate error
+				}
 			}
 		}
 		break;
@@ -263,6 +358,71 @@ static int32_t dfudf_out_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stag
 	return to_return;
 }
 
+#if CONF_USB_DFUD_RESUME_EN
+/**
+ * \brief Process the vendor requests for resumable downloads
+ *
+ * Errors only stall the request: the DFU state is not affected, so that hosts can probe for this extension.
+ * \param[in] ep Endpoint address.
+ * \param[in] req Pointer to the request.
+ * \param[in] stage Stage of the request.
+ * \return Operation status.
+ */
+static int32_t dfudf_vendor_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stage stage)
+{
+	static usb_dfu_image_id_t image_id; // received identity, until the data stage completed
+
+	switch (req->bRequest) {
+	case USB_REQ_DFU_GET_RESUME:
+		if (!(req->bmRequestType & USB_EP_DIR_IN)) {
+			return ERR_INVALID_ARG;
+		}
+		if (USB_DATA_STAGE == stage) {
+			return ERR_NONE;
+		}
+		dfu_resume_info.bPending = dfu_image_id_pending;
+#if CONF_USB_DFUD_BLOCK_CRC_EN
+		dfu_resume_info.bPending |= dfu_block_crcs_pending;
+#endif
+		return usbdc_xfer(ep, (uint8_t *)&dfu_resume_info, min(req->wLength, sizeof(dfu_resume_info)), false);
+	case USB_REQ_DFU_SET_IMAGE:
+		if ((req->bmRequestType & USB_EP_DIR_IN) || sizeof(image_id) != req->wLength
+		    || USB_DFU_STATE_DFU_IDLE != dfu_state) { // the image can't change during a download
+			return ERR_INVALID_ARG;
+		}
+		if (USB_SETUP_STAGE == stage) {
+			if (dfu_image_id_pending) { // the main application did not process the previous identity yet
+				return ERR_INVALID_ARG;
+			}
+			return usbdc_xfer(ep, (uint8_t *)&image_id, sizeof(image_id), false); // get the data
+		}
+		dfu_image_id = image_id;
+		dfu_image_id_pending = true; // the main application processes it before the next download request
+		dfudf_post_events(USB_DFU_EVENT_REQUEST);
+		return usbdc_xfer(ep, NULL, 0, false); // ACK the data
+#if CONF_USB_DFUD_BLOCK_CRC_EN
+	case USB_REQ_DFU_SET_BLOCK_CRCS:
+		if ((req->bmRequestType & USB_EP_DIR_IN) || 0 == req->wLength || req->wLength > sizeof(dfu_block_crcs)
+		    || 0 != req->wLength % sizeof(le32_t) || USB_DFU_STATE_DFU_IDLE != dfu_state) {
+			return ERR_INVALID_ARG;
+		}
+		if (USB_SETUP_STAGE == stage) {
+			if (dfu_block_crcs_pending) { // the main application is still checking the previous CRCs
+				return ERR_INVALID_ARG;
+			}
+			return usbdc_xfer(ep, (uint8_t *)dfu_block_crcs, req->wLength, false); // get the data
+		}
+		dfu_block_crcs_count = req->wLength / sizeof(le32_t);
+		dfu_block_crcs_pending = true; // the main application checks the flash before the next download request
+		dfudf_post_events(USB_DFU_EVENT_REQUEST);
+		return usbdc_xfer(ep, NULL, 0, false); // ACK the data
+#endif
+	default:
+		return ERR_INVALID_ARG;
+	}
+}
+#endif
+
 /**
  * \brief Process the CDC class request
  * \param[in] ep Endpoint address.
@@ -272,6 +432,12 @@ static int32_t dfudf_out_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stag
  */
 static int32_t dfudf_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stage stage)
 {
+#if CONF_USB_DFUD_RESUME_EN
+	if (0x02 == ((req->bmRequestType >> 5) & 0x03) && req->wIndex == _dfudf_funcd.func_iface
+	    && 0 == _dfudf_funcd.func_alt) { // vendor request to the DFU interface, for the internal flash
+		return dfudf_vendor_req(ep, req, stage);
+	}
+#endif
 	if (0x01 != ((req->bmRequestType >> 5) & 0x03)) { // class request
 		return ERR_NOT_FOUND;
 	}
@@ -300,6 +466,8 @@ int32_t dfudf_init(void)
 		return ERR_DENIED;
 	}
 
+	spsc_queue_init(&dfu_jobs, dfu_jobs_buf, sizeof(dfu_jobs_buf[0]), ARRAY_SIZE(dfu_jobs_buf));
+
 	_dfudf.ctrl      = dfudf_ctrl;
 	_dfudf.func_data = &_dfudf_funcd;
 
@@ -323,3 +491,27 @@ bool dfudf_is_enabled(void)
 {
 	return _dfudf_funcd.enabled;
 }
+
+/**
+ * \brief Post events for the main application
+ */
+void dfudf_post_events(uint32_t events)
+{
+	CRITICAL_SECTION_ENTER(); // the interrupts might not all have the same priority
+	dfu_events |= events;
+	CRITICAL_SECTION_LEAVE();
+}
+
+/**
+ * \brief Take the events posted so far
+ */
+uint32_t dfudf_take_events(void)
+{
+	uint32_t events;
+
+	CRITICAL_SECTION_ENTER();
+	events = dfu_events;
+	dfu_events = 0;
+	CRITICAL_SECTION_LEAVE();
+	return events;
+}
@@ -34,26 +34,80 @@
 #ifndef USBDF_DFU_H_
 #define USBDF_DFU_H_
 
+#include <utils_spsc.h>
 #include "usbdc.h"
 #include "usb_protocol_dfu.h"
 
-/** Current DFU state */
-extern enum usb_dfu_state dfu_state;
+/** Current DFU state (changed by the USB interrupt and the main application) */
+extern volatile enum usb_dfu_state dfu_state;
 /**< Current DFU status */
-extern enum usb_dfu_status dfu_status;
+extern volatile enum usb_dfu_status dfu_status;
+
+/** \name Events waking up the main application
+ *
+ *  Posted from interrupts in dfu_events, so that the main application only sleeps when it has nothing to do.
+ *  The states remain what the main application acts on: the events only tell it to look at them again.
+ */
+//@{
+#define USB_DFU_EVENT_DOWNLOAD (1u << 0) //!< downloaded data is ready to be flashed (dfuDNLOAD-SYNC), or a DfuSe command to be run (dfuDNBUSY)
+#define USB_DFU_EVENT_MANIFEST (1u << 1) //!< manifestation can start (dfuMANIFEST)
+#define USB_DFU_EVENT_REQUEST (1u << 2) //!< a vendor request has to be processed (resumable downloads)
+#define USB_DFU_EVENT_FLASH (1u << 3) //!< the flash controller completed an operation (posted by the main application)
+#define USB_DFU_EVENT_MSC (1u << 4) //!< the UF2 mass storage interface has blocks to transfer or process (posted by the main application)
+#define USB_DFU_EVENT_ENABLED (1u << 5) //!< the host configured the device, enabling the DFU function
+//@}
+/** Events posted since the main application last took them (see dfudf_take_events) */
+extern volatile uint32_t dfu_events;
 
 /** Downloaded data to be programmed in flash
  *
  *  512 is the flash page size of the SAM D5x/E5x
  */
 extern uint8_t dfu_download_data[512];
-/** Length of downloaded data in bytes */
-extern uint16_t dfu_download_length;
-/** Offset of where the downloaded data should be flashed in bytes */
-extern size_t dfu_download_offset;
+
+/** Work handed over by the USB interrupt to the main application */
+enum usb_dfu_job_type {
+	USB_DFU_JOB_DOWNLOAD, //!< program downloaded data, then leave dfuDNLOAD-SYNC/dfuDNBUSY
+	USB_DFU_JOB_MANIFEST, //!< finish flashing and check the image, then leave dfuMANIFEST
+	USB_DFU_JOB_COMMAND, //!< run the DfuSe command in data (CONF_USB_DFUD_DFUSE_EN), then leave dfuDNBUSY
+};
+
+/** Job descriptor, passed through dfu_jobs */
+struct usb_dfu_job {
+	enum usb_dfu_job_type type;
+	uint8_t alt; /**< Alternate setting of the DFU interface: 0 for the internal flash, 1 for the QSPI flash (CONF_QSPI_ENABLE) */
+	uint8_t *data; /**< Downloaded data (dfu_download_data), not overwritten before the state leaves dfuDNBUSY */
+	uint32_t offset; /**< Offset of where the downloaded data should be flashed in bytes (its address with CONF_USB_DFUD_DFUSE_EN) */
+	uint16_t length; /**< Length of downloaded data in bytes */
+};
+
+/** Jobs from the USB interrupt (producer) to the main application (consumer) */
+extern struct spsc_queue dfu_jobs;
 /** If manifestation (firmware flash and check) is complete */
 extern bool dfu_manifestation_complete;
 
+#if CONF_USB_DFUD_DFUSE_EN
+/** Address of the data block downloaded with wValue USB_DFUSE_FIRST_BLOCK (set by the main application running USB_DFUSE_CMD_SET_ADDRESS) */
+extern volatile uint32_t dfu_address_pointer;
+#endif
+
+#if CONF_USB_DFUD_RESUME_EN
+/** Progress of the download, reported to the host (maintained by the main application) */
+extern usb_dfu_resume_info_t dfu_resume_info;
+/** Identity of the image the host is about to download */
+extern usb_dfu_image_id_t dfu_image_id;
+/** If the host identified the image since the main application last processed dfu_image_id */
+extern volatile bool dfu_image_id_pending;
+#if CONF_USB_DFUD_BLOCK_CRC_EN
+/** CRC-32 of the blocks of the image given by the host, one for each block of usb_dfu_resume_info_t.bmBlocks */
+extern le32_t dfu_block_crcs[128];
+/** Number of blocks in dfu_block_crcs */
+extern uint16_t dfu_block_crcs_count;
+/** If the host gave the block CRCs since the main application last processed dfu_block_crcs */
+extern volatile bool dfu_block_crcs_pending;
+#endif
+#endif
+
 /**
  * \brief Initialize the USB DFU Function Driver
  * \return Operation status.
@@ -74,4 +128,16 @@ void dfudf_deinit(void);
  */
 bool dfudf_is_enabled(void);
 
+/**
+ * \brief Post events for the main application, from an interrupt or not
+ * \param[in] events USB_DFU_EVENT_* bits
+ */
+void dfudf_post_events(uint32_t events);
+
+/**
+ * \brief Take the events posted so far, clearing them
+ * \return USB_DFU_EVENT_* bits
+ */
+uint32_t dfudf_take_events(void);
+
 #endif /* USBDF_DFU_H_ */
@@ -78,7 +78,41 @@
 #define DFUD_IFACE_DESCB USB_DFU_FUNC_DESC_BYTES(USB_DFU_ATTRIBUTES_CAN_DOWNLOAD | USB_DFU_ATTRIBUTES_WILL_DETACH, \
 	                     	                     0, /**< detaching makes only sense in run-time mode */ \
 	                     	                     512, /**< transfer size corresponds to page size for optimal flash writing */ \
-	                     	                     0x0110 /**< DFU specification version 1.1 used */ )
+	                     	                     (CONF_USB_DFUD_DFUSE_EN ? USB_DFUSE_VERSION : 0x0110) /**< DFU specification version 1.1 used, with the DfuSe commands if enabled */ )
+
+#if CONF_QSPI_ENABLE
+/** Second alternate setting, for the QSPI flash */
+#define DFUD_QSPI_IFACE_DESCES \
+	, USB_IFACE_DESC_BYTES(CONF_USB_DFUD_BIFCNUM, \
+	                       CONF_USB_DFUD_BALTSET + 1, \
+	                       CONF_USB_DFUD_BNUMEP, \
+	                       USB_DFU_CLASS, \
+	                       USB_DFU_SUBCLASS, \
+	                       USB_DFU_PROTOCOL_DFU, \
+	                       CONF_USB_DFUD_QSPI_IINTERFACE), \
+	                       DFUD_IFACE_DESCB
+#define DFUD_QSPI_STR_DESCES CONF_USB_DFUD_QSPI_IINTERFACE_STR_DESC
+#else
+#define DFUD_QSPI_IFACE_DESCES
+#define DFUD_QSPI_STR_DESCES
+#endif
+
+#if CONF_USB_MSCD_UF2_EN
+#include "usb_protocol_msc.h"
+/** Second interface, for the UF2 mass storage */
+#define DFUD_MSC_IFACE_DESCES \
+	, USB_IFACE_DESC_BYTES(CONF_USB_MSCD_BIFCNUM, \
+	                       0, \
+	                       2, \
+	                       USB_MSC_CLASS, \
+	                       USB_MSC_SUBCLASS_SCSI, \
+	                       USB_MSC_PROTOCOL_BULK, \
+	                       0), \
+	  USB_ENDP_DESC_BYTES(CONF_USB_MSCD_BULKIN_EPADDR, USB_EP_TYPE_BULK, CONF_USB_MSCD_BULKIN_MAXPKSZ, 0), \
+	  USB_ENDP_DESC_BYTES(CONF_USB_MSCD_BULKOUT_EPADDR, USB_EP_TYPE_BULK, CONF_USB_MSCD_BULKOUT_MAXPKSZ, 0)
+#else
+#define DFUD_MSC_IFACE_DESCES
+#endif
 
 #define DFUD_IFACE_DESCES \
 	USB_IFACE_DESC_BYTES(CONF_USB_DFUD_BIFCNUM, \
@@ -88,7 +122,9 @@
 	                     USB_DFU_SUBCLASS, \
 	                     USB_DFU_PROTOCOL_DFU, \
 	                     CONF_USB_DFUD_IINTERFACE), \
-	                     DFUD_IFACE_DESCB
+	                     DFUD_IFACE_DESCB \
+	                     DFUD_QSPI_IFACE_DESCES \
+	                     DFUD_MSC_IFACE_DESCES
 
 #define DFUD_STR_DESCES \
 	CONF_USB_DFUD_LANGID_DESC \
@@ -96,7 +132,8 @@
 	CONF_USB_DFUD_IPRODUCT_STR_DESC \
 	CONF_USB_DFUD_ISERIALNUM_STR_DESC \
 	CONF_USB_DFUD_ICONFIG_STR_DESC \
-	CONF_USB_DFUD_IINTERFACE_STR_DESC
+	CONF_USB_DFUD_IINTERFACE_STR_DESC \
+	DFUD_QSPI_STR_DESCES
 
 /** USB Device descriptors and configuration descriptors */
 #define DFUD_DESCES_LS_FS \
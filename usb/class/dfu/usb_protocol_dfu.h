@@ -68,6 +68,25 @@
 #define USB_REQ_DFU_ABORT 0x06
 //@}
 
+//! \name DfuSe commands (ST AN3156), sent in a DNLOAD request with wValue 0 (CONF_USB_DFUD_DFUSE_EN)
+//@{
+#define USB_DFUSE_CMD_GET_COMMANDS 0x00 //!< read with an UPLOAD request with wValue 0: the supported commands
+#define USB_DFUSE_CMD_SET_ADDRESS 0x21 //!< followed by the 32-bit little-endian address of the data blocks, downloaded with wValue 2 and up
+#define USB_DFUSE_CMD_ERASE 0x41 //!< followed by the 32-bit little-endian address of the page to erase, alone for a mass erase
+#define USB_DFUSE_CMD_READ_UNPROTECT 0x92 //!< not supported: the flash is never read protected by the bootloader
+//@}
+//! bcdDFUVersion of devices supporting the DfuSe commands
+#define USB_DFUSE_VERSION 0x011A
+//! wValue of the first data block following the address set by USB_DFUSE_CMD_SET_ADDRESS
+#define USB_DFUSE_FIRST_BLOCK 2
+
+//! \name osmo-ASF4-DFU vendor request IDs (to the DFU interface, for resumable downloads)
+//@{
+#define USB_REQ_DFU_GET_RESUME 0x40 //!< IN: blocks programmed for the image last identified (usb_dfu_resume_info_t)
+#define USB_REQ_DFU_SET_IMAGE 0x41 //!< OUT, in dfuIDLE: identity of the image about to be downloaded (usb_dfu_image_id_t)
+#define USB_REQ_DFU_SET_BLOCK_CRCS 0x42 //!< OUT, in dfuIDLE after USB_REQ_DFU_SET_IMAGE: CRC-32 of every wBlockSize block of the image (le32_t each)
+//@}
+
 /*
  * Need to pack structures tightly, or the compiler might insert padding
  * and violate the spec-mandated layout.
@@ -97,6 +116,45 @@ typedef struct usb_dfu_func_desc {
 	LE_BYTE0(wTransferSize), LE_BYTE1(wTransferSize), \
 	LE_BYTE0(bcdDFUVersion), LE_BYTE1(bcdDFUVersion)
 
+//@}
+
+//! \name osmo-ASF4-DFU vendor request data
+//@{
+
+//! Identity of a downloaded image (USB_REQ_DFU_SET_IMAGE)
+typedef struct usb_dfu_image_id {
+	le32_t dwImageSize; /**< Size of the image, in bytes */
+	le32_t dwImageCrc; /**< CRC-32 (IEEE 802.3) of the image */
+} usb_dfu_image_id_t;
+
+//! Progress of the download of an image (USB_REQ_DFU_GET_RESUME)
+typedef struct usb_dfu_resume_info {
+	usb_dfu_image_id_t image; /**< Image the blocks belong to (all zero if none) */
+	le16_t  wBlockSize; /**< Size of the blocks, in bytes */
+	uint8_t bmBlocks[16]; /**< Blocks programmed and verified, block n (at offset n * wBlockSize of the image) being bit n % 8 of byte n / 8 */
+	uint8_t bPending; /**< 1 while the last identity or block CRCs have not been processed, the other fields not being up to date yet */
+} usb_dfu_resume_info_t;
+
+//! Magic of the header of an encrypted image ("ODFE")
+#define USB_DFU_ENCRYPTED_MAGIC 0x4546444F
+//! Version of the header of an encrypted image
+#define USB_DFU_ENCRYPTED_VERSION 1
+//! Modes of an encrypted image
+#define USB_DFU_ENCRYPTED_CTR 0 //!< AES-CTR, counter blocks bIV || 32-bit big-endian block number from 0
+#define USB_DFU_ENCRYPTED_GCM 1 //!< AES-GCM, authenticating the header up to bTag as additional data
+
+//! Header of an encrypted image (CONF_AES_ENABLE), alone in the first wTransferSize transfer of the download, padded with zeros
+typedef struct usb_dfu_encrypted_header {
+	le32_t  dwMagic; /**< USB_DFU_ENCRYPTED_MAGIC */
+	uint8_t bVersion; /**< USB_DFU_ENCRYPTED_VERSION */
+	uint8_t bMode; /**< USB_DFU_ENCRYPTED_CTR or USB_DFU_ENCRYPTED_GCM */
+	le16_t  wReserved; /**< 0 */
+	le32_t  dwLength; /**< Length of the encrypted payload, following the header transfer */
+	le32_t  dwReserved; /**< 0 */
+	uint8_t bIV[16]; /**< 12-byte nonce (CTR) or IV (GCM), followed by zeros */
+	uint8_t bTag[16]; /**< GCM tag of the payload, zero for CTR */
+} usb_dfu_encrypted_header_t;
+
 COMPILER_PACK_RESET()
 
 //! @}
@@ -0,0 +1,605 @@
+/**
+ * \file
+ *
+ * \brief USB Device Stack MSC Function Implementation.
+ *
+ * Bulk-Only Transport with the SCSI commands used by the mass storage drivers of the usual hosts.
+ * A single logical unit is served: the application provides the disk through callbacks.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <hal_atomic.h>
+#include "mscdf.h"
+
+/** Stage of the Bulk-Only Transport */
+enum mscdf_stage {
+	MSCDF_STAGE_CBW, /**< waiting for a command */
+	MSCDF_STAGE_DATA, /**< sending the data of a command (from mscdf_data) */
+	MSCDF_STAGE_BLOCKS, /**< transferring the blocks of a READ(10) or WRITE(10) command, driven by the application */
+	MSCDF_STAGE_HALTED, /**< the status is sent once the host cleared the halted Bulk-In endpoint */
+	MSCDF_STAGE_STATUS, /**< sending the status */
+	MSCDF_STAGE_ERROR, /**< invalid command: waiting for the reset recovery */
+};
+
+/** USB Device MSC Function Specific Data */
+struct mscdf_func_data {
+	/** MSC Interface information */
+	uint8_t func_iface;
+	/** Bulk-In and Bulk-Out endpoints */
+	uint8_t func_ep_in;
+	uint8_t func_ep_out;
+	/** MSC Enable Flag */
+	bool enabled;
+};
+
+static struct usbdf_driver _mscdf;
+static struct mscdf_func_data _mscdf_funcd;
+
+/** Application callbacks */
+static mscdf_inquiry_disk_t mscdf_inquiry_disk;
+static mscdf_get_disk_capacity_t mscdf_get_disk_capacity;
+static mscdf_test_disk_ready_t mscdf_test_disk_ready;
+static mscdf_read_disk_t mscdf_read_disk;
+static mscdf_write_disk_t mscdf_write_disk;
+static mscdf_xfer_blocks_done_t mscdf_xfer_blocks_done;
+static mscdf_status_sent_t mscdf_status_sent;
+
+/** Transfer buffers: the Bulk-In endpoint has no cache, so the data must be word aligned in RAM */
+static COMPILER_ALIGNED(4) usb_msc_cbw_t mscdf_cbw;
+static COMPILER_ALIGNED(4) usb_msc_csw_t mscdf_csw;
+static COMPILER_ALIGNED(4) uint8_t mscdf_data[36];
+
+static volatile enum mscdf_stage mscdf_stage;
+/** Data of the command expected by the host and not transferred yet */
+static uint32_t mscdf_residue;
+/** Block data of the READ(10) or WRITE(10) command not transferred yet, and its direction */
+static uint32_t mscdf_blocks_length;
+static bool mscdf_blocks_in;
+/** Sense data of the last command, reported by REQUEST SENSE */
+static uint8_t mscdf_sense_key;
+static uint16_t mscdf_sense_asc;
+
+/**
+ * \brief Read a big-endian integer of the command block
+ * \param[in] ptr First byte
+ * \param[in] length Size of the integer, in bytes
+ */
+static uint32_t mscdf_get_be(const uint8_t *ptr, uint8_t length)
+{
+	uint32_t value = 0;
+
+	while (length--) {
+		value = (value << 8) | *ptr++;
+	}
+	return value;
+}
+
+/**
+ * \brief Wait for the next command
+ */
+static void mscdf_read_cbw(void)
+{
+	mscdf_stage = MSCDF_STAGE_CBW;
+	// fails while the host has not cleared the halt of the endpoint yet, which then reads the command
+	usbdc_xfer(_mscdf_funcd.func_ep_out, (uint8_t *)&mscdf_cbw, USB_MSC_CBW_LEN, false);
+}
+
+/**
+ * \brief Send the status of the command
+ * \param[in] status USB_MSC_CSW_PASSED, USB_MSC_CSW_FAILED or USB_MSC_CSW_PHASE_ERROR
+ */
+static void mscdf_send_csw(uint8_t status)
+{
+	mscdf_csw.dCSWSignature = USB_MSC_CSW_SIGNATURE;
+	mscdf_csw.dCSWTag = mscdf_cbw.dCBWTag;
+	mscdf_csw.dCSWDataResidue = mscdf_residue;
+	mscdf_csw.bCSWStatus = status;
+	mscdf_stage = MSCDF_STAGE_STATUS;
+	usbdc_xfer(_mscdf_funcd.func_ep_in, (uint8_t *)&mscdf_csw, USB_MSC_CSW_LEN, false);
+}
+
+/**
+ * \brief End the command, ending the data stage expected by the host first
+ * \param[in] status USB_MSC_CSW_PASSED, USB_MSC_CSW_FAILED or USB_MSC_CSW_PHASE_ERROR
+ * \param[in] short_packet The data sent ended with a short packet, which ended the data stage for the host
+ */
+static void mscdf_end(uint8_t status, bool short_packet)
+{
+	if (USB_MSC_CSW_PASSED == status) {
+		mscdf_sense_key = SCSI_SENSE_NO_SENSE;
+		mscdf_sense_asc = SCSI_ASC_NONE;
+	}
+	if (0 == mscdf_residue || short_packet) {
+		mscdf_send_csw(status);
+	} else if (mscdf_cbw.bmCBWFlags & USB_MSC_CBW_DIR_IN) { // the host still waits for data
+		mscdf_csw.bCSWStatus = status;
+		mscdf_stage = MSCDF_STAGE_HALTED;
+		usb_d_ep_halt(_mscdf_funcd.func_ep_in, USB_EP_HALT_SET); // the status is sent once the host cleared the halt
+	} else { // the host still has data to send
+		usb_d_ep_halt(_mscdf_funcd.func_ep_out, USB_EP_HALT_SET);
+		mscdf_send_csw(status);
+	}
+}
+
+/**
+ * \brief Fail the command
+ * \param[in] sense_key SCSI sense key
+ * \param[in] asc SCSI additional sense code and qualifier
+ */
+static void mscdf_fail(uint8_t sense_key, uint16_t asc)
+{
+	mscdf_sense_key = sense_key;
+	mscdf_sense_asc = asc;
+	mscdf_end(USB_MSC_CSW_FAILED, false);
+}
+
+/**
+ * \brief Send the data of the command, then its status
+ * \param[in] data Data, copied
+ * \param[in] length Length of the data, truncated to what the host expects
+ */
+static void mscdf_send_data(const uint8_t *data, uint32_t length)
+{
+	if (mscdf_residue && !(mscdf_cbw.bmCBWFlags & USB_MSC_CBW_DIR_IN)) { // the host sends data instead
+		mscdf_end(USB_MSC_CSW_PHASE_ERROR, false);
+		return;
+	}
+	length = min(length, min(mscdf_residue, sizeof(mscdf_data)));
+	if (0 == length) {
+		mscdf_end(USB_MSC_CSW_PASSED, false);
+		return;
+	}
+	memcpy(mscdf_data, data, length);
+	mscdf_stage = MSCDF_STAGE_DATA;
+	usbdc_xfer(_mscdf_funcd.func_ep_in, mscdf_data, length, false);
+}
+
+/**
+ * \brief Start a READ(10) or WRITE(10) command
+ * \param[in] in true for READ(10)
+ */
+static void mscdf_start_blocks(bool in)
+{
+	const uint32_t addr = mscdf_get_be(&mscdf_cbw.CBWCB[2], 4);
+	const uint32_t nblocks = mscdf_get_be(&mscdf_cbw.CBWCB[7], 2);
+	const bool host_in = (mscdf_cbw.bmCBWFlags & USB_MSC_CBW_DIR_IN) != 0;
+	int32_t rc;
+
+	if (0 == nblocks) {
+		mscdf_end(USB_MSC_CSW_PASSED, false);
+		return;
+	}
+	if (nblocks * MSCDF_BLOCK_SIZE > mscdf_residue || in != host_in) { // the host does not expect this data
+		mscdf_end(USB_MSC_CSW_PHASE_ERROR, false);
+		return;
+	}
+	if (in) {
+		rc = mscdf_read_disk ? mscdf_read_disk(0, addr, nblocks) : ERR_UNSUPPORTED_OP;
+	} else {
+		rc = mscdf_write_disk ? mscdf_write_disk(0, addr, nblocks) : ERR_UNSUPPORTED_OP;
+	}
+	if (ERR_NONE != rc) {
+		mscdf_fail(ERR_BAD_ADDRESS == rc ? SCSI_SENSE_ILLEGAL_REQUEST : SCSI_SENSE_NOT_READY,
+		           ERR_BAD_ADDRESS == rc ? SCSI_ASC_LBA_OUT_OF_RANGE : SCSI_ASC_MEDIUM_NOT_PRESENT);
+		return;
+	}
+	mscdf_blocks_length = nblocks * MSCDF_BLOCK_SIZE;
+	mscdf_blocks_in = in;
+	mscdf_stage = MSCDF_STAGE_BLOCKS; // the application transfers the blocks with mscdf_xfer_blocks
+}
+
+/**
+ * \brief Process the command received
+ * \param[in] length Length of the command block wrapper
+ */
+static void mscdf_process_cbw(uint32_t length)
+{
+	uint8_t *capacity;
+	uint8_t response[18];
+
+	if (USB_MSC_CBW_LEN != length || USB_MSC_CBW_SIGNATURE != mscdf_cbw.dCBWSignature || 0 != mscdf_cbw.bCBWLUN
+	    || 0 == mscdf_cbw.bCBWCBLength || mscdf_cbw.bCBWCBLength > sizeof(mscdf_cbw.CBWCB)) { // not meaningful
+		mscdf_stage = MSCDF_STAGE_ERROR; // until the Bulk-Only Mass Storage Reset
+		usb_d_ep_halt(_mscdf_funcd.func_ep_in, USB_EP_HALT_SET);
+		usb_d_ep_halt(_mscdf_funcd.func_ep_out, USB_EP_HALT_SET);
+		return;
+	}
+	mscdf_residue = mscdf_cbw.dCBWDataTransferLength;
+
+	memset(response, 0, sizeof(response));
+	switch (mscdf_cbw.CBWCB[0]) {
+	case SCSI_TEST_UNIT_READY:
+		if (mscdf_test_disk_ready && ERR_NONE != mscdf_test_disk_ready(0)) {
+			mscdf_fail(SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+		} else {
+			mscdf_end(USB_MSC_CSW_PASSED, false);
+		}
+		break;
+	case SCSI_REQUEST_SENSE: // fixed format sense data
+		response[0] = 0x70; // current errors
+		response[2] = mscdf_sense_key;
+		response[7] = 10; // additional sense length
+		response[12] = (uint8_t)(mscdf_sense_asc >> 8);
+		response[13] = (uint8_t)mscdf_sense_asc;
+		mscdf_sense_key = SCSI_SENSE_NO_SENSE;
+		mscdf_sense_asc = SCSI_ASC_NONE;
+		mscdf_send_data(response, 18);
+		break;
+	case SCSI_INQUIRY:
+		if ((mscdf_cbw.CBWCB[1] & 0x01) || NULL == mscdf_inquiry_disk) { // vital product data pages are not supported
+			mscdf_fail(SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB);
+		} else {
+			mscdf_send_data(mscdf_inquiry_disk(0), 36);
+		}
+		break;
+	case SCSI_READ_CAPACITY10:
+	case SCSI_READ_FORMAT_CAPACITIES:
+		capacity = mscdf_get_disk_capacity ? mscdf_get_disk_capacity(0) : NULL;
+		if (NULL == capacity) {
+			mscdf_fail(SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+		} else if (SCSI_READ_CAPACITY10 == mscdf_cbw.CBWCB[0]) {
+			mscdf_send_data(capacity, 8);
+		} else { // capacity list header, then the current capacity descriptor (number of blocks, formatted media, block size)
+			uint32_t blocks = mscdf_get_be(capacity, 4) + 1;
+			response[3] = 8;
+			response[4] = (uint8_t)(blocks >> 24);
+			response[5] = (uint8_t)(blocks >> 16);
+			response[6] = (uint8_t)(blocks >> 8);
+			response[7] = (uint8_t)blocks;
+			response[8] = 0x02;
+			memcpy(&response[9], &capacity[5], 3);
+			mscdf_send_data(response, 12);
+		}
+		break;
+	case SCSI_MODE_SENSE6: // header only: no pages, not write protected
+		response[0] = 3;
+		mscdf_send_data(response, 4);
+		break;
+	case SCSI_MODE_SENSE10:
+		response[1] = 6;
+		mscdf_send_data(response, 8);
+		break;
+	case SCSI_START_STOP_UNIT:
+	case SCSI_PREVENT_ALLOW_MEDIUM_REMOVAL:
+	case SCSI_VERIFY10:
+	case SCSI_SYNCHRONIZE_CACHE10: // the written blocks are processed before their status is sent
+		mscdf_end(USB_MSC_CSW_PASSED, false);
+		break;
+	case SCSI_READ10:
+		mscdf_start_blocks(true);
+		break;
+	case SCSI_WRITE10:
+		mscdf_start_blocks(false);
+		break;
+	default:
+		mscdf_fail(SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND);
+		break;
+	}
+}
+
+/**
+ * \brief Callback of the Bulk-Out endpoint
+ * \param[in] ep Endpoint address
+ * \param[in] code Transfer status
+ * \param[in] count Number of bytes transferred
+ */
+static bool mscdf_cb_ep_out(const uint8_t ep, const enum usb_xfer_code code, uint32_t count)
+{
+	(void)ep;
+	if (USB_XFER_UNHALT == code) {
+		if (MSCDF_STAGE_CBW == mscdf_stage) { // the command could not be read while halted
+			mscdf_read_cbw();
+		}
+	} else if (USB_XFER_DONE == code) {
+		if (MSCDF_STAGE_CBW == mscdf_stage) {
+			mscdf_process_cbw(count);
+		} else if (MSCDF_STAGE_BLOCKS == mscdf_stage && !mscdf_blocks_in) {
+			mscdf_residue -= count;
+			mscdf_blocks_length -= count;
+			if (mscdf_xfer_blocks_done) {
+				mscdf_xfer_blocks_done(0);
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * \brief Callback of the Bulk-In endpoint
+ * \param[in] ep Endpoint address
+ * \param[in] code Transfer status
+ * \param[in] count Number of bytes transferred
+ */
+static bool mscdf_cb_ep_in(const uint8_t ep, const enum usb_xfer_code code, uint32_t count)
+{
+	(void)ep;
+	if (USB_XFER_UNHALT == code) {
+		if (MSCDF_STAGE_HALTED == mscdf_stage) {
+			mscdf_send_csw(mscdf_csw.bCSWStatus);
+		}
+	} else if (USB_XFER_DONE == code) {
+		if (MSCDF_STAGE_DATA == mscdf_stage) {
+			mscdf_residue -= count;
+			mscdf_end(USB_MSC_CSW_PASSED, 0 != count % CONF_USB_MSCD_BULKIN_MAXPKSZ);
+		} else if (MSCDF_STAGE_BLOCKS == mscdf_stage && mscdf_blocks_in) {
+			mscdf_residue -= count;
+			mscdf_blocks_length -= count;
+			if (mscdf_xfer_blocks_done) {
+				mscdf_xfer_blocks_done(0);
+			}
+		} else if (MSCDF_STAGE_STATUS == mscdf_stage) {
+			mscdf_read_cbw();
+			if (mscdf_status_sent) {
+				mscdf_status_sent(0);
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * \brief Enable MSC Function
+ * \param[in] drv Pointer to USB device function driver
+ * \param[in] desc Pointer to USB interface descriptor
+ * \return Operation status.
+ */
+static int32_t mscdf_enable(struct usbdf_driver *drv, struct usbd_descriptors *desc)
+{
+	struct mscdf_func_data *func_data = (struct mscdf_func_data *)(drv->func_data);
+	uint8_t *ifc, *ep;
+
+	ifc = desc->sod;
+	if (NULL == ifc) {
+		return ERR_NOT_FOUND;
+	}
+	if (USB_MSC_CLASS != ifc[5]) { // Not supported by this function driver
+		return ERR_NOT_FOUND;
+	}
+	if (func_data->func_iface == ifc[2]) { // Initialized
+		return ERR_ALREADY_INITIALIZED;
+	} else if (func_data->func_iface != 0xFF) { // Occupied
+		return ERR_NO_RESOURCE;
+	}
+
+	func_data->func_ep_in = 0xFF;
+	func_data->func_ep_out = 0xFF;
+	ep = usb_find_ep_desc(usb_desc_next(desc->sod), desc->eod);
+	while (NULL != ep) {
+		const uint8_t addr = ep[2];
+		if (usb_d_ep_init(addr, ep[3], usb_get_u16(ep + 4))) {
+			return ERR_NOT_INITIALIZED;
+		}
+		if (addr & USB_EP_DIR_IN) {
+			func_data->func_ep_in = addr;
+			usb_d_ep_register_callback(addr, USB_D_EP_CB_XFER, (FUNC_PTR)mscdf_cb_ep_in);
+		} else {
+			func_data->func_ep_out = addr;
+			usb_d_ep_register_callback(addr, USB_D_EP_CB_XFER, (FUNC_PTR)mscdf_cb_ep_out);
+		}
+		usb_d_ep_enable(addr);
+		desc->sod = ep;
+		ep = usb_find_ep_desc(usb_desc_next(desc->sod), desc->eod);
+	}
+	if (0xFF == func_data->func_ep_in || 0xFF == func_data->func_ep_out) {
+		return ERR_NOT_FOUND;
+	}
+	func_data->func_iface = ifc[2];
+
+	// Installed
+	_mscdf_funcd.enabled = true;
+	mscdf_read_cbw();
+	return ERR_NONE;
+}
+
+/**
+ * \brief Disable MSC Function
+ * \param[in] drv Pointer to USB device function driver
+ * \param[in] desc Pointer to USB device descriptor
+ * \return Operation status.
+ */
+static int32_t mscdf_disable(struct usbdf_driver *drv, struct usbd_descriptors *desc)
+{
+	struct mscdf_func_data *func_data = (struct mscdf_func_data *)(drv->func_data);
+
+	if (desc && USB_MSC_CLASS != desc->sod[5]) {
+		return ERR_NOT_FOUND;
+	}
+
+	if (func_data->func_iface != 0xFF) {
+		func_data->func_iface = 0xFF;
+		usb_d_ep_deinit(func_data->func_ep_in);
+		usb_d_ep_deinit(func_data->func_ep_out);
+	}
+
+	_mscdf_funcd.enabled = false;
+	return ERR_NONE;
+}
+
+/**
+ * \brief MSC Control Function
+ * \param[in] drv Pointer to USB device function driver
+ * \param[in] ctrl USB device general function control type
+ * \param[in] param Parameter pointer
+ * \return Operation status.
+ */
+static int32_t mscdf_ctrl(struct usbdf_driver *drv, enum usbdf_control ctrl, void *param)
+{
+	switch (ctrl) {
+	case USBDF_ENABLE:
+		return mscdf_enable(drv, (struct usbd_descriptors *)param);
+
+	case USBDF_DISABLE:
+		return mscdf_disable(drv, (struct usbd_descriptors *)param);
+
+	case USBDF_GET_IFACE:
+		if (((struct usb_req *)param)->wIndex != _mscdf_funcd.func_iface) {
+			return ERR_NOT_FOUND;
+		}
+		return 0;
+
+	default:
+		return ERR_INVALID_ARG;
+	}
+}
+
+/**
+ * \brief Process the MSC class request
+ * \param[in] ep Endpoint address.
+ * \param[in] req Pointer to the request.
+ * \param[in] stage Stage of the request.
+ * \return Operation status.
+ */
+static int32_t mscdf_req(uint8_t ep, struct usb_req *req, enum usb_ctrl_stage stage)
+{
+	static uint8_t max_lun = 0;
+
+	if (0x01 != ((req->bmRequestType >> 5) & 0x03) || req->wIndex != _mscdf_funcd.func_iface) { // class request to the MSC interface
+		return ERR_NOT_FOUND;
+	}
+	if (USB_DATA_STAGE == stage) { // the data stage is only for IN data, which we sent
+		return ERR_NONE;
+	}
+
+	switch (req->bRequest) {
+	case USB_REQ_MSC_GET_MAX_LUN:
+		if (!(req->bmRequestType & USB_EP_DIR_IN) || 1 != req->wLength || 0 != req->wValue) {
+			return ERR_INVALID_ARG;
+		}
+		return usbdc_xfer(ep, &max_lun, 1, false);
+	case USB_REQ_MSC_BULK_RESET: // the host then clears the halt of both endpoints
+		if ((req->bmRequestType & USB_EP_DIR_IN) || 0 != req->wLength || 0 != req->wValue) {
+			return ERR_INVALID_ARG;
+		}
+		usb_d_ep_abort(_mscdf_funcd.func_ep_in);
+		usb_d_ep_abort(_mscdf_funcd.func_ep_out);
+		mscdf_read_cbw();
+		return usbdc_xfer(ep, NULL, 0, false); // send ACK
+	default:
+		return ERR_INVALID_ARG;
+	}
+}
+
+/** USB Device MSC Handler Struct */
+static struct usbdc_handler mscdf_req_h = {NULL, (FUNC_PTR)mscdf_req};
+
+/**
+ * \brief Initialize the USB MSC Function Driver
+ */
+int32_t mscdf_init(void)
+{
+	if (usbdc_get_state() > USBD_S_POWER) {
+		return ERR_DENIED;
+	}
+
+	_mscdf.ctrl      = mscdf_ctrl;
+	_mscdf.func_data = &_mscdf_funcd;
+	_mscdf_funcd.func_iface = 0xFF;
+
+	usbdc_register_function(&_mscdf);
+	usbdc_register_handler(USBDC_HDL_REQ, &mscdf_req_h);
+
+	return ERR_NONE;
+}
+
+/**
+ * \brief De-initialize the USB MSC Function Driver
+ */
+void mscdf_deinit(void)
+{
+}
+
+/**
+ * \brief Check whether MSC Function is enabled
+ */
+bool mscdf_is_enabled(void)
+{
+	return _mscdf_funcd.enabled;
+}
+
+/**
+ * \brief Register an application callback
+ */
+int32_t mscdf_register_callback(enum mscdf_cb_type cb_type, FUNC_PTR func)
+{
+	switch (cb_type) {
+	case MSCDF_CB_INQUIRY_DISK:
+		mscdf_inquiry_disk = (mscdf_inquiry_disk_t)func;
+		break;
+	case MSCDF_CB_GET_DISK_CAPACITY:
+		mscdf_get_disk_capacity = (mscdf_get_disk_capacity_t)func;
+		break;
+	case MSCDF_CB_TEST_DISK_READY:
+		mscdf_test_disk_ready = (mscdf_test_disk_ready_t)func;
+		break;
+	case MSCDF_CB_START_READ_DISK:
+		mscdf_read_disk = (mscdf_read_disk_t)func;
+		break;
+	case MSCDF_CB_START_WRITE_DISK:
+		mscdf_write_disk = (mscdf_write_disk_t)func;
+		break;
+	case MSCDF_CB_XFER_BLOCKS_DONE:
+		mscdf_xfer_blocks_done = (mscdf_xfer_blocks_done_t)func;
+		break;
+	case MSCDF_CB_STATUS_SENT:
+		mscdf_status_sent = (mscdf_status_sent_t)func;
+		break;
+	default:
+		return ERR_INVALID_ARG;
+	}
+	return ERR_NONE;
+}
+
+/**
+ * \brief Transfer the next blocks of the READ(10) or WRITE(10) command started
+ */
+int32_t mscdf_xfer_blocks(bool rd, uint8_t *blk_buf, uint32_t blk_cnt)
+{
+	int32_t rc = ERR_DENIED;
+
+	CRITICAL_SECTION_ENTER(); // a Bulk-Only Mass Storage Reset can end the command meanwhile
+	if (MSCDF_STAGE_BLOCKS == mscdf_stage && rd == mscdf_blocks_in && blk_cnt
+	    && blk_cnt * MSCDF_BLOCK_SIZE <= mscdf_blocks_length) {
+		rc = usbdc_xfer(rd ? _mscdf_funcd.func_ep_in : _mscdf_funcd.func_ep_out, blk_buf, blk_cnt * MSCDF_BLOCK_SIZE,
+		                false);
+	}
+	CRITICAL_SECTION_LEAVE();
+	return rc;
+}
+
+/**
+ * \brief End the READ(10) or WRITE(10) command started, sending its status to the host
+ */
+int32_t mscdf_finish_blocks(int32_t status)
+{
+	int32_t rc = ERR_DENIED;
+
+	CRITICAL_SECTION_ENTER();
+	if (MSCDF_STAGE_BLOCKS == mscdf_stage) {
+		if (ERR_NONE == status && 0 == mscdf_blocks_length) {
+			mscdf_end(USB_MSC_CSW_PASSED, false);
+		} else if (ERR_BAD_ADDRESS == status) {
+			mscdf_fail(SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+		} else {
+			mscdf_fail(SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR);
+		}
+		rc = ERR_NONE;
+	}
+	CRITICAL_SECTION_LEAVE();
+	return rc;
+}
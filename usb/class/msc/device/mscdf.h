@@ -0,0 +1,99 @@
+/**
+ * \file
+ *
+ * \brief USB Device Stack MSC Function Definition.
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef USBDF_MSC_H_
+#define USBDF_MSC_H_
+
+#include "usbdc.h"
+#include "usb_protocol_msc.h"
+
+/** Size of the blocks of the disk, in bytes */
+#define MSCDF_BLOCK_SIZE 512
+
+/** Callbacks of the application, called from the USB interrupt (one logical unit, 0) */
+enum mscdf_cb_type {
+	MSCDF_CB_INQUIRY_DISK, /**< uint8_t *cb(uint8_t lun): 36 bytes of standard INQUIRY data */
+	MSCDF_CB_GET_DISK_CAPACITY, /**< uint8_t *cb(uint8_t lun): 8 bytes of READ CAPACITY(10) data (last block, block size, big-endian) */
+	MSCDF_CB_TEST_DISK_READY, /**< int32_t cb(uint8_t lun): ERR_NONE if the disk is ready */
+	MSCDF_CB_START_READ_DISK, /**< int32_t cb(uint8_t lun, uint32_t addr, uint32_t nblocks): a READ(10) command starts */
+	MSCDF_CB_START_WRITE_DISK, /**< int32_t cb(uint8_t lun, uint32_t addr, uint32_t nblocks): a WRITE(10) command starts */
+	MSCDF_CB_XFER_BLOCKS_DONE, /**< int32_t cb(uint8_t lun): the blocks given to mscdf_xfer_blocks have been transferred */
+	MSCDF_CB_STATUS_SENT, /**< void cb(uint8_t lun): the host received the status of a command */
+};
+
+/** Application callback types */
+typedef uint8_t *(*mscdf_inquiry_disk_t)(uint8_t lun);
+typedef uint8_t *(*mscdf_get_disk_capacity_t)(uint8_t lun);
+typedef int32_t (*mscdf_test_disk_ready_t)(uint8_t lun);
+typedef int32_t (*mscdf_read_disk_t)(uint8_t lun, uint32_t addr, uint32_t nblocks);
+typedef int32_t (*mscdf_write_disk_t)(uint8_t lun, uint32_t addr, uint32_t nblocks);
+typedef int32_t (*mscdf_xfer_blocks_done_t)(uint8_t lun);
+typedef void (*mscdf_status_sent_t)(uint8_t lun);
+
+/**
+ * \brief Initialize the USB MSC Function Driver
+ * \return Operation status.
+ */
+int32_t mscdf_init(void);
+
+/**
+ * \brief Deinitialize the USB MSC Function Driver
+ */
+void mscdf_deinit(void);
+
+/**
+ * \brief Check whether MSC Function is enabled
+ * \return true MSC Function is enabled
+ * \return false MSC Function is disabled
+ */
+bool mscdf_is_enabled(void);
+
+/**
+ * \brief Register an application callback
+ * \param[in] cb_type Callback type
+ * \param[in] func Callback function, of the type given by cb_type
+ * \return Operation status.
+ */
+int32_t mscdf_register_callback(enum mscdf_cb_type cb_type, FUNC_PTR func);
+
+/**
+ * \brief Transfer the next blocks of the READ(10) or WRITE(10) command started
+ *
+ * MSCDF_CB_XFER_BLOCKS_DONE is called once they have been transferred: the buffer can then be used again.
+ * \param[in] rd true for a READ(10) command (the blocks are sent to the host), false for a WRITE(10) command
+ * \param[in] blk_buf Buffer of the blocks, in RAM and word aligned
+ * \param[in] blk_cnt Number of blocks
+ * \return Operation status.
+ */
+int32_t mscdf_xfer_blocks(bool rd, uint8_t *blk_buf, uint32_t blk_cnt);
+
+/**
+ * \brief End the READ(10) or WRITE(10) command started, sending its status to the host
+ *
+ * The application calls it once all the blocks have been transferred and processed, so that the
+ * status of a write tells whether the data has been written, or on an error to end the data stage early.
+ * \param[in] status ERR_NONE, ERR_BAD_ADDRESS for blocks out of the disk, or another error (medium error)
+ * \return Operation status.
+ */
+int32_t mscdf_finish_blocks(int32_t status);
+
+#endif /* USBDF_MSC_H_ */
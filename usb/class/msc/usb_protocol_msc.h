@@ -0,0 +1,161 @@
+/**
+ * \file
+ *
+ * \brief USB Mass Storage Class (Bulk-Only Transport, SCSI) protocol definitions
+ *
+ * Copyright (c) 2019 sysmocom -s.f.m.c. GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _USB_PROTOCOL_MSC_H_
+#define _USB_PROTOCOL_MSC_H_
+
+#include "usb_includes.h"
+
+/*
+ * \ingroup usb_protocol_group
+ * \defgroup msc_protocol_group Mass Storage Class Definitions
+ * \implements USB Mass Storage Class Bulk-Only Transport, Revision 1.0
+ * @{
+ */
+
+//! \name USB MSC Class, Subclass and Protocol IDs
+//@{
+#define USB_MSC_CLASS 0x08 //!< Mass Storage Class Code
+#define USB_MSC_SUBCLASS_SCSI 0x06 //!< SCSI transparent command set
+#define USB_MSC_PROTOCOL_BULK 0x50 //!< Bulk-Only Transport
+//@}
+
+//! \name USB MSC Request IDs (Bulk-Only Transport)
+//@{
+#define USB_REQ_MSC_GET_MAX_LUN 0xFE //!< IN: number of the last logical unit (1 byte)
+#define USB_REQ_MSC_BULK_RESET 0xFF //!< OUT: Bulk-Only Mass Storage Reset, ready for the next CBW
+//@}
+
+//! \name Command Block Wrapper and Command Status Wrapper signatures
+//@{
+#define USB_MSC_CBW_SIGNATURE 0x43425355 //!< "USBC"
+#define USB_MSC_CSW_SIGNATURE 0x53425355 //!< "USBS"
+//@}
+
+//! \name Command Block Wrapper flags
+//@{
+#define USB_MSC_CBW_DIR_IN 0x80 //!< data stage from the device to the host
+//@}
+
+//! \name Command Status Wrapper status
+//@{
+#define USB_MSC_CSW_PASSED 0x00
+#define USB_MSC_CSW_FAILED 0x01
+#define USB_MSC_CSW_PHASE_ERROR 0x02
+//@}
+
+//! \name SCSI operation codes (SPC-4, SBC-3)
+//@{
+#define SCSI_TEST_UNIT_READY 0x00
+#define SCSI_REQUEST_SENSE 0x03
+#define SCSI_INQUIRY 0x12
+#define SCSI_MODE_SENSE6 0x1A
+#define SCSI_START_STOP_UNIT 0x1B
+#define SCSI_PREVENT_ALLOW_MEDIUM_REMOVAL 0x1E
+#define SCSI_READ_FORMAT_CAPACITIES 0x23
+#define SCSI_READ_CAPACITY10 0x25
+#define SCSI_READ10 0x28
+#define SCSI_WRITE10 0x2A
+#define SCSI_VERIFY10 0x2F
+#define SCSI_SYNCHRONIZE_CACHE10 0x35
+#define SCSI_MODE_SENSE10 0x5A
+//@}
+
+//! \name SCSI sense keys
+//@{
+#define SCSI_SENSE_NO_SENSE 0x00
+#define SCSI_SENSE_NOT_READY 0x02
+#define SCSI_SENSE_MEDIUM_ERROR 0x03
+#define SCSI_SENSE_ILLEGAL_REQUEST 0x05
+//@}
+
+//! \name SCSI additional sense codes (ASC << 8 | ASCQ)
+//@{
+#define SCSI_ASC_NONE 0x0000
+#define SCSI_ASC_MEDIUM_NOT_PRESENT 0x3A00
+#define SCSI_ASC_WRITE_ERROR 0x0C00
+#define SCSI_ASC_INVALID_COMMAND 0x2000
+#define SCSI_ASC_LBA_OUT_OF_RANGE 0x2100
+#define SCSI_ASC_INVALID_FIELD_IN_CDB 0x2400
+//@}
+
+/*
+ * Need to pack structures tightly, or the compiler might insert padding
+ * and violate the spec-mandated layout.
+ */
+COMPILER_PACK_SET(1)
+
+//! Command Block Wrapper
+typedef struct usb_msc_cbw {
+	le32_t  dCBWSignature; /**< USB_MSC_CBW_SIGNATURE */
+	le32_t  dCBWTag; /**< Tag, echoed in the CSW */
+	le32_t  dCBWDataTransferLength; /**< Length of the data stage expected by the host */
+	uint8_t bmCBWFlags; /**< USB_MSC_CBW_DIR_IN for data from the device */
+	uint8_t bCBWLUN; /**< Logical unit */
+	uint8_t bCBWCBLength; /**< Valid bytes in CBWCB (1 to 16) */
+	uint8_t CBWCB[16]; /**< SCSI command block */
+} usb_msc_cbw_t;
+
+//! Command Status Wrapper
+typedef struct usb_msc_csw {
+	le32_t  dCSWSignature; /**< USB_MSC_CSW_SIGNATURE */
+	le32_t  dCSWTag; /**< dCBWTag of the command */
+	le32_t  dCSWDataResidue; /**< Data expected by the host but not transferred */
+	uint8_t bCSWStatus; /**< USB_MSC_CSW_PASSED, USB_MSC_CSW_FAILED or USB_MSC_CSW_PHASE_ERROR */
+} usb_msc_csw_t;
+
+#define USB_MSC_CBW_LEN 31
+#define USB_MSC_CSW_LEN 13
+
+//! Magics of a UF2 block (Microsoft UF2 specification), carried in a 512-byte sector written to the volume
+#define USB_UF2_MAGIC_START0 0x0A324655 //!< "UF2\n"
+#define USB_UF2_MAGIC_START1 0x9E5D5157
+#define USB_UF2_MAGIC_END 0x0AB16F30
+//! \name UF2 block flags
+//@{
+#define USB_UF2_FLAG_NOT_MAIN_FLASH 0x00000001 //!< the block is not meant for the main flash, and is ignored
+#define USB_UF2_FLAG_FILE_CONTAINER 0x00001000 //!< the block is part of a file, not a flash image
+#define USB_UF2_FLAG_FAMILY_ID 0x00002000 //!< dwFileSize holds the family ID of the target
+//@}
+//! Family ID of the SAM D5x/E5x
+#define USB_UF2_FAMILY_SAMD51 0x55114460
+//! Payload space of a UF2 block
+#define USB_UF2_PAYLOAD_MAX 476
+
+//! UF2 block
+typedef struct usb_uf2_block {
+	le32_t  dwMagicStart0; /**< USB_UF2_MAGIC_START0 */
+	le32_t  dwMagicStart1; /**< USB_UF2_MAGIC_START1 */
+	le32_t  dwFlags; /**< USB_UF2_FLAG_* */
+	le32_t  dwTargetAddr; /**< Address in flash where the payload is written */
+	le32_t  dwPayloadSize; /**< Bytes used in bData (256 for the usual images) */
+	le32_t  dwBlockNo; /**< Sequential block number, from 0 */
+	le32_t  dwNumBlocks; /**< Number of blocks of the file */
+	le32_t  dwFileSize; /**< Family ID with USB_UF2_FLAG_FAMILY_ID, else the file size or 0 */
+	uint8_t bData[USB_UF2_PAYLOAD_MAX]; /**< Payload, padded with zeros */
+	le32_t  dwMagicEnd; /**< USB_UF2_MAGIC_END */
+} usb_uf2_block_t;
+
+COMPILER_PACK_RESET()
+
+//! @}
+
+#endif // _USB_PROTOCOL_MSC_H_
@@ -90,6 +90,10 @@ struct usbdc_driver {
 	uint8_t ctrl_size;
 	/** Alternate interface used map */
 	uint8_t ifc_alt_map;
+	/** String descriptor built at run time, served instead of the one in the descriptors block. */
+	uint8_t *str_desc;
+	/** Index of the string descriptor built at run time. */
+	uint8_t str_index;
 };
 
 /**
@@ -186,8 +190,13 @@ static bool usbdc_get_str_desc(const uint8_t ep, struct usb_req *req)
 	uint16_t length   = req->wLength;
 	uint8_t  index    = req->wValue & 0x00FF;
 	bool     need_zlp = !(length & (usbdc.ctrl_size - 1));
-	/* All string are in default descriptors block: FS/LS */
-	str_desc = usb_find_str_desc(usbdc.desces.ls_fs->sod, usbdc.desces.ls_fs->eod, index);
+	if (usbdc.str_desc && index == usbdc.str_index) {
+		/* String built at run time (e.g. serial number) */
+		str_desc = usbdc.str_desc;
+	} else {
+		/* All string are in default descriptors block: FS/LS */
+		str_desc = usb_find_str_desc(usbdc.desces.ls_fs->sod, usbdc.desces.ls_fs->eod, index);
+	}
 	if (NULL == str_desc) {
 		return false;
 	}
@@ -896,6 +905,17 @@ void usbdc_unregister_function(struct usbdf_driver *func)
 	list_delete_element(&usbdc.func_list, func);
 }
 
+/**
+ * \brief Set the string descriptor built at run time
+ */
+void usbdc_set_str_desc(uint8_t index, uint8_t *str_desc)
+{
+	ASSERT(index); // index 0 is the language ID list
+
+	usbdc.str_index = index;
+	usbdc.str_desc  = str_desc;
+}
+
 /**
  * \brief Validate the descriptor
  */
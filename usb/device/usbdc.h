@@ -178,6 +178,20 @@ void usbdc_register_function(struct usbdf_driver *func);
  */
 void usbdc_unregister_function(struct usbdf_driver *func);
 
+/**
+ * \brief Set the string descriptor built at run time
+ *
+ * The descriptor is served for the given index instead of the one in the
+ * descriptors block, which only needs to hold a placeholder to keep the
+ * string indexes in place. This avoids keeping a modifiable RAM copy of
+ * the whole descriptors block only to patch a string, e.g. the serial number.
+ * Must be invoked after usbdc_init().
+ * \param[in] index String descriptor index (not 0).
+ * \param[in] str_desc Pointer to the string descriptor, which must stay valid,
+ *                     or NULL to serve the one in the descriptors block.
+ */
+void usbdc_set_str_desc(uint8_t index, uint8_t *str_desc);
+
 /**
  * \brief Validate the descriptors
  * \param[in] desces Pointer to usb device core descriptors
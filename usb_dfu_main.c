@@ -21,6 +21,18 @@
 
 #include "atmel_start.h"
 #include "atmel_start_pins.h"
+#include <hpl_cmcc_config.h>
+#include <hpl_oscctrl_config.h>
+#include <hal_cache.h>
+#include <hpl_nvmctrl_geometry.h>
+
+#if CONF_USB_DFUD_CLOCK_PROFILE == USB_DFUD_CLOCK_MAX && !CONF_XOSC1_CONFIG
+#error the maximum throughput clock profile needs the 12 MHz crystal (XOSC1) as reference for DPLL0
+#endif
+/** DPLL0 reference frequency: the crystal divided by 2 * (DIV + 1), within the 32 kHz - 3.2 MHz input range */
+#define DPLL0_REFERENCE 2000000
+/** Time for the crystal to start in a crystal-less start, far above its start-up time: without crystal the USB profile is used */
+#define XOSC1_START_TIMEOUT_US 100000
 
 /** Start address of the application in flash
  *  \remark must be initialized by check_bootloader
@@ -36,13 +48,13 @@ static volatile uint32_t* dfu_magic = (uint32_t*)HSRAM_ADDR; // magic value shou
  */
 static bool check_bootloader(void)
 {
-	if (hri_nvmctrl_read_STATUS_BOOTPROT_bf(FLASH_0.dev.hw) > 15) { // ensure BOOTPROT setting is valid
-		return false;
-	}
-	application_start_address = (uint32_t*)((15 - hri_nvmctrl_read_STATUS_BOOTPROT_bf(FLASH_0.dev.hw)) * 8192); // calculate bootloader size to know start address of the application (e.g. after the bootloader)
-	if (0 == application_start_address) { // no space has been reserved for the bootloader
+	const uint8_t bootprot = hri_nvmctrl_read_STATUS_BOOTPROT_bf(FLASH_0.dev.hw);
+
+	if (bootprot >= NVM_BOOTPROT_MAX) { // no space has been reserved for the bootloader
 		return false;
 	}
+	application_start_address = (uint32_t*)NVM_BOOTPROT_SIZE(bootprot); // calculate bootloader size to know start address of the application (e.g. after the bootloader)
+	// even the largest bootloader leaves space for the application in each bank (checked in hpl_nvmctrl_geometry.h)
 	return true;
 }
 
@@ -76,11 +88,71 @@ static bool check_application(void)
 	return (HSRAM_ADDR == ((*application_start_address) & 0xFFF80000));
 }
 
+#if CONF_USB_DFUD_DUAL_BANK_EN
+/** Check if the inactive bank holds a valid application we can swap to
+ *  \return true if the application and the bootloader in the inactive bank are valid
+ *  \warning application_start_address must be initialized
+ */
+static bool check_inactive_application(void)
+{
+	const uint32_t* inactive_start_address = application_start_address + NVM_BANK_SIZE / sizeof(uint32_t); // the inactive bank is always mapped in the upper half
+	return (HSRAM_ADDR == ((*inactive_start_address) & 0xFFF80000)) && usb_dfu_bank_check_bootloader((uint32_t)application_start_address);
+}
+#endif
+
+/** Set the NVM read wait states, and enable the NVMCTRL caches when there are wait states to hide
+ *  \param[in] wait_states NVM read wait states
+ */
+static void clock_profile_nvm(uint8_t wait_states)
+{
+	hri_nvmctrl_write_CTRLA_RWS_bf(FLASH_0.dev.hw, wait_states);
+	hri_nvmctrl_write_CTRLA_CACHEDIS0_bit(FLASH_0.dev.hw, 0 == wait_states);
+	hri_nvmctrl_write_CTRLA_CACHEDIS1_bit(FLASH_0.dev.hw, 0 == wait_states);
+}
+
+/** Switch to the clocks of the DFU mode (CONF_USB_DFUD_CLOCK_PROFILE)
+ *
+ *  The NVM read wait states are raised before the CPU frequency, and the NVMCTRL caches enabled when there are wait states to hide.
+ *  The USB clock (DFLL on GCLK1) is not changed.
+ */
+static void clock_profile_dfu(void)
+{
+	hri_nvmctrl_clear_CTRLA_AUTOWS_bit(FLASH_0.dev.hw); // use the wait states of the profile
+	clock_profile_nvm(CONF_USB_DFUD_NVM_WAIT_STATE);
+#if CONF_USB_DFUD_CLOCK_PROFILE == USB_DFUD_CLOCK_MAX
+#if !CONF_XOSC1_ENABLE
+	uint32_t i;
+	hri_oscctrl_set_XOSCCTRL_ENABLE_bit(OSCCTRL, 1); // crystal-less start: USB is already attached and enumerates meanwhile
+	for (i = 0; i < XOSC1_START_TIMEOUT_US / 100 && !hri_oscctrl_get_STATUS_XOSCRDY1_bit(OSCCTRL); i++) { // wait for the crystal to start
+		delay_us(100);
+	}
+	if (!hri_oscctrl_get_STATUS_XOSCRDY1_bit(OSCCTRL)) { // no crystal (or it failed): use the USB profile instead of waiting forever
+		hri_oscctrl_clear_XOSCCTRL_ENABLE_bit(OSCCTRL, 1);
+		hri_gclk_write_GENCTRL_SRC_bf(GCLK, 0, GCLK_GENCTRL_SRC_DFLL_Val); // the CPU already runs on the DFLL in a crystal-less start
+		clock_profile_nvm(USB_DFUD_NVM_WAIT_STATE(48000000)); // lowered after the CPU frequency
+		return;
+	}
+#endif
+	hri_oscctrl_write_DPLLRATIO_reg(OSCCTRL, 0, OSCCTRL_DPLLRATIO_LDR(CONF_USB_DFUD_CPU_FREQUENCY / DPLL0_REFERENCE - 1));
+	hri_oscctrl_write_DPLLCTRLB_reg(OSCCTRL, 0, OSCCTRL_DPLLCTRLB_DIV(CONF_XOSC1_FREQUENCY / DPLL0_REFERENCE / 2 - 1) | OSCCTRL_DPLLCTRLB_REFCLK_XOSC1);
+	hri_oscctrl_write_DPLLCTRLA_reg(OSCCTRL, 0, OSCCTRL_DPLLCTRLA_ENABLE);
+	while (!(hri_oscctrl_get_DPLLSTATUS_LOCK_bit(OSCCTRL, 0) && hri_oscctrl_get_DPLLSTATUS_CLKRDY_bit(OSCCTRL, 0))); // wait for the DPLL to lock
+	hri_gclk_write_GENCTRL_SRC_bf(GCLK, 0, GCLK_GENCTRL_SRC_DPLL0_Val);
+#elif CONF_USB_DFUD_CLOCK_PROFILE == USB_DFUD_CLOCK_USB
+	hri_gclk_write_GENCTRL_SRC_bf(GCLK, 0, GCLK_GENCTRL_SRC_DFLL_Val);
+#endif
+}
+
 /** Start the application
  *  \warning application_start_address must be initialized
+ *  \remark the active bank is always mapped at address 0, thus the application start address is the same in both banks
  */
 static void start_application(void)
 {
+#if CONF_CMCC_ENABLE
+	cache_disable(CMCC); // hand the cache over as after reset, the application configures it itself
+	cache_invalidate_all(CMCC); // stays disabled
+#endif
 	__set_MSP(*application_start_address); // re-base the Stack Pointer
 	SCB->VTOR = ((uint32_t) application_start_address & SCB_VTOR_TBLOFF_Msk); // re-base the vector table base address
 	asm("bx %0"::"r"(*(application_start_address + 1))); // jump to application Reset Handler in the application */
@@ -98,9 +170,21 @@ int main(void)
 			delay_ms(500);
 		}
 	}
-	if (!check_force_dfu() && check_application()) { // application is valid
+	const bool force_dfu = check_force_dfu();
+#if CONF_USB_DFUD_DUAL_BANK_EN
+	if (!force_dfu && !check_application() && check_inactive_application()) { // the active application is corrupted but the previous one is still there
+		usb_dfu_bank_swap(); // roll back to it (this resets)
+	}
+#endif
+	if (!force_dfu && check_application()) { // application is valid
 		start_application(); // start application
 	} else {
+		clock_profile_dfu(); // the application is started with the boot clocks, only DFU runs faster
+#if CONF_USB_DFUD_PRE_ERASE_EN && !(CONF_USB_DFUD_RESUME_EN && CONF_USB_DFUD_BLOCK_CRC_EN) // else the host first tells which blocks to keep
+		if (force_dfu) { // the user wants to flash a new application
+			usb_dfu_pre_erase(); // erase ahead before the download starts
+		}
+#endif
 		if (!check_application()) { // if the application is corrupted the start DFU start should be dfuERROR
 			dfu_state = USB_DFU_STATE_DFU_ERROR;
 		}
@@ -17,25 +17,34 @@
  */
 #include "atmel_start.h"
 #include "usb_start.h"
+#include <hpl_dma_copy.h>
+#include <hpl_nvmctrl_geometry.h>
+#if CONF_USB_DFUD_RESUME_EN
+#include <hpl_user_area.h>
+#endif
+#if CONF_USB_MSCD_UF2_EN
+#include "mscdf.h"
+#endif
 
+/* the descriptors are only read, and stay in flash: the USB driver copies them through the endpoint cache */
 #if CONF_USBD_HS_SP
-static uint8_t single_desc_bytes[] = {
+static const uint8_t single_desc_bytes[] = {
     /* Device descriptors and Configuration descriptors list. */
     DFUD_HS_DESCES_LS_FS};
-static uint8_t single_desc_bytes_hs[] = {
+static const uint8_t single_desc_bytes_hs[] = {
     /* Device descriptors and Configuration descriptors list. */
     DFUD_HS_DESCES_HS};
 #else
-static uint8_t single_desc_bytes[] = {
+static const uint8_t single_desc_bytes[] = {
     /* Device descriptors and Configuration descriptors list. */
     DFUD_DESCES_LS_FS};
 #endif
 
 static struct usbd_descriptors single_desc[]
-    = {{single_desc_bytes, single_desc_bytes + sizeof(single_desc_bytes)}
+    = {{(uint8_t*)single_desc_bytes, (uint8_t*)single_desc_bytes + sizeof(single_desc_bytes)}
 #if CONF_USBD_HS_SP
        ,
-       {single_desc_bytes_hs, single_desc_bytes_hs + sizeof(single_desc_bytes_hs)}
+       {(uint8_t*)single_desc_bytes_hs, (uint8_t*)single_desc_bytes_hs + sizeof(single_desc_bytes_hs)}
 #endif
 };
 
@@ -45,18 +54,126 @@ static const usb_dfu_func_desc_t* usb_dfu_func_desc = (usb_dfu_func_desc_t*)&usb
 /** Ctrl endpoint buffer */
 static uint8_t ctrl_buffer[64];
 
+#if CONF_USB_DFUD_ISERIALNUM_EN
+#ifndef SERIAL_NUMBER_WORD0_ADDR
+/* addresses of the four 32-bit words forming the 128-bit chip serial number (see data sheet section 9.6 Serial Number) */
+#define SERIAL_NUMBER_WORD0_ADDR 0x008061FC
+#define SERIAL_NUMBER_WORD1_ADDR 0x00806010
+#define SERIAL_NUMBER_WORD2_ADDR 0x00806014
+#define SERIAL_NUMBER_WORD3_ADDR 0x00806018
+#endif
+/** Words forming the 128-bit chip serial number */
+static const uint32_t* const serial_number_words[4] = {(uint32_t*)SERIAL_NUMBER_WORD0_ADDR, (uint32_t*)SERIAL_NUMBER_WORD1_ADDR, (uint32_t*)SERIAL_NUMBER_WORD2_ADDR, (uint32_t*)SERIAL_NUMBER_WORD3_ADDR};
+/** USB serial number string descriptor, holding the chip serial number as 32 hexadecimal digits */
+static uint8_t usb_dfu_serial_desc[2 + 32 * 2];
+
+/**
+ * \brief Build the USB serial number string descriptor from the chip serial number
+ */
+static void usb_dfu_serial_init(void)
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+	uint8_t i, j;
+
+	usb_dfu_serial_desc[0] = sizeof(usb_dfu_serial_desc); // bLength
+	usb_dfu_serial_desc[1] = USB_DT_STRING; // bDescriptorType
+	for (i = 0; i < ARRAY_SIZE(serial_number_words); i++) {
+		uint32_t word = *serial_number_words[i];
+		for (j = 0; j < 8; j++) { // one UTF-16LE character per nibble, most significant first
+			usb_dfu_serial_desc[2 + (i * 8 + j) * 2] = hex_digits[(word >> (28 - j * 4)) & 0xf];
+			usb_dfu_serial_desc[2 + (i * 8 + j) * 2 + 1] = 0;
+		}
+	}
+}
+#endif
+
+#if CONF_USB_MSCD_UF2_EN
+static void usb_dfu_uf2_init(void);
+#endif
+
 /**
  * \brief USB DFU Init
  */
 void usb_dfu_init(void)
 {
 	usbdc_init(ctrl_buffer);
+#if CONF_USB_DFUD_ISERIALNUM_EN
+	usb_dfu_serial_init();
+	usbdc_set_str_desc(CONF_USB_DFUD_ISERIALNUM, usb_dfu_serial_desc); // serve the chip serial number instead of the placeholder
+#endif
 	dfudf_init();
+#if CONF_USB_MSCD_UF2_EN
+	usb_dfu_uf2_init();
+#endif
 
 	usbdc_start(single_desc);
 	usbdc_attach();
 }
 
+#if CONF_USB_DFUD_DUAL_BANK_EN
+/** The application is downloaded in the inactive bank, which is always mapped in the upper half of the flash */
+#define DFU_BANK_SIZE NVM_BANK_SIZE
+#else
+#define DFU_BANK_SIZE NVM_FLASH_SIZE
+#endif
+/** Address of the bank the application is downloaded into */
+#define DFU_DOWNLOAD_BANK (NVM_FLASH_SIZE - DFU_BANK_SIZE)
+
+#if CONF_USB_DFUD_DUAL_BANK_EN
+bool usb_dfu_bank_check_bootloader(uint32_t size)
+{
+	uint8_t page[NVMCTRL_PAGE_SIZE];
+	uint32_t addr;
+
+	for (addr = 0; addr < size; addr += NVMCTRL_PAGE_SIZE) {
+		flash_read(&FLASH_0, addr, page, sizeof(page)); // the active bank starts at address 0, which can't be dereferenced
+		if (0 != memcmp(page, (const void*)(FLASH_ADDR + DFU_BANK_SIZE + addr), sizeof(page))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void usb_dfu_bank_swap(void)
+{
+	while (!hri_nvmctrl_get_STATUS_READY_bit(FLASH_0.dev.hw)); // wait for the last flash operation to complete
+	hri_nvmctrl_write_CTRLB_reg(FLASH_0.dev.hw, NVMCTRL_CTRLB_CMD_BKSWRST | NVMCTRL_CTRLB_CMDEX_KEY); // swap the banks and reset
+}
+
+/**
+ * \brief Copy the bootloader of the active bank in the inactive bank, so that it still starts after the banks are swapped
+ * \param[in] size Size of the bootloader
+ * \return Operation status
+ */
+static int32_t usb_dfu_bank_copy_bootloader(uint32_t size)
+{
+	uint8_t page[NVMCTRL_PAGE_SIZE];
+	uint32_t addr;
+	int32_t rc;
+
+	if (usb_dfu_bank_check_bootloader(size)) { // nothing to do
+		return ERR_NONE;
+	}
+	for (addr = 0; addr < size; addr += NVMCTRL_PAGE_SIZE) {
+		if (0 == addr % NVMCTRL_BLOCK_SIZE) {
+			rc = flash_erase(&FLASH_0, DFU_BANK_SIZE + addr, NVMCTRL_BLOCK_SIZE / NVMCTRL_PAGE_SIZE);
+			if (ERR_NONE != rc) {
+				return rc;
+			}
+		}
+		flash_read(&FLASH_0, addr, page, sizeof(page));
+		rc = flash_append(&FLASH_0, DFU_BANK_SIZE + addr, page, sizeof(page));
+		if (ERR_NONE != rc) {
+			return rc;
+		}
+	}
+	return usb_dfu_bank_check_bootloader(size) ? ERR_NONE : ERR_FAILURE;
+}
+
+/** The downloaded application is complete and checked in the inactive bank, to be swapped to at reset */
+static bool bank_swap_ready;
+#endif
+
 /**
  * \brief reset device
  */
@@ -66,6 +183,14 @@ static void usb_dfu_reset(const enum usb_event ev, const uint32_t param)
 	switch (ev) {
 	case USB_EV_RESET:
 		usbdc_detach(); // make sure we are detached
+#if CONF_USB_DFUD_PRE_ERASE_EN
+		while (!hri_nvmctrl_get_STATUS_READY_bit(FLASH_0.dev.hw)); // don't interrupt an erase ahead of the download
+#endif
+#if CONF_USB_DFUD_DUAL_BANK_EN
+		if (bank_swap_ready) { // the new application is ready in the inactive bank
+			usb_dfu_bank_swap(); // swap to it (this also resets)
+		}
+#endif
 		NVIC_SystemReset(); // initiate a system reset
 		break;
 	default:
@@ -74,60 +199,1841 @@ static void usb_dfu_reset(const enum usb_event ev, const uint32_t param)
 	
 }
 
+/** Start address where the application is written in flash, right after the bootloader (in the inactive bank for dual-bank updates) */
+static uint32_t application_start_address;
+
+#if CONF_USB_DFUD_STAGING_EN || CONF_QSPI_ENABLE
+#ifndef DFU_STAGING_START
+/* RAM left after the stack, defined in the linker script */
+extern uint32_t _sdfu_staging;
+extern uint32_t _edfu_staging;
+#define DFU_STAGING_START ((uint8_t*)&_sdfu_staging)
+#define DFU_STAGING_END ((uint8_t*)&_edfu_staging)
+#endif
+#endif
+
+#if CONF_USB_DFUD_STAGING_EN
+/** Size of the staging area, in whole flash blocks so that no block needs to be erased twice */
+static size_t staging_size;
+/** Offset in the application region of the first staged byte (block aligned) */
+static size_t staging_offset;
+/** Number of staged bytes */
+static size_t staging_length;
+#endif
+
+#if CONF_USB_DFUD_PRE_ERASE_EN
+#if CONF_USB_DFUD_STAGING_EN
+#error "erasing ahead can not be combined with staging in RAM, which checks the image before touching the flash"
+#endif
+/** Blocks of the application region erased (or being erased) during this download, the block at offset n * NVMCTRL_BLOCK_SIZE being bit n
+ *  \remark the pages of these blocks are erased, except the ones below program_end
+ */
+static uint32_t erased_blocks[(DFU_BANK_SIZE / NVMCTRL_BLOCK_SIZE + 31) / 32];
+/** Set once blocks may be erased ahead of the downloaded data */
+static bool pre_erase_armed;
+/** End of the programmed data in the application region (page aligned offset) */
+static uint32_t program_end;
+/** End of the downloaded data in the application region (offset) */
+static uint32_t download_end;
+#endif
+
+#if CONF_USB_DFUD_DFUSE_EN
+/** Pages of the application region erased by DfuSe commands and not written since, the page at offset n * NVMCTRL_PAGE_SIZE being bit n */
+static uint32_t dfuse_erased_pages[(DFU_BANK_SIZE / NVMCTRL_PAGE_SIZE + 31) / 32];
+#endif
+
+#if CONF_USB_DFUD_RESUME_EN
+#if CONF_USB_DFUD_STAGING_EN
+#error "resumable downloads can not be combined with staging in RAM"
+#endif
+#if NVM_TOTAL_BLOCKS > 128
+#error "bmBlocks and the block CRCs track at most 128 blocks"
+#endif
+/** Size of a resume record (struct usb_dfu_resume_record) */
+#define DFU_RESUME_RECORD_SIZE ((5 + (NVM_TOTAL_BLOCKS + 31) / 32) * 4)
+#if CONF_USB_DFUD_RESUME_OFFSET % 4 || CONF_USB_DFUD_RESUME_OFFSET + 2 * DFU_RESUME_RECORD_SIZE > 512
+#error "the two resume record slots must be word aligned in the first 512 bytes of the SmartEEPROM"
+#endif
+/** Marks a resume record ("DFUR") */
+#define DFU_RESUME_MAGIC 0x52554644
+/** Progress of the download, persisted in the SmartEEPROM at CONF_USB_DFUD_RESUME_OFFSET
+ *
+ *  The record is saved alternately in two slots, so that a save interrupted by a power loss leaves the previous one intact.
+ */
+struct usb_dfu_resume_record {
+	uint32_t magic; /**< DFU_RESUME_MAGIC if a download is recorded */
+	uint32_t sequence; /**< incremented at each save, the slot holding the highest one being the current record */
+	usb_dfu_image_id_t image; /**< image given by the host */
+	uint32_t blocks[(NVM_TOTAL_BLOCKS + 31) / 32]; /**< blocks of the application region programmed and verified, the block at offset n * NVMCTRL_BLOCK_SIZE being bit n */
+	uint32_t check; /**< complement of the XOR of the other words */
+};
+static struct usb_dfu_resume_record resume_record;
+/** Slot holding the current record (0 or 1), the next save going to the other one */
+static uint8_t resume_slot;
+/** Sequence number of the current record */
+static uint32_t resume_sequence;
+/** The SmartEEPROM is allocated: the record persists across resets, else the progress is only reported during this session */
+static bool resume_persistent;
+/** Blocks completed since the record has been persisted */
+static uint32_t resume_unsaved;
+/** The host identified the image of this download, else the first download request discards the record */
+static bool resume_identified;
+/** Contiguous data verified during this download (offsets in the application region), giving the completed blocks */
+static uint32_t resume_chain_start;
+static uint32_t resume_chain_end;
+/** Data written last, verified once the NVMCTRL completed writing it so that the next USB transfer is not delayed */
+COMPILER_ALIGNED(4) static uint8_t resume_written_data[sizeof(dfu_download_data)];
+static uint32_t resume_written_offset;
+/** Length of the data to verify, 0 if none */
+static uint16_t resume_written_length;
+#endif
+
+#if CONF_QSPI_ENABLE
+/** Alternate setting of the DFU interface downloading to the QSPI flash (the internal flash being CONF_USB_DFUD_BALTSET) */
+#define USB_DFUD_ALT_QSPI (CONF_USB_DFUD_BALTSET + 1)
+/** Data of the write queue entry i, in the staging arena */
+#define QSPI_QUEUE_DATA(i) (DFU_STAGING_START + (i) * sizeof(dfu_download_data))
+/** Sector being read-modify-written, in the staging arena after the write queue */
+#define QSPI_SECTOR_BUFFER (DFU_STAGING_START + CONF_USB_DFUD_QSPI_QUEUE * sizeof(dfu_download_data))
+/** Flash page read back, in the staging arena after the sector */
+#define QSPI_PAGE_BUFFER (QSPI_SECTOR_BUFFER + CONF_QSPI_NOR_SECTOR_SIZE)
+/** Downloaded data waiting to be written in the QSPI flash */
+struct usb_dfu_qspi_entry {
+	uint32_t offset; /**< offset of the data in the QSPI region */
+	uint16_t length; /**< length of the data */
+	uint16_t done; /**< length of the data written (or already in flash) and verified */
+	bool programmed; /**< the page at done has been programmed, and is verified next */
+	bool erased; /**< the page at done has been erased, and is programmed next */
+};
+/** Write queue, a ring of entries from qspi_queue_head */
+static struct usb_dfu_qspi_entry qspi_queue[CONF_USB_DFUD_QSPI_QUEUE];
+static uint8_t qspi_queue_head;
+static uint8_t qspi_queue_count;
+/** Error of the background writes, reported with the next job */
+static int32_t qspi_error;
+/** Result of the detection of the QSPI flash */
+static int32_t qspi_present;
+#endif
+
+#if CONF_AES_ENABLE
+#if CONF_USB_DFUD_RESUME_EN
+#error "encrypted images can not be combined with resumable downloads"
+#endif
+/** The header of an encrypted image fills the first transfer, the payload starting at the second one */
+#define USB_DFU_DECRYPT_HEADER_SIZE sizeof(dfu_download_data)
+/** Key of the encrypted images, padded with zeros */
+static const uint8_t decrypt_key[32] = {CONF_USB_DFUD_DECRYPT_KEY};
+/** Header of the encrypted image being downloaded */
+static usb_dfu_encrypted_header_t decrypt_header;
+/** The header of this download has been received and checked */
+static bool decrypt_ready;
+/** End of the decrypted data in the payload (offset), the GCM payload being decrypted in order */
+static uint32_t decrypt_next;
+#endif
+
+#if CONF_USB_MSCD_UF2_EN
+/** Sectors transferred at once by the mass storage interface, in each of the two buffers */
+#define MSC_BUFFER_SECTORS 4
+/** Application bytes carried by each block of CURRENT.UF2, as the usual UF2 files */
+#define UF2_BLOCK_PAYLOAD 256
+/** Largest UF2 file accepted, in blocks: the application region in blocks of the usual payload */
+#define UF2_MAX_BLOCKS (DFU_BANK_SIZE / UF2_BLOCK_PAYLOAD)
+/** No flash block is held in uf2_flash_block */
+#define UF2_NO_BLOCK 0xFFFFFFFF
+
+/** \name Virtual FAT16 volume, with one sector per cluster
+ *  Boot sector, two FATs, root directory, then INFO_UF2.TXT (cluster 2) and CURRENT.UF2 (from cluster 3).
+ */
+//@{
+#define UF2_FAT_SECTORS ((CONF_USB_MSCD_UF2_SECTORS * 2 + MSCDF_BLOCK_SIZE - 1) / MSCDF_BLOCK_SIZE)
+#define UF2_ROOT_ENTRIES 64
+#define UF2_ROOT_START (1 + 2 * UF2_FAT_SECTORS)
+#define UF2_DATA_START (UF2_ROOT_START + UF2_ROOT_ENTRIES * 32 / MSCDF_BLOCK_SIZE)
+#define UF2_INFO_CLUSTER 2
+#define UF2_CURRENT_CLUSTER 3
+/** Date of the files (2019-01-01) */
+#define UF2_FAT_DATE (((2019 - 1980) << 9) | (1 << 5) | 1)
+//@}
+
+/** READ(10) or WRITE(10) command started by the host, given by the USB interrupt to the main loop */
+static volatile bool msc_command;
+static volatile bool msc_command_read;
+static volatile uint32_t msc_command_lba;
+static volatile uint32_t msc_command_sectors;
+/** Command served by the main loop: direction, next sector to transfer and number of sectors left, error */
+static bool msc_active;
+static bool msc_read;
+static uint32_t msc_lba;
+static uint32_t msc_left;
+static int32_t msc_rc;
+/** Transfer in progress (0 sectors if none), and its buffer */
+static uint32_t msc_xfer_sectors;
+static uint8_t msc_xfer_buffer;
+/** Set by the USB interrupt once the transfer in progress completed */
+static volatile bool msc_xfer_done;
+/** Set by the USB interrupt once the host received the status of the last command */
+static volatile bool msc_status_sent;
+/** Two buffers, so that the host sends the next sectors while the previous ones are processed */
+static COMPILER_ALIGNED(4) uint8_t msc_buffers[2][MSC_BUFFER_SECTORS * MSCDF_BLOCK_SIZE];
+
+/** Number of blocks of CURRENT.UF2, holding the application region */
+static uint32_t uf2_current_blocks;
+/** Number of blocks of the UF2 file being written (0 if none), and the blocks received, block n being bit n */
+static uint32_t uf2_num_blocks;
+static uint32_t uf2_received;
+static uint32_t uf2_blocks[(UF2_MAX_BLOCKS + 31) / 32];
+/** Flash block being updated by the UF2 blocks, written once blocks for another flash block come */
+static COMPILER_ALIGNED(4) uint8_t uf2_flash_block[NVMCTRL_BLOCK_SIZE];
+/** Offset of this block in the application region, UF2_NO_BLOCK if none */
+static uint32_t uf2_flash_offset;
+/** The whole UF2 file has been written: reset once the host got the status of the write */
+static bool uf2_reset_pending;
+#endif
+
+/**
+ * \brief Report an error of the flash operations to the host
+ * \param[in] rc Error code of the flash operation
+ */
+static void usb_dfu_error(int32_t rc)
+{
+	dfu_state = USB_DFU_STATE_DFU_ERROR;
+	if (ERR_BAD_ADDRESS == rc) {
+		dfu_status = USB_DFU_STATUS_ERR_ADDRESS;
+	} else if (ERR_DENIED == rc) {
+		dfu_status = USB_DFU_STATUS_ERR_WRITE;
+	} else if (ERR_INVALID_DATA == rc) {
+		dfu_status = USB_DFU_STATUS_ERR_FILE;
+	} else if (ERR_FAILURE == rc) {
+		dfu_status = USB_DFU_STATUS_ERR_VERIFY;
+	} else {
+		dfu_status = USB_DFU_STATUS_ERR_PROG;
+	}
+}
+
+#if CONF_USB_DFUD_RESUME_EN
 /**
- * \brief Enter USB DFU runtime
+ * \brief Compute the check word of the resume record
+ * \param[in] record Resume record
  */
-void usb_dfu(void)
+static uint32_t usb_dfu_resume_check(const struct usb_dfu_resume_record* record)
 {
-	while (!dfudf_is_enabled()); // wait for DFU to be installed
-	LED_SYSTEM_on(); // switch LED on to indicate USB DFU stack is ready
+	const uint32_t* words = (const uint32_t*)record;
+	uint32_t check = 0;
+	uint32_t i;
+
+	for (i = 0; i < sizeof(*record) / sizeof(uint32_t) - 1; i++) {
+		check ^= words[i];
+	}
+	return ~check;
+}
 
-	ASSERT(hri_nvmctrl_read_STATUS_BOOTPROT_bf(FLASH_0.dev.hw) <= 15);
-	uint32_t application_start_address = (15 - hri_nvmctrl_read_STATUS_BOOTPROT_bf(FLASH_0.dev.hw)) * 8192; // calculate bootloader size to know where we should write the application firmware
-	ASSERT(application_start_address > 0);
+/**
+ * \brief Check if a block of the application region has been programmed and verified for the identified image
+ * \param[in] offset Offset of the block in the application region
+ */
+static bool usb_dfu_resume_done(uint32_t offset)
+{
+	offset /= NVMCTRL_BLOCK_SIZE;
+	return DFU_RESUME_MAGIC == resume_record.magic && (resume_record.blocks[offset / 32] & (1UL << (offset % 32)));
+}
 
-	while (true) { // main DFU infinite loop
-		// run the second part of the USB DFU state machine handling non-USB aspects
-		if (USB_DFU_STATE_DFU_DNLOAD_SYNC == dfu_state || USB_DFU_STATE_DFU_DNBUSY == dfu_state) { // there is some data to be flashed
-			LED_SYSTEM_off(); // switch LED off to indicate we are flashing
-			if (dfu_download_length > 0) { // there is some data to be flashed
-				int32_t rc = flash_write(&FLASH_0, application_start_address + dfu_download_offset, dfu_download_data, dfu_download_length); // write downloaded data chunk to flash
-				if (ERR_NONE == rc) {
-					dfu_state = USB_DFU_STATE_DFU_DNLOAD_IDLE; // indicate flashing this block has been completed
-				} else { // there has been a programming error
-					dfu_state = USB_DFU_STATE_DFU_ERROR;
-					if (ERR_BAD_ADDRESS == rc) {
-						dfu_status = USB_DFU_STATUS_ERR_ADDRESS;
-					} else if (ERR_DENIED == rc) {
-						dfu_status = USB_DFU_STATUS_ERR_WRITE;
-					} else {
-						dfu_status = USB_DFU_STATUS_ERR_PROG;
-					}
-				}
-			} else { // there was no data to flash
-				// this case should not happen, but it's not a critical error
-				dfu_state = USB_DFU_STATE_DFU_DNLOAD_IDLE; // indicate flashing can continue
-			}
-			LED_SYSTEM_on(); // switch LED on to indicate USB DFU can resume
-		}
-		if (USB_DFU_STATE_DFU_MANIFEST == dfu_state) { // we can start manifestation (finish flashing)
-			// in theory every DFU files should have a suffix to with a CRC to check the data
-			// in practice most downloaded files are just the raw binary with DFU suffix
-			dfu_manifestation_complete = true; // we completed flashing and all checks
-			if (usb_dfu_func_desc->bmAttributes & USB_DFU_ATTRIBUTES_MANIFEST_TOLERANT) {
-				dfu_state = USB_DFU_STATE_DFU_MANIFEST_SYNC;
-			} else {
-				dfu_state = USB_DFU_STATE_DFU_MANIFEST_WAIT_RESET;
+/**
+ * \brief Update the progress reported to the host
+ */
+static void usb_dfu_resume_report(void)
+{
+	if (DFU_RESUME_MAGIC == resume_record.magic) {
+		dfu_resume_info.image = resume_record.image;
+		memcpy(dfu_resume_info.bmBlocks, resume_record.blocks, min(sizeof(dfu_resume_info.bmBlocks), sizeof(resume_record.blocks)));
+	} else {
+		memset(&dfu_resume_info.image, 0, sizeof(dfu_resume_info.image));
+		memset(dfu_resume_info.bmBlocks, 0, sizeof(dfu_resume_info.bmBlocks));
+	}
+	dfu_resume_info.wBlockSize = NVMCTRL_BLOCK_SIZE;
+}
+
+/**
+ * \brief Persist the resume record in the SmartEEPROM, unless the current slot already holds it
+ * \return Operation status
+ */
+static int32_t usb_dfu_resume_save(void)
+{
+	struct usb_dfu_resume_record saved;
+	int32_t rc;
+
+	resume_unsaved = 0;
+	if (!resume_persistent) {
+		return ERR_NONE;
+	}
+	resume_record.sequence = resume_sequence;
+	resume_record.check = usb_dfu_resume_check(&resume_record);
+	rc = _user_area_read((const void*)SEEPROM_ADDR, CONF_USB_DFUD_RESUME_OFFSET + resume_slot * sizeof(saved), (uint8_t*)&saved, sizeof(saved));
+	if (ERR_NONE == rc && 0 == memcmp(&saved, &resume_record, sizeof(saved))) {
+		return ERR_NONE; // spare the writes
+	}
+	resume_record.sequence = resume_sequence + 1;
+	resume_record.check = usb_dfu_resume_check(&resume_record);
+	rc = _user_area_write((void*)SEEPROM_ADDR, CONF_USB_DFUD_RESUME_OFFSET + (resume_slot ^ 1) * sizeof(resume_record), (const uint8_t*)&resume_record, sizeof(resume_record));
+	if (ERR_NONE == rc) { // the new record is complete: it is the current one
+		resume_slot ^= 1;
+		resume_sequence++;
+	}
+	return rc;
+}
+
+/**
+ * \brief Load the current resume record from the SmartEEPROM
+ */
+static void usb_dfu_resume_load(void)
+{
+	struct usb_dfu_resume_record slots[2];
+	bool valid[2];
+	uint8_t i;
+
+	ASSERT(sizeof(resume_record) == DFU_RESUME_RECORD_SIZE);
+	memset(&resume_record, 0, sizeof(resume_record));
+	resume_slot = 1; // the first save goes to slot 0
+	resume_sequence = 0;
+	resume_persistent = (ERR_NONE == _user_area_read((const void*)SEEPROM_ADDR, CONF_USB_DFUD_RESUME_OFFSET, (uint8_t*)slots, sizeof(slots)));
+	if (resume_persistent) {
+		for (i = 0; i < 2; i++) { // erased, or the save has been interrupted
+			valid[i] = 0xFFFFFFFF != slots[i].sequence && usb_dfu_resume_check(&slots[i]) == slots[i].check;
+		}
+		if (valid[0] || valid[1]) {
+			resume_slot = (valid[1] && (!valid[0] || (int32_t)(slots[1].sequence - slots[0].sequence) > 0)) ? 1 : 0;
+			resume_sequence = slots[resume_slot].sequence;
+			if (DFU_RESUME_MAGIC == slots[resume_slot].magic) {
+				resume_record = slots[resume_slot];
+			}
+		}
+	}
+	resume_unsaved = 0;
+	resume_identified = false;
+	resume_chain_start = 0;
+	resume_chain_end = 0;
+	resume_written_length = 0;
+	usb_dfu_resume_report();
+}
+
+/**
+ * \brief Process the identity of the image about to be downloaded, given by the host
+ *
+ * The recorded progress is kept if it belongs to the same image, else a new record is started.
+ * \return Operation status
+ */
+static int32_t usb_dfu_resume_identify(void)
+{
+	int32_t rc = ERR_NONE;
+
+	resume_identified = true;
+	if (DFU_RESUME_MAGIC != resume_record.magic || dfu_image_id.dwImageSize != resume_record.image.dwImageSize
+	    || dfu_image_id.dwImageCrc != resume_record.image.dwImageCrc) { // else the host resumes the download
+		memset(&resume_record, 0, sizeof(resume_record));
+		resume_record.magic = DFU_RESUME_MAGIC;
+		resume_record.image = dfu_image_id;
+		usb_dfu_resume_report();
+		rc = usb_dfu_resume_save(); // before any block of the previous image is overwritten
+	}
+	dfu_image_id_pending = false; // the host may now get the progress
+	return rc;
+}
+
+#if CONF_USB_DFUD_BLOCK_CRC_EN
+/**
+ * \brief Compute the CRC-32 (IEEE 802.3) of flash data using the DSU
+ * \param[in] addr Address of the data in flash
+ * \param[in] length Length of the data
+ * \param[out] crc CRC-32 of the data
+ * \return Operation status
+ */
+static int32_t usb_dfu_flash_crc32(uint32_t addr, uint32_t length, uint32_t* crc)
+{
+	const uint8_t* tail = (const uint8_t*)(FLASH_ADDR + addr + (length & ~3));
+	uint32_t value = 0xFFFFFFFF;
+	uint8_t bit;
+
+	if (length >= 4) {
+		hri_dsu_clear_STATUSA_reg(DSU, DSU_STATUSA_DONE | DSU_STATUSA_BERR);
+		hri_dsu_write_ADDR_reg(DSU, DSU_ADDR_ADDR(addr / 4)); // the flash starts at address 0 of the bus
+		hri_dsu_write_LENGTH_reg(DSU, DSU_LENGTH_LENGTH(length / 4));
+		hri_dsu_write_DATA_reg(DSU, value);
+		hri_dsu_write_CTRL_reg(DSU, DSU_CTRL_CRC);
+		while (!hri_dsu_get_STATUSA_DONE_bit(DSU));
+		if (hri_dsu_get_STATUSA_BERR_bit(DSU)) {
+			return ERR_FAILURE;
+		}
+		value = hri_dsu_read_DATA_reg(DSU);
+	}
+	for (; tail < (const uint8_t*)(FLASH_ADDR + addr + length); tail++) { // the DSU only processes whole words
+		value ^= *tail;
+		for (bit = 0; bit < 8; bit++) {
+			value = (value >> 1) ^ (0xEDB88320 & (0 - (value & 1)));
+		}
+	}
+	*crc = ~value;
+	return ERR_NONE;
+}
+
+/**
+ * \brief Record the blocks of the identified image already in flash, according to the block CRCs given by the host
+ * \return Operation status
+ */
+static int32_t usb_dfu_resume_check_blocks(void)
+{
+	const uint32_t size = resume_record.image.dwImageSize;
+	uint32_t offset, crc;
+	bool changed = false;
+	int32_t rc = ERR_NONE;
+
+	if (DFU_RESUME_MAGIC == resume_record.magic && dfu_block_crcs_count == (size + NVMCTRL_BLOCK_SIZE - 1) / NVMCTRL_BLOCK_SIZE
+	    && application_start_address + size <= NVM_FLASH_SIZE) { // else the CRCs do not belong to the identified image
+		_flash_wait_ready(&FLASH_0.dev); // the flash can't be read while it is erased ahead
+		for (offset = 0; offset < size && ERR_NONE == rc; offset += NVMCTRL_BLOCK_SIZE) {
+			if (usb_dfu_resume_done(offset)) {
+				continue;
+			}
+			rc = usb_dfu_flash_crc32(application_start_address + offset, min(NVMCTRL_BLOCK_SIZE, size - offset), &crc);
+			if (ERR_NONE == rc && crc == dfu_block_crcs[offset / NVMCTRL_BLOCK_SIZE]) { // the block already holds this part of the image
+				resume_record.blocks[offset / NVMCTRL_BLOCK_SIZE / 32] |= (1UL << (offset / NVMCTRL_BLOCK_SIZE % 32));
+				changed = true;
 			}
 		}
-		if (USB_DFU_STATE_DFU_MANIFEST_WAIT_RESET == dfu_state) {
-			if (usb_dfu_func_desc->bmAttributes & USB_DFU_ATTRIBUTES_WILL_DETACH) {
-				usb_dfu_reset(USB_EV_RESET, 0); // immediately reset
-			} else { // wait for USB reset
-				usb_d_register_callback(USB_D_CB_EVENT, (FUNC_PTR)usb_dfu_reset); // register new USB reset event handler
+		if (changed) {
+			usb_dfu_resume_report();
+			if (ERR_NONE == rc) {
+				rc = usb_dfu_resume_save();
 			}
 		}
 	}
+	dfu_block_crcs_pending = false; // the host may now get the blocks to download
+	return rc;
+}
+#endif
+
+/**
+ * \brief Forget the blocks about to be written, before writing them
+ *
+ * When the host did not identify the image, the whole record is discarded.
+ * \param[in] offset Offset of the data in the application region
+ * \param[in] length Length of the data
+ * \return Operation status
+ */
+static int32_t usb_dfu_resume_write(uint32_t offset, uint16_t length)
+{
+	bool changed = false;
+	uint32_t block;
+
+	if (application_start_address + offset + length > NVM_FLASH_SIZE) {
+		return ERR_BAD_ADDRESS;
+	}
+	if (!resume_identified) { // the host does not resume this download
+		resume_identified = true;
+		if (DFU_RESUME_MAGIC == resume_record.magic) {
+			memset(&resume_record, 0, sizeof(resume_record));
+			changed = true;
+		}
+	}
+	for (block = offset & ~(NVMCTRL_BLOCK_SIZE - 1); block < offset + length; block += NVMCTRL_BLOCK_SIZE) {
+		if (usb_dfu_resume_done(block)) {
+			resume_record.blocks[block / NVMCTRL_BLOCK_SIZE / 32] &= ~(1UL << (block / NVMCTRL_BLOCK_SIZE % 32));
+			changed = true;
+		}
+	}
+	if (!changed) {
+		return ERR_NONE;
+	}
+	usb_dfu_resume_report();
+	return usb_dfu_resume_save();
+}
+
+/**
+ * \brief Keep written data, to verify it later
+ * \param[in] offset Offset of the data in the application region
+ * \param[in] data Written data
+ * \param[in] length Length of the data
+ */
+static void usb_dfu_resume_written(uint32_t offset, const uint8_t* data, uint16_t length)
+{
+	_dma_copy(resume_written_data, data, length);
+	resume_written_offset = offset;
+	resume_written_length = length;
+}
+
+/**
+ * \brief Verify the data written last, and record the blocks it completes
+ *
+ * A block is complete once it has been written from its start to its end (or to the end of the image) by consecutive requests.
+ * \param[in] wait Wait for the NVMCTRL to complete the write, else only verify if it already did
+ * \return Operation status
+ */
+static int32_t usb_dfu_resume_verify(bool wait)
+{
+	const uint32_t offset = resume_written_offset;
+	uint32_t block;
+
+	if (0 == resume_written_length || (!wait && !hri_nvmctrl_get_STATUS_reg(FLASH_0.dev.hw, NVMCTRL_STATUS_READY))) {
+		return ERR_NONE;
+	}
+	_flash_wait_ready(&FLASH_0.dev); // the last page write must have completed
+	if (0 != memcmp((const void*)(FLASH_ADDR + application_start_address + offset), resume_written_data, resume_written_length)) {
+		resume_written_length = 0;
+		return ERR_FAILURE;
+	}
+	if (DFU_RESUME_MAGIC != resume_record.magic) { // progress is only recorded for identified images
+		resume_written_length = 0;
+		return ERR_NONE;
+	}
+
+	if (offset != resume_chain_end) {
+		resume_chain_start = offset;
+	}
+	resume_chain_end = offset + resume_written_length;
+	resume_written_length = 0;
+	block = offset & ~(NVMCTRL_BLOCK_SIZE - 1);
+	if (block < resume_chain_start) { // the beginning of this block has not been verified
+		block += NVMCTRL_BLOCK_SIZE;
+	}
+	for (; block < resume_chain_end; block += NVMCTRL_BLOCK_SIZE) {
+		if ((block + NVMCTRL_BLOCK_SIZE <= resume_chain_end || resume_chain_end >= resume_record.image.dwImageSize)
+		    && !usb_dfu_resume_done(block)) {
+			resume_record.blocks[block / NVMCTRL_BLOCK_SIZE / 32] |= (1UL << (block / NVMCTRL_BLOCK_SIZE % 32));
+			resume_unsaved++;
+		}
+	}
+	usb_dfu_resume_report();
+	if (resume_unsaved >= CONF_USB_DFUD_RESUME_CHECKPOINT) {
+		return usb_dfu_resume_save();
+	}
+	return ERR_NONE;
+}
+
+/**
+ * \brief Discard the resume record once the image has been manifested
+ * \return Operation status
+ */
+static int32_t usb_dfu_resume_complete(void)
+{
+	if (DFU_RESUME_MAGIC != resume_record.magic) {
+		return ERR_NONE;
+	}
+	memset(&resume_record, 0, sizeof(resume_record));
+	usb_dfu_resume_report();
+	return usb_dfu_resume_save();
+}
+#endif
+
+/**
+ * \brief Wake up the main loop when the flash controller completed an operation
+ *
+ * Erasing ahead and verifying the written data continue without waiting for the next request from the host.
+ * \param[in] descr Flash descriptor
+ */
+static void usb_dfu_flash_ready(struct flash_descriptor* const descr)
+{
+	(void)descr;
+	dfudf_post_events(USB_DFU_EVENT_FLASH);
+}
+
+/**
+ * \brief Wait for the USB DFU stack to be ready and locate the application
+ */
+void usb_dfu_start(void)
+{
+	while (!dfudf_is_enabled()) { // wait for DFU to be installed
+		usb_dfu_wait(); // until the host sets the configuration (USB_DFU_EVENT_ENABLED)
+	}
+	LED_SYSTEM_on(); // switch LED on to indicate USB DFU stack is ready
+
+	ASSERT(hri_nvmctrl_read_STATUS_BOOTPROT_bf(FLASH_0.dev.hw) < NVM_BOOTPROT_MAX);
+	application_start_address = NVM_BOOTPROT_SIZE(hri_nvmctrl_read_STATUS_BOOTPROT_bf(FLASH_0.dev.hw)); // calculate bootloader size to know where we should write the application firmware
+	application_start_address += DFU_DOWNLOAD_BANK;
+#if CONF_USB_DFUD_STAGING_EN
+	staging_size = ((size_t)(DFU_STAGING_END - DFU_STAGING_START) / NVMCTRL_BLOCK_SIZE) * NVMCTRL_BLOCK_SIZE;
+	staging_offset = 0;
+	staging_length = 0;
+#endif
+#if CONF_USB_DFUD_PRE_ERASE_EN
+	memset(erased_blocks, 0, sizeof(erased_blocks));
+	program_end = 0;
+	download_end = 0;
+#endif
+#if CONF_USB_DFUD_DFUSE_EN
+	memset(dfuse_erased_pages, 0, sizeof(dfuse_erased_pages));
+	dfu_address_pointer = application_start_address - DFU_DOWNLOAD_BANK; // the start of the application, until the host sets the address
+#endif
+#if CONF_USB_DFUD_RESUME_EN
+	usb_dfu_resume_load();
+#endif
+#if CONF_USB_DFUD_RESUME_EN && CONF_USB_DFUD_BLOCK_CRC_EN
+	hri_pac_write_WRCTRL_reg(PAC, PAC_WRCTRL_PERID(ID_DSU) | PAC_WRCTRL_KEY_CLR); // the DSU is write-protected after reset
+#endif
+	flash_register_callback(&FLASH_0, FLASH_CB_READY, usb_dfu_flash_ready); // enable the NVMCTRL DONE interrupt
+#if CONF_QSPI_ENABLE
+	ASSERT(QSPI_PAGE_BUFFER + CONF_QSPI_NOR_PAGE_SIZE <= DFU_STAGING_END);
+	qspi_queue_head = 0;
+	qspi_queue_count = 0;
+	qspi_error = ERR_NONE;
+	qspi_present = _qspi_nor_init(&QSPI_INSTANCE); // downloads to the QSPI flash fail if it is missing
+#endif
+#if CONF_AES_ENABLE
+	_aes_sync_set_key(&CRYPTOGRAPHY_0, decrypt_key, CONF_AES_KEYSIZE);
+	decrypt_ready = false;
+#endif
+#if CONF_USB_MSCD_UF2_EN
+	uf2_current_blocks = (DFU_BANK_SIZE - (application_start_address - DFU_DOWNLOAD_BANK)) / UF2_BLOCK_PAYLOAD;
+	ASSERT(UF2_DATA_START + 1 + uf2_current_blocks <= CONF_USB_MSCD_UF2_SECTORS); // INFO_UF2.TXT and CURRENT.UF2 fit
+	uf2_num_blocks = 0;
+	uf2_flash_offset = UF2_NO_BLOCK;
+	uf2_reset_pending = false;
+#endif
+}
+
+#if CONF_USB_DFUD_STAGING_EN || CONF_USB_DFUD_DUAL_BANK_EN || CONF_USB_MSCD_UF2_EN
+/**
+ * \brief Check the vector table of the downloaded application (see check_application in usb_dfu_main.c)
+ * \param[in] vectors Initial stack pointer and reset handler entries of the vector table
+ * \return true if the stack pointer is in RAM and the reset handler in the application region, once running
+ */
+static bool usb_dfu_check_vectors(const uint32_t* vectors)
+{
+	return HSRAM_ADDR == (vectors[0] & 0xFFF80000) && vectors[1] >= application_start_address - DFU_DOWNLOAD_BANK
+	       && vectors[1] < DFU_BANK_SIZE;
+}
+#endif
+
+#if CONF_USB_DFUD_PRE_ERASE_EN
+void usb_dfu_pre_erase(void)
+{
+	pre_erase_armed = true;
+}
+
+/**
+ * \brief Check if a block has been erased during this download
+ * \param[in] offset Offset of the block in the application region
+ */
+static bool usb_dfu_block_erased(uint32_t offset)
+{
+	offset /= NVMCTRL_BLOCK_SIZE;
+	return erased_blocks[offset / 32] & (1UL << (offset % 32));
+}
+
+/**
+ * \brief Mark a block as erased, or as programmed
+ * \param[in] offset Offset of the block in the application region
+ * \param[in] erased If the block is erased
+ */
+static void usb_dfu_block_set_erased(uint32_t offset, bool erased)
+{
+	offset /= NVMCTRL_BLOCK_SIZE;
+	if (erased) {
+		erased_blocks[offset / 32] |= (1UL << (offset % 32));
+	} else {
+		erased_blocks[offset / 32] &= ~(1UL << (offset % 32));
+	}
+}
+
+/**
+ * \brief Erase a block of the application region unless it already is, without waiting for the erase to complete
+ * \param[in] offset Offset of the block in the application region
+ * \return Operation status
+ */
+static int32_t usb_dfu_block_erase(uint32_t offset)
+{
+	int32_t rc = ERR_NONE;
+
+	if (!usb_dfu_block_erased(offset)) {
+		rc = flash_erase(&FLASH_0, application_start_address + offset, NVMCTRL_BLOCK_SIZE / NVMCTRL_PAGE_SIZE); // only issues the command: the next flash operation waits for the erase to complete
+		if (ERR_NONE == rc) {
+			usb_dfu_block_set_erased(offset, true);
+		}
+	}
+	return rc;
+}
+
+/**
+ * \brief Account for downloaded data, which also allows erasing ahead of it
+ * \param[in] offset Offset of the data in the application region
+ * \param[in] length Length of the data
+ */
+static void usb_dfu_pre_erase_download(uint32_t offset, uint16_t length)
+{
+	uint32_t block;
+
+	if (0 == offset) { // (re)start of a download: only the blocks after the programmed data are still erased
+		for (block = 0; block < program_end; block += NVMCTRL_BLOCK_SIZE) {
+			usb_dfu_block_set_erased(block, false);
+		}
+		program_end = 0;
+		download_end = 0;
+	}
+	pre_erase_armed = true;
+	if (offset + length > download_end) {
+		download_end = offset + length;
+	}
+}
+
+/**
+ * \brief Record programmed data
+ * \param[in] offset Offset of the data in the application region
+ * \param[in] length Length of the data
+ */
+static void usb_dfu_pre_erase_program(uint32_t offset, uint32_t length)
+{
+	offset += length;
+	offset = (offset + NVMCTRL_PAGE_SIZE - 1) & ~(NVMCTRL_PAGE_SIZE - 1); // the rest of the page can't be programmed again
+	if (offset > program_end) {
+		program_end = offset;
+	}
+}
+
+/**
+ * \brief Start erasing the next block ahead of the downloaded data, if the NVMCTRL is not busy
+ */
+static void usb_dfu_erase_ahead(void)
+{
+	const uint32_t region_size = NVM_FLASH_SIZE - application_start_address;
+	uint32_t offset = (program_end + NVMCTRL_BLOCK_SIZE - 1) & ~(NVMCTRL_BLOCK_SIZE - 1); // never erase programmed data
+	uint32_t end = ((download_end + NVMCTRL_BLOCK_SIZE - 1) & ~(NVMCTRL_BLOCK_SIZE - 1)) + CONF_USB_DFUD_PRE_ERASE_BLOCKS * NVMCTRL_BLOCK_SIZE;
+
+	if (!pre_erase_armed || !hri_nvmctrl_get_STATUS_reg(FLASH_0.dev.hw, NVMCTRL_STATUS_READY)) { // don't wait for the previous erase, the download has precedence
+		return;
+	}
+	if (end > region_size) {
+		end = region_size;
+	}
+	for (; offset < end; offset += NVMCTRL_BLOCK_SIZE) {
+#if CONF_USB_DFUD_RESUME_EN
+		if (usb_dfu_resume_done(offset)) { // the host will not download this block again
+			continue;
+		}
+#endif
+		if (!usb_dfu_block_erased(offset)) {
+			if (ERR_NONE != usb_dfu_block_erase(offset)) {
+				pre_erase_armed = false; // the download will report the error
+			}
+			return; // one block at a time
+		}
+	}
+}
+
+/**
+ * \brief Write downloaded data in flash, without erasing when the pages have been erased during this download
+ * \param[in] offset Offset of the data in the application region
+ * \param[in] data Downloaded data
+ * \param[in] length Length of the data
+ * \return Operation status
+ */
+static int32_t usb_dfu_write(uint32_t offset, uint8_t* data, uint16_t length)
+{
+	const uint32_t block = offset & ~(NVMCTRL_BLOCK_SIZE - 1);
+	int32_t rc;
+
+	if (application_start_address + offset + length > NVM_FLASH_SIZE) {
+		return ERR_BAD_ADDRESS;
+	}
+	if (offset >= program_end && offset + length <= block + NVMCTRL_BLOCK_SIZE && (offset == block || usb_dfu_block_erased(block))) { // the pages are erased, or the whole block can be
+		rc = usb_dfu_block_erase(block);
+		if (ERR_NONE == rc) {
+			rc = flash_append(&FLASH_0, application_start_address + offset, data, length);
+		}
+	} else { // read-modify-write the blocks, which leaves their pages programmed
+		uint32_t i;
+		for (i = block; i < offset + length; i += NVMCTRL_BLOCK_SIZE) {
+			usb_dfu_block_set_erased(i, false);
+		}
+		rc = flash_write(&FLASH_0, application_start_address + offset, data, length);
+	}
+	usb_dfu_pre_erase_program(offset, length);
+	return rc;
+}
+#endif
+
+#if CONF_USB_DFUD_DFUSE_EN
+/**
+ * \brief Locate data given by its DfuSe address in the application region
+ * \param[in] address Address of the data, as the application is linked (in the active bank for dual-bank updates)
+ * \param[in] length Length of the data
+ * \param[out] offset Offset of the data in the application region
+ * \return ERR_NONE, or ERR_BAD_ADDRESS if the data is not in the application region
+ */
+static int32_t usb_dfu_dfuse_offset(uint32_t address, uint32_t length, uint32_t* offset)
+{
+	const uint32_t start = application_start_address - DFU_DOWNLOAD_BANK; // the flash is at address 0
+	const uint32_t end = DFU_BANK_SIZE;
+
+	if (address < start || address >= end || length > end - address) {
+		return ERR_BAD_ADDRESS;
+	}
+	*offset = address - start;
+	return ERR_NONE;
+}
+
+/**
+ * \brief Check if a page has been erased by a DfuSe command and not written since
+ * \param[in] offset Offset of the page in the application region
+ */
+static bool usb_dfu_dfuse_page_erased(uint32_t offset)
+{
+	offset /= NVMCTRL_PAGE_SIZE;
+	return dfuse_erased_pages[offset / 32] & (1UL << (offset % 32));
+}
+
+/**
+ * \brief Mark the pages of a range as erased, or as written
+ * \param[in] offset Offset of the first page in the application region (page aligned)
+ * \param[in] end End of the range
+ * \param[in] erased If the pages are erased
+ */
+static void usb_dfu_dfuse_set_erased(uint32_t offset, uint32_t end, bool erased)
+{
+	for (offset /= NVMCTRL_PAGE_SIZE; offset * NVMCTRL_PAGE_SIZE < end; offset++) {
+		if (erased) {
+			dfuse_erased_pages[offset / 32] |= (1UL << (offset % 32));
+		} else {
+			dfuse_erased_pages[offset / 32] &= ~(1UL << (offset % 32));
+		}
+	}
+}
+
+/**
+ * \brief Erase the blocks of the application region holding a range, skipping the ones still erased
+ * \param[in] offset Offset of the range in the application region
+ * \param[in] length Length of the range
+ * \return Operation status
+ */
+static int32_t usb_dfu_dfuse_erase(uint32_t offset, uint32_t length)
+{
+	uint32_t block;
+	uint32_t page;
+	int32_t rc = ERR_NONE;
+
+	for (block = offset & ~(NVMCTRL_BLOCK_SIZE - 1); block < offset + length && ERR_NONE == rc; block += NVMCTRL_BLOCK_SIZE) {
+		for (page = block; page < block + NVMCTRL_BLOCK_SIZE && usb_dfu_dfuse_page_erased(page); page += NVMCTRL_PAGE_SIZE);
+		if (page < block + NVMCTRL_BLOCK_SIZE) { // some pages have been written, or are not known to be erased
+			rc = flash_erase(&FLASH_0, application_start_address + block, NVMCTRL_BLOCK_SIZE / NVMCTRL_PAGE_SIZE); // the next flash operation waits for the erase to complete
+			if (ERR_NONE == rc) {
+				usb_dfu_dfuse_set_erased(block, block + NVMCTRL_BLOCK_SIZE, true);
+			}
+		}
+	}
+	return rc;
+}
+
+/**
+ * \brief Run a DfuSe command
+ * \param[in] command Command byte, followed by its argument
+ * \param[in] length Length of the command
+ * \return Operation status, ERR_UNSUPPORTED_OP for commands which are not supported or malformed
+ */
+static int32_t usb_dfu_dfuse_command(const uint8_t* command, uint16_t length)
+{
+	const uint32_t region_size = DFU_BANK_SIZE - (application_start_address - DFU_DOWNLOAD_BANK);
+	const uint32_t address = (5 == length) ? (command[1] | (command[2] << 8) | (command[3] << 16) | ((uint32_t)command[4] << 24)) : 0;
+	uint32_t offset;
+	int32_t rc;
+
+	if (USB_DFUSE_CMD_SET_ADDRESS == command[0] && 5 == length) {
+		rc = usb_dfu_dfuse_offset(address, 0, &offset);
+		if (ERR_NONE == rc) {
+			dfu_address_pointer = address;
+		}
+	} else if (USB_DFUSE_CMD_ERASE == command[0] && 5 == length) { // the block holding the address, the erase unit of the NVMCTRL
+		rc = usb_dfu_dfuse_offset(address, 1, &offset);
+		if (ERR_NONE == rc) {
+			rc = usb_dfu_dfuse_erase(offset, 1);
+		}
+	} else if (USB_DFUSE_CMD_ERASE == command[0] && 1 == length) { // mass erase, of the application region only
+		rc = usb_dfu_dfuse_erase(0, region_size);
+	} else { // USB_DFUSE_CMD_READ_UNPROTECT is not supported either
+		rc = ERR_UNSUPPORTED_OP;
+	}
+	return rc;
+}
+
+/**
+ * \brief Write downloaded data at its DfuSe address, without erasing again the pages erased by a command
+ * \param[in] address Address of the data
+ * \param[in] data Downloaded data
+ * \param[in] length Length of the data
+ * \return Operation status
+ */
+static int32_t usb_dfu_dfuse_write(uint32_t address, uint8_t* data, uint16_t length)
+{
+	uint32_t offset;
+	uint32_t page;
+	int32_t rc;
+
+	rc = usb_dfu_dfuse_offset(address, length, &offset);
+	if (ERR_NONE != rc) {
+		return rc;
+	}
+	for (page = offset & ~(NVMCTRL_PAGE_SIZE - 1); page < offset + length && usb_dfu_dfuse_page_erased(page); page += NVMCTRL_PAGE_SIZE);
+	if (page >= offset + length) { // all the pages are erased
+		rc = flash_append(&FLASH_0, application_start_address + offset, data, length);
+		usb_dfu_dfuse_set_erased(offset & ~(NVMCTRL_PAGE_SIZE - 1), offset + length, false); // a page can only be written once
+	} else { // read-modify-write the blocks, which leaves their pages written
+		rc = flash_write(&FLASH_0, application_start_address + offset, data, length);
+		usb_dfu_dfuse_set_erased(offset & ~(NVMCTRL_BLOCK_SIZE - 1), (offset + length + NVMCTRL_BLOCK_SIZE - 1) & ~(NVMCTRL_BLOCK_SIZE - 1), false);
+	}
+	return rc;
+}
+#endif
+
+#if CONF_USB_DFUD_STAGING_EN
+/**
+ * \brief Check and program the staged data in one pass of block erases and page writes
+ * \return Operation status
+ */
+static int32_t usb_dfu_program(void)
+{
+	const uint8_t* staged = DFU_STAGING_START;
+	const uint32_t start = application_start_address + staging_offset;
+	uint32_t i, j, length;
+	int32_t rc;
+
+	if (0 == staging_length) {
+		return ERR_NONE;
+	}
+	if (0 == staging_offset && (staging_length < 8 || !usb_dfu_check_vectors((const uint32_t*)staged))) { // check the image before touching the flash
+		return ERR_INVALID_DATA;
+	}
+
+	for (i = 0; i < staging_length; i += NVMCTRL_BLOCK_SIZE) {
+		rc = flash_erase(&FLASH_0, start + i, NVMCTRL_BLOCK_SIZE / NVMCTRL_PAGE_SIZE);
+		if (ERR_NONE != rc) {
+			return rc;
+		}
+		for (j = i; j < i + NVMCTRL_BLOCK_SIZE && j < staging_length; j += NVMCTRL_PAGE_SIZE) {
+			length = min(NVMCTRL_PAGE_SIZE, staging_length - j);
+			uint32_t k;
+			for (k = 0; k < length && 0xFF == staged[j + k]; k++); // erased pages do not need to be written
+			if (k < length) {
+				rc = flash_append(&FLASH_0, start + j, (uint8_t*)&staged[j], length);
+				if (ERR_NONE != rc) {
+					return rc;
+				}
+			}
+		}
+	}
+	_flash_wait_ready(&FLASH_0.dev); // the last page write must have completed
+	if (0 != memcmp((const void*)(FLASH_ADDR + start), staged, staging_length)) { // verify the programmed data
+		return ERR_FAILURE;
+	}
+
+	staging_offset += staging_length;
+	staging_length = 0;
+	return ERR_NONE;
+}
+
+/**
+ * \brief Copy downloaded data in the staging area
+ *
+ * The download must be sequential. When the staging area is full, the staged data is programmed first.
+ * \param[in] offset Offset of the data in the application region
+ * \param[in] data Downloaded data
+ * \param[in] length Length of the data
+ * \return Operation status
+ */
+static int32_t usb_dfu_stage(size_t offset, const uint8_t* data, uint16_t length)
+{
+	if (application_start_address + offset + length > NVM_FLASH_SIZE) {
+		return ERR_BAD_ADDRESS;
+	}
+	if (0 == offset) { // (re)start of a download
+		staging_offset = 0;
+		staging_length = 0;
+	}
+	if (offset + length > staging_offset + staging_size) { // the staging area is full
+		if (offset != staging_offset + staging_size || staging_length != staging_size) { // only continue sequential downloads
+			return ERR_BAD_ADDRESS;
+		}
+		int32_t rc = usb_dfu_program();
+		if (ERR_NONE != rc) {
+			return rc;
+		}
+	}
+	if (offset < staging_offset || offset > staging_offset + staging_length) { // the data must follow the staged data (or be sent again)
+		return ERR_BAD_ADDRESS;
+	}
+	_dma_copy(DFU_STAGING_START + (offset - staging_offset), data, length);
+	if (offset + length > staging_offset + staging_length) {
+		staging_length = offset + length - staging_offset;
+	}
+	return ERR_NONE;
+}
+#endif
+
+#if CONF_QSPI_ENABLE
+/**
+ * \brief Read-modify-write the sector of a page of the QSPI flash, waiting for the flash
+ * \param[in] addr Address of the data in the QSPI flash
+ * \param[in] data Data to write
+ * \param[in] length Length of the data, not crossing a page boundary
+ * \return Operation status
+ */
+static int32_t usb_dfu_qspi_rewrite_sector(uint32_t addr, const uint8_t* data, uint16_t length)
+{
+	const uint32_t sector = addr & ~(CONF_QSPI_NOR_SECTOR_SIZE - 1);
+	uint8_t* const buffer = QSPI_SECTOR_BUFFER;
+	uint32_t i, j;
+	int32_t rc;
+
+	rc = _qspi_nor_read(&QSPI_INSTANCE, sector, buffer, CONF_QSPI_NOR_SECTOR_SIZE);
+	if (ERR_NONE == rc) {
+		_dma_copy(buffer + (addr - sector), data, length);
+		rc = _qspi_nor_erase(&QSPI_INSTANCE, sector, CONF_QSPI_NOR_SECTOR_SIZE);
+	}
+	for (i = 0; i < CONF_QSPI_NOR_SECTOR_SIZE && ERR_NONE == rc; i += CONF_QSPI_NOR_PAGE_SIZE) {
+		for (j = 0; j < CONF_QSPI_NOR_PAGE_SIZE && 0xFF == buffer[i + j]; j++); // erased pages do not need to be programmed
+		if (j < CONF_QSPI_NOR_PAGE_SIZE) {
+			rc = _qspi_nor_program(&QSPI_INSTANCE, sector + i, buffer + i, CONF_QSPI_NOR_PAGE_SIZE);
+		}
+	}
+	for (i = 0; i < CONF_QSPI_NOR_SECTOR_SIZE && ERR_NONE == rc; i += CONF_QSPI_NOR_PAGE_SIZE) { // verify the programmed data
+		rc = _qspi_nor_read(&QSPI_INSTANCE, sector + i, QSPI_PAGE_BUFFER, CONF_QSPI_NOR_PAGE_SIZE);
+		if (ERR_NONE == rc && 0 != memcmp(QSPI_PAGE_BUFFER, buffer + i, CONF_QSPI_NOR_PAGE_SIZE)) {
+			rc = ERR_FAILURE;
+		}
+	}
+	return rc;
+}
+
+/**
+ * \brief Write the next page of the write queue, without waiting for the QSPI flash
+ *
+ * Pages already holding the data are skipped, and pages where bits only need to be cleared are programmed right away.
+ * Else the block (or sector) is erased when the data starts it, since the download rewrites it from there, or the sector is read-modify-written.
+ * Once the flash is ready again, the page is read back to check it.
+ * \return Operation status
+ * \retval ERR_BUSY Nothing to do until the flash is ready, or the queue is empty
+ */
+static int32_t usb_dfu_qspi_step(void)
+{
+	struct usb_dfu_qspi_entry* const entry = &qspi_queue[qspi_queue_head];
+	const uint8_t* const data = QSPI_QUEUE_DATA(qspi_queue_head) + entry->done;
+	const uint8_t* const flash = QSPI_PAGE_BUFFER;
+	const uint32_t addr = CONF_USB_DFUD_QSPI_OFFSET + entry->offset + entry->done;
+	const uint16_t length = min(CONF_QSPI_NOR_PAGE_SIZE - addr % CONF_QSPI_NOR_PAGE_SIZE, entry->length - entry->done);
+	const uint32_t block = addr & ~(CONF_QSPI_NOR_BLOCK_SIZE - 1);
+	uint16_t i;
+	int32_t rc;
+
+	if (0 == qspi_queue_count || _qspi_nor_is_busy(&QSPI_INSTANCE)) { // don't wait for the flash, the download has precedence
+		return ERR_BUSY;
+	}
+	rc = _qspi_nor_read(&QSPI_INSTANCE, addr, QSPI_PAGE_BUFFER, length);
+	if (ERR_NONE != rc) {
+		return rc;
+	}
+	if (0 == memcmp(flash, data, length)) { // the page already holds the data, or has been programmed with it
+		entry->programmed = false;
+		entry->erased = false;
+		entry->done += length;
+	} else if (entry->programmed) { // the programmed page does not hold the data
+		return ERR_FAILURE;
+	} else {
+		for (i = 0; i < length && (flash[i] & data[i]) == data[i]; i++);
+		if (i == length) { // only bits at 1 have to be cleared
+			rc = _qspi_nor_program(&QSPI_INSTANCE, addr, data, length);
+			entry->programmed = (ERR_NONE == rc);
+		} else if (entry->erased) { // the erase failed
+			return ERR_FAILURE;
+		} else if (addr == block && block >= CONF_USB_DFUD_QSPI_OFFSET
+		           && block + CONF_QSPI_NOR_BLOCK_SIZE <= CONF_USB_DFUD_QSPI_OFFSET + CONF_USB_DFUD_QSPI_SIZE) {
+			rc = _qspi_nor_erase(&QSPI_INSTANCE, block, CONF_QSPI_NOR_BLOCK_SIZE); // the page is programmed at the next step
+			entry->erased = true;
+		} else if (0 == addr % CONF_QSPI_NOR_SECTOR_SIZE) {
+			rc = _qspi_nor_erase(&QSPI_INSTANCE, addr, CONF_QSPI_NOR_SECTOR_SIZE);
+			entry->erased = true;
+		} else { // the beginning of the sector must be kept
+			rc = usb_dfu_qspi_rewrite_sector(addr, data, length);
+			if (ERR_NONE == rc) {
+				entry->done += length;
+			}
+		}
+	}
+	if (entry->done >= entry->length) { // the data of the entry is in flash
+		qspi_queue_head = (qspi_queue_head + 1) % CONF_USB_DFUD_QSPI_QUEUE;
+		qspi_queue_count--;
+	}
+	return rc;
+}
+
+/**
+ * \brief Continue writing the write queue in the QSPI flash, until the flash is busy
+ *
+ * Checking a page and starting to program the next one take a single call, so that the flash is not left idle until the next one.
+ * After an error, the rest of the queue is discarded: the download failed.
+ * \return Operation status
+ */
+static int32_t usb_dfu_qspi_service(void)
+{
+	int32_t rc;
+
+	while (ERR_NONE == (rc = usb_dfu_qspi_step()));
+	if (ERR_BUSY == rc) {
+		return ERR_NONE;
+	}
+	qspi_queue_count = 0;
+	return rc;
+}
+
+/**
+ * \brief Write the whole write queue in the QSPI flash, waiting for it
+ * \return Operation status, including errors of the background writes
+ */
+static int32_t usb_dfu_qspi_drain(void)
+{
+	int32_t rc = qspi_error;
+
+	qspi_error = ERR_NONE;
+	while (ERR_NONE == rc && qspi_queue_count > 0) {
+		rc = usb_dfu_qspi_service();
+	}
+	return rc;
+}
+
+/**
+ * \brief Queue downloaded data to be written in the QSPI flash, waiting for a free entry if the queue is full
+ * \param[in] offset Offset of the data in the QSPI region
+ * \param[in] data Downloaded data
+ * \param[in] length Length of the data
+ * \return Operation status, including errors of the background writes
+ */
+static int32_t usb_dfu_qspi_enqueue(uint32_t offset, const uint8_t* data, uint16_t length)
+{
+	struct usb_dfu_qspi_entry* entry;
+	uint8_t i;
+	int32_t rc = qspi_error;
+
+	qspi_error = ERR_NONE;
+	if (ERR_NONE != rc) {
+		return rc;
+	}
+	if (ERR_NONE != qspi_present) {
+		return ERR_DENIED;
+	}
+	if (offset + length > CONF_USB_DFUD_QSPI_SIZE) {
+		return ERR_BAD_ADDRESS;
+	}
+	while (CONF_USB_DFUD_QSPI_QUEUE == qspi_queue_count) {
+		rc = usb_dfu_qspi_service();
+		if (ERR_NONE != rc) {
+			return rc;
+		}
+	}
+	i = (qspi_queue_head + qspi_queue_count) % CONF_USB_DFUD_QSPI_QUEUE;
+	entry = &qspi_queue[i];
+	_dma_copy(QSPI_QUEUE_DATA(i), data, length);
+	entry->offset = offset;
+	entry->length = length;
+	entry->done = 0;
+	entry->programmed = false;
+	entry->erased = false;
+	qspi_queue_count++;
+	return ERR_NONE;
+}
+#endif
+
+#if CONF_AES_ENABLE
+/**
+ * \brief Decrypt the downloaded data of an encrypted image in place, before it is written
+ *
+ * The header in the first transfer is checked and consumed, leaving no data to write.
+ * The offset of the other transfers becomes the one of their data in the payload.
+ * \param[in,out] job Download job
+ * \return Operation status
+ */
+static int32_t usb_dfu_decrypt(struct usb_dfu_job* job)
+{
+	uint32_t offset;
+
+	if (0 == job->offset) { // (re)start of a download
+		decrypt_ready = false;
+		if (job->length < sizeof(decrypt_header)) {
+			return ERR_INVALID_DATA;
+		}
+		memcpy(&decrypt_header, job->data, sizeof(decrypt_header));
+		if (USB_DFU_ENCRYPTED_MAGIC != decrypt_header.dwMagic || USB_DFU_ENCRYPTED_VERSION != decrypt_header.bVersion) {
+			return ERR_INVALID_DATA;
+		}
+		if (USB_DFU_ENCRYPTED_GCM == decrypt_header.bMode) { // the header is authenticated too
+			_aes_sync_gcm_start(&CRYPTOGRAPHY_0, decrypt_header.bIV, (const uint8_t*)&decrypt_header, offsetof(usb_dfu_encrypted_header_t, bTag));
+		} else if (USB_DFU_ENCRYPTED_CTR != decrypt_header.bMode || !CONF_USB_DFUD_DECRYPT_CTR_EN) {
+			return ERR_INVALID_DATA;
+		}
+		decrypt_next = 0;
+		decrypt_ready = true;
+		job->length = 0;
+		return ERR_NONE;
+	}
+	if (!decrypt_ready) {
+		return ERR_INVALID_DATA;
+	}
+	offset = job->offset - USB_DFU_DECRYPT_HEADER_SIZE;
+	if (offset + job->length > decrypt_header.dwLength) { // beyond the payload
+		return ERR_INVALID_DATA;
+	}
+	job->offset = offset;
+	if (USB_DFU_ENCRYPTED_GCM == decrypt_header.bMode) {
+		if (offset != decrypt_next) { // the tag covers the data in order
+			return ERR_INVALID_DATA;
+		}
+		decrypt_next += job->length;
+		return _aes_sync_gcm_decrypt(&CRYPTOGRAPHY_0, job->data, job->data, job->length);
+	}
+	if (offset + job->length > decrypt_next) {
+		decrypt_next = offset + job->length;
+	}
+	return _aes_sync_ctr_crypt(&CRYPTOGRAPHY_0, decrypt_header.bIV, offset, job->data, job->data, job->length);
+}
+
+/**
+ * \brief Check that the whole payload of the encrypted image has been downloaded, and its GCM tag
+ * \return ERR_NONE if the image can be used, else ERR_INVALID_DATA
+ */
+static int32_t usb_dfu_decrypt_check(void)
+{
+	uint8_t tag[AES_BLOCK_SIZE];
+	uint8_t diff = 0;
+	uint8_t i;
+
+	if (!decrypt_ready || decrypt_next != decrypt_header.dwLength) { // no header, or truncated payload
+		return ERR_INVALID_DATA;
+	}
+	decrypt_ready = false; // the next download needs a header again
+	if (USB_DFU_ENCRYPTED_GCM != decrypt_header.bMode) {
+		return ERR_NONE;
+	}
+	_aes_sync_gcm_finish(&CRYPTOGRAPHY_0, tag);
+	for (i = 0; i < AES_BLOCK_SIZE; i++) { // in constant time
+		diff |= tag[i] ^ decrypt_header.bTag[i];
+	}
+	return (0 == diff) ? ERR_NONE : ERR_INVALID_DATA;
+}
+
+/**
+ * \brief Make sure the written data of a rejected encrypted image is not used
+ *
+ * The first flash block of the image is erased, so that the application (or the QSPI flash content) is not valid.
+ * An image staged in RAM and not programmed yet is only discarded, keeping the previous application.
+ * \warning Without staging, the rest of the rejected image stays in flash (in the inactive bank with dual-bank updates)
+ * \param[in] alt Alternate setting of the download
+ */
+static void usb_dfu_decrypt_invalidate(uint8_t alt)
+{
+#if CONF_QSPI_ENABLE
+	if (USB_DFUD_ALT_QSPI == alt) {
+		usb_dfu_qspi_drain(); // the queued data would be written afterwards
+		_qspi_nor_erase(&QSPI_INSTANCE, CONF_USB_DFUD_QSPI_OFFSET, CONF_QSPI_NOR_SECTOR_SIZE);
+		return;
+	}
+	usb_dfu_qspi_drain();
+#else
+	(void)alt;
+#endif
+#if CONF_USB_DFUD_STAGING_EN
+	if (0 == staging_offset) { // nothing has been programmed
+		staging_length = 0;
+		return;
+	}
+	staging_length = 0;
+#endif
+	flash_erase(&FLASH_0, application_start_address, NVMCTRL_BLOCK_SIZE / NVMCTRL_PAGE_SIZE);
+}
+#endif
+
+#if CONF_USB_MSCD_UF2_EN
+/** Standard INQUIRY data: removable direct access block device */
+static const uint8_t uf2_inquiry[36] = {0x00, 0x80, 0x04, 0x02, 36 - 5, 0x00, 0x00, 0x00,
+                                        'o', 's', 'm', 'o', 'c', 'o', 'm', ' ', // vendor
+                                        'U', 'F', '2', ' ', 'B', 'o', 'o', 't', 'l', 'o', 'a', 'd', 'e', 'r', ' ', ' ', // product
+                                        '1', '.', '0', '0'}; // revision
+/** READ CAPACITY(10) data: last sector and sector size, big-endian */
+static const uint8_t uf2_capacity[8] = {(uint8_t)((CONF_USB_MSCD_UF2_SECTORS - 1) >> 24), (uint8_t)((CONF_USB_MSCD_UF2_SECTORS - 1) >> 16),
+                                        (uint8_t)((CONF_USB_MSCD_UF2_SECTORS - 1) >> 8), (uint8_t)(CONF_USB_MSCD_UF2_SECTORS - 1),
+                                        0x00, 0x00, (uint8_t)(MSCDF_BLOCK_SIZE >> 8), (uint8_t)MSCDF_BLOCK_SIZE};
+/** Content of INFO_UF2.TXT */
+static const char uf2_info[] = "UF2 Bootloader " CONF_USB_DFUD_IPRODUCT_STR "\r\n"
+                               "Model: " CONF_USB_DFUD_IPRODUCT_STR "\r\n"
+                               "Board-ID: " CONF_USB_MSCD_UF2_BOARD_ID "\r\n";
+
+static uint8_t* usb_dfu_msc_inquiry(uint8_t lun)
+{
+	(void)lun;
+	return (uint8_t*)uf2_inquiry; // only read, copied by the MSC function
+}
+
+static uint8_t* usb_dfu_msc_capacity(uint8_t lun)
+{
+	(void)lun;
+	return (uint8_t*)uf2_capacity;
+}
+
+/**
+ * \brief Hand a READ(10) or WRITE(10) command over to the main loop (called from the USB interrupt)
+ * \param[in] read true for READ(10)
+ * \param[in] addr First sector
+ * \param[in] nblocks Number of sectors
+ * \return Operation status
+ */
+static int32_t usb_dfu_msc_start(bool read, uint32_t addr, uint32_t nblocks)
+{
+	if (addr >= CONF_USB_MSCD_UF2_SECTORS || nblocks > CONF_USB_MSCD_UF2_SECTORS - addr) {
+		return ERR_BAD_ADDRESS;
+	}
+	msc_command_read = read;
+	msc_command_lba = addr;
+	msc_command_sectors = nblocks;
+	msc_command = true;
+	dfudf_post_events(USB_DFU_EVENT_MSC);
+	return ERR_NONE;
+}
+
+static int32_t usb_dfu_msc_read(uint8_t lun, uint32_t addr, uint32_t nblocks)
+{
+	(void)lun;
+	return usb_dfu_msc_start(true, addr, nblocks);
+}
+
+static int32_t usb_dfu_msc_write(uint8_t lun, uint32_t addr, uint32_t nblocks)
+{
+	(void)lun;
+	return usb_dfu_msc_start(false, addr, nblocks);
+}
+
+static int32_t usb_dfu_msc_xfer_done(uint8_t lun)
+{
+	(void)lun;
+	msc_xfer_done = true;
+	dfudf_post_events(USB_DFU_EVENT_MSC);
+	return ERR_NONE;
+}
+
+static void usb_dfu_msc_status_sent(uint8_t lun)
+{
+	(void)lun;
+	msc_status_sent = true;
+	if (uf2_reset_pending) { // the main loop resets the device
+		dfudf_post_events(USB_DFU_EVENT_MSC);
+	}
+}
+
+/**
+ * \brief Install the mass storage function, before the USB device stack starts
+ */
+static void usb_dfu_uf2_init(void)
+{
+	mscdf_init();
+	mscdf_register_callback(MSCDF_CB_INQUIRY_DISK, (FUNC_PTR)usb_dfu_msc_inquiry);
+	mscdf_register_callback(MSCDF_CB_GET_DISK_CAPACITY, (FUNC_PTR)usb_dfu_msc_capacity);
+	mscdf_register_callback(MSCDF_CB_START_READ_DISK, (FUNC_PTR)usb_dfu_msc_read);
+	mscdf_register_callback(MSCDF_CB_START_WRITE_DISK, (FUNC_PTR)usb_dfu_msc_write);
+	mscdf_register_callback(MSCDF_CB_XFER_BLOCKS_DONE, (FUNC_PTR)usb_dfu_msc_xfer_done);
+	mscdf_register_callback(MSCDF_CB_STATUS_SENT, (FUNC_PTR)usb_dfu_msc_status_sent);
+}
+
+static void usb_dfu_uf2_put16(uint8_t* ptr, uint16_t value)
+{
+	ptr[0] = (uint8_t)value;
+	ptr[1] = (uint8_t)(value >> 8);
+}
+
+static void usb_dfu_uf2_put32(uint8_t* ptr, uint32_t value)
+{
+	usb_dfu_uf2_put16(ptr, (uint16_t)value);
+	usb_dfu_uf2_put16(ptr + 2, (uint16_t)(value >> 16));
+}
+
+/**
+ * \brief Fill a directory entry
+ * \param[out] entry Directory entry (32 bytes, zeroed)
+ * \param[in] name Name and extension, padded with spaces (11 characters)
+ * \param[in] attr Attributes
+ * \param[in] cluster First cluster
+ * \param[in] size File size
+ */
+static void usb_dfu_uf2_dir_entry(uint8_t* entry, const char* name, uint8_t attr, uint16_t cluster, uint32_t size)
+{
+	memcpy(entry, name, 11);
+	entry[11] = attr;
+	usb_dfu_uf2_put16(&entry[16], UF2_FAT_DATE); // creation
+	usb_dfu_uf2_put16(&entry[18], UF2_FAT_DATE); // last access
+	usb_dfu_uf2_put16(&entry[24], UF2_FAT_DATE); // last modification
+	usb_dfu_uf2_put16(&entry[26], cluster);
+	usb_dfu_uf2_put32(&entry[28], size);
+}
+
+/**
+ * \brief Generate a sector of the virtual volume
+ * \param[in] lba Sector
+ * \param[out] sector Sector content
+ */
+static void usb_dfu_uf2_read_sector(uint32_t lba, uint8_t* sector)
+{
+	char label[11];
+
+	memset(sector, 0, MSCDF_BLOCK_SIZE);
+	memset(label, ' ', sizeof(label));
+	memcpy(label, CONF_USB_MSCD_UF2_LABEL, min(sizeof(CONF_USB_MSCD_UF2_LABEL) - 1, sizeof(label)));
+	if (0 == lba) { // boot sector, with the BIOS parameter block of FAT16
+		static const uint8_t jump[11] = {0xEB, 0x3C, 0x90, 'U', 'F', '2', ' ', 'U', 'F', '2', ' '}; // jump, OEM name
+		memcpy(sector, jump, sizeof(jump));
+		usb_dfu_uf2_put16(&sector[11], MSCDF_BLOCK_SIZE);
+		sector[13] = 1; // sectors per cluster
+		usb_dfu_uf2_put16(&sector[14], 1); // reserved sectors
+		sector[16] = 2; // FATs
+		usb_dfu_uf2_put16(&sector[17], UF2_ROOT_ENTRIES);
+		usb_dfu_uf2_put16(&sector[19], CONF_USB_MSCD_UF2_SECTORS);
+		sector[21] = 0xF8; // fixed disk
+		usb_dfu_uf2_put16(&sector[22], UF2_FAT_SECTORS);
+		usb_dfu_uf2_put16(&sector[24], 1); // sectors per track
+		usb_dfu_uf2_put16(&sector[26], 1); // heads
+		sector[36] = 0x80; // drive number
+		sector[38] = 0x29; // extended boot signature
+		usb_dfu_uf2_put32(&sector[39], USB_UF2_MAGIC_START0); // volume serial number
+		memcpy(&sector[43], label, sizeof(label));
+		memcpy(&sector[54], "FAT16   ", 8);
+		sector[510] = 0x55;
+		sector[511] = 0xAA;
+	} else if (lba < UF2_ROOT_START) { // both FATs: INFO_UF2.TXT, then the chain of CURRENT.UF2
+		const uint32_t first = ((lba - 1) % UF2_FAT_SECTORS) * (MSCDF_BLOCK_SIZE / 2);
+		const uint32_t last = UF2_CURRENT_CLUSTER + uf2_current_blocks - 1;
+		uint32_t i, cluster;
+		for (i = 0; i < MSCDF_BLOCK_SIZE / 2; i++) {
+			cluster = first + i;
+			if (0 == cluster) {
+				usb_dfu_uf2_put16(&sector[i * 2], 0xFFF8); // media descriptor
+			} else if (1 == cluster || UF2_INFO_CLUSTER == cluster || last == cluster) {
+				usb_dfu_uf2_put16(&sector[i * 2], 0xFFFF); // end of chain
+			} else if (cluster >= UF2_CURRENT_CLUSTER && cluster < last) {
+				usb_dfu_uf2_put16(&sector[i * 2], (uint16_t)(cluster + 1));
+			}
+		}
+	} else if (UF2_ROOT_START == lba) { // first sector of the root directory
+		usb_dfu_uf2_dir_entry(&sector[0], label, 0x08, 0, 0); // volume label
+		usb_dfu_uf2_dir_entry(&sector[32], "INFO_UF2TXT", 0x01, UF2_INFO_CLUSTER, sizeof(uf2_info) - 1); // read-only
+		usb_dfu_uf2_dir_entry(&sector[64], "CURRENT UF2", 0x01, UF2_CURRENT_CLUSTER, uf2_current_blocks * MSCDF_BLOCK_SIZE);
+	} else if (UF2_DATA_START + UF2_INFO_CLUSTER - 2 == lba) {
+		memcpy(sector, uf2_info, sizeof(uf2_info) - 1);
+	} else if (lba >= UF2_DATA_START + UF2_CURRENT_CLUSTER - 2 && lba < UF2_DATA_START + UF2_CURRENT_CLUSTER - 2 + uf2_current_blocks) { // the application in flash
+		usb_uf2_block_t* block = (usb_uf2_block_t*)sector;
+		const uint32_t n = lba - (UF2_DATA_START + UF2_CURRENT_CLUSTER - 2);
+		block->dwMagicStart0 = USB_UF2_MAGIC_START0;
+		block->dwMagicStart1 = USB_UF2_MAGIC_START1;
+		block->dwFlags = USB_UF2_FLAG_FAMILY_ID;
+		block->dwTargetAddr = application_start_address - DFU_DOWNLOAD_BANK + n * UF2_BLOCK_PAYLOAD; // where the application runs
+		block->dwPayloadSize = UF2_BLOCK_PAYLOAD;
+		block->dwBlockNo = n;
+		block->dwNumBlocks = uf2_current_blocks;
+		block->dwFileSize = CONF_USB_MSCD_UF2_FAMILY_ID;
+		block->dwMagicEnd = USB_UF2_MAGIC_END;
+		flash_read(&FLASH_0, block->dwTargetAddr, block->bData, UF2_BLOCK_PAYLOAD); // the active bank starts at address 0, which can't be dereferenced
+	}
+}
+
+/**
+ * \brief Write the flash block updated by the UF2 blocks, unless it already holds the data
+ * \return Operation status
+ */
+static int32_t usb_dfu_uf2_flush(void)
+{
+	uint8_t page[NVMCTRL_PAGE_SIZE];
+	uint32_t i;
+	int32_t rc = ERR_NONE;
+
+	if (UF2_NO_BLOCK == uf2_flash_offset) {
+		return ERR_NONE;
+	}
+	for (i = 0; i < NVMCTRL_BLOCK_SIZE; i += NVMCTRL_PAGE_SIZE) { // the flash HAL waits for an erase ahead to complete
+		flash_read(&FLASH_0, application_start_address + uf2_flash_offset + i, page, sizeof(page));
+		if (0 != memcmp(page, &uf2_flash_block[i], sizeof(page))) {
+			break;
+		}
+	}
+#if CONF_USB_DFUD_PRE_ERASE_EN
+	pre_erase_armed = true;
+	if (uf2_flash_offset + NVMCTRL_BLOCK_SIZE > download_end) { // the blocks after it can be erased ahead
+		download_end = uf2_flash_offset + NVMCTRL_BLOCK_SIZE;
+	}
+	if (i < NVMCTRL_BLOCK_SIZE) { // the block changed
+		rc = usb_dfu_write(uf2_flash_offset, uf2_flash_block, NVMCTRL_BLOCK_SIZE); // in erased pages when possible
+	} else { // the blocks come in any order: never erase this one ahead
+		usb_dfu_pre_erase_program(uf2_flash_offset, NVMCTRL_BLOCK_SIZE);
+	}
+#else
+	if (i < NVMCTRL_BLOCK_SIZE) { // the block changed
+		rc = flash_write(&FLASH_0, application_start_address + uf2_flash_offset, uf2_flash_block, NVMCTRL_BLOCK_SIZE);
+	}
+#endif
+	uf2_flash_offset = UF2_NO_BLOCK;
+	return rc;
+}
+
+/**
+ * \brief Check the application once all the blocks of the UF2 file have been written
+ * \return Operation status
+ */
+static int32_t usb_dfu_uf2_complete(void)
+{
+	uint32_t vectors[2];
+	int32_t rc;
+
+	rc = usb_dfu_uf2_flush();
+	if (ERR_NONE == rc) {
+		flash_read(&FLASH_0, application_start_address, (uint8_t*)vectors, sizeof(vectors));
+		if (!usb_dfu_check_vectors(vectors)) { // never start (or swap to) an invalid application
+			rc = ERR_INVALID_DATA;
+		}
+	}
+#if CONF_USB_DFUD_DUAL_BANK_EN
+	if (ERR_NONE == rc) {
+		rc = usb_dfu_bank_copy_bootloader(application_start_address - DFU_DOWNLOAD_BANK);
+	}
+	bank_swap_ready = (ERR_NONE == rc);
+#endif
+	uf2_num_blocks = 0; // the file can be written again after an error
+	uf2_reset_pending = (ERR_NONE == rc);
+	return rc;
+}
+
+/**
+ * \brief Process a sector written to the virtual volume
+ *
+ * UF2 blocks are programmed wherever the host writes them, in any order: the other sectors (FAT, directory, other files) are ignored.
+ * \param[in] sector Sector content
+ * \return Operation status
+ */
+static int32_t usb_dfu_uf2_write_sector(const uint8_t* sector)
+{
+	const usb_uf2_block_t* block = (const usb_uf2_block_t*)sector;
+	const uint32_t base = application_start_address - DFU_DOWNLOAD_BANK; // address of the application region once running
+	uint32_t offset;
+	int32_t rc = ERR_NONE;
+
+	if (USB_UF2_MAGIC_START0 != block->dwMagicStart0 || USB_UF2_MAGIC_START1 != block->dwMagicStart1
+	    || USB_UF2_MAGIC_END != block->dwMagicEnd) { // not a UF2 block
+		return ERR_NONE;
+	}
+	if ((block->dwFlags & USB_UF2_FLAG_FAMILY_ID) && CONF_USB_MSCD_UF2_FAMILY_ID != block->dwFileSize) { // for another device
+		return ERR_NONE;
+	}
+	if (0 == block->dwNumBlocks || block->dwNumBlocks > UF2_MAX_BLOCKS || block->dwBlockNo >= block->dwNumBlocks) {
+		return ERR_INVALID_DATA;
+	}
+	if (USB_DFU_STATE_DFU_IDLE != dfu_state) { // a DFU download is in progress
+		return ERR_DENIED;
+	}
+	if (block->dwNumBlocks != uf2_num_blocks) { // another file
+		memset(uf2_blocks, 0, sizeof(uf2_blocks));
+		uf2_num_blocks = block->dwNumBlocks;
+		uf2_received = 0;
+	}
+	if (uf2_blocks[block->dwBlockNo / 32] & (1UL << (block->dwBlockNo % 32))) { // written again by the host
+		return ERR_NONE;
+	}
+	if (!(block->dwFlags & (USB_UF2_FLAG_NOT_MAIN_FLASH | USB_UF2_FLAG_FILE_CONTAINER))) { // data for the flash
+		offset = block->dwTargetAddr - base;
+		if (block->dwTargetAddr < base || block->dwPayloadSize > USB_UF2_PAYLOAD_MAX
+		    || offset + block->dwPayloadSize > DFU_BANK_SIZE - base
+		    || (offset & ~(NVMCTRL_BLOCK_SIZE - 1)) != ((offset + block->dwPayloadSize - 1) & ~(NVMCTRL_BLOCK_SIZE - 1))) { // the bootloader is not written, and the payload fits in a flash block
+			return ERR_BAD_ADDRESS;
+		}
+		if ((offset & ~(NVMCTRL_BLOCK_SIZE - 1)) != uf2_flash_offset) { // the blocks usually come in order: write the previous flash block once complete
+			rc = usb_dfu_uf2_flush();
+			if (ERR_NONE != rc) {
+				return rc;
+			}
+			uf2_flash_offset = offset & ~(NVMCTRL_BLOCK_SIZE - 1);
+			flash_read(&FLASH_0, application_start_address + uf2_flash_offset, uf2_flash_block, NVMCTRL_BLOCK_SIZE);
+		}
+		memcpy(&uf2_flash_block[offset - uf2_flash_offset], block->bData, block->dwPayloadSize);
+	}
+	uf2_blocks[block->dwBlockNo / 32] |= (1UL << (block->dwBlockNo % 32));
+	uf2_received++;
+	if (uf2_received == uf2_num_blocks) {
+		rc = usb_dfu_uf2_complete();
+	}
+	return rc;
+}
+
+/**
+ * \brief Serve the READ(10) and WRITE(10) commands of the mass storage interface
+ */
+static void usb_dfu_msc_task(void)
+{
+	uint8_t* done = NULL;
+	uint32_t done_sectors = 0;
+	uint32_t i;
+
+	CRITICAL_SECTION_ENTER();
+	if (msc_command) { // a new command, which also replaces the previous one if the host reset the interface meanwhile
+		msc_command = false;
+		msc_active = true;
+		msc_read = msc_command_read;
+		msc_lba = msc_command_lba;
+		msc_left = msc_command_sectors;
+		msc_rc = ERR_NONE;
+		msc_xfer_sectors = 0;
+	}
+	CRITICAL_SECTION_LEAVE();
+	if (!msc_active || (msc_xfer_sectors && !msc_xfer_done)) { // nothing to do, or wait for the host
+		return;
+	}
+	if (msc_xfer_sectors) { // the transfer completed
+		done = msc_buffers[msc_xfer_buffer];
+		done_sectors = msc_xfer_sectors;
+		msc_xfer_sectors = 0;
+		msc_xfer_buffer ^= 1;
+	}
+	if (msc_left && ERR_NONE == msc_rc) { // start the next transfer with the other buffer
+		uint8_t* buffer = msc_buffers[msc_xfer_buffer];
+		const uint32_t n = min(msc_left, MSC_BUFFER_SECTORS);
+		if (msc_read) {
+			for (i = 0; i < n; i++) {
+				usb_dfu_uf2_read_sector(msc_lba + i, &buffer[i * MSCDF_BLOCK_SIZE]);
+			}
+		}
+		msc_xfer_done = false;
+		msc_xfer_sectors = n;
+		msc_rc = mscdf_xfer_blocks(msc_read, buffer, n);
+		if (ERR_NONE != msc_rc) {
+			msc_xfer_sectors = 0;
+		}
+		msc_lba += n;
+		msc_left -= n;
+	}
+	if (done && !msc_read) { // process the written sectors while the host sends the next ones
+		LED_SYSTEM_off(); // switch LED off to indicate we are flashing
+		for (i = 0; i < done_sectors && ERR_NONE == msc_rc; i++) {
+			msc_rc = usb_dfu_uf2_write_sector(&done[i * MSCDF_BLOCK_SIZE]);
+		}
+		LED_SYSTEM_on();
+	}
+	if (0 == msc_xfer_sectors && (0 == msc_left || ERR_NONE != msc_rc)) { // all sectors transferred and processed
+		msc_active = false;
+		msc_status_sent = false;
+		mscdf_finish_blocks(msc_rc);
+	}
+}
+#endif
+
+/**
+ * \brief Run the second part of the USB DFU state machine handling non-USB aspects
+ */
+void usb_dfu_task(void)
+{
+	struct usb_dfu_job job;
+	bool has_job;
+
+	dfudf_take_events(); // the states and jobs tell what to do, events posted from now on mean they need to be looked at again
+	has_job = (ERR_NONE == spsc_queue_get(&dfu_jobs, &job));
+#if CONF_USB_DFUD_RESUME_EN
+	if (dfu_image_id_pending) { // the host identified the image before downloading it
+		int32_t rc = usb_dfu_resume_identify();
+		if (ERR_NONE != rc) {
+			usb_dfu_error(rc);
+		}
+	}
+#if CONF_USB_DFUD_BLOCK_CRC_EN
+	if (dfu_block_crcs_pending && !dfu_image_id_pending) { // the host gave the CRCs of the blocks of the image
+		int32_t rc = usb_dfu_resume_check_blocks();
+		if (ERR_NONE != rc) {
+			usb_dfu_error(rc);
+		}
+	}
+#endif
+#endif
+	if (has_job && USB_DFU_JOB_DOWNLOAD == job.type
+	    && (USB_DFU_STATE_DFU_DNLOAD_SYNC == dfu_state || USB_DFU_STATE_DFU_DNBUSY == dfu_state)) { // there is some data to be flashed (and the download has not been aborted)
+		int32_t rc = ERR_NONE;
+		LED_SYSTEM_off(); // switch LED off to indicate we are flashing
+#if CONF_AES_ENABLE
+		rc = usb_dfu_decrypt(&job); // in place, the header leaving no data to flash
+#endif
+		if (ERR_NONE == rc && job.length > 0) { // there is some data to be flashed
+#if CONF_QSPI_ENABLE
+			if (USB_DFUD_ALT_QSPI == job.alt) {
+				rc = usb_dfu_qspi_enqueue(job.offset, job.data, job.length); // written in the background
+			} else {
+				rc = usb_dfu_qspi_drain(); // the staging arena is free again
+			}
+			if (USB_DFUD_ALT_QSPI != job.alt && ERR_NONE == rc) {
+#endif
+#if CONF_USB_DFUD_PRE_ERASE_EN
+			usb_dfu_pre_erase_download(job.offset, job.length);
+#endif
+#if CONF_USB_DFUD_RESUME_EN
+			rc = usb_dfu_resume_verify(true); // the previous data, before it is overwritten
+			if (ERR_NONE == rc) {
+				rc = usb_dfu_resume_write(job.offset, job.length); // a block being written is not complete anymore
+			}
+			if (ERR_NONE == rc) {
+#endif
+#if CONF_USB_DFUD_DFUSE_EN
+			rc = usb_dfu_dfuse_write(job.offset, job.data, job.length); // at the address set by the host
+#elif CONF_USB_DFUD_STAGING_EN
+			rc = usb_dfu_stage(job.offset, job.data, job.length); // only copy the data, unless the staging area is full
+#elif CONF_USB_DFUD_PRE_ERASE_EN
+			rc = usb_dfu_write(job.offset, job.data, job.length); // write the data in erased pages when possible
+#else
+			rc = flash_write(&FLASH_0, application_start_address + job.offset, job.data, job.length); // write downloaded data chunk to flash
+#endif
+#if CONF_USB_DFUD_RESUME_EN
+			}
+			if (ERR_NONE == rc) {
+				usb_dfu_resume_written(job.offset, job.data, job.length); // verified once written
+			}
+#endif
+#if CONF_QSPI_ENABLE
+			}
+#endif
+			if (ERR_NONE == rc) {
+				dfu_state = USB_DFU_STATE_DFU_DNLOAD_IDLE; // indicate flashing this block has been completed
+			} else { // there has been a programming error
+				usb_dfu_error(rc);
+			}
+		} else if (ERR_NONE != rc) { // the encrypted image is invalid
+			usb_dfu_error(rc);
+		} else { // there was no data to flash
+			// this case should not happen (except for the header of an encrypted image), but it's not a critical error
+			dfu_state = USB_DFU_STATE_DFU_DNLOAD_IDLE; // indicate flashing can continue
+		}
+		LED_SYSTEM_on(); // switch LED on to indicate USB DFU can resume
+	}
+#if CONF_USB_DFUD_DFUSE_EN
+	if (has_job && USB_DFU_JOB_COMMAND == job.type && USB_DFU_STATE_DFU_DNBUSY == dfu_state) { // a DfuSe command (and the download has not been aborted)
+		int32_t rc;
+		LED_SYSTEM_off(); // switch LED off to indicate we are flashing
+		rc = usb_dfu_dfuse_command(job.data, job.length);
+		LED_SYSTEM_on();
+		if (ERR_NONE == rc) {
+			dfu_state = USB_DFU_STATE_DFU_DNLOAD_IDLE; // the host can send the next command or data block
+		} else if (ERR_UNSUPPORTED_OP == rc) {
+			dfu_status = USB_DFU_STATUS_ERR_STALLEDPKT;
+			dfu_state = USB_DFU_STATE_DFU_ERROR;
+		} else {
+			usb_dfu_error(rc);
+		}
+	}
+#endif
+#if CONF_USB_DFUD_RESUME_EN
+	if (USB_DFU_STATE_DFU_IDLE == dfu_state || USB_DFU_STATE_DFU_DNLOAD_IDLE == dfu_state) { // waiting for the host
+		int32_t rc = usb_dfu_resume_verify(false); // as soon as the data is written, before erasing ahead
+		if (ERR_NONE != rc) {
+			usb_dfu_error(rc);
+		}
+	}
+#endif
+#if CONF_USB_MSCD_UF2_EN
+	usb_dfu_msc_task(); // before erasing ahead, which follows the written blocks
+#endif
+#if CONF_USB_DFUD_PRE_ERASE_EN
+	if (USB_DFU_STATE_DFU_IDLE == dfu_state || USB_DFU_STATE_DFU_DNLOAD_IDLE == dfu_state) { // waiting for the host
+		usb_dfu_erase_ahead();
+	}
+#endif
+#if CONF_QSPI_ENABLE
+	if (ERR_NONE == qspi_error) { // write the queued data while the host sends the next one
+		qspi_error = usb_dfu_qspi_service();
+	}
+#endif
+	if (has_job && USB_DFU_JOB_MANIFEST == job.type && USB_DFU_STATE_DFU_MANIFEST == dfu_state) { // we can start manifestation (finish flashing)
+		// in theory every DFU files should have a suffix to with a CRC to check the data
+		// in practice most downloaded files are just the raw binary with DFU suffix
+		int32_t rc = ERR_NONE;
+		LED_SYSTEM_off(); // switch LED off to indicate we are flashing
+#if CONF_AES_ENABLE
+		rc = usb_dfu_decrypt_check(); // before the image is programmed (staging) or swapped to (dual-bank)
+		if (ERR_NONE != rc) {
+			usb_dfu_decrypt_invalidate(job.alt);
+			LED_SYSTEM_on();
+			usb_dfu_error(rc);
+			return;
+		}
+#endif
+#if CONF_QSPI_ENABLE
+		if (USB_DFUD_ALT_QSPI == job.alt) {
+			rc = usb_dfu_qspi_drain(); // write and verify the rest of the data
+		} else {
+#endif
+#if CONF_USB_DFUD_STAGING_EN
+		rc = usb_dfu_program(); // program the staged image
+#endif
+#if CONF_USB_DFUD_RESUME_EN
+		rc = usb_dfu_resume_verify(true); // the last data
+#endif
+#if CONF_USB_DFUD_DUAL_BANK_EN
+		_flash_wait_ready(&FLASH_0.dev); // the last page write must have completed
+		if (ERR_NONE == rc && !usb_dfu_check_vectors((const uint32_t*)(FLASH_ADDR + application_start_address))) { // never swap to an invalid application
+			rc = ERR_INVALID_DATA;
+		}
+		if (ERR_NONE == rc) {
+			rc = usb_dfu_bank_copy_bootloader(application_start_address - DFU_DOWNLOAD_BANK);
+		}
+#endif
+#if CONF_USB_DFUD_RESUME_EN
+		if (ERR_NONE == rc) {
+			rc = usb_dfu_resume_complete(); // nothing left to resume
+		}
+#endif
+#if CONF_USB_DFUD_DUAL_BANK_EN
+		bank_swap_ready = (ERR_NONE == rc);
+#endif
+#if CONF_QSPI_ENABLE
+		}
+#endif
+		LED_SYSTEM_on();
+		if (ERR_NONE != rc) {
+			usb_dfu_error(rc);
+			return;
+		}
+		dfu_manifestation_complete = true; // we completed flashing and all checks
+		if (usb_dfu_func_desc->bmAttributes & USB_DFU_ATTRIBUTES_MANIFEST_TOLERANT) {
+			dfu_state = USB_DFU_STATE_DFU_MANIFEST_SYNC;
+		} else {
+			dfu_state = USB_DFU_STATE_DFU_MANIFEST_WAIT_RESET;
+		}
+	}
+	if (USB_DFU_STATE_DFU_MANIFEST_WAIT_RESET == dfu_state) {
+		if (usb_dfu_func_desc->bmAttributes & USB_DFU_ATTRIBUTES_WILL_DETACH) {
+			usb_dfu_reset(USB_EV_RESET, 0); // immediately reset
+		} else { // wait for USB reset
+			usb_d_register_callback(USB_D_CB_EVENT, (FUNC_PTR)usb_dfu_reset); // register new USB reset event handler
+		}
+	}
+#if CONF_USB_MSCD_UF2_EN
+	if (uf2_reset_pending && msc_status_sent) { // the host got the status of the last write of the UF2 file
+		usb_dfu_reset(USB_EV_RESET, 0); // start the new application
+	}
+#endif
+}
+
+void usb_dfu_wait(void)
+{
+#if CONF_QSPI_ENABLE
+	const bool busy = qspi_queue_count > 0; // the QSPI flash has no interrupt: keep polling it
+#else
+	const bool busy = false;
+#endif
+
+	__disable_irq(); // an interrupt occurring after the check still wakes up the CPU, and is served once enabled again
+	if (!busy && !dfu_events && 0 == spsc_queue_num(&dfu_jobs)) {
+		sleep(PM_SLEEPCFG_SLEEPMODE_IDLE2_Val); // IDLE: only the CPU stops, the USB and NVMCTRL keep running
+	}
+	__enable_irq();
+}
+
+/**
+ * \brief Enter USB DFU runtime
+ */
+void usb_dfu(void)
+{
+	usb_dfu_start();
+	while (true) { // main DFU infinite loop
+		usb_dfu_task();
+		usb_dfu_wait(); // until the USB or flash interrupts post events
+	}
 }
 
 void usb_init(void)
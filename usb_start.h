@@ -27,12 +27,44 @@ extern "C" {
 
 void usb_dfu(void);
 void usb_dfu_init(void);
+/**
+ * \brief Wait for the USB DFU stack to be ready (first part of usb_dfu)
+ */
+void usb_dfu_start(void);
+/**
+ * \brief Run one iteration of the USB DFU main loop (called repeatedly by usb_dfu)
+ */
+void usb_dfu_task(void);
+/**
+ * \brief Sleep until an interrupt, unless events are pending (called by usb_dfu between usb_dfu_task iterations)
+ */
+void usb_dfu_wait(void);
 
 /**
  * \berif Initialize USB
  */
 void usb_init(void);
 
+#if CONF_USB_DFUD_PRE_ERASE_EN
+/**
+ * \brief Allow erasing the application region ahead of the download before it starts (e.g. when DFU has been forced)
+ */
+void usb_dfu_pre_erase(void);
+#endif
+
+#if CONF_USB_DFUD_DUAL_BANK_EN
+/**
+ * \brief Check if the inactive flash bank holds the same bootloader as the active one
+ * \param[in] size Size of the bootloader
+ * \return true if the banks can be swapped
+ */
+bool usb_dfu_bank_check_bootloader(uint32_t size);
+/**
+ * \brief Swap the flash banks and reset the device
+ */
+void usb_dfu_bank_swap(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus